@@ -178,8 +178,21 @@ extern unsigned int CX_SEED_REPORT_num_descriptors ( CX_SEED_REPORT *report );
 extern CX_SEED_DESCRIPTOR *
 CX_SEED_REPORT_add0_descriptor ( CX_SEED_REPORT *report );
 
+/** Do not verify newly created seed report signatures */
+#define CX_SEED_REPORT_SIGN_NO_VERIFY 0x0001
+
+extern int CX_SEED_REPORT_sign_parallel ( CX_SEED_REPORT *report,
+					  const EVP_MD *md, unsigned int flags,
+					  unsigned int threads );
+
+extern int CX_SEED_REPORT_sign_ex ( CX_SEED_REPORT *report, const EVP_MD *md,
+				    unsigned int flags );
+
 extern int CX_SEED_REPORT_sign ( CX_SEED_REPORT *report, const EVP_MD *md );
 
+extern int CX_SEED_REPORT_verify_parallel ( CX_SEED_REPORT *report,
+					    unsigned int threads );
+
 extern int CX_SEED_REPORT_verify ( CX_SEED_REPORT *report );
 
 #endif /* _CX_ASN1_H */
@@ -34,10 +34,64 @@
 
 struct cx_drbg;
 
+/** Size of DRBG storage */
+#define CX_DRBG_STORAGE_SIZE 192
+
+/**
+ * Storage for a DRBG
+ *
+ * This may be embedded within a caller-owned structure (or placed on
+ * the stack) and used with cx_drbg_init() to instantiate a DRBG
+ * without any heap allocation.
+ */
+struct cx_drbg_storage {
+	union {
+		/** Opaque storage */
+		unsigned char bytes[CX_DRBG_STORAGE_SIZE];
+		/** Force pointer alignment */
+		void *align_ptr;
+		/** Force 64-bit alignment */
+		unsigned long long align_ull;
+	} u;
+};
+
+/** Size of saved DRBG state */
+#define CX_DRBG_STATE_SIZE 64
+
+/**
+ * Saved DRBG state
+ *
+ * This is a fixed-size, versioned, byte-order independent
+ * serialisation of the internal state of a DRBG, created using
+ * cx_drbg_save() and consumed using cx_drbg_restore().  It contains
+ * the DRBG's secret key and must be protected accordingly.
+ */
+struct cx_drbg_state {
+	/** Opaque serialised state */
+	unsigned char bytes[CX_DRBG_STATE_SIZE];
+};
+
 extern size_t cx_drbg_seed_len ( enum cx_generator_type type );
 
 extern unsigned int cx_drbg_max_iterations ( enum cx_generator_type type );
 
+extern int cx_set_engine ( const char *name );
+
+extern const char * cx_engine_name ( void );
+
+extern size_t cx_drbg_storage_size ( void );
+
+extern struct cx_drbg *
+cx_drbg_init_split ( struct cx_drbg_storage *storage,
+		     enum cx_generator_type type, const void *entropy,
+		     size_t entropy_len, const void *nonce, size_t nonce_len,
+		     const void *personal, size_t personal_len );
+
+extern struct cx_drbg * cx_drbg_init ( struct cx_drbg_storage *storage,
+				       enum cx_generator_type type,
+				       const void *input, size_t len,
+				       EVP_PKEY *key );
+
 extern struct cx_drbg *
 cx_drbg_instantiate_split ( enum cx_generator_type type, const void *entropy,
 			    size_t entropy_len, const void *nonce,
@@ -53,8 +107,26 @@ cx_drbg_instantiate_fresh ( enum cx_generator_type type );
 
 extern int cx_drbg_generate ( struct cx_drbg *drbg, void *output, size_t len );
 
+extern int cx_drbg_generate_bulk ( struct cx_drbg *drbg, void *output,
+				   size_t len, unsigned int count );
+
+extern int cx_drbg_generate_multi ( struct cx_drbg **drbgs, unsigned int count,
+				    void *output, size_t len,
+				    unsigned int iterations );
+
+extern enum cx_generator_type cx_drbg_type ( struct cx_drbg *drbg );
+
+extern unsigned int cx_drbg_remaining ( struct cx_drbg *drbg );
+
+extern int cx_drbg_save ( struct cx_drbg *drbg, struct cx_drbg_state *state );
+
+extern struct cx_drbg * cx_drbg_restore ( struct cx_drbg_storage *storage,
+					  const struct cx_drbg_state *state );
+
 extern void cx_drbg_invalidate ( struct cx_drbg *drbg );
 
+extern void cx_drbg_fini ( struct cx_drbg *drbg );
+
 extern void cx_drbg_uninstantiate ( struct cx_drbg *drbg );
 
 #endif /* _CX_DRBG_H */
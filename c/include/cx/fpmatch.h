@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+#ifndef _CX_FPMATCH_H
+#define _CX_FPMATCH_H
+
+#include <stdint.h>
+#include <cx.h>
+#include <cx/match.h>
+
+struct cx_fpmatch;
+
+/** Fingerprint matching statistics */
+struct cx_fpmatch_stats {
+	/** Number of generated contact IDs looked up */
+	unsigned long long lookups;
+	/** Number of candidate matches found */
+	unsigned long long candidates;
+	/** Number of candidate matches checked against full contact IDs */
+	unsigned long long checked;
+	/** Number of checked candidate matches rejected */
+	unsigned long long rejected;
+	/** Theoretical false positive rate per lookup */
+	double expected;
+	/** Measured false positive rate per lookup */
+	double measured;
+};
+
+extern uint64_t cx_fpmatch_fingerprint ( const struct cx_contact_id *id );
+
+extern void cx_fpmatch_sort ( struct cx_contact_id *ids, unsigned int count );
+
+extern struct cx_fpmatch * cx_fpmatch_create ( const uint64_t *fingerprints,
+					       unsigned int count );
+
+extern struct cx_match_result *
+cx_fpmatch_seeds ( struct cx_fpmatch *fp, const struct cx_match_seed *seeds,
+		   unsigned int count );
+
+extern int cx_fpmatch_confirm ( struct cx_fpmatch *fp,
+				const struct cx_match_seed *seeds,
+				struct cx_match_result *result,
+				const struct cx_contact_id *ids );
+
+extern void cx_fpmatch_stats ( struct cx_fpmatch *fp,
+			       struct cx_fpmatch_stats *stats );
+
+extern void cx_fpmatch_free ( struct cx_fpmatch *fp );
+
+#endif /* _CX_FPMATCH_H */
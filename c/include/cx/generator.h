@@ -32,10 +32,54 @@
 
 struct cx_generator;
 
+/** Size of generator storage */
+#define CX_GEN_STORAGE_SIZE 256
+
+/**
+ * Storage for a generator
+ *
+ * This may be embedded within a caller-owned structure (or placed on
+ * the stack) and used with cx_gen_init() to instantiate a generator
+ * without any heap allocation.
+ */
+struct cx_gen_storage {
+	union {
+		/** Opaque storage */
+		unsigned char bytes[CX_GEN_STORAGE_SIZE];
+		/** Force pointer alignment */
+		void *align_ptr;
+		/** Force 64-bit alignment */
+		unsigned long long align_ull;
+	} u;
+};
+
+/** Size of saved generator state */
+#define CX_GEN_STATE_SIZE 64
+
+/**
+ * Saved generator state
+ *
+ * This is a fixed-size, versioned, byte-order independent
+ * serialisation of a generator's position within its sequence of
+ * contact IDs, created using cx_gen_save() and consumed using
+ * cx_gen_restore().  It contains secret key material and must be
+ * protected in the same way as the seed value.
+ */
+struct cx_gen_state {
+	/** Opaque serialised state */
+	unsigned char bytes[CX_GEN_STATE_SIZE];
+};
+
 extern size_t cx_gen_seed_len ( enum cx_generator_type type );
 
 extern unsigned int cx_gen_max_iterations ( enum cx_generator_type type );
 
+extern size_t cx_gen_storage_size ( void );
+
+extern struct cx_generator * cx_gen_init ( struct cx_gen_storage *storage,
+					   enum cx_generator_type type,
+					   const void *seed, size_t len );
+
 extern struct cx_generator * cx_gen_instantiate ( enum cx_generator_type type,
 						  const void *seed,
 						  size_t len );
@@ -43,8 +87,41 @@ extern struct cx_generator * cx_gen_instantiate ( enum cx_generator_type type,
 extern int cx_gen_iterate ( struct cx_generator *gen,
 			    struct cx_contact_id *id );
 
+extern int cx_gen_iterate_bulk ( struct cx_generator *gen,
+				 struct cx_contact_id *ids,
+				 unsigned int count );
+
+extern int cx_gen_expand ( enum cx_generator_type type, const void *seed,
+			   size_t len, struct cx_contact_id *ids );
+
+extern int cx_gen_expand_range ( enum cx_generator_type type,
+				 const void *seed, size_t len,
+				 const struct cx_gen_state *hint,
+				 unsigned int first, unsigned int last,
+				 struct cx_contact_id *ids );
+
+extern int cx_gen_expand_multi ( enum cx_generator_type type,
+				 const void *seeds, size_t len,
+				 unsigned int count,
+				 struct cx_contact_id *ids );
+
+extern int cx_gen_expand_multi_range ( enum cx_generator_type type,
+				       const void *seeds, size_t len,
+				       unsigned int count, unsigned int first,
+				       unsigned int last,
+				       struct cx_contact_id *ids );
+
+extern int cx_gen_save ( struct cx_generator *gen,
+			 struct cx_gen_state *state );
+
+extern struct cx_generator *
+cx_gen_restore ( struct cx_gen_storage *storage,
+		 const struct cx_gen_state *state );
+
 extern void cx_gen_invalidate ( struct cx_generator *gen );
 
+extern void cx_gen_fini ( struct cx_generator *gen );
+
 extern void cx_gen_uninstantiate ( struct cx_generator *gen );
 
 #endif /* _CX_GENERATOR_H */
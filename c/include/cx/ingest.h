@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+#ifndef _CX_INGEST_H
+#define _CX_INGEST_H
+
+#include <stdint.h>
+#include <cx.h>
+
+struct cx_ingest;
+
+/** A deduplicated sighting */
+struct cx_sighting {
+	/** Sighted contact ID */
+	struct cx_contact_id id;
+	/** Earliest timestamp (in caller-defined units) */
+	uint64_t first;
+	/** Latest timestamp (in caller-defined units) */
+	uint64_t last;
+	/** Number of times sighted */
+	unsigned int count;
+};
+
+extern struct cx_ingest *
+cx_ingest_create ( unsigned int capacity, uint64_t window,
+		   int ( * flush ) ( void *ctx,
+				     const struct cx_sighting *sightings,
+				     unsigned int count ),
+		   void *ctx );
+
+extern int cx_ingest_add ( struct cx_ingest *ingest,
+			   const struct cx_contact_id *id, uint64_t time );
+
+extern int cx_ingest_flush ( struct cx_ingest *ingest );
+
+extern unsigned int cx_ingest_count ( struct cx_ingest *ingest );
+
+extern void cx_ingest_free ( struct cx_ingest *ingest );
+
+#endif /* _CX_INGEST_H */
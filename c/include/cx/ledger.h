@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+#ifndef _CX_LEDGER_H
+#define _CX_LEDGER_H
+
+#include <stdint.h>
+#include <cx.h>
+#include <cx/match.h>
+
+struct cx_ledger;
+
+/** Observation time range covered by a seed value */
+struct cx_ledger_range {
+	/** Start time (inclusive, in caller-defined units) */
+	uint64_t start;
+	/** End time (exclusive, in caller-defined units) */
+	uint64_t end;
+	/** Time at which the ledger entry expires (in caller-defined units) */
+	uint64_t expiry;
+};
+
+extern struct cx_ledger * cx_ledger_open ( const char *path );
+
+extern int cx_ledger_checked ( struct cx_ledger *ledger,
+			       const struct cx_match_seed *seed,
+			       const struct cx_ledger_range *range,
+			       uint64_t now );
+
+extern int cx_ledger_record ( struct cx_ledger *ledger,
+			      const struct cx_match_seed *seed,
+			      const struct cx_ledger_range *range );
+
+extern int cx_ledger_observe ( struct cx_ledger *ledger, uint64_t start,
+			       uint64_t end );
+
+extern struct cx_match_result *
+cx_ledger_match ( struct cx_ledger *ledger, struct cx_match *match,
+		  const struct cx_match_seed *seeds,
+		  const struct cx_ledger_range *ranges, unsigned int count,
+		  uint64_t now );
+
+extern int cx_ledger_expire ( struct cx_ledger *ledger, uint64_t now );
+
+extern unsigned int cx_ledger_count ( struct cx_ledger *ledger );
+
+extern void cx_ledger_close ( struct cx_ledger *ledger );
+
+#endif /* _CX_LEDGER_H */
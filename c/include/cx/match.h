@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+#ifndef _CX_MATCH_H
+#define _CX_MATCH_H
+
+#include <stddef.h>
+#include <cx.h>
+
+struct cx_match;
+struct cx_gen_state;
+
+/** A seed value to be matched */
+struct cx_match_seed {
+	/** Generator type */
+	enum cx_generator_type type;
+	/** Seed value */
+	const void *seed;
+	/** Length of seed value */
+	size_t len;
+	/** Index of first contact ID to look up */
+	unsigned int first;
+	/** Index of last contact ID to look up, plus one
+	 *
+	 * Zero indicates the end of the complete sequence.
+	 */
+	unsigned int last;
+	/** Saved generator state to start expansion from, or NULL
+	 *
+	 * See cx_gen_expand_range() for the requirements on a hint.
+	 */
+	const struct cx_gen_state *hint;
+};
+
+/** A match between a generated contact ID and an observation */
+struct cx_match_hit {
+	/** Index of seed value */
+	unsigned int seed;
+	/** Iteration at which the contact ID was generated (from zero) */
+	unsigned int iteration;
+	/** Index of observed contact ID */
+	unsigned int observation;
+};
+
+/** A set of matches */
+struct cx_match_result {
+	/** Matches, ordered by seed, iteration, and observation */
+	struct cx_match_hit *hits;
+	/** Number of matches */
+	unsigned int count;
+};
+
+extern struct cx_match * cx_match_create ( const struct cx_contact_id *ids,
+					   unsigned int count );
+
+extern int cx_match_filter ( struct cx_match *match, unsigned int bits );
+
+extern struct cx_match_result *
+cx_match_seeds ( struct cx_match *match, const struct cx_match_seed *seeds,
+		 unsigned int count );
+
+extern struct cx_match_result *
+cx_match_seeds_parallel ( struct cx_match *match,
+			  const struct cx_match_seed *seeds,
+			  unsigned int count, unsigned int threads );
+
+extern void cx_match_result_free ( struct cx_match_result *result );
+
+extern void cx_match_free ( struct cx_match *match );
+
+#endif /* _CX_MATCH_H */
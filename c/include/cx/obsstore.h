@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+#ifndef _CX_OBSSTORE_H
+#define _CX_OBSSTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cx.h>
+#include <cx/match.h>
+#include <cx/ingest.h>
+
+struct cx_obsstore;
+
+/** An observation record */
+struct cx_obs_record {
+	/** Observed contact ID */
+	struct cx_contact_id id;
+	/** Coarse timestamp (in caller-defined units) */
+	uint64_t time;
+	/** Number of times observed */
+	unsigned int count;
+};
+
+extern struct cx_obsstore * cx_obsstore_open ( const char *dir,
+					       unsigned int records );
+
+extern int cx_obsstore_append ( struct cx_obsstore *store,
+				const struct cx_contact_id *id,
+				uint64_t time, unsigned int count );
+
+extern int cx_obsstore_ingest ( void *ctx,
+				const struct cx_sighting *sightings,
+				unsigned int count );
+
+extern int cx_obsstore_flush ( struct cx_obsstore *store );
+
+extern int cx_obsstore_seal ( struct cx_obsstore *store );
+
+extern unsigned int cx_obsstore_prune ( struct cx_obsstore *store,
+					uint64_t before );
+
+extern unsigned int cx_obsstore_segments ( struct cx_obsstore *store );
+
+extern unsigned int cx_obsstore_count ( struct cx_obsstore *store );
+
+extern int cx_obsstore_record ( struct cx_obsstore *store, unsigned int index,
+				struct cx_obs_record *record );
+
+extern struct cx_match_result *
+cx_obsstore_match ( struct cx_obsstore *store,
+		    const struct cx_match_seed *seeds, unsigned int count );
+
+extern void cx_obsstore_close ( struct cx_obsstore *store );
+
+#endif /* _CX_OBSSTORE_H */
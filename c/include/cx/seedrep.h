@@ -57,18 +57,66 @@ struct cx_seed_report {
 	const char *challenge;
 };
 
+/** A seed report in DER format */
+struct cx_seed_report_der {
+	/** DER data */
+	const void *der;
+	/** Length of DER data */
+	size_t len;
+};
+
+/** Limits applied when pre-validating a seed report in DER format */
+struct cx_seedrep_limits {
+	/** Maximum length of DER data */
+	size_t max_len;
+	/** Maximum number of seed descriptors */
+	unsigned int max_descriptors;
+	/** Maximum length of publisher name */
+	size_t max_publisher;
+	/** Maximum length of seed report challenge */
+	size_t max_challenge;
+	/** Maximum length of a preseed verification key */
+	size_t max_key;
+	/** Maximum length of a signature value */
+	size_t max_signature;
+};
+
+extern const struct cx_seedrep_limits cx_seedrep_default_limits;
+
+extern CX_SEED_REPORT *
+cx_seedrep_sign_asn1_ex ( const struct cx_seed_report *report,
+			  const EVP_MD *md, unsigned int flags );
+
 extern CX_SEED_REPORT *
 cx_seedrep_sign_asn1 ( const struct cx_seed_report *report, const EVP_MD *md );
 
+extern void * cx_seedrep_sign_der_ex ( const struct cx_seed_report *report,
+				       const EVP_MD *md, unsigned int flags,
+				       size_t *len );
+
 extern void * cx_seedrep_sign_der ( const struct cx_seed_report *report,
 				    const EVP_MD *md, size_t *len );
 
 extern struct cx_seed_report *
 cx_seedrep_verify_asn1 ( CX_SEED_REPORT *seedReport );
 
+extern int cx_seedrep_check_der ( const void *der, size_t der_len,
+				  const struct cx_seedrep_limits *limits );
+
+extern struct cx_seed_report *
+cx_seedrep_verify_der_ex ( const void *der, size_t der_len,
+			   const struct cx_seedrep_limits *limits );
+
 extern struct cx_seed_report * cx_seedrep_verify_der ( const void *der,
 						       size_t der_len );
 
+extern unsigned int
+cx_seedrep_verify_batch ( const struct cx_seed_report_der *ders,
+			  unsigned int count,
+			  const struct cx_seedrep_limits *limits,
+			  struct cx_seed_report **reports,
+			  unsigned int threads );
+
 extern void cx_seedrep_free ( struct cx_seed_report *report );
 
 #endif /* _CX_SEEDREP_H */
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+#ifndef _CX_SORTMATCH_H
+#define _CX_SORTMATCH_H
+
+#include <stddef.h>
+#include <cx.h>
+#include <cx/match.h>
+
+struct cx_sortmatch;
+
+/** Sort-merge matching statistics */
+struct cx_sortmatch_stats {
+	/** CPU time spent outside spill file I/O (in seconds) */
+	double cpu;
+	/** Elapsed time spent in spill file I/O (in seconds) */
+	double io;
+	/** Number of bytes written to spill files */
+	unsigned long long written;
+	/** Number of bytes read from spill files */
+	unsigned long long read;
+};
+
+extern struct cx_sortmatch * cx_sortmatch_create ( const char *dir,
+						   size_t memory );
+
+extern int cx_sortmatch_observe ( struct cx_sortmatch *sort,
+				  const struct cx_contact_id *ids,
+				  unsigned int count );
+
+extern struct cx_match_result *
+cx_sortmatch_seeds ( struct cx_sortmatch *sort,
+		     const struct cx_match_seed *seeds, unsigned int count );
+
+extern void cx_sortmatch_stats ( struct cx_sortmatch *sort,
+				 struct cx_sortmatch_stats *stats );
+
+extern void cx_sortmatch_free ( struct cx_sortmatch *sort );
+
+#endif /* _CX_SORTMATCH_H */
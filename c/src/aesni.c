@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * AES-NI generator kernel
+ *
+ * This kernel performs CTR_DRBG generate operations for up to eight
+ * independent DRBG instances in lockstep using the AES-NI
+ * instructions, so that the AES rounds for each lane are interleaved
+ * and the AES pipeline remains busy.
+ *
+ * The key schedule is calculated using AESENCLAST rather than
+ * AESKEYGENASSIST, since the former has much higher throughput and
+ * does not require the round constant to be an immediate value.
+ *
+ ******************************************************************************
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include "kernel.h"
+
+#if defined ( __x86_64__ ) || defined ( __i386__ )
+
+#include <immintrin.h>
+
+/** Number of lanes processed in lockstep */
+#define CX_AESNI_WIDTH 8
+
+/** AES block size */
+#define CX_AESNI_BLOCK_LEN 16
+
+/** Maximum number of AES rounds */
+#define CX_AESNI_MAX_ROUNDS 14
+
+/** Maximum number of blocks per lane per iteration */
+#define CX_AESNI_MAX_BLOCKS \
+	( ( CX_KERNEL_MAX_LEN + 32 /* key */ + 16 /* V */ ) / \
+	  CX_AESNI_BLOCK_LEN )
+
+/** Function attributes for AES-NI code */
+#define CX_AESNI_TARGET __attribute__ (( target ( "sse2,ssse3,aes" ) ))
+
+/** AES round constants */
+static const uint8_t cx_aesni_rcon[] = {
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36
+};
+
+/** AES-NI lane state */
+struct cx_aesni_lane {
+	/** Round keys */
+	__m128i rk[ CX_AESNI_MAX_ROUNDS + 1 ];
+	/** Current key */
+	__m128i key[2];
+	/** Counter value (high 64 bits) */
+	uint64_t hi;
+	/** Counter value (low 64 bits) */
+	uint64_t lo;
+};
+
+/**
+ * Check if AES-NI kernel is supported
+ *
+ * @ret supported	Kernel is supported
+ */
+static int cx_aesni_supported ( void ) {
+
+	return ( __builtin_cpu_supports ( "aes" ) &&
+		 __builtin_cpu_supports ( "ssse3" ) );
+}
+
+/**
+ * Byte-swap mask for converting between big-endian blocks and integers
+ *
+ * @ret mask		Byte-swap mask
+ */
+static CX_AESNI_TARGET inline __m128i cx_aesni_bswap ( void ) {
+
+	return _mm_set_epi8 ( 0, 1, 2, 3, 4, 5, 6, 7,
+			      8, 9, 10, 11, 12, 13, 14, 15 );
+}
+
+/**
+ * Calculate XOR of all preceding words within key
+ *
+ * @v key		Key
+ * @ret key		Key with each word XORed with all preceding words
+ */
+static CX_AESNI_TARGET inline __m128i cx_aesni_shift_xor ( __m128i key ) {
+
+	key = _mm_xor_si128 ( key, _mm_slli_si128 ( key, 4 ) );
+	key = _mm_xor_si128 ( key, _mm_slli_si128 ( key, 8 ) );
+	return key;
+}
+
+/**
+ * Calculate round key using RotWord(), SubWord(), and Rcon
+ *
+ * @v prev		Round key from one key length earlier
+ * @v last		Preceding round key
+ * @v rcon		Round constant
+ * @ret rk		Round key
+ */
+static CX_AESNI_TARGET inline __m128i
+cx_aesni_rk_rot ( __m128i prev, __m128i last, __m128i rcon ) {
+	const __m128i rotword = _mm_set1_epi32 ( 0x0c0f0e0d );
+	__m128i tmp;
+
+	tmp = _mm_shuffle_epi8 ( last, rotword );
+	tmp = _mm_aesenclast_si128 ( tmp, rcon );
+	return _mm_xor_si128 ( cx_aesni_shift_xor ( prev ), tmp );
+}
+
+/**
+ * Calculate round key using SubWord() only
+ *
+ * @v prev		Round key from one key length earlier
+ * @v last		Preceding round key
+ * @ret rk		Round key
+ */
+static CX_AESNI_TARGET inline __m128i
+cx_aesni_rk_sub ( __m128i prev, __m128i last ) {
+	__m128i tmp;
+
+	tmp = _mm_shuffle_epi32 ( last, 0xff );
+	tmp = _mm_aesenclast_si128 ( tmp, _mm_setzero_si128() );
+	return _mm_xor_si128 ( cx_aesni_shift_xor ( prev ), tmp );
+}
+
+/**
+ * Expand keys
+ *
+ * @v lanes		Lanes
+ * @v count		Number of lanes
+ * @v key_len		AES key length
+ */
+static CX_AESNI_TARGET CX_KERNEL_GENERIC void
+cx_aesni_expand ( struct cx_aesni_lane *lanes, unsigned int count,
+		  size_t key_len ) {
+	__m128i *rk;
+	__m128i rcon;
+	unsigned int i;
+	unsigned int l;
+
+	if ( key_len == 16 ) {
+
+		/* AES-128 key schedule */
+		for ( l = 0 ; l < count ; l++ )
+			lanes[l].rk[0] = lanes[l].key[0];
+		for ( i = 1 ; i <= 10 ; i++ ) {
+			rcon = _mm_set1_epi32 ( cx_aesni_rcon[ i - 1 ] );
+			for ( l = 0 ; l < count ; l++ ) {
+				rk = lanes[l].rk;
+				rk[i] = cx_aesni_rk_rot ( rk[ i - 1 ],
+							  rk[ i - 1 ], rcon );
+			}
+		}
+
+	} else {
+
+		/* AES-256 key schedule */
+		for ( l = 0 ; l < count ; l++ ) {
+			lanes[l].rk[0] = lanes[l].key[0];
+			lanes[l].rk[1] = lanes[l].key[1];
+		}
+		for ( i = 2 ; i <= 14 ; i += 2 ) {
+			rcon = _mm_set1_epi32 (
+				cx_aesni_rcon[ ( i / 2 ) - 1 ] );
+			for ( l = 0 ; l < count ; l++ ) {
+				rk = lanes[l].rk;
+				rk[i] = cx_aesni_rk_rot ( rk[ i - 2 ],
+							  rk[ i - 1 ], rcon );
+			}
+			if ( i == 14 )
+				break;
+			for ( l = 0 ; l < count ; l++ ) {
+				rk = lanes[l].rk;
+				rk[ i + 1 ] = cx_aesni_rk_sub ( rk[ i - 1 ],
+								rk[i] );
+			}
+		}
+	}
+}
+
+/**
+ * Generate random bytes
+ *
+ * @v lanes		Lanes
+ * @v count		Number of lanes (at most the kernel width)
+ * @v key_len		AES key length
+ * @v len		Length of output per iteration
+ * @v iterations	Number of iterations
+ */
+static CX_AESNI_TARGET CX_KERNEL_GENERIC void
+cx_aesni_generate ( struct cx_kernel_lane *lanes, unsigned int count,
+		    size_t key_len, size_t len, unsigned int iterations ) {
+	const __m128i bswap = cx_aesni_bswap();
+	struct cx_aesni_lane state[CX_AESNI_WIDTH];
+	__m128i blocks[CX_AESNI_WIDTH][CX_AESNI_MAX_BLOCKS];
+	__m128i *key;
+	__m128i *out;
+	__m128i tail;
+	uint64_t halves[2];
+	unsigned int rounds = ( ( key_len == 16 ) ? 10 : 14 );
+	unsigned int key_blocks = ( key_len / CX_AESNI_BLOCK_LEN );
+	unsigned int out_blocks;
+	unsigned int num_blocks;
+	unsigned int iteration;
+	unsigned int l;
+	unsigned int b;
+	unsigned int r;
+	size_t tail_len;
+
+	/* Calculate number of blocks */
+	out_blocks = ( ( len + CX_AESNI_BLOCK_LEN - 1 ) / CX_AESNI_BLOCK_LEN );
+	num_blocks = ( out_blocks + key_blocks + 1 );
+	tail_len = ( len - ( ( out_blocks - 1 ) * CX_AESNI_BLOCK_LEN ) );
+
+	/* Load initial state */
+	for ( l = 0 ; l < count ; l++ ) {
+		key = ( ( __m128i * ) lanes[l].key );
+		for ( b = 0 ; b < key_blocks ; b++ )
+			state[l].key[b] = _mm_loadu_si128 ( &key[b] );
+		_mm_storeu_si128 ( ( __m128i * ) halves, _mm_shuffle_epi8 (
+			_mm_loadu_si128 ( ( const __m128i * ) lanes[l].v ),
+			bswap ) );
+		state[l].lo = halves[0];
+		state[l].hi = halves[1];
+	}
+
+	/* Perform iterations */
+	for ( iteration = 0 ; iteration < iterations ; iteration++ ) {
+
+		/* Expand keys */
+		cx_aesni_expand ( state, count, key_len );
+
+		/* Construct counter blocks and apply initial round key */
+		for ( l = 0 ; l < count ; l++ ) {
+			for ( b = 0 ; b < num_blocks ; b++ ) {
+				if ( ! ++state[l].lo )
+					state[l].hi++;
+				blocks[l][b] = _mm_xor_si128 (
+				    _mm_shuffle_epi8 (
+					_mm_set_epi64x ( state[l].hi,
+							 state[l].lo ),
+					bswap ),
+				    state[l].rk[0] );
+			}
+		}
+
+		/* Apply AES rounds, interleaved across all lanes */
+		for ( r = 1 ; r < rounds ; r++ ) {
+			for ( l = 0 ; l < count ; l++ ) {
+				for ( b = 0 ; b < num_blocks ; b++ ) {
+					blocks[l][b] = _mm_aesenc_si128 (
+					    blocks[l][b], state[l].rk[r] );
+				}
+			}
+		}
+		for ( l = 0 ; l < count ; l++ ) {
+			for ( b = 0 ; b < num_blocks ; b++ ) {
+				blocks[l][b] = _mm_aesenclast_si128 (
+				    blocks[l][b], state[l].rk[rounds] );
+			}
+		}
+
+		/* Store output and update key and counter value */
+		for ( l = 0 ; l < count ; l++ ) {
+			for ( b = 0 ; b < ( out_blocks - 1 ) ; b++ ) {
+				out = ( ( __m128i * ) lanes[l].output );
+				_mm_storeu_si128 ( out, blocks[l][b] );
+				lanes[l].output += CX_AESNI_BLOCK_LEN;
+			}
+			if ( tail_len == CX_AESNI_BLOCK_LEN ) {
+				out = ( ( __m128i * ) lanes[l].output );
+				_mm_storeu_si128 ( out, blocks[l][b] );
+			} else {
+				_mm_storeu_si128 ( &tail, blocks[l][b] );
+				memcpy ( lanes[l].output, &tail, tail_len );
+			}
+			lanes[l].output += tail_len;
+			for ( b = 0 ; b < key_blocks ; b++ ) {
+				state[l].key[b] =
+					blocks[l][ out_blocks + b ];
+			}
+			_mm_storeu_si128 ( ( __m128i * ) halves,
+					   _mm_shuffle_epi8 (
+					       blocks[l][ num_blocks - 1 ],
+					       bswap ) );
+			state[l].lo = halves[0];
+			state[l].hi = halves[1];
+		}
+	}
+
+	/* Store final state */
+	for ( l = 0 ; l < count ; l++ ) {
+		key = ( ( __m128i * ) lanes[l].key );
+		for ( b = 0 ; b < key_blocks ; b++ )
+			_mm_storeu_si128 ( &key[b], state[l].key[b] );
+		halves[0] = state[l].lo;
+		halves[1] = state[l].hi;
+		_mm_storeu_si128 ( ( __m128i * ) lanes[l].v, _mm_shuffle_epi8 (
+			_mm_loadu_si128 ( ( const __m128i * ) halves ),
+			bswap ) );
+	}
+
+	/* Zero internal state */
+	OPENSSL_cleanse ( state, sizeof ( state ) );
+	OPENSSL_cleanse ( blocks, sizeof ( blocks ) );
+}
+
+/* Specialised variants for each AES key length */
+CX_KERNEL_VARIANT ( cx_aesni, CX_AESNI_TARGET, 128 )
+CX_KERNEL_VARIANT ( cx_aesni, CX_AESNI_TARGET, 256 )
+
+/** AES-NI generator kernel */
+const struct cx_kernel cx_kernel_aesni = {
+	.name = "aesni",
+	.width = CX_AESNI_WIDTH,
+	.supported = cx_aesni_supported,
+	.aes128 = { .generate = cx_aesni_generate_128 },
+	.aes256 = { .generate = cx_aesni_generate_256 },
+};
+
+#else /* __x86_64__ || __i386__ */
+
+/**
+ * Check if AES-NI kernel is supported
+ *
+ * @ret supported	Kernel is supported
+ */
+static int cx_aesni_supported ( void ) {
+
+	return 0;
+}
+
+/** AES-NI generator kernel (unsupported on this architecture) */
+const struct cx_kernel cx_kernel_aesni = {
+	.name = "aesni",
+	.width = 1,
+	.supported = cx_aesni_supported,
+};
+
+#endif /* __x86_64__ || __i386__ */
@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * ARMv8 Cryptography Extensions generator kernel
+ *
+ * This kernel performs CTR_DRBG generate operations for up to eight
+ * independent DRBG instances in lockstep using the ARMv8 AESE and
+ * AESMC instructions, so that the AES rounds for each lane are
+ * interleaved and the AES pipeline remains busy.
+ *
+ * The key schedule is calculated using AESE with an all-zero round
+ * key applied to a word replicated across all four columns, which
+ * yields SubWord() of that word since ShiftRows() has no effect on
+ * identical columns.
+ *
+ ******************************************************************************
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include "kernel.h"
+
+#if defined ( __aarch64__ ) && defined ( __linux__ )
+
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_neon.h>
+
+/** Number of lanes processed in lockstep */
+#define CX_ARMCE_WIDTH 8
+
+/** AES block size */
+#define CX_ARMCE_BLOCK_LEN 16
+
+/** Maximum number of AES rounds */
+#define CX_ARMCE_MAX_ROUNDS 14
+
+/** Maximum number of blocks per lane per iteration */
+#define CX_ARMCE_MAX_BLOCKS \
+	( ( CX_KERNEL_MAX_LEN + 32 /* key */ + 16 /* V */ ) / \
+	  CX_ARMCE_BLOCK_LEN )
+
+/** Function attributes for ARMv8 Cryptography Extensions code */
+#define CX_ARMCE_TARGET __attribute__ (( target ( "+crypto" ) ))
+
+/** AES round constants */
+static const uint8_t cx_armce_rcon[] = {
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36
+};
+
+/** Shuffle mask for RotWord() of the final word, in all columns */
+static const uint8_t cx_armce_rotword[CX_ARMCE_BLOCK_LEN] = {
+	13, 14, 15, 12, 13, 14, 15, 12, 13, 14, 15, 12, 13, 14, 15, 12
+};
+
+/** ARMv8 Cryptography Extensions lane state */
+struct cx_armce_lane {
+	/** Round keys */
+	uint8x16_t rk[ CX_ARMCE_MAX_ROUNDS + 1 ];
+	/** Current key */
+	uint8x16_t key[2];
+	/** Counter value (high 64 bits) */
+	uint64_t hi;
+	/** Counter value (low 64 bits) */
+	uint64_t lo;
+};
+
+/**
+ * Check if ARMv8 Cryptography Extensions kernel is supported
+ *
+ * @ret supported	Kernel is supported
+ */
+static int cx_armce_supported ( void ) {
+
+	return ( ( getauxval ( AT_HWCAP ) & HWCAP_AES ) != 0 );
+}
+
+/**
+ * Calculate XOR of all preceding words within key
+ *
+ * @v key		Key
+ * @ret key		Key with each word XORed with all preceding words
+ */
+static CX_ARMCE_TARGET inline uint8x16_t
+cx_armce_shift_xor ( uint8x16_t key ) {
+	const uint8x16_t zero = vdupq_n_u8 ( 0 );
+
+	key = veorq_u8 ( key, vextq_u8 ( zero, key, 12 ) );
+	key = veorq_u8 ( key, vextq_u8 ( zero, key, 8 ) );
+	return key;
+}
+
+/**
+ * Construct big-endian counter block
+ *
+ * @v hi		Counter value (high 64 bits)
+ * @v lo		Counter value (low 64 bits)
+ * @ret block		Counter block
+ */
+static CX_ARMCE_TARGET inline uint8x16_t cx_armce_block ( uint64_t hi,
+							  uint64_t lo ) {
+
+	return vcombine_u8 ( vrev64_u8 ( vcreate_u8 ( hi ) ),
+			     vrev64_u8 ( vcreate_u8 ( lo ) ) );
+}
+
+/**
+ * Construct vector with a value replicated in each word
+ *
+ * @v value		Value
+ * @ret vector		Vector
+ */
+static CX_ARMCE_TARGET inline uint8x16_t cx_armce_set1 ( uint32_t value ) {
+
+	return vreinterpretq_u8_u32 ( vdupq_n_u32 ( value ) );
+}
+
+/**
+ * Perform final AES round (equivalent to x86 AESENCLAST)
+ *
+ * @v data		Data
+ * @v key		Round key
+ * @ret data		Data
+ */
+static CX_ARMCE_TARGET inline uint8x16_t
+cx_armce_aesenclast ( uint8x16_t data, uint8x16_t key ) {
+
+	return veorq_u8 ( vaeseq_u8 ( data, vdupq_n_u8 ( 0 ) ), key );
+}
+
+/**
+ * Calculate round key using RotWord(), SubWord(), and Rcon
+ *
+ * @v prev		Round key from one key length earlier
+ * @v last		Preceding round key
+ * @v rcon		Round constant
+ * @ret rk		Round key
+ */
+static CX_ARMCE_TARGET inline uint8x16_t
+cx_armce_rk_rot ( uint8x16_t prev, uint8x16_t last, uint8x16_t rcon ) {
+	const uint8x16_t rotword = vld1q_u8 ( cx_armce_rotword );
+	uint8x16_t tmp;
+
+	tmp = vqtbl1q_u8 ( last, rotword );
+	tmp = cx_armce_aesenclast ( tmp, rcon );
+	return veorq_u8 ( cx_armce_shift_xor ( prev ), tmp );
+}
+
+/**
+ * Calculate round key using SubWord() only
+ *
+ * @v prev		Round key from one key length earlier
+ * @v last		Preceding round key
+ * @ret rk		Round key
+ */
+static CX_ARMCE_TARGET inline uint8x16_t
+cx_armce_rk_sub ( uint8x16_t prev, uint8x16_t last ) {
+	uint8x16_t tmp;
+
+	tmp = vreinterpretq_u8_u32 ( vdupq_laneq_u32 (
+		vreinterpretq_u32_u8 ( last ), 3 ) );
+	tmp = cx_armce_aesenclast ( tmp, vdupq_n_u8 ( 0 ) );
+	return veorq_u8 ( cx_armce_shift_xor ( prev ), tmp );
+}
+
+/**
+ * Expand keys
+ *
+ * @v lanes		Lanes
+ * @v count		Number of lanes
+ * @v key_len		AES key length
+ */
+static CX_ARMCE_TARGET CX_KERNEL_GENERIC void
+cx_armce_expand ( struct cx_armce_lane *lanes, unsigned int count,
+		  size_t key_len ) {
+	uint8x16_t *rk;
+	uint8x16_t rcon;
+	unsigned int i;
+	unsigned int l;
+
+	if ( key_len == 16 ) {
+
+		/* AES-128 key schedule */
+		for ( l = 0 ; l < count ; l++ )
+			lanes[l].rk[0] = lanes[l].key[0];
+		for ( i = 1 ; i <= 10 ; i++ ) {
+			rcon = cx_armce_set1 ( cx_armce_rcon[ i - 1 ] );
+			for ( l = 0 ; l < count ; l++ ) {
+				rk = lanes[l].rk;
+				rk[i] = cx_armce_rk_rot ( rk[ i - 1 ],
+							  rk[ i - 1 ], rcon );
+			}
+		}
+
+	} else {
+
+		/* AES-256 key schedule */
+		for ( l = 0 ; l < count ; l++ ) {
+			lanes[l].rk[0] = lanes[l].key[0];
+			lanes[l].rk[1] = lanes[l].key[1];
+		}
+		for ( i = 2 ; i <= 14 ; i += 2 ) {
+			rcon = cx_armce_set1 (
+				cx_armce_rcon[ ( i / 2 ) - 1 ] );
+			for ( l = 0 ; l < count ; l++ ) {
+				rk = lanes[l].rk;
+				rk[i] = cx_armce_rk_rot ( rk[ i - 2 ],
+							  rk[ i - 1 ], rcon );
+			}
+			if ( i == 14 )
+				break;
+			for ( l = 0 ; l < count ; l++ ) {
+				rk = lanes[l].rk;
+				rk[ i + 1 ] = cx_armce_rk_sub ( rk[ i - 1 ],
+								rk[i] );
+			}
+		}
+	}
+}
+
+/**
+ * Generate random bytes
+ *
+ * @v lanes		Lanes
+ * @v count		Number of lanes (at most the kernel width)
+ * @v key_len		AES key length
+ * @v len		Length of output per iteration
+ * @v iterations	Number of iterations
+ */
+static CX_ARMCE_TARGET CX_KERNEL_GENERIC void
+cx_armce_generate ( struct cx_kernel_lane *lanes, unsigned int count,
+		    size_t key_len, size_t len, unsigned int iterations ) {
+	struct cx_armce_lane state[CX_ARMCE_WIDTH];
+	uint8x16_t blocks[CX_ARMCE_WIDTH][CX_ARMCE_MAX_BLOCKS];
+	uint8_t tail[CX_ARMCE_BLOCK_LEN];
+	uint64x2_t halves;
+	unsigned int rounds = ( ( key_len == 16 ) ? 10 : 14 );
+	unsigned int key_blocks = ( key_len / CX_ARMCE_BLOCK_LEN );
+	unsigned int out_blocks;
+	unsigned int num_blocks;
+	unsigned int iteration;
+	unsigned int l;
+	unsigned int b;
+	unsigned int r;
+	size_t tail_len;
+	size_t offset;
+
+	/* Calculate number of blocks */
+	out_blocks = ( ( len + CX_ARMCE_BLOCK_LEN - 1 ) / CX_ARMCE_BLOCK_LEN );
+	num_blocks = ( out_blocks + key_blocks + 1 );
+	tail_len = ( len - ( ( out_blocks - 1 ) * CX_ARMCE_BLOCK_LEN ) );
+
+	/* Load initial state */
+	for ( l = 0 ; l < count ; l++ ) {
+		for ( b = 0 ; b < key_blocks ; b++ ) {
+			offset = ( b * CX_ARMCE_BLOCK_LEN );
+			state[l].key[b] = vld1q_u8 ( lanes[l].key + offset );
+		}
+		halves = vreinterpretq_u64_u8 (
+			vrev64q_u8 ( vld1q_u8 ( lanes[l].v ) ) );
+		state[l].hi = vgetq_lane_u64 ( halves, 0 );
+		state[l].lo = vgetq_lane_u64 ( halves, 1 );
+	}
+
+	/* Perform iterations */
+	for ( iteration = 0 ; iteration < iterations ; iteration++ ) {
+
+		/* Expand keys */
+		cx_armce_expand ( state, count, key_len );
+
+		/* Construct counter blocks */
+		for ( l = 0 ; l < count ; l++ ) {
+			for ( b = 0 ; b < num_blocks ; b++ ) {
+				if ( ! ++state[l].lo )
+					state[l].hi++;
+				blocks[l][b] = cx_armce_block ( state[l].hi,
+								state[l].lo );
+			}
+		}
+
+		/* Apply AES rounds, interleaved across all lanes */
+		for ( r = 0 ; r < ( rounds - 1 ) ; r++ ) {
+			for ( l = 0 ; l < count ; l++ ) {
+				for ( b = 0 ; b < num_blocks ; b++ ) {
+					blocks[l][b] = vaesmcq_u8 ( vaeseq_u8 (
+					    blocks[l][b], state[l].rk[r] ) );
+				}
+			}
+		}
+		for ( l = 0 ; l < count ; l++ ) {
+			for ( b = 0 ; b < num_blocks ; b++ ) {
+				blocks[l][b] = veorq_u8 (
+				    vaeseq_u8 ( blocks[l][b],
+						state[l].rk[ rounds - 1 ] ),
+				    state[l].rk[rounds] );
+			}
+		}
+
+		/* Store output and update key and counter value */
+		for ( l = 0 ; l < count ; l++ ) {
+			for ( b = 0 ; b < ( out_blocks - 1 ) ; b++ ) {
+				vst1q_u8 ( lanes[l].output, blocks[l][b] );
+				lanes[l].output += CX_ARMCE_BLOCK_LEN;
+			}
+			if ( tail_len == CX_ARMCE_BLOCK_LEN ) {
+				vst1q_u8 ( lanes[l].output, blocks[l][b] );
+			} else {
+				vst1q_u8 ( tail, blocks[l][b] );
+				memcpy ( lanes[l].output, tail, tail_len );
+			}
+			lanes[l].output += tail_len;
+			for ( b = 0 ; b < key_blocks ; b++ ) {
+				state[l].key[b] =
+					blocks[l][ out_blocks + b ];
+			}
+			halves = vreinterpretq_u64_u8 (
+				vrev64q_u8 ( blocks[l][ num_blocks - 1 ] ) );
+			state[l].hi = vgetq_lane_u64 ( halves, 0 );
+			state[l].lo = vgetq_lane_u64 ( halves, 1 );
+		}
+	}
+
+	/* Store final state */
+	for ( l = 0 ; l < count ; l++ ) {
+		for ( b = 0 ; b < key_blocks ; b++ ) {
+			offset = ( b * CX_ARMCE_BLOCK_LEN );
+			vst1q_u8 ( ( lanes[l].key + offset ),
+				   state[l].key[b] );
+		}
+		vst1q_u8 ( lanes[l].v, cx_armce_block ( state[l].hi,
+							state[l].lo ) );
+	}
+
+	/* Zero internal state */
+	OPENSSL_cleanse ( state, sizeof ( state ) );
+	OPENSSL_cleanse ( blocks, sizeof ( blocks ) );
+	OPENSSL_cleanse ( tail, sizeof ( tail ) );
+}
+
+/* Specialised variants for each AES key length */
+CX_KERNEL_VARIANT ( cx_armce, CX_ARMCE_TARGET, 128 )
+CX_KERNEL_VARIANT ( cx_armce, CX_ARMCE_TARGET, 256 )
+
+/** ARMv8 Cryptography Extensions generator kernel */
+const struct cx_kernel cx_kernel_armce = {
+	.name = "armce",
+	.width = CX_ARMCE_WIDTH,
+	.supported = cx_armce_supported,
+	.aes128 = { .generate = cx_armce_generate_128 },
+	.aes256 = { .generate = cx_armce_generate_256 },
+};
+
+#else /* __aarch64__ && __linux__ */
+
+/**
+ * Check if ARMv8 Cryptography Extensions kernel is supported
+ *
+ * @ret supported	Kernel is supported
+ */
+static int cx_armce_supported ( void ) {
+
+	return 0;
+}
+
+/** ARMv8 Cryptography Extensions generator kernel (unsupported) */
+const struct cx_kernel cx_kernel_armce = {
+	.name = "armce",
+	.width = 1,
+	.supported = cx_armce_supported,
+};
+
+#endif /* __aarch64__ && __linux__ */
@@ -31,10 +31,14 @@
  ******************************************************************************
  */
 
+#include <string.h>
+#include <stdio.h>
 #include <openssl/asn1t.h>
 #include <openssl/bio.h>
+#include <openssl/err.h>
 #include <openssl/pem.h>
 #include <cx/asn1.h>
+#include "parallel.h"
 #include "debug.h"
 
 /**
@@ -625,6 +629,626 @@ static int CX_SEED_REPORT_CONTENT_verify ( CX_SEED_REPORT_CONTENT *content,
 	return 0;
 }
 
+/** An encoded to-be-signed seed report content
+ *
+ * Every signature within a seed report covers the same seed report
+ * content, differing only in the embedded signature algorithm.  The
+ * DER encoding (and, where the signature scheme allows it, the
+ * digest) is therefore computed once per distinct signature
+ * algorithm and shared between all signatures using that algorithm.
+ */
+struct cx_tbs_encoding {
+	/** Signature algorithm (borrowed from the first signature) */
+	X509_ALGOR *algor;
+	/** DER encoding */
+	unsigned char *der;
+	/** Length of DER encoding */
+	int len;
+	/** Public key algorithm */
+	int pknid;
+	/** Digest algorithm (or NULL if digest is not precomputed) */
+	const EVP_MD *md;
+	/** Digest of DER encoding */
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	/** Length of digest */
+	unsigned int digest_len;
+};
+
+/**
+ * Encode to-be-signed seed report content
+ *
+ * @v encoding		Encoding to fill in
+ * @v content		Seed report content
+ * @v algor		Signature algorithm
+ * @ret ok		Success indicator
+ */
+static int cx_tbs_encode ( struct cx_tbs_encoding *encoding,
+			   CX_SEED_REPORT_CONTENT *content,
+			   X509_ALGOR *algor ) {
+	CX_TBS_SEED_REPORT_CONTENT *tbs;
+	CX_SEED_REPORT_CONTENT *saved_content;
+	X509_ALGOR *saved_algor;
+	const ASN1_ITEM *item;
+	int mdnid;
+	int pknid;
+
+	/* Construct temporary TbsSeedReportContent */
+	tbs = CX_TBS_SEED_REPORT_CONTENT_new();
+	if ( ! tbs ) {
+		DBG ( "CX_SEED_REPORT_CONTENT could not allocate "
+		      "TbsSeedReportContent\n" );
+		goto err_alloc;
+	}
+
+	/* Borrow copies of the seed report content and algorithm */
+	saved_content = tbs->content;
+	tbs->content = content;
+	saved_algor = tbs->signatureAlgorithm;
+	tbs->signatureAlgorithm = algor;
+
+	/* Construct DER encoding */
+	encoding->algor = algor;
+	encoding->der = NULL;
+	item = ASN1_ITEM_rptr ( CX_TBS_SEED_REPORT_CONTENT );
+	encoding->len = ASN1_item_i2d ( ( ( ASN1_VALUE * ) tbs ),
+					&encoding->der, item );
+	if ( encoding->len <= 0 ) {
+		DBG ( "CX_SEED_REPORT_CONTENT could not encode "
+		      "TbsSeedReportContent\n" );
+		goto err_encode;
+	}
+
+	/* Precompute digest for schemes that sign a plain digest */
+	encoding->pknid = NID_undef;
+	encoding->md = NULL;
+	if ( OBJ_find_sigid_algs ( OBJ_obj2nid ( algor->algorithm ),
+				   &mdnid, &pknid ) ) {
+		encoding->pknid = pknid;
+		if ( ( mdnid != NID_undef ) &&
+		     ( ( pknid == NID_rsaEncryption ) ||
+		       ( pknid == NID_X9_62_id_ecPublicKey ) ||
+		       ( pknid == NID_dsa ) ) ) {
+			encoding->md = EVP_get_digestbynid ( mdnid );
+		}
+	}
+	if ( encoding->md &&
+	     ( ! EVP_Digest ( encoding->der, encoding->len, encoding->digest,
+			      &encoding->digest_len, encoding->md, NULL ) ) ) {
+		DBG ( "CX_SEED_REPORT_CONTENT could not digest "
+		      "TbsSeedReportContent\n" );
+		goto err_digest;
+	}
+
+	/* Release copies of the seed report content and algorithm */
+	tbs->signatureAlgorithm = saved_algor;
+	tbs->content = saved_content;
+
+	/* Free temporary TbsSeedReportContent */
+	CX_TBS_SEED_REPORT_CONTENT_free ( tbs );
+
+	return 1;
+
+ err_digest:
+	OPENSSL_free ( encoding->der );
+	encoding->der = NULL;
+ err_encode:
+	tbs->signatureAlgorithm = saved_algor;
+	tbs->content = saved_content;
+	CX_TBS_SEED_REPORT_CONTENT_free ( tbs );
+ err_alloc:
+	return 0;
+}
+
+/**
+ * Find or construct encoding for a signature algorithm
+ *
+ * @v encodings		Encodings
+ * @v encoded		Number of encodings constructed so far
+ * @v content		Seed report content
+ * @v algor		Signature algorithm
+ * @ret encoding	Encoding (or NULL on error)
+ */
+static struct cx_tbs_encoding *
+cx_tbs_find ( struct cx_tbs_encoding *encodings, unsigned int *encoded,
+	      CX_SEED_REPORT_CONTENT *content, X509_ALGOR *algor ) {
+	struct cx_tbs_encoding *encoding;
+	unsigned int i;
+
+	/* Use existing encoding, if any */
+	for ( i = 0 ; i < *encoded ; i++ ) {
+		encoding = &encodings[i];
+		if ( X509_ALGOR_cmp ( encoding->algor, algor ) == 0 )
+			return encoding;
+	}
+
+	/* Otherwise, construct a new encoding */
+	encoding = &encodings[i];
+	if ( ! cx_tbs_encode ( encoding, content, algor ) )
+		return NULL;
+	( *encoded )++;
+
+	return encoding;
+}
+
+/**
+ * Select signature algorithm for signing from encoded content
+ *
+ * @v algor		Signature algorithm to fill in
+ * @v key		Preseed signing key
+ * @v md		Digest type (or NULL to use default)
+ * @ret ok		Success indicator
+ *
+ * This constructs the same signatureAlgorithm that ASN1_item_sign()
+ * would construct for the key type.  Key types for which this is not
+ * straightforward (e.g. RSA-PSS) are rejected, and must be signed
+ * using ASN1_item_sign() instead.
+ */
+static int cx_tbs_algorithm ( X509_ALGOR *algor, EVP_PKEY *key,
+			      const EVP_MD *md ) {
+	int pknid;
+	int mdnid;
+	int signid;
+	int ptype;
+
+	/* Identify parameter type and default digest */
+	pknid = EVP_PKEY_base_id ( key );
+	switch ( pknid ) {
+	case EVP_PKEY_RSA:
+		ptype = V_ASN1_NULL;
+		break;
+	case EVP_PKEY_EC:
+	case EVP_PKEY_DSA:
+		ptype = V_ASN1_UNDEF;
+		break;
+	case EVP_PKEY_ED25519:
+	case EVP_PKEY_ED448:
+		if ( md )
+			return 0;
+		ptype = V_ASN1_UNDEF;
+		break;
+	default:
+		return 0;
+	}
+	if ( ( ptype == V_ASN1_NULL ) || ( pknid == EVP_PKEY_EC ) ||
+	     ( pknid == EVP_PKEY_DSA ) ) {
+		if ( ( ! md ) &&
+		     ( EVP_PKEY_get_default_digest_nid ( key, &mdnid ) > 0 ) )
+			md = EVP_get_digestbynid ( mdnid );
+		if ( ! md )
+			return 0;
+	}
+
+	/* Identify signature algorithm */
+	mdnid = ( md ? EVP_MD_type ( md ) : NID_undef );
+	if ( ! OBJ_find_sigid_by_algs ( &signid, mdnid, pknid ) )
+		return 0;
+	if ( ! X509_ALGOR_set0 ( algor, OBJ_nid2obj ( signid ), ptype, NULL ) )
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Create seed report content signature using encoded content
+ *
+ * @v encoding		Encoded to-be-signed seed report content
+ * @v signature		Signature
+ * @v key		Preseed signing key
+ * @v ctx		Reusable digest context
+ * @ret ok		Success indicator
+ */
+static int cx_tbs_sign ( struct cx_tbs_encoding *encoding,
+			 CX_SIGNATURE *signature, EVP_PKEY *key,
+			 EVP_MD_CTX *ctx ) {
+	EVP_PKEY_CTX *pctx = NULL;
+	unsigned char *value;
+	size_t len;
+	int rv;
+
+	/* Allocate signature value */
+	len = EVP_PKEY_size ( key );
+	value = OPENSSL_malloc ( len );
+	if ( ! value )
+		goto err_alloc;
+
+	/* Sign precomputed digest, if applicable, otherwise DER encoding */
+	if ( encoding->md ) {
+		pctx = EVP_PKEY_CTX_new ( key, NULL );
+		if ( ! pctx )
+			goto err_pctx;
+		rv = ( ( EVP_PKEY_sign_init ( pctx ) > 0 ) &&
+		       ( EVP_PKEY_CTX_set_signature_md ( pctx, encoding->md )
+			 > 0 ) &&
+		       ( EVP_PKEY_sign ( pctx, value, &len, encoding->digest,
+					 encoding->digest_len ) > 0 ) );
+	} else {
+		EVP_MD_CTX_reset ( ctx );
+		rv = ( ( EVP_DigestSignInit ( ctx, NULL, NULL, NULL,
+					      key ) > 0 ) &&
+		       ( EVP_DigestSign ( ctx, value, &len, encoding->der,
+					  encoding->len ) > 0 ) );
+	}
+	if ( ! rv ) {
+		DBG ( "CX_SIGNATURE could not sign\n" );
+		goto err_sign;
+	}
+
+	/* Record signature value */
+	ASN1_STRING_set0 ( &signature->signatureValue, value, len );
+
+	/* Free context */
+	EVP_PKEY_CTX_free ( pctx );
+
+	return 1;
+
+ err_sign:
+	EVP_PKEY_CTX_free ( pctx );
+ err_pctx:
+	OPENSSL_free ( value );
+ err_alloc:
+	return 0;
+}
+
+/**
+ * Check whether or not a signature may be verified using encoded content
+ *
+ * @v encoding		Encoded to-be-signed seed report content
+ * @v key		Preseed verification key
+ * @ret direct		Signature may be verified using encoded content
+ *
+ * Signature schemes that are not handled directly must be passed to
+ * ASN1_item_verify(), which will re-encode the seed report content.
+ */
+static int cx_tbs_direct ( struct cx_tbs_encoding *encoding,
+			   EVP_PKEY *key ) {
+	int pktype;
+
+	/* Check key type matches signature algorithm */
+	if ( encoding->pknid == NID_undef )
+		return 0;
+	pktype = EVP_PKEY_type ( encoding->pknid );
+	if ( ( pktype == NID_undef ) ||
+	     ( EVP_PKEY_base_id ( key ) != pktype ) ) {
+		return 0;
+	}
+
+	/* Check scheme signs either a plain digest or the raw encoding */
+	return ( encoding->md || ( encoding->pknid == NID_ED25519 ) ||
+		 ( encoding->pknid == NID_ED448 ) );
+}
+
+/**
+ * Verify seed report content signature using encoded content
+ *
+ * @v encoding		Encoded to-be-signed seed report content
+ * @v signature		Signature
+ * @v key		Preseed verification key
+ * @v ctx		Reusable digest context
+ * @ret ok		Success indicator
+ */
+static int cx_tbs_verify ( struct cx_tbs_encoding *encoding,
+			   CX_SIGNATURE *signature, EVP_PKEY *key,
+			   EVP_MD_CTX *ctx ) {
+	ASN1_OCTET_STRING *value = &signature->signatureValue;
+	EVP_PKEY_CTX *pctx;
+	int rv;
+
+	/* Verify signature over precomputed digest, if applicable */
+	if ( encoding->md ) {
+		pctx = EVP_PKEY_CTX_new ( key, NULL );
+		if ( ! pctx )
+			return 0;
+		rv = ( ( EVP_PKEY_verify_init ( pctx ) > 0 ) &&
+		       ( EVP_PKEY_CTX_set_signature_md ( pctx, encoding->md )
+			 > 0 ) &&
+		       ( EVP_PKEY_verify ( pctx, value->data, value->length,
+					   encoding->digest,
+					   encoding->digest_len ) == 1 ) );
+		EVP_PKEY_CTX_free ( pctx );
+		if ( ! rv )
+			DBG ( "CX_SIGNATURE verification failed\n" );
+		return rv;
+	}
+
+	/* Otherwise verify signature over DER encoding */
+	EVP_MD_CTX_reset ( ctx );
+	rv = ( ( EVP_DigestVerifyInit ( ctx, NULL, NULL, NULL, key ) > 0 ) &&
+	       ( EVP_DigestVerify ( ctx, value->data, value->length,
+				    encoding->der, encoding->len ) == 1 ) );
+	if ( ! rv )
+		DBG ( "CX_SIGNATURE verification failed\n" );
+	return rv;
+}
+
+/** Sentinel error used to detect errors queued by a signature operation */
+#define CX_TBS_SENTINEL ERR_PACK ( ERR_LIB_USER, 0, 1 )
+
+/** A signature operation on encoded content */
+struct cx_tbs_op {
+	/** Encoded to-be-signed seed report content, or NULL if the
+	 * operation cannot use a shared encoding
+	 */
+	struct cx_tbs_encoding *encoding;
+	/** Signature */
+	CX_SIGNATURE *signature;
+	/** Preseed signing or verification key */
+	EVP_PKEY *key;
+	/** Index of seed descriptor */
+	unsigned int index;
+	/** Operation succeeded */
+	int ok;
+	/** Last OpenSSL error queued by a failed operation, if any */
+	unsigned long error;
+};
+
+/** A set of signature operations shared between threads */
+struct cx_tbs_job {
+	/** Operations */
+	struct cx_tbs_op *ops;
+	/** Number of operations */
+	unsigned int count;
+	/** Index of next unclaimed operation */
+	unsigned int next;
+	/** Index of lowest known failed operation (or number of
+	 * operations, if no failure is yet known)
+	 */
+	unsigned int failed;
+	/** Create (rather than verify) signatures */
+	int sign;
+};
+
+/**
+ * Claim next signature operation
+ *
+ * @v job		Signature job
+ * @v index		Operation index to fill in
+ * @ret ok		An operation was claimed
+ */
+static int cx_tbs_next ( struct cx_tbs_job *job, unsigned int *index ) {
+
+	*index = __atomic_fetch_add ( &job->next, 1, __ATOMIC_RELAXED );
+	return ( *index < job->count );
+}
+
+/**
+ * Record failed signature operation
+ *
+ * @v job		Signature job
+ * @v index		Operation index
+ */
+static void cx_tbs_fail ( struct cx_tbs_job *job, unsigned int index ) {
+	unsigned int failed;
+
+	/* Lower the index of the lowest known failure, if applicable */
+	failed = __atomic_load_n ( &job->failed, __ATOMIC_RELAXED );
+	while ( ( index < failed ) &&
+		( ! __atomic_compare_exchange_n ( &job->failed, &failed,
+						  index, 0, __ATOMIC_RELAXED,
+						  __ATOMIC_RELAXED ) ) ) {}
+}
+
+/**
+ * Queue OpenSSL error on the current thread
+ *
+ * @v error		Error code
+ * @v data		Additional error data, or NULL
+ */
+static void cx_tbs_put ( unsigned long error, const char *data ) {
+
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+	ERR_put_error ( ERR_GET_LIB ( error ), ERR_GET_FUNC ( error ),
+			ERR_GET_REASON ( error ), __FILE__, __LINE__ );
+	if ( data )
+		ERR_add_error_data ( 1, data );
+#else
+	ERR_new();
+	ERR_set_debug ( __FILE__, __LINE__, __func__ );
+	if ( data ) {
+		ERR_set_error ( ERR_GET_LIB ( error ), ERR_GET_REASON ( error ),
+				"%s", data );
+	} else {
+		ERR_set_error ( ERR_GET_LIB ( error ), ERR_GET_REASON ( error ),
+				NULL );
+	}
+#endif
+}
+
+/**
+ * Mark OpenSSL error queue before signature operation
+ *
+ * A sentinel error is queued between two marks, so that the last
+ * queued error is the sentinel if and only if the operation queues no
+ * errors of its own.  Comparing against the error that happened to be
+ * last before the operation is not sufficient, since a persistent
+ * pool thread may still hold an identical error from an earlier job.
+ */
+static void cx_tbs_mark ( void ) {
+
+	ERR_set_mark();
+	cx_tbs_put ( CX_TBS_SENTINEL, NULL );
+	ERR_set_mark();
+}
+
+/**
+ * Record outcome of signature operation
+ *
+ * @v op		Signature operation
+ * @v ok		Operation succeeded
+ *
+ * The operation must have been preceded by a call to cx_tbs_mark().
+ * Any OpenSSL errors queued by the operation (along with the
+ * sentinel) are removed from the queue of the thread that performed
+ * it, and the last such error is recorded so that it can be raised on
+ * the calling thread if this operation turns out to be the failure
+ * that is reported.
+ */
+static void cx_tbs_record ( struct cx_tbs_op *op, int ok ) {
+	unsigned long error;
+
+	error = ( ok ? 0 : ERR_peek_last_error() );
+	if ( error == CX_TBS_SENTINEL )
+		error = 0;
+	ERR_pop_to_mark();
+	ERR_pop_to_mark();
+	op->ok = ok;
+	op->error = error;
+}
+
+/**
+ * Raise error for failed signature operation on the calling thread
+ *
+ * @v op		Failed signature operation
+ *
+ * The recorded error (if any) is raised, annotated with the index of
+ * the seed descriptor.
+ */
+static void cx_tbs_raise ( struct cx_tbs_op *op ) {
+	char data[ 24 /* "descriptor " + 10 digits + NUL */ ];
+
+	/* Do nothing unless an error was recorded */
+	if ( ! op->error )
+		return;
+
+	/* Raise error */
+	snprintf ( data, sizeof ( data ), "descriptor %u", op->index );
+	cx_tbs_put ( op->error, data );
+}
+
+/**
+ * Run signature worker
+ *
+ * @v arg		Signature job
+ * @v index		Worker index (unused)
+ *
+ * The worker claims operations one at a time until none remain, or
+ * until the claimed operation lies at or above the lowest known
+ * failure.  Operations are claimed in order of index, and so every
+ * operation below the lowest failure is always performed.  Each
+ * operation records its own outcome, so the overall result does not
+ * depend on which worker performed which operation.
+ */
+static void cx_tbs_worker ( void *arg, unsigned int index ) {
+	struct cx_tbs_job *job = arg;
+	struct cx_tbs_op *op;
+	EVP_MD_CTX *ctx;
+	unsigned int i;
+	int ok;
+
+	( void ) index;
+
+	/* Allocate reusable digest context */
+	ctx = EVP_MD_CTX_new();
+	if ( ! ctx )
+		return;
+
+	/* Perform operations */
+	while ( cx_tbs_next ( job, &i ) ) {
+		if ( i >= __atomic_load_n ( &job->failed, __ATOMIC_RELAXED ) )
+			break;
+		op = &job->ops[i];
+		if ( ! op->encoding )
+			continue;
+		cx_tbs_mark();
+		if ( job->sign ) {
+			ok = cx_tbs_sign ( op->encoding, op->signature,
+					   op->key, ctx );
+		} else {
+			ok = cx_tbs_verify ( op->encoding, op->signature,
+					     op->key, ctx );
+		}
+		cx_tbs_record ( op, ok );
+		if ( ! ok )
+			cx_tbs_fail ( job, i );
+	}
+
+	/* Free reusable digest context */
+	EVP_MD_CTX_free ( ctx );
+}
+
+/**
+ * Perform signature operations
+ *
+ * @v content		Seed report content
+ * @v md		Digest type (or NULL to use default)
+ * @v ops		Operations, in order of descriptor index
+ * @v count		Number of operations
+ * @v sign		Create (rather than verify) signatures
+ * @v threads		Number of threads, or zero to use all processors
+ * @ret ok		Success indicator
+ *
+ * Any operations that cannot use a shared encoding are performed
+ * first by the calling thread, in order of descriptor index and
+ * stopping at the first failure.  Operations using a shared encoding
+ * below that failure are then performed using threads taken from the
+ * shared worker pool (see cx_parallel_run()), and no operation is
+ * started at or above the lowest failure known at the time.
+ *
+ * The failure reported is always that of the operation with the
+ * lowest descriptor index, regardless of the number of threads.  Any
+ * OpenSSL errors queued by individual operations are discarded, and
+ * only the last error queued by the reported operation is raised on
+ * the calling thread (annotated with the descriptor index), so that
+ * the error queue is also the same regardless of the number of
+ * threads.
+ */
+static int cx_tbs_run ( CX_SEED_REPORT_CONTENT *content, const EVP_MD *md,
+			struct cx_tbs_op *ops, unsigned int count, int sign,
+			unsigned int threads ) {
+	struct cx_tbs_job job;
+	struct cx_tbs_op *op;
+	unsigned int i;
+	int ok;
+
+	/* Perform operations that cannot use a shared encoding */
+	memset ( &job, 0, sizeof ( job ) );
+	job.failed = count;
+	for ( i = 0 ; i < count ; i++ ) {
+		op = &ops[i];
+		if ( op->encoding )
+			continue;
+		cx_tbs_mark();
+		if ( sign ) {
+			ok = CX_SEED_REPORT_CONTENT_sign ( content,
+							   op->signature,
+							   op->key, md );
+		} else {
+			ok = CX_SEED_REPORT_CONTENT_verify ( content,
+							     op->signature,
+							     op->key );
+		}
+		cx_tbs_record ( op, ok );
+		if ( ! ok ) {
+			job.failed = i;
+			break;
+		}
+	}
+
+	/* Perform operations using a shared encoding */
+	job.ops = ops;
+	job.count = job.failed;
+	job.sign = sign;
+	threads = cx_parallel_threads ( threads );
+	if ( threads > job.count )
+		threads = job.count;
+	cx_parallel_run ( threads, cx_tbs_worker, &job );
+
+	/* Report lowest failure, if any */
+	for ( i = 0 ; i < count ; i++ ) {
+		op = &ops[i];
+		if ( ! op->ok ) {
+			DBG ( "CX_SEED_REPORT signature %d %s\n", op->index,
+			      ( sign ? "not created" : "incorrect" ) );
+			cx_tbs_raise ( op );
+			goto err_op;
+		}
+	}
+
+	return 1;
+
+ err_op:
+	return 0;
+}
+
 /******************************************************************************
  *
  * Seed reports
@@ -916,18 +1540,38 @@ CX_SEED_REPORT_add0_descriptor ( CX_SEED_REPORT *report ) {
 }
 
 /**
- * Sign seed report
+ * Sign seed report using multiple threads
  *
  * @v report		Seed report
  * @v md		Digest type (or NULL to use default)
+ * @v flags		Signing flags
+ * @v threads		Number of threads, or zero to use all processors
  * @ret ok		Success indicator
+ *
+ * The to-be-signed seed report content is encoded (and, where
+ * possible, digested) only once per distinct signature algorithm.
+ * The private key operation for each descriptor is then shared out
+ * between the threads.  Signatures are always placed in descriptor
+ * order, and the result is identical regardless of the number of
+ * threads.
+ *
+ * The newly created signatures are then verified (using the same
+ * number of threads), unless the flag CX_SEED_REPORT_SIGN_NO_VERIFY
+ * is specified.
  */
-int CX_SEED_REPORT_sign ( CX_SEED_REPORT *report, const EVP_MD *md ) {
+int CX_SEED_REPORT_sign_parallel ( CX_SEED_REPORT *report, const EVP_MD *md,
+				   unsigned int flags, unsigned int threads ) {
 	CX_SEED_REPORT_CONTENT *content;
 	CX_SEED_DESCRIPTOR *desc;
 	CX_SIGNATURES *signatures;
 	CX_SIGNATURE *signature;
+	struct cx_tbs_encoding *encodings;
+	struct cx_tbs_op *ops;
+	struct cx_tbs_op *op;
+	X509_ALGOR *algor;
 	EVP_PKEY *key;
+	unsigned int encoded;
+	unsigned int count;
 	unsigned int num;
 	unsigned int i;
 
@@ -943,87 +1587,164 @@ int CX_SEED_REPORT_sign ( CX_SEED_REPORT *report, const EVP_MD *md ) {
 	while ( ( signature = sk_CX_SIGNATURE_pop ( signatures ) ) )
 		CX_SIGNATURE_free ( signature );
 
-	/* Reserve space in signature stack */
+	/* Check that at least one seed descriptor exists */
 	num = CX_SEED_REPORT_num_descriptors ( report );
+	if ( ! num )
+		goto err_num;
+
+	/* Reserve space in signature stack */
 	if ( ! sk_CX_SIGNATURE_reserve ( signatures, num ) ) {
 		DBG ( "CX_SEED_REPORT could not reserve\n" );
 		goto err_reserve;
 	}
 
-	/* Add a signature for each descriptor */
+	/* Allocate encodings and operations (at most one per signature) */
+	encodings = OPENSSL_zalloc ( num * sizeof ( encodings[0] ) );
+	if ( ! encodings )
+		goto err_alloc_encodings;
+	encoded = 0;
+	ops = OPENSSL_zalloc ( num * sizeof ( ops[0] ) );
+	if ( ! ops )
+		goto err_alloc_ops;
+	count = 0;
+
+	/* Add a signature for each descriptor, stopping at the first
+	 * descriptor without a key.
+	 */
 	for ( i = 0 ; i < num ; i++ ) {
 
-		/* Get seed descriptor */
+		/* Get seed descriptor and signing key */
 		desc = CX_SEED_REPORT_get0_descriptor ( report, i );
-		if ( ! desc ) {
-			DBG ( "CX_SEED_REPORT missing descriptor %d\n", i );
-			goto err_descriptor;
-		}
-
-		/* Get signing key */
+		if ( ! desc )
+			break;
 		key = CX_SEED_DESCRIPTOR_get0_key ( desc );
-		if ( ! key ) {
-			DBG ( "CX_SEED_REPORT missing key %d\n", i );
-			goto err_key;
-		}
+		if ( ! key )
+			break;
 
-		/* Allocate new signature */
+		/* Allocate and append new signature */
 		signature = CX_SIGNATURE_new();
 		if ( ! signature ) {
 			DBG ( "CX_SEED_REPORT could not allocate signature "
 			      "%d\n", i );
 			goto err_new;
 		}
-
-		/* Create signature */
-		if ( ! CX_SEED_REPORT_CONTENT_sign ( content, signature,
-						     key, md ) ) {
-			DBG ( "CX_SEED_REPORT could not sign using key %d\n",
-			      i );
-			goto err_sign;
-		}
-
-		/* Append signature */
 		if ( ! sk_CX_SIGNATURE_push ( signatures, signature ) ) {
 			DBG ( "CX_SEED_REPORT could not append signature "
 			      "%d\n", i );
+			CX_SIGNATURE_free ( signature );
 			goto err_push;
 		}
 
-		/* Disown signature */
-		signature = NULL;
+		/* Sign from shared encoding, if possible */
+		op = &ops[count++];
+		op->signature = signature;
+		op->key = key;
+		op->index = i;
+		algor = &signature->signatureAlgorithm;
+		if ( cx_tbs_algorithm ( algor, key, md ) ) {
+			op->encoding = cx_tbs_find ( encodings, &encoded,
+						     content, algor );
+			if ( ! op->encoding )
+				goto err_encode;
+		}
 	}
 
-	/* Verify created signatures */
-	if ( ! CX_SEED_REPORT_verify ( report ) )
-		goto err_verify;
+	/* Create signatures */
+	if ( ! cx_tbs_run ( content, md, ops, count, 1, threads ) )
+		goto err_run;
+	if ( i < num ) {
+		DBG ( "CX_SEED_REPORT missing descriptor or key %d\n", i );
+		goto err_missing;
+	}
+
+	/* Free operations and encodings */
+	OPENSSL_free ( ops );
+	for ( i = 0 ; i < encoded ; i++ )
+		OPENSSL_free ( encodings[i].der );
+	OPENSSL_free ( encodings );
+
+	/* Verify created signatures, if applicable */
+	if ( ! ( flags & CX_SEED_REPORT_SIGN_NO_VERIFY ) ) {
+		if ( ! CX_SEED_REPORT_verify_parallel ( report, threads ) )
+			goto err_verify;
+	}
 
 	return 1;
 
- err_verify:
+ err_missing:
+ err_run:
+ err_encode:
  err_push:
- err_sign:
-	CX_SIGNATURE_free ( signature );
  err_new:
- err_key:
- err_descriptor:
+	OPENSSL_free ( ops );
+ err_alloc_ops:
+	for ( i = 0 ; i < encoded ; i++ )
+		OPENSSL_free ( encodings[i].der );
+	OPENSSL_free ( encodings );
+ err_alloc_encodings:
  err_reserve:
+ err_num:
  err_sanity:
+ err_verify:
 	return 0;
 }
 
 /**
- * Verify seed report
+ * Sign seed report
  *
  * @v report		Seed report
+ * @v md		Digest type (or NULL to use default)
+ * @v flags		Signing flags
  * @ret ok		Success indicator
+ *
+ * The newly created signatures are verified, unless the flag
+ * CX_SEED_REPORT_SIGN_NO_VERIFY is specified.
  */
-int CX_SEED_REPORT_verify ( CX_SEED_REPORT *report ) {
+int CX_SEED_REPORT_sign_ex ( CX_SEED_REPORT *report, const EVP_MD *md,
+			     unsigned int flags ) {
+
+	return CX_SEED_REPORT_sign_parallel ( report, md, flags, 1 );
+}
+
+/**
+ * Sign seed report
+ *
+ * @v report		Seed report
+ * @v md		Digest type (or NULL to use default)
+ * @ret ok		Success indicator
+ */
+int CX_SEED_REPORT_sign ( CX_SEED_REPORT *report, const EVP_MD *md ) {
+
+	return CX_SEED_REPORT_sign_ex ( report, md, 0 );
+}
+
+/**
+ * Verify seed report using multiple threads
+ *
+ * @v report		Seed report
+ * @v threads		Number of threads, or zero to use all processors
+ * @ret ok		Success indicator
+ *
+ * The to-be-signed seed report content is encoded (and, where
+ * possible, digested) only once per distinct signature algorithm.
+ * The public key operation for each descriptor is then shared out
+ * between the threads.  The result is identical regardless of the
+ * number of threads: signatures are checked in order of descriptor
+ * index, and the first failure is the one reported.
+ */
+int CX_SEED_REPORT_verify_parallel ( CX_SEED_REPORT *report,
+				     unsigned int threads ) {
 	CX_SEED_REPORT_CONTENT *content;
 	CX_SEED_DESCRIPTOR *desc;
 	CX_SIGNATURES *signatures;
 	CX_SIGNATURE *signature;
+	struct cx_tbs_encoding *encodings;
+	struct cx_tbs_encoding *encoding;
+	struct cx_tbs_op *ops;
+	struct cx_tbs_op *op;
 	EVP_PKEY *key;
+	unsigned int encoded;
+	unsigned int count;
 	unsigned int num;
 	unsigned int i;
 
@@ -1040,45 +1761,85 @@ int CX_SEED_REPORT_verify ( CX_SEED_REPORT *report ) {
 	if ( ! num )
 		goto err_num;
 
-	/* Verify signature for each descriptor */
+	/* Allocate encodings and operations (at most one per signature) */
+	encodings = OPENSSL_zalloc ( num * sizeof ( encodings[0] ) );
+	if ( ! encodings )
+		goto err_alloc_encodings;
+	encoded = 0;
+	ops = OPENSSL_zalloc ( num * sizeof ( ops[0] ) );
+	if ( ! ops )
+		goto err_alloc_ops;
+	count = 0;
+
+	/* Collect signature for each descriptor, stopping at the first
+	 * descriptor without a key or signature.
+	 */
 	for ( i = 0 ; i < num ; i++ ) {
 
-		/* Get seed descriptor */
+		/* Get seed descriptor, verification key, and signature */
 		desc = CX_SEED_REPORT_get0_descriptor ( report, i );
-		if ( ! desc ) {
-			DBG ( "CX_SEED_REPORT missing descriptor %d\n", i );
-			goto err_descriptor;
-		}
-
-		/* Get verification key */
+		if ( ! desc )
+			break;
 		key = CX_SEED_DESCRIPTOR_get0_key ( desc );
-		if ( ! key ) {
-			DBG ( "CX_SEED_REPORT missing key %d\n", i );
-			goto err_key;
-		}
-
-		/* Get signature */
+		if ( ! key )
+			break;
 		signature = sk_CX_SIGNATURE_value ( signatures, i );
-		if ( ! signature ) {
-			DBG ( "CX_SEED_REPORT missing signature %d\n", i );
-			goto err_signature;
-		}
+		if ( ! signature )
+			break;
+
+		/* Find or construct encoding for this signature algorithm */
+		encoding = cx_tbs_find ( encodings, &encoded, content,
+					 &signature->signatureAlgorithm );
+		if ( ! encoding )
+			goto err_encode;
+
+		/* Verify using shared encoding, if possible */
+		op = &ops[count++];
+		if ( cx_tbs_direct ( encoding, key ) )
+			op->encoding = encoding;
+		op->signature = signature;
+		op->key = key;
+		op->index = i;
+	}
 
-		/* Verify signature */
-		if ( ! CX_SEED_REPORT_CONTENT_verify ( content, signature,
-						       key ) ) {
-			DBG ( "CX_SEED_REPORT signature %d incorrect\n", i );
-			goto err_verify;
-		}
+	/* Verify signatures */
+	if ( ! cx_tbs_run ( content, NULL, ops, count, 0, threads ) )
+		goto err_run;
+	if ( i < num ) {
+		DBG ( "CX_SEED_REPORT missing descriptor, key, or signature "
+		      "%d\n", i );
+		goto err_missing;
 	}
 
+	/* Free operations and encodings */
+	OPENSSL_free ( ops );
+	for ( i = 0 ; i < encoded ; i++ )
+		OPENSSL_free ( encodings[i].der );
+	OPENSSL_free ( encodings );
+
 	return 1;
 
- err_verify:
- err_signature:
- err_key:
- err_descriptor:
+ err_missing:
+ err_run:
+ err_encode:
+	OPENSSL_free ( ops );
+ err_alloc_ops:
+	for ( i = 0 ; i < encoded ; i++ )
+		OPENSSL_free ( encodings[i].der );
+	OPENSSL_free ( encodings );
+ err_alloc_encodings:
  err_num:
  err_sanity:
 	return 0;
 }
+
+/**
+ * Verify seed report
+ *
+ * @v report		Seed report
+ * @ret ok		Success indicator
+ */
+int CX_SEED_REPORT_verify ( CX_SEED_REPORT *report ) {
+
+	return CX_SEED_REPORT_verify_parallel ( report, 1 );
+}
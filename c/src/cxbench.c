@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Benchmarks
+ *
+ ******************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cxbench.h"
+#include "genbench.h"
+#include "matchbench.h"
+#include "seedcalcbench.h"
+#include "seedrepbench.h"
+
+/** Default number of seed values */
+#define CXBENCH_DEFAULT_COUNT 1000
+
+/**
+ * Get current time
+ *
+ * @ret now		Current monotonic time (in seconds)
+ */
+double cxbench_now ( void ) {
+	struct timespec ts;
+
+	clock_gettime ( CLOCK_MONOTONIC, &ts );
+	return ( ts.tv_sec + ( ts.tv_nsec / 1e9 ) );
+}
+
+/**
+ * Report benchmark result
+ *
+ * @v name		Benchmark name
+ * @v subname		Benchmark subname
+ * @v ops		Number of operations performed
+ * @v elapsed		Elapsed time (in seconds)
+ */
+void cxbench_report ( const char *name, const char *subname,
+		      unsigned long ops, double elapsed ) {
+
+	printf ( "BENCH %-16s %-24s %12lu ops %9.3f s %14.0f ops/s\n",
+		 name, subname, ops, elapsed,
+		 ( elapsed > 0 ? ( ops / elapsed ) : 0 ) );
+}
+
+/** A benchmark suite */
+struct cxbench_suite {
+	/** Name */
+	const char *name;
+	/**
+	 * Run benchmarks
+	 *
+	 * @v count		Number of seed values
+	 * @ret ok		Success indicator
+	 */
+	int ( * run ) ( unsigned int count );
+};
+
+/** Benchmark suites */
+static struct cxbench_suite cxbench_suites[] = {
+	{ "gen", genbench },
+	{ "seedcalc", seedcalcbench },
+	{ "match", matchbench },
+	{ "seedrep", seedrepbench },
+};
+
+/**
+ * Main entry point
+ *
+ * @v argc		Number of arguments
+ * @v argv		Arguments
+ * @ret exit		Exit status
+ *
+ * The optional first argument specifies the number of seed values to
+ * use.  Any further arguments name the benchmark suites to run (by
+ * default, all suites are run).
+ */
+int main ( int argc, char **argv ) {
+	unsigned int count = CXBENCH_DEFAULT_COUNT;
+	struct cxbench_suite *suite;
+	unsigned int i;
+	int selected;
+	int ok = 1;
+	int j;
+
+	/* Parse arguments */
+	if ( argc > 1 )
+		count = strtoul ( argv[1], NULL, 0 );
+
+	/* Run selected benchmark suites */
+	for ( i = 0 ; i < ( sizeof ( cxbench_suites ) /
+			    sizeof ( cxbench_suites[0] ) ) ; i++ ) {
+		suite = &cxbench_suites[i];
+		selected = ( argc <= 2 );
+		for ( j = 2 ; j < argc ; j++ ) {
+			if ( strcmp ( argv[j], suite->name ) == 0 )
+				selected = 1;
+		}
+		if ( selected )
+			ok &= suite->run ( count );
+	}
+
+	/* Report failure */
+	if ( ! ok ) {
+		fprintf ( stderr, "Benchmarks failed\n" );
+		return 1;
+	}
+
+	return 0;
+}
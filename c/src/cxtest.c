@@ -31,12 +31,23 @@
  ******************************************************************************
  */
 
+#include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <openssl/objects.h>
 #include <openssl/x509.h>
 #include <openssl/evp.h>
+#include <cx/drbg.h>
+#include <cx/generator.h>
 #include "cxtest.h"
 #include "gentest.h"
+#include "matchtest.h"
+#include "fpmatchtest.h"
+#include "sortmatchtest.h"
+#include "ingesttest.h"
+#include "obsstoretest.h"
+#include "ledgertest.h"
+#include "threadtest.h"
 #include "seedcalctest.h"
 #include "preseedtest.h"
 #include "seedreptest.h"
@@ -144,6 +155,175 @@ static void cxtest_free_keys ( void ) {
 	}
 }
 
+/**
+ * Construct matching self-test seed values
+ *
+ * @v seeds		Seed values to fill in
+ * @v raw		Raw seed value buffers
+ * @v count		Number of seed values
+ *
+ * Seed values alternate between generator types, and are derived
+ * from the standard generator test vectors so that each pair of
+ * seed values is distinct.  No iteration ranges or hints are set.
+ */
+void cxtest_match_seeds ( struct cx_match_seed *seeds,
+			  unsigned char ( * raw )[CXTEST_MATCH_SEED_LEN],
+			  unsigned int count ) {
+	struct cx_match_seed *seed;
+	unsigned int i;
+
+	/* Construct seed values of alternating types */
+	for ( i = 0 ; i < count ; i++ ) {
+		seed = &seeds[i];
+		seed->type = ( ( i & 1 ) ? CX_GEN_AES_256_CTR_2048 :
+			       CX_GEN_AES_128_CTR_2048 );
+		seed->len = cx_gen_seed_len ( seed->type );
+		memcpy ( raw[i], ( ( i & 1 ) ? gen_type2_test1_seed :
+				   gen_type1_test1_seed ), seed->len );
+		raw[i][0] ^= ( i >> 1 );
+		seed->seed = raw[i];
+		seed->first = 0;
+		seed->last = 0;
+		seed->hint = NULL;
+	}
+}
+
+/**
+ * Construct matching self-test observations
+ *
+ * @v name		Self-test name
+ * @v seeds		Seed values
+ * @v count		Number of seed values
+ * @v observed		Observed contact IDs to fill in
+ * @v observations	Number of observed contact IDs
+ * @ret ok		Success indicator
+ *
+ * Each observation is a contact ID generated from the seed values in
+ * turn, at a scattered iteration.  Every ninth observation (starting
+ * from the fifth) repeats the previous observation, and every ninth
+ * observation (starting from the eighth) is a near miss that differs
+ * from a generated contact ID only in the least significant bit.
+ * Callers may further modify the remaining observations.
+ */
+int cxtest_match_observe ( const char *name,
+			   const struct cx_match_seed *seeds,
+			   unsigned int count, struct cx_contact_id *observed,
+			   unsigned int observations ) {
+	const struct cx_match_seed *seed;
+	struct cx_contact_id *ids;
+	unsigned int i;
+	unsigned int j;
+
+	/* Allocate generated contact IDs */
+	ids = malloc ( CXTEST_MATCH_MAX * sizeof ( ids[0] ) );
+	if ( ! ids ) {
+		fprintf ( stderr, "%s fail: out of memory\n", name );
+		goto err_alloc;
+	}
+
+	/* Construct observations from each seed value */
+	for ( i = 0 ; i < count ; i++ ) {
+		seed = &seeds[i];
+		if ( ! cx_gen_expand ( seed->type, seed->seed, seed->len,
+				       ids ) ) {
+			fprintf ( stderr, "%s fail: could not expand\n",
+				  name );
+			goto err_expand;
+		}
+		for ( j = i ; j < observations ; j += count ) {
+			memcpy ( &observed[j],
+				 &ids[ ( j * 397 ) % CXTEST_MATCH_MAX ],
+				 sizeof ( observed[j] ) );
+		}
+	}
+
+	/* Construct repeated observations and near misses */
+	for ( i = 0 ; i < observations ; i++ ) {
+		if ( ( i % 9 ) == 4 ) {
+			memcpy ( &observed[i], &observed[ i - 1 ],
+				 sizeof ( observed[i] ) );
+		} else if ( ( i % 9 ) == 7 ) {
+			observed[i].bytes[15] ^= 0x01;
+		}
+	}
+
+	free ( ids );
+	return 1;
+
+ err_expand:
+	free ( ids );
+ err_alloc:
+	return 0;
+}
+
+/** Engines to be tested */
+static const char *cxtest_engines[] = {
+	"portable",
+	"aesni",
+	"vaes",
+	"armce",
+	"openssl",
+};
+
+/**
+ * Run DRBG-based self-tests using each engine
+ *
+ * @ret ok		Success indicator
+ *
+ * Engines that are not supported by the host CPU are skipped.
+ */
+static int cxtest_engine_tests ( void ) {
+	const char *name;
+	unsigned int i;
+	int ok = 1;
+
+	/* Report automatically selected engine */
+	fprintf ( stderr, "CXTEST default engine %s\n", cx_engine_name() );
+
+	/* Run tests for each engine */
+	for ( i = 0 ; i < ( sizeof ( cxtest_engines ) /
+			    sizeof ( cxtest_engines[0] ) ) ; i++ ) {
+
+		/* Select engine */
+		name = cxtest_engines[i];
+		if ( ! cx_set_engine ( name ) ) {
+			fprintf ( stderr, "CXTEST %s engine not supported\n",
+				  name );
+			continue;
+		}
+		fprintf ( stderr, "CXTEST using %s engine\n", name );
+
+		/* Run concurrent expansion self-tests first, so that
+		 * any first-use initialisation happens concurrently.
+		 */
+		ok &= threadtests();
+
+		/* Run generator self-tests */
+		ok &= gentests();
+
+		/* Run contact ID matching self-tests */
+		ok &= matchtests();
+		ok &= fpmatchtests();
+		ok &= sortmatchtests();
+		ok &= obsstoretests();
+		ok &= ledgertests();
+
+		/* Run seed calculator self-tests */
+		ok &= seedcalctests();
+
+		/* Run preseed self-tests */
+		ok &= preseedtests();
+	}
+
+	/* Restore automatically selected engine */
+	if ( ! cx_set_engine ( "auto" ) ) {
+		fprintf ( stderr, "CXTEST could not restore engine\n" );
+		ok = 0;
+	}
+
+	return ok;
+}
+
 /**
  * Main entry point
  *
@@ -156,14 +336,11 @@ int main ( void ) {
 	if ( ! cxtest_parse_keys() )
 		goto err_keys;
 
-	/* Run generator self-tests */
-	ok &= gentests();
-
-	/* Run seed calculator self-tests */
-	ok &= seedcalctests();
+	/* Run DRBG-based self-tests */
+	ok &= cxtest_engine_tests();
 
-	/* Run preseed self-tests */
-	ok &= preseedtests();
+	/* Run sighting deduplication self-tests */
+	ok &= ingesttests();
 
 	/* Run seed report self-tests */
 	ok &= seedreptests();
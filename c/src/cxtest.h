@@ -29,6 +29,7 @@
 
 #include <openssl/objects.h>
 #include <openssl/evp.h>
+#include <cx/match.h>
 
 typedef unsigned char uuid_t[16];
 
@@ -63,4 +64,19 @@ DECL_KEY ( key_b );
 DECL_KEY ( keypair_c );
 DECL_KEY ( keypair_d );
 
+/** Number of contact IDs generated from each matching self-test seed */
+#define CXTEST_MATCH_MAX 2048
+
+/** Maximum length of a matching self-test seed value */
+#define CXTEST_MATCH_SEED_LEN 48
+
+extern void cxtest_match_seeds ( struct cx_match_seed *seeds,
+				 unsigned char ( * raw )[CXTEST_MATCH_SEED_LEN],
+				 unsigned int count );
+extern int cxtest_match_observe ( const char *name,
+				  const struct cx_match_seed *seeds,
+				  unsigned int count,
+				  struct cx_contact_id *observed,
+				  unsigned int observations );
+
 #endif /* _CX_TEST_H */
@@ -39,15 +39,67 @@
 #include <openssl/evp.h>
 #include <openssl/objects.h>
 #include <openssl/rand.h>
-#include <openssl/rand_drbg.h>
 #include <openssl/x509.h>
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+#include <openssl/rand_drbg.h>
+#else
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
 #include <cx/drbg.h>
+#include "kernel.h"
 #include "debug.h"
 
-/** A DRBG */
-struct cx_drbg {
+/** AES block size */
+#define CX_DRBG_BLOCK_LEN 16
+
+/** Maximum AES key length */
+#define CX_DRBG_MAX_KEY_LEN 32
+
+/** Maximum seed length (key length plus block length) */
+#define CX_DRBG_MAX_SEED_LEN ( CX_DRBG_MAX_KEY_LEN + CX_DRBG_BLOCK_LEN )
+
+/** Maximum output length generated alongside the state update */
+#define CX_DRBG_MAX_INLINE_LEN ( 4 * CX_DRBG_BLOCK_LEN )
+
+/** Maximum number of generator kernel lanes */
+#define CX_DRBG_MAX_LANES 16
+
+struct cx_drbg_info;
+
+/** An OpenSSL DRBG context (for the OpenSSL engine) */
+struct cx_drbg_openssl_ctx {
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
 	/** OpenSSL DRBG */
 	RAND_DRBG *drbg;
+#else
+	/** Test entropy source */
+	EVP_RAND_CTX *parent;
+	/** OpenSSL DRBG */
+	EVP_RAND_CTX *rand;
+#endif
+};
+
+/** A DRBG */
+struct cx_drbg {
+	/** DRBG information */
+	const struct cx_drbg_info *info;
+	/** DRBG engine */
+	const struct cx_drbg_engine *engine;
+	/** OpenSSL DRBG context (for the OpenSSL engine) */
+	struct cx_drbg_openssl_ctx openssl;
+	/** Attached per-thread cipher context (for the native engine) */
+	EVP_CIPHER_CTX *ctx;
+	/** Generator kernel (for the native engine, or NULL) */
+	const struct cx_kernel *kernel;
+	/** Generator kernel variant for this DRBG's key length */
+	const struct cx_kernel_variant *variant;
+	/** Single-lane generator kernel variant for this DRBG's key length */
+	const struct cx_kernel_variant *single;
+	/** Key (for the native engine) */
+	unsigned char key[CX_DRBG_MAX_KEY_LEN];
+	/** Counter value (for the native engine) */
+	unsigned char v[CX_DRBG_BLOCK_LEN];
 	/** Entropy input */
 	const void *entropy;
 	/** Length of entropy input */
@@ -60,6 +112,39 @@ struct cx_drbg {
 	unsigned int remaining;
 };
 
+/** Saved DRBG state format version */
+#define CX_DRBG_STATE_VERSION 1
+
+/**
+ * Saved DRBG state
+ *
+ * All fields are byte arrays, so that the layout is independent of
+ * host byte order and structure padding.  No reseed counter is
+ * stored: reseeding is never performed, and so the reseed counter is
+ * fully determined by the remaining iteration count.
+ */
+struct cx_drbg_saved {
+	/** Format version */
+	unsigned char version;
+	/** Generator type */
+	unsigned char type;
+	/** Reserved (must be zero) */
+	unsigned char reserved[2];
+	/** Remaining iteration count (big-endian) */
+	unsigned char remaining[4];
+	/** Key (zero-padded) */
+	unsigned char key[CX_DRBG_MAX_KEY_LEN];
+	/** Counter value */
+	unsigned char v[CX_DRBG_BLOCK_LEN];
+	/** Padding (must be zero) */
+	unsigned char pad[8];
+};
+
+/* Saved DRBG state must exactly fill the public structure */
+_Static_assert ( sizeof ( struct cx_drbg_saved ) ==
+		 sizeof ( struct cx_drbg_state ),
+		 "struct cx_drbg_state size mismatch" );
+
 /** DRBG information */
 struct cx_drbg_info {
 	/** Security strength (in bits) */
@@ -68,6 +153,10 @@ struct cx_drbg_info {
 	int type;
 	/** OpenSSL flags */
 	unsigned int flags;
+	/** Block cipher used by the native engine */
+	const EVP_CIPHER * ( * cipher ) ( void );
+	/** Key length */
+	size_t key_len;
 	/** Fixed entropy length */
 	size_t entropy_len;
 	/** Fixed nonce length */
@@ -76,6 +165,37 @@ struct cx_drbg_info {
 	unsigned int max;
 };
 
+/** A DRBG engine */
+struct cx_drbg_engine {
+	/** Name */
+	const char *name;
+	/**
+	 * Instantiate DRBG
+	 *
+	 * @v drbg		DRBG
+	 * @v personal		Personalization string (or NULL)
+	 * @v personal_len	Length of personalization string
+	 * @ret ok		Success indicator
+	 */
+	int ( * instantiate ) ( struct cx_drbg *drbg, const void *personal,
+				size_t personal_len );
+	/**
+	 * Generate random bytes
+	 *
+	 * @v drbg		DRBG
+	 * @v output		Output buffer
+	 * @v len		Length of output buffer
+	 * @ret ok		Success indicator
+	 */
+	int ( * generate ) ( struct cx_drbg *drbg, void *output, size_t len );
+	/**
+	 * Uninstantiate DRBG
+	 *
+	 * @v drbg		DRBG
+	 */
+	void ( * uninstantiate ) ( struct cx_drbg *drbg );
+};
+
 /******************************************************************************
  *
  * Generator types
@@ -89,6 +209,8 @@ static const struct cx_drbg_info cx_drbg_infos[] = {
 		.strength = 128, /* from NIST SP800-57 */
 		.type = NID_aes_128_ctr,
 		.flags = 0,
+		.cipher = EVP_aes_128_ecb,
+		.key_len = 16,
 		.entropy_len = 16,
 		.nonce_len = 8,
 		.max = 2048,
@@ -97,6 +219,8 @@ static const struct cx_drbg_info cx_drbg_infos[] = {
 		.strength = 256, /* from NIST SP800-57 */
 		.type = NID_aes_256_ctr,
 		.flags = 0,
+		.cipher = EVP_aes_256_ecb,
+		.key_len = 32,
 		.entropy_len = 32,
 		.nonce_len = 16,
 		.max = 2048,
@@ -162,6 +286,184 @@ unsigned int cx_drbg_max_iterations ( enum cx_generator_type type ) {
 	return info->max;
 }
 
+/******************************************************************************
+ *
+ * OpenSSL engine context pool
+ *
+ * Allocating and configuring an OpenSSL DRBG is considerably more
+ * expensive than instantiating it.  Each thread therefore retains
+ * one idle, fully configured OpenSSL DRBG context per generator type,
+ * which is reinstantiated in place by the next OpenSSL engine DRBG of
+ * that type to be instantiated on the same thread.
+ *
+ ******************************************************************************
+ */
+
+/** OpenSSL engine per-thread idle contexts */
+struct cx_drbg_openssl_pool {
+	/** Idle context (if any) for each generator type */
+	struct cx_drbg_openssl_ctx idle[ sizeof ( cx_drbg_infos ) /
+					 sizeof ( cx_drbg_infos[0] ) ];
+};
+
+/** OpenSSL engine per-thread idle context initialisation */
+static CRYPTO_ONCE cx_drbg_openssl_pool_once = CRYPTO_ONCE_STATIC_INIT;
+
+/** OpenSSL engine per-thread idle contexts */
+static CRYPTO_THREAD_LOCAL cx_drbg_openssl_pool_local;
+
+/** OpenSSL engine per-thread idle contexts are available */
+static int cx_drbg_openssl_pool_local_ok;
+
+/**
+ * Free OpenSSL DRBG context
+ *
+ * @v ctx		OpenSSL DRBG context
+ */
+static void cx_drbg_openssl_ctx_free ( struct cx_drbg_openssl_ctx *ctx ) {
+
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+	RAND_DRBG_free ( ctx->drbg );
+#else
+	EVP_RAND_CTX_free ( ctx->rand );
+	EVP_RAND_CTX_free ( ctx->parent );
+#endif
+	memset ( ctx, 0, sizeof ( *ctx ) );
+}
+
+/**
+ * Check if OpenSSL DRBG context is present
+ *
+ * @v ctx		OpenSSL DRBG context
+ * @ret present		Context is present
+ */
+static int cx_drbg_openssl_ctx_present ( struct cx_drbg_openssl_ctx *ctx ) {
+
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+	return ( ctx->drbg != NULL );
+#else
+	return ( ctx->rand != NULL );
+#endif
+}
+
+/**
+ * Free OpenSSL engine per-thread idle contexts
+ *
+ * @v data		Per-thread idle contexts
+ */
+static void cx_drbg_openssl_pool_free ( void *data ) {
+	struct cx_drbg_openssl_pool *pool = data;
+	unsigned int i;
+
+	/* Free idle contexts */
+	for ( i = 0 ; i < ( sizeof ( pool->idle ) /
+			    sizeof ( pool->idle[0] ) ) ; i++ ) {
+		cx_drbg_openssl_ctx_free ( &pool->idle[i] );
+	}
+	free ( pool );
+}
+
+/**
+ * Initialise OpenSSL engine per-thread idle contexts
+ *
+ */
+static void cx_drbg_openssl_pool_init_local ( void ) {
+
+	/* Allocate thread-local storage key */
+	cx_drbg_openssl_pool_local_ok =
+		CRYPTO_THREAD_init_local ( &cx_drbg_openssl_pool_local,
+					   cx_drbg_openssl_pool_free );
+}
+
+/**
+ * Get OpenSSL engine per-thread idle contexts
+ *
+ * @ret pool		Per-thread idle contexts (or NULL on error)
+ */
+static struct cx_drbg_openssl_pool * cx_drbg_openssl_pool ( void ) {
+	struct cx_drbg_openssl_pool *pool;
+
+	/* Initialise thread-local storage */
+	if ( ! CRYPTO_THREAD_run_once ( &cx_drbg_openssl_pool_once,
+					cx_drbg_openssl_pool_init_local ) )
+		return NULL;
+	if ( ! cx_drbg_openssl_pool_local_ok )
+		return NULL;
+
+	/* Get per-thread idle contexts, allocating if necessary */
+	pool = CRYPTO_THREAD_get_local ( &cx_drbg_openssl_pool_local );
+	if ( ! pool ) {
+		pool = calloc ( 1, sizeof ( *pool ) );
+		if ( ! pool )
+			return NULL;
+		if ( ! CRYPTO_THREAD_set_local ( &cx_drbg_openssl_pool_local,
+						 pool ) ) {
+			free ( pool );
+			return NULL;
+		}
+	}
+
+	return pool;
+}
+
+/**
+ * Take idle OpenSSL DRBG context
+ *
+ * @v drbg		DRBG
+ * @ret ok		An idle context was taken
+ *
+ * On success, the DRBG's OpenSSL context is a configured but
+ * uninstantiated context previously released on this thread.
+ */
+static int cx_drbg_openssl_take ( struct cx_drbg *drbg ) {
+	struct cx_drbg_openssl_pool *pool;
+	struct cx_drbg_openssl_ctx *idle;
+
+	/* Get per-thread idle contexts */
+	pool = cx_drbg_openssl_pool();
+	if ( ! pool )
+		return 0;
+
+	/* Take idle context, if any */
+	idle = &pool->idle[ drbg->info - cx_drbg_infos ];
+	if ( ! cx_drbg_openssl_ctx_present ( idle ) )
+		return 0;
+	memcpy ( &drbg->openssl, idle, sizeof ( drbg->openssl ) );
+	memset ( idle, 0, sizeof ( *idle ) );
+
+	return 1;
+}
+
+/**
+ * Release OpenSSL DRBG context
+ *
+ * @v drbg		DRBG
+ *
+ * The DRBG's OpenSSL context must already have been uninstantiated.
+ * It is retained as this thread's idle context for the generator
+ * type if there is not already one, and freed otherwise.
+ */
+static void cx_drbg_openssl_release ( struct cx_drbg *drbg ) {
+	struct cx_drbg_openssl_pool *pool;
+	struct cx_drbg_openssl_ctx *idle;
+
+	/* Retain as idle context, if possible */
+	pool = cx_drbg_openssl_pool();
+	if ( pool ) {
+		idle = &pool->idle[ drbg->info - cx_drbg_infos ];
+		if ( ! cx_drbg_openssl_ctx_present ( idle ) ) {
+			memcpy ( idle, &drbg->openssl, sizeof ( *idle ) );
+			memset ( &drbg->openssl, 0, sizeof ( drbg->openssl ) );
+			return;
+		}
+	}
+
+	/* Otherwise, free context */
+	cx_drbg_openssl_ctx_free ( &drbg->openssl );
+}
+
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+
 /******************************************************************************
  *
  * External data
@@ -172,6 +474,9 @@ unsigned int cx_drbg_max_iterations ( enum cx_generator_type type ) {
  ******************************************************************************
  */
 
+/** External data index initialisation */
+static CRYPTO_ONCE cx_drbg_ex_once = CRYPTO_ONCE_STATIC_INIT;
+
 /** External data index */
 static int cx_drbg_ex_idx = -1;
 
@@ -241,21 +546,32 @@ static void cx_drbg_ex_free ( void *parent, void *ptr, CRYPTO_EX_DATA *ad,
 }
 
 /**
- * Initialise external data
+ * Allocate external data index
  *
- * @ret ok		Success indicator
  */
-static int cx_drbg_ex_init ( void ) {
-
-	/* Do nothing if already initialised */
-	if ( cx_drbg_ex_idx >= 0 )
-		return 1;
+static void cx_drbg_ex_alloc ( void ) {
 
 	/* Allocate external data index */
 	cx_drbg_ex_idx = RAND_DRBG_get_ex_new_index ( 0, NULL, cx_drbg_ex_new,
 						      cx_drbg_ex_dup,
 						      cx_drbg_ex_free );
-	if ( cx_drbg_ex_idx < 0 ) {
+}
+
+/**
+ * Initialise external data
+ *
+ * @ret ok		Success indicator
+ *
+ * This may be called concurrently from multiple threads.  The
+ * external data index is allocated exactly once, and is thereafter
+ * only ever read.
+ */
+static int cx_drbg_ex_init ( void ) {
+
+	/* Allocate external data index on first use */
+	if ( ( ! CRYPTO_THREAD_run_once ( &cx_drbg_ex_once,
+					  cx_drbg_ex_alloc ) ) ||
+	     ( cx_drbg_ex_idx < 0 ) ) {
 		DBG ( "DRBG could not allocate external data index\n" );
 		return 0;
 	}
@@ -306,13 +622,8 @@ static size_t cx_drbg_get_entropy ( RAND_DRBG *rdrbg, unsigned char **pout,
 		return 0;
 	}
 
-	/* Copy predefined entropy */
-	*pout = OPENSSL_secure_malloc ( len );
-	if ( ! *pout ) {
-		DBG ( "DRBG %p could not allocate entropy copy\n", drbg );
-		return 0;
-	}
-	memcpy ( *pout, drbg->entropy, len );
+	/* Use predefined entropy directly (OpenSSL will not modify it) */
+	*pout = ( ( unsigned char * ) drbg->entropy );
 
 	/* Mark entropy as consumed */
 	drbg->entropy_len = 0;
@@ -331,8 +642,8 @@ static void cx_drbg_cleanup_entropy ( RAND_DRBG *rdrbg, unsigned char *out,
 				      size_t outlen ) {
 	struct cx_drbg *drbg = RAND_DRBG_get_ex_data ( rdrbg, cx_drbg_ex_idx );
 
-	/* Zero and free copy of entropy */
-	OPENSSL_secure_clear_free ( out, outlen );
+	( void ) out;
+	( void ) outlen;
 
 	/* Mark entropy as consumed */
 	drbg->entropy_len = 0;
@@ -369,13 +680,8 @@ static size_t cx_drbg_get_nonce ( RAND_DRBG *rdrbg, unsigned char **pout,
 		return 0;
 	}
 
-	/* Copy predefined nonce */
-	*pout = OPENSSL_secure_malloc ( len );
-	if ( ! *pout ) {
-		DBG ( "DRBG %p could not allocate nonce copy\n", drbg );
-		return 0;
-	}
-	memcpy ( *pout, drbg->nonce, len );
+	/* Use predefined nonce directly (OpenSSL will not modify it) */
+	*pout = ( ( unsigned char * ) drbg->nonce );
 
 	/* Mark nonce as consumed */
 	drbg->nonce_len = 0;
@@ -394,8 +700,8 @@ static void cx_drbg_cleanup_nonce ( RAND_DRBG *rdrbg, unsigned char *out,
 				    size_t outlen ) {
 	struct cx_drbg *drbg = RAND_DRBG_get_ex_data ( rdrbg, cx_drbg_ex_idx );
 
-	/* Zero and free copy of nonce */
-	OPENSSL_secure_clear_free ( out, outlen );
+	( void ) out;
+	( void ) outlen;
 
 	/* Mark nonce as consumed */
 	drbg->nonce_len = 0;
@@ -403,174 +709,1405 @@ static void cx_drbg_cleanup_nonce ( RAND_DRBG *rdrbg, unsigned char *out,
 
 /******************************************************************************
  *
- * External API
+ * OpenSSL engine (OpenSSL 1.1)
+ *
+ * The OpenSSL engine drives an OpenSSL RAND_DRBG instance, injecting
+ * the fixed entropy input and nonce via callbacks.
  *
  ******************************************************************************
  */
 
 /**
- * Instantiate DRBG with explicitly split entropy, nonce, and personalization
+ * Allocate and configure OpenSSL DRBG context
  *
- * @v type		Generator type
- * @v entropy		Entropy input (or NULL to use system entropy source)
- * @v entropy_len	Length of entropy input
- * @v nonce		Nonce (or NULL to use system entropy source)
- * @v nonce_len		Length of nonce
- * @v personal		Personalization string (or NULL to use no string)
- * @v personal_len	Length of personalization string
- * @ret drbg		DRBG (or NULL on error)
+ * @v drbg		DRBG
+ * @ret ok		Success indicator
  */
-struct cx_drbg * cx_drbg_instantiate_split ( enum cx_generator_type type,
-					     const void *entropy,
-					     size_t entropy_len,
-					     const void *nonce,
-					     size_t nonce_len,
-					     const void *personal,
-					     size_t personal_len ) {
-	const struct cx_drbg_info *info;
-	struct cx_drbg *drbg;
+static int cx_drbg_openssl_new ( struct cx_drbg *drbg ) {
+	const struct cx_drbg_info *info = drbg->info;
+	RAND_DRBG *rdrbg;
 
-	/* Validate parameter combinations */
-	if ( entropy_len && ! entropy ) {
-		DBG ( "DRBG invalid NULL entropy len %zd\n", entropy_len );
-		goto err_sanity;
-	}
-	if ( nonce_len && ! nonce ) {
-		DBG ( "DRBG invalid NULL nonce len %zd\n", nonce_len );
-		goto err_sanity;
+	/* Allocate OpenSSL DRBG */
+	rdrbg = RAND_DRBG_new ( info->type, info->flags, NULL );
+	if ( ! rdrbg ) {
+		DBG ( "DRBG %p could not allocate\n", drbg );
+		goto err_new;
 	}
-	if ( personal_len && ! personal ) {
-		DBG ( "DRBG invalid NULL personalization len %zd\n",
-		      personal_len );
-		goto err_sanity;
+
+	/* Disable reseeding */
+	if ( ! RAND_DRBG_set_reseed_interval ( rdrbg, 0 ) ) {
+		DBG ( "DRBG %p could not set reseed interval\n", drbg );
+		goto err_set_reseed_interval;
 	}
-	if ( entropy && ! nonce ) {
-		DBG ( "DRBG invalid entropy without nonce\n" );
-		goto err_sanity;
+	if ( ! RAND_DRBG_set_reseed_time_interval ( rdrbg, 0 ) ) {
+		DBG ( "DRBG %p could not set reseed time interval\n", drbg );
+		goto err_set_reseed_time_interval;
 	}
-	if ( nonce && ! entropy ) {
-		DBG ( "DRBG invalid nonce without entropy\n" );
-		goto err_sanity;
+
+	/* Inject entropy input and nonce via callbacks */
+	if ( ! RAND_DRBG_set_callbacks ( rdrbg, cx_drbg_get_entropy,
+					 cx_drbg_cleanup_entropy,
+					 cx_drbg_get_nonce,
+					 cx_drbg_cleanup_nonce ) ) {
+		DBG ( "DRBG %p could not set callbacks\n", drbg );
+		goto err_set_callbacks;
 	}
 
-	/* Identify Generator type */
-	info = cx_drbg_info ( type );
-	if ( ! info )
-		goto err_info;
+	drbg->openssl.drbg = rdrbg;
+	return 1;
+
+ err_set_callbacks:
+ err_set_reseed_time_interval:
+ err_set_reseed_interval:
+	RAND_DRBG_free ( rdrbg );
+ err_new:
+	return 0;
+}
+
+/**
+ * Instantiate DRBG using OpenSSL engine
+ *
+ * @v drbg		DRBG
+ * @v personal		Personalization string (or NULL)
+ * @v personal_len	Length of personalization string
+ * @ret ok		Success indicator
+ */
+static int cx_drbg_openssl_instantiate ( struct cx_drbg *drbg,
+					 const void *personal,
+					 size_t personal_len ) {
+	const struct cx_drbg_info *info = drbg->info;
+	unsigned char fresh[CX_DRBG_MAX_SEED_LEN];
 
 	/* Initialise external data */
 	if ( ! cx_drbg_ex_init() )
 		goto err_ex_init;
 
-	/* Allocate DRBG */
-	drbg = malloc ( sizeof ( *drbg ) );
-	if ( ! drbg ) {
-		DBG ( "DRBG out of memory\n" );
-		goto err_alloc;
+	/* Use system entropy source if no entropy input was provided */
+	if ( ! drbg->entropy ) {
+		if ( RAND_priv_bytes ( fresh, ( info->entropy_len +
+						info->nonce_len ) ) != 1 ) {
+			DBG ( "DRBG %p could not obtain fresh entropy\n",
+			      drbg );
+			goto err_fresh;
+		}
+		drbg->entropy = fresh;
+		drbg->entropy_len = info->entropy_len;
+		drbg->nonce = &fresh[info->entropy_len];
+		drbg->nonce_len = info->nonce_len;
 	}
-	memset ( drbg, 0, sizeof ( *drbg ) );
-	drbg->entropy = entropy;
-	drbg->entropy_len = entropy_len;
-	drbg->nonce = nonce;
-	drbg->nonce_len = nonce_len;
-	drbg->remaining = info->max;
 
-	/* Allocate OpenSSL DRBG */
-	drbg->drbg = RAND_DRBG_new ( info->type, info->flags, NULL );
-	if ( ! drbg->drbg ) {
-		DBG ( "DRBG %p could not allocate\n", drbg );
+	/* Reuse an idle OpenSSL DRBG, or allocate a new one */
+	if ( ( ! cx_drbg_openssl_take ( drbg ) ) &&
+	     ( ! cx_drbg_openssl_new ( drbg ) ) ) {
 		goto err_new;
 	}
 
 	/* Set external data */
-	if ( ! RAND_DRBG_set_ex_data ( drbg->drbg, cx_drbg_ex_idx, drbg ) ) {
+	if ( ! RAND_DRBG_set_ex_data ( drbg->openssl.drbg, cx_drbg_ex_idx,
+				       drbg ) ) {
 		DBG ( "DRBG %p could not set external data\n", drbg );
 		goto err_set_ex_data;
 	}
 
-	/* Disable reseeding */
-	if ( ! RAND_DRBG_set_reseed_interval ( drbg->drbg, 0 ) ) {
-		DBG ( "DRBG %p could not set reseed interval\n", drbg );
-		goto err_set_reseed_interval;
-	}
-	if ( ! RAND_DRBG_set_reseed_time_interval ( drbg->drbg, 0 ) ) {
-		DBG ( "DRBG %p could not set reseed time interval\n", drbg );
-		goto err_set_reseed_time_interval;
-	}
-
-	/* Prepare for instantiation */
-	if ( entropy ) {
-		if ( ! RAND_DRBG_set_callbacks ( drbg->drbg,
-						 cx_drbg_get_entropy,
-						 cx_drbg_cleanup_entropy,
-						 cx_drbg_get_nonce,
-						 cx_drbg_cleanup_nonce ) ) {
-			DBG ( "DRBG %p could not set callbacks\n", drbg );
-			goto err_set_callbacks;
-		}
-	}
-
 	/* Instantiate DRBG */
-	if ( ! RAND_DRBG_instantiate ( drbg->drbg, personal, personal_len ) ) {
+	if ( ! RAND_DRBG_instantiate ( drbg->openssl.drbg, personal,
+				       personal_len ) ) {
 		DBG ( "DRBG %p could not instantiate\n", drbg );
 		goto err_instantiate;
 	}
 
-	/* Clear any unconsumed entropy or nonce */
-	drbg->entropy = NULL;
-	drbg->entropy_len = 0;
-	drbg->nonce = NULL;
-	drbg->nonce_len = 0;
-
-	return drbg;
+	OPENSSL_cleanse ( fresh, sizeof ( fresh ) );
+	return 1;
 
-	RAND_DRBG_uninstantiate ( drbg->drbg );
+	RAND_DRBG_uninstantiate ( drbg->openssl.drbg );
  err_instantiate:
- err_set_callbacks:
- err_set_reseed_time_interval:
- err_set_reseed_interval:
  err_set_ex_data:
-	RAND_DRBG_free ( drbg->drbg );
+	cx_drbg_openssl_ctx_free ( &drbg->openssl );
  err_new:
-	free ( drbg );
- err_alloc:
+ err_fresh:
+	OPENSSL_cleanse ( fresh, sizeof ( fresh ) );
  err_ex_init:
- err_info:
- err_sanity:
-	return NULL;
+	return 0;
 }
 
 /**
- * Instantiate DRBG with fixed-length input and optional verification key
+ * Generate random bytes using OpenSSL engine
  *
- * @v type		Generator type
- * @v input		Combined entropy and nonce input
- * @v len		Combined entropy and nonce input length
- * @v key		Verification key (or NULL)
- * @ret drbg		DRBG (or NULL on error)
+ * @v drbg		DRBG
+ * @v output		Output buffer
+ * @v len		Length of output buffer
+ * @ret ok		Success indicator
  */
-struct cx_drbg * cx_drbg_instantiate ( enum cx_generator_type type,
-				       const void *input, size_t len,
-				       EVP_PKEY *key ) {
-	const struct cx_drbg_info *info;
-	struct cx_drbg *drbg;
-	const void *entropy;
-	const void *nonce;
-	size_t expected_len;
-	unsigned char *personal;
-	int personal_len;
+static int cx_drbg_openssl_generate ( struct cx_drbg *drbg, void *output,
+				      size_t len ) {
 
-	/* Identify Generator type */
-	info = cx_drbg_info ( type );
-	if ( ! info )
-		return NULL;
+	/* Generate random bytes */
+	return RAND_DRBG_generate ( drbg->openssl.drbg, output, len, 0,
+				    NULL, 0 );
+}
 
-	/* Validity checks */
-	expected_len = ( info->entropy_len + info->nonce_len );
-	if ( len != expected_len ) {
-		DBG ( "DRBG type %d incorrect length (%zd bytes, expected "
-		      "%zd bytes)\n", type, len, expected_len );
-		return NULL;
+/**
+ * Uninstantiate DRBG using OpenSSL engine
+ *
+ * @v drbg		DRBG
+ */
+static void cx_drbg_openssl_uninstantiate ( struct cx_drbg *drbg ) {
+
+	/* Uninstantiate DRBG, discarding the context on failure since
+	 * its state is then unknown.
+	 */
+	if ( ! RAND_DRBG_uninstantiate ( drbg->openssl.drbg ) ) {
+		DBG ( "DRBG %p could not uninstantiate\n", drbg );
+		cx_drbg_openssl_ctx_free ( &drbg->openssl );
+		return;
+	}
+
+	/* Retain context for reuse */
+	cx_drbg_openssl_release ( drbg );
+}
+
+/** OpenSSL engine */
+static const struct cx_drbg_engine cx_drbg_openssl = {
+	.name = "openssl",
+	.instantiate = cx_drbg_openssl_instantiate,
+	.generate = cx_drbg_openssl_generate,
+	.uninstantiate = cx_drbg_openssl_uninstantiate,
+};
+
+#else /* OPENSSL_VERSION_NUMBER */
+
+/******************************************************************************
+ *
+ * OpenSSL engine (OpenSSL 3)
+ *
+ * The OpenSSL engine drives an OpenSSL EVP_RAND CTR_DRBG instance,
+ * injecting the fixed entropy input and nonce via a parent instance
+ * of the TEST-RAND entropy source.
+ *
+ * Provider algorithm lookups are comparatively expensive, and so the
+ * CTR_DRBG and TEST-RAND algorithms and the underlying block ciphers
+ * are fetched once per process and reused for all DRBGs.
+ *
+ ******************************************************************************
+ */
+
+/** OpenSSL engine algorithm fetch */
+static CRYPTO_ONCE cx_drbg_openssl_once = CRYPTO_ONCE_STATIC_INIT;
+
+/** OpenSSL engine CTR_DRBG algorithm */
+static EVP_RAND *cx_drbg_openssl_ctr;
+
+/** OpenSSL engine test entropy source algorithm */
+static EVP_RAND *cx_drbg_openssl_test;
+
+/** OpenSSL engine block ciphers (for each generator type) */
+static EVP_CIPHER *cx_drbg_openssl_ciphers[ sizeof ( cx_drbg_infos ) /
+					    sizeof ( cx_drbg_infos[0] ) ];
+
+/**
+ * Fetch OpenSSL engine algorithms
+ *
+ */
+static void cx_drbg_openssl_fetch ( void ) {
+	const struct cx_drbg_info *info;
+	unsigned int i;
+
+	/* Fetch DRBG algorithms */
+	cx_drbg_openssl_ctr = EVP_RAND_fetch ( NULL, "CTR-DRBG", NULL );
+	cx_drbg_openssl_test = EVP_RAND_fetch ( NULL, "TEST-RAND", NULL );
+
+	/* Fetch block ciphers */
+	for ( i = 0 ; i < ( sizeof ( cx_drbg_infos ) /
+			    sizeof ( cx_drbg_infos[0] ) ) ; i++ ) {
+		info = &cx_drbg_infos[i];
+		if ( ! info->strength )
+			continue;
+		cx_drbg_openssl_ciphers[i] =
+			EVP_CIPHER_fetch ( NULL, OBJ_nid2sn ( info->type ),
+					   NULL );
+	}
+}
+
+/**
+ * Allocate and configure OpenSSL DRBG context
+ *
+ * @v drbg		DRBG
+ * @ret ok		Success indicator
+ */
+static int cx_drbg_openssl_new ( struct cx_drbg *drbg ) {
+	const struct cx_drbg_info *info = drbg->info;
+	unsigned int strength = info->strength;
+	unsigned int reseed_requests = 0;
+	time_t reseed_time_interval = 0;
+	int use_df = 1;
+	const EVP_CIPHER *cipher;
+	EVP_RAND_CTX *parent;
+	EVP_RAND_CTX *rand;
+	OSSL_PARAM params[5];
+	OSSL_PARAM *param;
+
+	/* Fetch algorithms */
+	if ( ! CRYPTO_THREAD_run_once ( &cx_drbg_openssl_once,
+					cx_drbg_openssl_fetch ) ) {
+		DBG ( "DRBG %p could not fetch algorithms\n", drbg );
+		goto err_fetch;
+	}
+	cipher = cx_drbg_openssl_ciphers[ info - cx_drbg_infos ];
+	if ( ( ! cx_drbg_openssl_ctr ) || ( ! cx_drbg_openssl_test ) ||
+	     ( ! cipher ) ) {
+		DBG ( "DRBG %p algorithms unavailable\n", drbg );
+		goto err_fetch;
+	}
+
+	/* Create test entropy source.  The entropy input and nonce
+	 * are provided separately for each instantiation.
+	 */
+	parent = EVP_RAND_CTX_new ( cx_drbg_openssl_test, NULL );
+	if ( ! parent ) {
+		DBG ( "DRBG %p could not allocate entropy source\n", drbg );
+		goto err_parent_new;
+	}
+	param = params;
+	*(param++) = OSSL_PARAM_construct_uint ( OSSL_RAND_PARAM_STRENGTH,
+						 &strength );
+	*param = OSSL_PARAM_construct_end();
+	if ( ! EVP_RAND_CTX_set_params ( parent, params ) ) {
+		DBG ( "DRBG %p could not set entropy source\n", drbg );
+		goto err_parent_params;
+	}
+	if ( ! EVP_RAND_instantiate ( parent, strength, 0, NULL, 0, NULL ) ) {
+		DBG ( "DRBG %p could not instantiate entropy source\n",
+		      drbg );
+		goto err_parent_instantiate;
+	}
+
+	/* Create OpenSSL DRBG */
+	rand = EVP_RAND_CTX_new ( cx_drbg_openssl_ctr, parent );
+	if ( ! rand ) {
+		DBG ( "DRBG %p could not allocate\n", drbg );
+		goto err_new;
+	}
+
+	/* Select cipher and disable reseeding */
+	param = params;
+	*(param++) = OSSL_PARAM_construct_utf8_string (
+		OSSL_DRBG_PARAM_CIPHER,
+		( ( char * ) EVP_CIPHER_get0_name ( cipher ) ), 0 );
+	*(param++) = OSSL_PARAM_construct_int ( OSSL_DRBG_PARAM_USE_DF,
+						&use_df );
+	*(param++) = OSSL_PARAM_construct_uint (
+		OSSL_DRBG_PARAM_RESEED_REQUESTS, &reseed_requests );
+	*(param++) = OSSL_PARAM_construct_time_t (
+		OSSL_DRBG_PARAM_RESEED_TIME_INTERVAL, &reseed_time_interval );
+	*param = OSSL_PARAM_construct_end();
+	if ( ! EVP_RAND_CTX_set_params ( rand, params ) ) {
+		DBG ( "DRBG %p could not set parameters\n", drbg );
+		goto err_params;
+	}
+
+	drbg->openssl.parent = parent;
+	drbg->openssl.rand = rand;
+	return 1;
+
+ err_params:
+	EVP_RAND_CTX_free ( rand );
+ err_new:
+ err_parent_instantiate:
+ err_parent_params:
+	EVP_RAND_CTX_free ( parent );
+ err_parent_new:
+ err_fetch:
+	return 0;
+}
+
+/**
+ * Instantiate DRBG using OpenSSL engine
+ *
+ * @v drbg		DRBG
+ * @v personal		Personalization string (or NULL)
+ * @v personal_len	Length of personalization string
+ * @ret ok		Success indicator
+ */
+static int cx_drbg_openssl_instantiate ( struct cx_drbg *drbg,
+					 const void *personal,
+					 size_t personal_len ) {
+	const struct cx_drbg_info *info = drbg->info;
+	unsigned char fresh[CX_DRBG_MAX_SEED_LEN];
+	OSSL_PARAM params[3];
+	OSSL_PARAM *param;
+
+	/* Use system entropy source if no entropy input was provided */
+	if ( ! drbg->entropy ) {
+		if ( RAND_priv_bytes ( fresh, ( info->entropy_len +
+						info->nonce_len ) ) != 1 ) {
+			DBG ( "DRBG %p could not obtain fresh entropy\n",
+			      drbg );
+			goto err_fresh;
+		}
+		drbg->entropy = fresh;
+		drbg->entropy_len = info->entropy_len;
+		drbg->nonce = &fresh[info->entropy_len];
+		drbg->nonce_len = info->nonce_len;
+	}
+
+	/* Reuse an idle OpenSSL DRBG, or allocate a new one */
+	if ( ( ! cx_drbg_openssl_take ( drbg ) ) &&
+	     ( ! cx_drbg_openssl_new ( drbg ) ) ) {
+		goto err_new;
+	}
+
+	/* Provide entropy input and nonce */
+	param = params;
+	*(param++) = OSSL_PARAM_construct_octet_string (
+		OSSL_RAND_PARAM_TEST_ENTROPY, ( ( void * ) drbg->entropy ),
+		drbg->entropy_len );
+	*(param++) = OSSL_PARAM_construct_octet_string (
+		OSSL_RAND_PARAM_TEST_NONCE, ( ( void * ) drbg->nonce ),
+		drbg->nonce_len );
+	*param = OSSL_PARAM_construct_end();
+	if ( ! EVP_RAND_CTX_set_params ( drbg->openssl.parent, params ) ) {
+		DBG ( "DRBG %p could not set entropy source\n", drbg );
+		goto err_parent_params;
+	}
+
+	/* Instantiate DRBG.  OpenSSL substitutes a default
+	 * personalization string if none is provided, and so an empty
+	 * string must be passed explicitly.
+	 */
+	if ( ! personal )
+		personal = "";
+	if ( ! EVP_RAND_instantiate ( drbg->openssl.rand, info->strength, 0,
+				      personal, personal_len, NULL ) ) {
+		DBG ( "DRBG %p could not instantiate\n", drbg );
+		goto err_instantiate;
+	}
+
+	/* Mark entropy input and nonce as consumed */
+	drbg->entropy_len = 0;
+	drbg->nonce_len = 0;
+
+	OPENSSL_cleanse ( fresh, sizeof ( fresh ) );
+	return 1;
+
+	EVP_RAND_uninstantiate ( drbg->openssl.rand );
+ err_instantiate:
+ err_parent_params:
+	cx_drbg_openssl_ctx_free ( &drbg->openssl );
+ err_new:
+ err_fresh:
+	OPENSSL_cleanse ( fresh, sizeof ( fresh ) );
+	return 0;
+}
+
+/**
+ * Generate random bytes using OpenSSL engine
+ *
+ * @v drbg		DRBG
+ * @v output		Output buffer
+ * @v len		Length of output buffer
+ * @ret ok		Success indicator
+ */
+static int cx_drbg_openssl_generate ( struct cx_drbg *drbg, void *output,
+				      size_t len ) {
+
+	/* Generate random bytes */
+	return EVP_RAND_generate ( drbg->openssl.rand, output, len,
+				   drbg->info->strength, 0, NULL, 0 );
+}
+
+/**
+ * Uninstantiate DRBG using OpenSSL engine
+ *
+ * @v drbg		DRBG
+ */
+static void cx_drbg_openssl_uninstantiate ( struct cx_drbg *drbg ) {
+
+	/* Uninstantiate DRBG, discarding the context on failure since
+	 * its state is then unknown.
+	 */
+	if ( ! EVP_RAND_uninstantiate ( drbg->openssl.rand ) ) {
+		DBG ( "DRBG %p could not uninstantiate\n", drbg );
+		cx_drbg_openssl_ctx_free ( &drbg->openssl );
+		return;
+	}
+
+	/* Retain context for reuse */
+	cx_drbg_openssl_release ( drbg );
+}
+
+/** OpenSSL engine */
+static const struct cx_drbg_engine cx_drbg_openssl = {
+	.name = "openssl",
+	.instantiate = cx_drbg_openssl_instantiate,
+	.generate = cx_drbg_openssl_generate,
+	.uninstantiate = cx_drbg_openssl_uninstantiate,
+};
+
+#endif /* OPENSSL_VERSION_NUMBER */
+
+/******************************************************************************
+ *
+ * Native engine
+ *
+ * The native engine implements CTR_DRBG (with derivation function)
+ * as defined in NIST SP800-90A directly on top of an AES-ECB cipher
+ * context, avoiding the locking, reseed checks, and callback
+ * machinery of the generic OpenSSL DRBG.  The output is identical to
+ * that of the OpenSSL engine.
+ *
+ ******************************************************************************
+ */
+
+/** Block cipher chaining state for the derivation function */
+struct cx_drbg_bcc {
+	/** Chaining value */
+	unsigned char chain[CX_DRBG_BLOCK_LEN];
+	/** Number of bytes accumulated into chaining value */
+	size_t fill;
+};
+
+/** Native engine per-thread cipher contexts */
+struct cx_drbg_native_ctxs {
+	/** Cipher context for each generator type */
+	EVP_CIPHER_CTX *ctx[ sizeof ( cx_drbg_infos ) /
+			     sizeof ( cx_drbg_infos[0] ) ];
+};
+
+/** Native engine per-thread cipher context initialisation */
+static CRYPTO_ONCE cx_drbg_native_once = CRYPTO_ONCE_STATIC_INIT;
+
+/** Native engine per-thread cipher contexts */
+static CRYPTO_THREAD_LOCAL cx_drbg_native_local;
+
+/** Native engine per-thread cipher contexts are available */
+static int cx_drbg_native_local_ok;
+
+/**
+ * Free native engine per-thread cipher contexts
+ *
+ * @v data		Per-thread cipher contexts
+ */
+static void cx_drbg_native_ctxs_free ( void *data ) {
+	struct cx_drbg_native_ctxs *ctxs = data;
+	unsigned int i;
+
+	/* Free cipher contexts */
+	for ( i = 0 ; i < ( sizeof ( ctxs->ctx ) /
+			    sizeof ( ctxs->ctx[0] ) ) ; i++ ) {
+		EVP_CIPHER_CTX_free ( ctxs->ctx[i] );
+	}
+	free ( ctxs );
+}
+
+/**
+ * Initialise native engine per-thread cipher contexts
+ *
+ */
+static void cx_drbg_native_init_local ( void ) {
+
+	/* Allocate thread-local storage key */
+	cx_drbg_native_local_ok =
+		CRYPTO_THREAD_init_local ( &cx_drbg_native_local,
+					   cx_drbg_native_ctxs_free );
+}
+
+/**
+ * Attach native engine cipher context
+ *
+ * @v drbg		DRBG
+ * @ret ok		Success indicator
+ *
+ * The native engine holds no cipher context of its own.  Each thread
+ * lazily allocates one cipher context per generator type, which is
+ * then rekeyed as needed by every native DRBG used on that thread.
+ * Instantiating, using, and uninstantiating a native DRBG therefore
+ * never touches the allocator after the first use on each thread.
+ */
+static int cx_drbg_native_attach ( struct cx_drbg *drbg ) {
+	const struct cx_drbg_info *info = drbg->info;
+	struct cx_drbg_native_ctxs *ctxs;
+	EVP_CIPHER_CTX **ctx;
+
+	/* Initialise thread-local storage */
+	if ( ( ! CRYPTO_THREAD_run_once ( &cx_drbg_native_once,
+					  cx_drbg_native_init_local ) ) ||
+	     ( ! cx_drbg_native_local_ok ) ) {
+		DBG ( "DRBG %p could not initialise thread-local storage\n",
+		      drbg );
+		return 0;
+	}
+
+	/* Get per-thread cipher contexts, allocating if necessary */
+	ctxs = CRYPTO_THREAD_get_local ( &cx_drbg_native_local );
+	if ( ! ctxs ) {
+		ctxs = calloc ( 1, sizeof ( *ctxs ) );
+		if ( ! ctxs ) {
+			DBG ( "DRBG %p could not allocate cipher contexts\n",
+			      drbg );
+			return 0;
+		}
+		if ( ! CRYPTO_THREAD_set_local ( &cx_drbg_native_local,
+						 ctxs ) ) {
+			DBG ( "DRBG %p could not set cipher contexts\n",
+			      drbg );
+			free ( ctxs );
+			return 0;
+		}
+	}
+
+	/* Get cipher context for this generator type, allocating if
+	 * necessary.
+	 */
+	ctx = &ctxs->ctx[ info - cx_drbg_infos ];
+	if ( ! *ctx ) {
+		*ctx = EVP_CIPHER_CTX_new();
+		if ( ! *ctx ) {
+			DBG ( "DRBG %p could not allocate cipher context\n",
+			      drbg );
+			return 0;
+		}
+		if ( ! EVP_EncryptInit_ex ( *ctx, info->cipher(), NULL, NULL,
+					    NULL ) ) {
+			DBG ( "DRBG %p could not initialise cipher\n", drbg );
+			EVP_CIPHER_CTX_free ( *ctx );
+			*ctx = NULL;
+			return 0;
+		}
+		EVP_CIPHER_CTX_set_padding ( *ctx, 0 );
+	}
+	drbg->ctx = *ctx;
+
+	return 1;
+}
+
+/**
+ * Set key for native engine block cipher
+ *
+ * @v drbg		DRBG
+ * @v key		Key
+ * @ret ok		Success indicator
+ */
+static int cx_drbg_native_key ( struct cx_drbg *drbg,
+				const unsigned char *key ) {
+
+	/* Set key */
+	if ( ! EVP_EncryptInit_ex ( drbg->ctx, NULL, NULL, key, NULL ) ) {
+		DBG ( "DRBG %p could not set key\n", drbg );
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Encrypt blocks using native engine block cipher
+ *
+ * @v drbg		DRBG
+ * @v data		Data to encrypt in place
+ * @v len		Length of data (must be a multiple of the block size)
+ * @ret ok		Success indicator
+ */
+static int cx_drbg_native_encrypt ( struct cx_drbg *drbg, unsigned char *data,
+				    size_t len ) {
+	int out_len;
+
+	/* Encrypt data */
+	if ( ( ! EVP_EncryptUpdate ( drbg->ctx, data, &out_len, data,
+				     len ) ) ||
+	     ( ( ( size_t ) out_len ) != len ) ) {
+		DBG ( "DRBG %p could not encrypt %zd bytes\n", drbg, len );
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Accumulate data into derivation function chaining state
+ *
+ * @v drbg		DRBG
+ * @v bcc		Chaining state
+ * @v data		Data
+ * @v len		Length of data
+ * @ret ok		Success indicator
+ */
+static int cx_drbg_native_bcc ( struct cx_drbg *drbg, struct cx_drbg_bcc *bcc,
+				const void *data, size_t len ) {
+	const unsigned char *bytes = data;
+
+	/* Accumulate data, encrypting each completed block */
+	while ( len-- ) {
+		bcc->chain[bcc->fill++] ^= *(bytes++);
+		if ( bcc->fill < sizeof ( bcc->chain ) )
+			continue;
+		if ( ! cx_drbg_native_encrypt ( drbg, bcc->chain,
+						sizeof ( bcc->chain ) ) )
+			return 0;
+		bcc->fill = 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Apply block cipher derivation function
+ *
+ * @v drbg		DRBG
+ * @v personal		Personalization string (or NULL)
+ * @v personal_len	Length of personalization string
+ * @v out		Seed material to fill in
+ * @ret ok		Success indicator
+ *
+ * The derivation function input is the concatenation of the entropy
+ * input, the nonce, and the personalization string.
+ */
+static int cx_drbg_native_df ( struct cx_drbg *drbg, const void *personal,
+			       size_t personal_len, unsigned char *out ) {
+	static const unsigned char pad = 0x80;
+	const struct cx_drbg_info *info = drbg->info;
+	size_t seed_len = ( info->key_len + CX_DRBG_BLOCK_LEN );
+	unsigned char temp[CX_DRBG_MAX_SEED_LEN];
+	unsigned char key[CX_DRBG_MAX_KEY_LEN];
+	unsigned char prefix[CX_DRBG_BLOCK_LEN + 8];
+	struct cx_drbg_bcc bcc;
+	size_t input_len;
+	size_t offset;
+	unsigned int i;
+	int ok = 0;
+
+	/* Construct IV || L || N prefix */
+	input_len = ( drbg->entropy_len + drbg->nonce_len + personal_len );
+	memset ( prefix, 0, sizeof ( prefix ) );
+	prefix[CX_DRBG_BLOCK_LEN + 0] = ( input_len >> 24 );
+	prefix[CX_DRBG_BLOCK_LEN + 1] = ( input_len >> 16 );
+	prefix[CX_DRBG_BLOCK_LEN + 2] = ( input_len >> 8 );
+	prefix[CX_DRBG_BLOCK_LEN + 3] = ( input_len >> 0 );
+	prefix[CX_DRBG_BLOCK_LEN + 7] = seed_len;
+
+	/* Use fixed key 0x00010203... for BCC */
+	for ( i = 0 ; i < info->key_len ; i++ )
+		key[i] = i;
+	if ( ! cx_drbg_native_key ( drbg, key ) )
+		goto err;
+
+	/* Calculate BCC ( K, IV || S ) for each required block */
+	for ( offset = 0, i = 0 ; offset < seed_len ;
+	      offset += CX_DRBG_BLOCK_LEN, i++ ) {
+		memset ( &bcc, 0, sizeof ( bcc ) );
+		prefix[3] = i;
+		if ( ! ( cx_drbg_native_bcc ( drbg, &bcc, prefix,
+					      sizeof ( prefix ) ) &&
+			 cx_drbg_native_bcc ( drbg, &bcc, drbg->entropy,
+					      drbg->entropy_len ) &&
+			 cx_drbg_native_bcc ( drbg, &bcc, drbg->nonce,
+					      drbg->nonce_len ) &&
+			 cx_drbg_native_bcc ( drbg, &bcc, personal,
+					      personal_len ) &&
+			 cx_drbg_native_bcc ( drbg, &bcc, &pad,
+					      sizeof ( pad ) ) ) ) {
+			goto err;
+		}
+		if ( bcc.fill && ( ! cx_drbg_native_encrypt ( drbg, bcc.chain,
+						sizeof ( bcc.chain ) ) ) ) {
+			goto err;
+		}
+		memcpy ( &temp[offset], bcc.chain, sizeof ( bcc.chain ) );
+	}
+
+	/* Generate output using derived key K and initial block X */
+	if ( ! cx_drbg_native_key ( drbg, temp ) )
+		goto err;
+	memcpy ( out, &temp[info->key_len], CX_DRBG_BLOCK_LEN );
+	if ( ! cx_drbg_native_encrypt ( drbg, out, CX_DRBG_BLOCK_LEN ) )
+		goto err;
+	for ( offset = CX_DRBG_BLOCK_LEN ; offset < seed_len ;
+	      offset += CX_DRBG_BLOCK_LEN ) {
+		memcpy ( &out[offset], &out[ offset - CX_DRBG_BLOCK_LEN ],
+			 CX_DRBG_BLOCK_LEN );
+		if ( ! cx_drbg_native_encrypt ( drbg, &out[offset],
+						CX_DRBG_BLOCK_LEN ) ) {
+			goto err;
+		}
+	}
+
+	ok = 1;
+ err:
+	OPENSSL_cleanse ( &bcc, sizeof ( bcc ) );
+	OPENSSL_cleanse ( temp, sizeof ( temp ) );
+	return ok;
+}
+
+/**
+ * Generate counter mode blocks using native engine
+ *
+ * @v drbg		DRBG
+ * @v out		Output buffer
+ * @v len		Length of output buffer (a multiple of the block size)
+ * @ret ok		Success indicator
+ *
+ * The counter value V is incremented before generating each block.
+ */
+static int cx_drbg_native_ctr ( struct cx_drbg *drbg, unsigned char *out,
+				size_t len ) {
+	unsigned char *v = drbg->v;
+	size_t offset;
+	unsigned int i;
+
+	/* Construct counter blocks */
+	for ( offset = 0 ; offset < len ; offset += CX_DRBG_BLOCK_LEN ) {
+		for ( i = CX_DRBG_BLOCK_LEN ; i-- && ( ++v[i] == 0 ) ; ) {}
+		memcpy ( &out[offset], v, CX_DRBG_BLOCK_LEN );
+	}
+
+	/* Encrypt counter blocks */
+	return cx_drbg_native_encrypt ( drbg, out, len );
+}
+
+/**
+ * Update native engine state
+ *
+ * @v drbg		DRBG
+ * @v temp		Encrypted counter blocks (of length seed length)
+ */
+static void cx_drbg_native_update ( struct cx_drbg *drbg,
+				    const unsigned char *temp ) {
+	const struct cx_drbg_info *info = drbg->info;
+
+	/* Update key and counter value */
+	memcpy ( drbg->key, temp, info->key_len );
+	memcpy ( drbg->v, &temp[info->key_len], CX_DRBG_BLOCK_LEN );
+}
+
+/**
+ * Instantiate DRBG using native engine
+ *
+ * @v drbg		DRBG
+ * @v personal		Personalization string (or NULL)
+ * @v personal_len	Length of personalization string
+ * @ret ok		Success indicator
+ */
+static int cx_drbg_native_instantiate ( struct cx_drbg *drbg,
+					const void *personal,
+					size_t personal_len ) {
+	const struct cx_drbg_info *info = drbg->info;
+	size_t seed_len = ( info->key_len + CX_DRBG_BLOCK_LEN );
+	unsigned char fresh[CX_DRBG_MAX_SEED_LEN];
+	unsigned char seed[CX_DRBG_MAX_SEED_LEN];
+	unsigned char temp[CX_DRBG_MAX_SEED_LEN];
+	unsigned int i;
+
+	/* Use system entropy source if no entropy input was provided */
+	if ( ! drbg->entropy ) {
+		if ( RAND_priv_bytes ( fresh, ( info->entropy_len +
+						info->nonce_len ) ) != 1 ) {
+			DBG ( "DRBG %p could not obtain fresh entropy\n",
+			      drbg );
+			goto err_fresh;
+		}
+		drbg->entropy = fresh;
+		drbg->entropy_len = info->entropy_len;
+		drbg->nonce = &fresh[info->entropy_len];
+		drbg->nonce_len = info->nonce_len;
+	}
+
+	/* Validity checks */
+	if ( drbg->entropy_len < info->key_len ) {
+		DBG ( "DRBG %p entropy too short (%zd bytes, min %zd bytes)\n",
+		      drbg, drbg->entropy_len, info->key_len );
+		goto err_entropy_len;
+	}
+	if ( drbg->nonce_len < ( info->key_len / 2 ) ) {
+		DBG ( "DRBG %p nonce too short (%zd bytes, min %zd bytes)\n",
+		      drbg, drbg->nonce_len, ( info->key_len / 2 ) );
+		goto err_nonce_len;
+	}
+
+	/* Attach cipher context */
+	if ( ! cx_drbg_native_attach ( drbg ) )
+		goto err_attach;
+
+	/* Derive seed material */
+	if ( ! cx_drbg_native_df ( drbg, personal, personal_len, seed ) )
+		goto err_df;
+
+	/* Update from all-zero key and counter value */
+	memset ( drbg->key, 0, sizeof ( drbg->key ) );
+	memset ( drbg->v, 0, sizeof ( drbg->v ) );
+	if ( ! cx_drbg_native_key ( drbg, drbg->key ) )
+		goto err_key;
+	if ( ! cx_drbg_native_ctr ( drbg, temp, seed_len ) )
+		goto err_ctr;
+	for ( i = 0 ; i < seed_len ; i++ )
+		temp[i] ^= seed[i];
+	cx_drbg_native_update ( drbg, temp );
+
+	OPENSSL_cleanse ( fresh, sizeof ( fresh ) );
+	OPENSSL_cleanse ( seed, sizeof ( seed ) );
+	OPENSSL_cleanse ( temp, sizeof ( temp ) );
+	return 1;
+
+ err_ctr:
+ err_key:
+ err_df:
+ err_attach:
+ err_nonce_len:
+ err_entropy_len:
+ err_fresh:
+	OPENSSL_cleanse ( fresh, sizeof ( fresh ) );
+	OPENSSL_cleanse ( seed, sizeof ( seed ) );
+	OPENSSL_cleanse ( temp, sizeof ( temp ) );
+	return 0;
+}
+
+/**
+ * Generate random bytes using native engine
+ *
+ * @v drbg		DRBG
+ * @v output		Output buffer
+ * @v len		Length of output buffer
+ * @ret ok		Success indicator
+ */
+static int cx_drbg_native_generate ( struct cx_drbg *drbg, void *output,
+				     size_t len ) {
+	const struct cx_drbg_info *info = drbg->info;
+	size_t seed_len = ( info->key_len + CX_DRBG_BLOCK_LEN );
+	unsigned char temp[ CX_DRBG_MAX_INLINE_LEN + CX_DRBG_MAX_SEED_LEN ];
+	size_t direct_len;
+	size_t inline_len;
+	size_t temp_len;
+	int ok = 0;
+
+	/* Attach and key cipher context */
+	if ( ! cx_drbg_native_attach ( drbg ) )
+		goto err;
+	if ( ! cx_drbg_native_key ( drbg, drbg->key ) )
+		goto err;
+
+	/* Generate any large whole number of blocks directly into
+	 * the output buffer, and generate the remainder alongside
+	 * the blocks required for the state update.
+	 */
+	direct_len = ( ( len > CX_DRBG_MAX_INLINE_LEN ) ?
+		       ( len & ~( CX_DRBG_BLOCK_LEN - 1 ) ) : 0 );
+	inline_len = ( len - direct_len );
+	temp_len = ( ( ( inline_len + CX_DRBG_BLOCK_LEN - 1 ) &
+		       ~( CX_DRBG_BLOCK_LEN - 1 ) ) + seed_len );
+	if ( direct_len &&
+	     ( ! cx_drbg_native_ctr ( drbg, output, direct_len ) ) ) {
+		goto err;
+	}
+	if ( ! cx_drbg_native_ctr ( drbg, temp, temp_len ) )
+		goto err;
+	memcpy ( ( output + direct_len ), temp, inline_len );
+
+	/* Update state (with no additional input) */
+	cx_drbg_native_update ( drbg, &temp[ temp_len - seed_len ] );
+
+	ok = 1;
+ err:
+	OPENSSL_cleanse ( temp, sizeof ( temp ) );
+	return ok;
+}
+
+/**
+ * Uninstantiate DRBG using native engine
+ *
+ * @v drbg		DRBG
+ */
+static void cx_drbg_native_uninstantiate ( struct cx_drbg *drbg ) {
+
+	/* Zero internal state */
+	OPENSSL_cleanse ( drbg->key, sizeof ( drbg->key ) );
+	OPENSSL_cleanse ( drbg->v, sizeof ( drbg->v ) );
+}
+
+/** Native engine */
+static const struct cx_drbg_engine cx_drbg_native = {
+	.name = "native",
+	.instantiate = cx_drbg_native_instantiate,
+	.generate = cx_drbg_native_generate,
+	.uninstantiate = cx_drbg_native_uninstantiate,
+};
+
+/******************************************************************************
+ *
+ * Engine selection
+ *
+ * The library-wide engine is a combination of a DRBG engine and
+ * (for the native DRBG engine) an optional generator kernel.  The
+ * best generator kernel supported by the host CPU is chosen once, on
+ * first use, and may be overridden by setting the CX_ENGINE
+ * environment variable or by calling cx_set_engine().
+ *
+ ******************************************************************************
+ */
+
+/** Environment variable used to override the engine */
+#define CX_ENGINE_ENV "CX_ENGINE"
+
+/** Engine name used for the native engine with no generator kernel */
+#define CX_ENGINE_PORTABLE "portable"
+
+/** Engine name used to select the best available engine */
+#define CX_ENGINE_AUTO "auto"
+
+/** Available DRBG engines */
+static const struct cx_drbg_engine *cx_drbg_engines[] = {
+	&cx_drbg_native,
+	&cx_drbg_openssl,
+};
+
+/** Available generator kernels, in order of preference */
+static const struct cx_kernel *cx_drbg_kernels[] = {
+	&cx_kernel_vaes,
+	&cx_kernel_aesni,
+	&cx_kernel_armce,
+};
+
+/** Selected DRBG engine */
+static const struct cx_drbg_engine *cx_drbg_engine = &cx_drbg_native;
+
+/** Selected generator kernel (or NULL to use no kernel) */
+static const struct cx_kernel *cx_drbg_selected_kernel;
+
+/** Engine dispatch initialisation */
+static CRYPTO_ONCE cx_drbg_dispatch_once = CRYPTO_ONCE_STATIC_INIT;
+
+/**
+ * Select best supported generator kernel
+ *
+ */
+static void cx_drbg_select_best ( void ) {
+	const struct cx_kernel *kernel;
+	unsigned int i;
+
+	/* Use first supported kernel */
+	cx_drbg_engine = &cx_drbg_native;
+	cx_drbg_selected_kernel = NULL;
+	for ( i = 0 ; i < ( sizeof ( cx_drbg_kernels ) /
+			    sizeof ( cx_drbg_kernels[0] ) ) ; i++ ) {
+		kernel = cx_drbg_kernels[i];
+		if ( kernel->supported() ) {
+			cx_drbg_selected_kernel = kernel;
+			break;
+		}
+	}
+}
+
+/**
+ * Select engine
+ *
+ * @v name		Engine name
+ * @ret ok		Success indicator
+ */
+static int cx_drbg_select ( const char *name ) {
+	const struct cx_kernel *kernel;
+	unsigned int i;
+
+	/* Handle automatic selection */
+	if ( strcmp ( name, CX_ENGINE_AUTO ) == 0 ) {
+		cx_drbg_select_best();
+		return 1;
+	}
+
+	/* Handle native engine with no generator kernel */
+	if ( strcmp ( name, CX_ENGINE_PORTABLE ) == 0 ) {
+		cx_drbg_engine = &cx_drbg_native;
+		cx_drbg_selected_kernel = NULL;
+		return 1;
+	}
+
+	/* Handle native engine with a specific generator kernel */
+	for ( i = 0 ; i < ( sizeof ( cx_drbg_kernels ) /
+			    sizeof ( cx_drbg_kernels[0] ) ) ; i++ ) {
+		kernel = cx_drbg_kernels[i];
+		if ( strcmp ( kernel->name, name ) != 0 )
+			continue;
+		if ( ! kernel->supported() ) {
+			DBG ( "DRBG engine \"%s\" not supported\n", name );
+			return 0;
+		}
+		cx_drbg_engine = &cx_drbg_native;
+		cx_drbg_selected_kernel = kernel;
+		return 1;
+	}
+
+	/* Handle other DRBG engines */
+	for ( i = 0 ; i < ( sizeof ( cx_drbg_engines ) /
+			    sizeof ( cx_drbg_engines[0] ) ) ; i++ ) {
+		if ( strcmp ( cx_drbg_engines[i]->name, name ) == 0 ) {
+			cx_drbg_engine = cx_drbg_engines[i];
+			cx_drbg_selected_kernel = NULL;
+			return 1;
+		}
+	}
+
+	DBG ( "DRBG engine \"%s\" unknown\n", name );
+	return 0;
+}
+
+/**
+ * Initialise engine dispatch
+ *
+ */
+static void cx_drbg_dispatch_init ( void ) {
+	const char *name;
+
+	/* Select best supported engine */
+	cx_drbg_select_best();
+
+	/* Apply any override from the environment */
+	name = getenv ( CX_ENGINE_ENV );
+	if ( name && ( ! cx_drbg_select ( name ) ) ) {
+		DBG ( "DRBG ignoring %s=\"%s\"\n", CX_ENGINE_ENV, name );
+		cx_drbg_select_best();
+	}
+}
+
+/**
+ * Ensure engine dispatch is initialised
+ *
+ */
+static void cx_drbg_dispatch ( void ) {
+
+	/* Initialise dispatch table on first use.  If this fails then
+	 * the static defaults (the native DRBG engine with no generator
+	 * kernel) remain in effect.
+	 */
+	CRYPTO_THREAD_run_once ( &cx_drbg_dispatch_once,
+				 cx_drbg_dispatch_init );
+}
+
+/**
+ * Select engine
+ *
+ * @v name		Engine name
+ * @ret ok		Success indicator
+ *
+ * The engine name may be "openssl" (to use OpenSSL's own CTR_DRBG),
+ * "portable" (to use the native DRBG engine via the generic EVP
+ * cipher interface), the name of a generator kernel such as "aesni",
+ * "vaes", or "armce" (to use the native DRBG engine with that
+ * kernel), or "auto" (to use the best engine supported by the host
+ * CPU).
+ *
+ * The selected engine is used for all subsequent operations.
+ * Existing DRBGs continue to use the DRBG engine and generator
+ * kernel with which they were instantiated.
+ *
+ * All other library functions may be called concurrently from any
+ * number of threads: initialisation happens exactly once on first
+ * use, and thereafter each thread uses only its own state.  This
+ * function changes process-wide state, and must not be called while
+ * other threads may be using the library.
+ */
+int cx_set_engine ( const char *name ) {
+
+	/* Ensure dispatch is initialised */
+	cx_drbg_dispatch();
+
+	/* Select engine */
+	return cx_drbg_select ( name );
+}
+
+/**
+ * Get selected engine name
+ *
+ * @ret name		Engine name
+ */
+const char * cx_engine_name ( void ) {
+
+	/* Ensure dispatch is initialised */
+	cx_drbg_dispatch();
+
+	/* Identify engine */
+	if ( cx_drbg_engine != &cx_drbg_native )
+		return cx_drbg_engine->name;
+	if ( cx_drbg_selected_kernel )
+		return cx_drbg_selected_kernel->name;
+	return CX_ENGINE_PORTABLE;
+}
+
+/******************************************************************************
+ *
+ * Generator kernels
+ *
+ ******************************************************************************
+ */
+
+/**
+ * Get generator kernel
+ *
+ * @ret kernel		Generator kernel (or NULL if none is selected)
+ */
+static const struct cx_kernel * cx_drbg_kernel ( void ) {
+
+	/* Ensure dispatch is initialised */
+	cx_drbg_dispatch();
+
+	return cx_drbg_selected_kernel;
+}
+
+/**
+ * Bind native engine DRBG to the selected generator kernel
+ *
+ * @v drbg		DRBG
+ *
+ * The generator kernel variant for the DRBG's key length is selected
+ * once, so that subsequent generate operations need neither consult
+ * the engine selection nor branch on the key length.
+ */
+static void cx_drbg_native_bind ( struct cx_drbg *drbg ) {
+	const struct cx_drbg_info *info = drbg->info;
+	const struct cx_kernel *kernel;
+	const struct cx_kernel *single;
+
+	/* Use no kernel unless a usable kernel is selected */
+	drbg->kernel = NULL;
+	drbg->variant = NULL;
+	drbg->single = NULL;
+	kernel = cx_drbg_kernel();
+	if ( ( ! kernel ) || ( kernel->width > CX_DRBG_MAX_LANES ) )
+		return;
+	single = ( kernel->single ? kernel->single : kernel );
+
+	/* Select variants for this key length */
+	drbg->kernel = kernel;
+	if ( info->key_len == 16 ) {
+		drbg->variant = &kernel->aes128;
+		drbg->single = &single->aes128;
+	} else {
+		drbg->variant = &kernel->aes256;
+		drbg->single = &single->aes256;
+	}
+}
+
+/**
+ * Check if DRBGs may be driven by a generator kernel
+ *
+ * @v drbgs		DRBGs
+ * @v count		Number of DRBGs
+ * @v len		Length of each block
+ * @ret ok		DRBGs may be driven by the generator kernel
+ */
+static int cx_drbg_kernel_usable ( struct cx_drbg **drbgs, unsigned int count,
+				   size_t len ) {
+	const struct cx_kernel_variant *variant;
+	unsigned int i;
+
+	/* Check output length */
+	if ( ( count == 0 ) || ( len == 0 ) || ( len > CX_KERNEL_MAX_LEN ) )
+		return 0;
+
+	/* Check that a kernel is bound */
+	variant = drbgs[0]->variant;
+	if ( ! variant )
+		return 0;
+
+	/* Check that all DRBGs are bound to the same kernel variant */
+	for ( i = 1 ; i < count ; i++ ) {
+		if ( drbgs[i]->variant != variant )
+			return 0;
+	}
+
+	return 1;
+}
+
+/******************************************************************************
+ *
+ * External API
+ *
+ ******************************************************************************
+ */
+
+/**
+ * Get DRBG storage size
+ *
+ * @ret len		Storage size
+ *
+ * This is the number of bytes actually required by this build of
+ * the library, and will never exceed sizeof ( struct
+ * cx_drbg_storage ).
+ */
+size_t cx_drbg_storage_size ( void ) {
+
+	return sizeof ( struct cx_drbg );
+}
+
+/* DRBG must fit within caller-provided storage */
+_Static_assert ( sizeof ( struct cx_drbg ) <=
+		 sizeof ( struct cx_drbg_storage ),
+		 "struct cx_drbg_storage too small" );
+
+/**
+ * Instantiate DRBG in place with explicitly split entropy, nonce,
+ * and personalization
+ *
+ * @v storage		DRBG storage
+ * @v type		Generator type
+ * @v entropy		Entropy input (or NULL to use system entropy source)
+ * @v entropy_len	Length of entropy input
+ * @v nonce		Nonce (or NULL to use system entropy source)
+ * @v nonce_len		Length of nonce
+ * @v personal		Personalization string (or NULL to use no string)
+ * @v personal_len	Length of personalization string
+ * @ret drbg		DRBG (or NULL on error)
+ */
+struct cx_drbg * cx_drbg_init_split ( struct cx_drbg_storage *storage,
+				      enum cx_generator_type type,
+				      const void *entropy, size_t entropy_len,
+				      const void *nonce, size_t nonce_len,
+				      const void *personal,
+				      size_t personal_len ) {
+	struct cx_drbg *drbg = ( ( struct cx_drbg * ) storage );
+	const struct cx_drbg_info *info;
+
+	/* Validate parameter combinations */
+	if ( entropy_len && ! entropy ) {
+		DBG ( "DRBG invalid NULL entropy len %zd\n", entropy_len );
+		goto err_sanity;
+	}
+	if ( nonce_len && ! nonce ) {
+		DBG ( "DRBG invalid NULL nonce len %zd\n", nonce_len );
+		goto err_sanity;
+	}
+	if ( personal_len && ! personal ) {
+		DBG ( "DRBG invalid NULL personalization len %zd\n",
+		      personal_len );
+		goto err_sanity;
+	}
+	if ( entropy && ! nonce ) {
+		DBG ( "DRBG invalid entropy without nonce\n" );
+		goto err_sanity;
+	}
+	if ( nonce && ! entropy ) {
+		DBG ( "DRBG invalid nonce without entropy\n" );
+		goto err_sanity;
+	}
+
+	/* Identify Generator type */
+	info = cx_drbg_info ( type );
+	if ( ! info )
+		goto err_info;
+
+	/* Ensure engine dispatch is initialised */
+	cx_drbg_dispatch();
+
+	/* Initialise DRBG */
+	memset ( drbg, 0, sizeof ( *drbg ) );
+	drbg->info = info;
+	drbg->engine = cx_drbg_engine;
+	drbg->entropy = entropy;
+	drbg->entropy_len = entropy_len;
+	drbg->nonce = nonce;
+	drbg->nonce_len = nonce_len;
+	drbg->remaining = info->max;
+
+	/* Instantiate DRBG */
+	if ( ! drbg->engine->instantiate ( drbg, personal, personal_len ) ) {
+		DBG ( "DRBG %p could not instantiate using %s engine\n",
+		      drbg, drbg->engine->name );
+		goto err_instantiate;
+	}
+
+	/* Bind to generator kernel, if applicable */
+	if ( drbg->engine == &cx_drbg_native )
+		cx_drbg_native_bind ( drbg );
+
+	/* Clear any unconsumed entropy or nonce */
+	drbg->entropy = NULL;
+	drbg->entropy_len = 0;
+	drbg->nonce = NULL;
+	drbg->nonce_len = 0;
+
+	return drbg;
+
+	drbg->engine->uninstantiate ( drbg );
+ err_instantiate:
+ err_info:
+ err_sanity:
+	return NULL;
+}
+
+/**
+ * Instantiate DRBG with explicitly split entropy, nonce, and personalization
+ *
+ * @v type		Generator type
+ * @v entropy		Entropy input (or NULL to use system entropy source)
+ * @v entropy_len	Length of entropy input
+ * @v nonce		Nonce (or NULL to use system entropy source)
+ * @v nonce_len		Length of nonce
+ * @v personal		Personalization string (or NULL to use no string)
+ * @v personal_len	Length of personalization string
+ * @ret drbg		DRBG (or NULL on error)
+ */
+struct cx_drbg * cx_drbg_instantiate_split ( enum cx_generator_type type,
+					     const void *entropy,
+					     size_t entropy_len,
+					     const void *nonce,
+					     size_t nonce_len,
+					     const void *personal,
+					     size_t personal_len ) {
+	struct cx_drbg_storage *storage;
+	struct cx_drbg *drbg;
+
+	/* Allocate storage */
+	storage = malloc ( sizeof ( *storage ) );
+	if ( ! storage ) {
+		DBG ( "DRBG out of memory\n" );
+		goto err_alloc;
+	}
+
+	/* Instantiate DRBG */
+	drbg = cx_drbg_init_split ( storage, type, entropy, entropy_len,
+				    nonce, nonce_len, personal,
+				    personal_len );
+	if ( ! drbg )
+		goto err_init;
+
+	return drbg;
+
+	cx_drbg_fini ( drbg );
+ err_init:
+	free ( storage );
+ err_alloc:
+	return NULL;
+}
+
+/**
+ * Instantiate DRBG in place with fixed-length input and optional
+ * verification key
+ *
+ * @v storage		DRBG storage
+ * @v type		Generator type
+ * @v input		Combined entropy and nonce input
+ * @v len		Combined entropy and nonce input length
+ * @v key		Verification key (or NULL)
+ * @ret drbg		DRBG (or NULL on error)
+ */
+struct cx_drbg * cx_drbg_init ( struct cx_drbg_storage *storage,
+				enum cx_generator_type type,
+				const void *input, size_t len,
+				EVP_PKEY *key ) {
+	const struct cx_drbg_info *info;
+	struct cx_drbg *drbg;
+	const void *entropy;
+	const void *nonce;
+	size_t expected_len;
+	unsigned char *personal;
+	int personal_len;
+
+	/* Identify Generator type */
+	info = cx_drbg_info ( type );
+	if ( ! info )
+		return NULL;
+
+	/* Validity checks */
+	expected_len = ( info->entropy_len + info->nonce_len );
+	if ( len != expected_len ) {
+		DBG ( "DRBG type %d incorrect length (%zd bytes, expected "
+		      "%zd bytes)\n", type, len, expected_len );
+		return NULL;
 	}
 
 	/* Split out entropy and nonce */
@@ -591,14 +2128,50 @@ struct cx_drbg * cx_drbg_instantiate ( enum cx_generator_type type,
 	}
 
 	/* Instantiate DRBG */
-	drbg = cx_drbg_instantiate_split ( type, entropy, info->entropy_len,
-					   nonce, info->nonce_len,
-					   personal, personal_len );
+	drbg = cx_drbg_init_split ( storage, type, entropy, info->entropy_len,
+				    nonce, info->nonce_len,
+				    personal, personal_len );
 	if ( personal )
 		OPENSSL_free ( personal );
 	return drbg;
 }
 
+/**
+ * Instantiate DRBG with fixed-length input and optional verification key
+ *
+ * @v type		Generator type
+ * @v input		Combined entropy and nonce input
+ * @v len		Combined entropy and nonce input length
+ * @v key		Verification key (or NULL)
+ * @ret drbg		DRBG (or NULL on error)
+ */
+struct cx_drbg * cx_drbg_instantiate ( enum cx_generator_type type,
+				       const void *input, size_t len,
+				       EVP_PKEY *key ) {
+	struct cx_drbg_storage *storage;
+	struct cx_drbg *drbg;
+
+	/* Allocate storage */
+	storage = malloc ( sizeof ( *storage ) );
+	if ( ! storage ) {
+		DBG ( "DRBG out of memory\n" );
+		goto err_alloc;
+	}
+
+	/* Instantiate DRBG */
+	drbg = cx_drbg_init ( storage, type, input, len, key );
+	if ( ! drbg )
+		goto err_init;
+
+	return drbg;
+
+	cx_drbg_fini ( drbg );
+ err_init:
+	free ( storage );
+ err_alloc:
+	return NULL;
+}
+
 /**
  * Instantiate DRBG with fresh entropy
  *
@@ -631,7 +2204,7 @@ int cx_drbg_generate ( struct cx_drbg *drbg, void *output, size_t len ) {
 	drbg->remaining--;
 
 	/* Generate random bytes */
-	if ( ! RAND_DRBG_generate ( drbg->drbg, output, len, 0, NULL, 0 ) ) {
+	if ( ! drbg->engine->generate ( drbg, output, len ) ) {
 		DBG ( "DRBG %p could not generate %zd bytes\n", drbg, len );
 		/* No idea of the resulting DRBG state: make this a
 		 * permanent failure to avoid silently generating
@@ -644,6 +2217,269 @@ int cx_drbg_generate ( struct cx_drbg *drbg, void *output, size_t len ) {
 	return 1;
 }
 
+/**
+ * Generate multiple blocks of random bytes
+ *
+ * @v drbg		DRBG
+ * @v output		Output buffer
+ * @v len		Length of each block
+ * @v count		Number of blocks
+ * @ret ok		Success indicator
+ *
+ * This is equivalent to calling cx_drbg_generate() once for each
+ * block, except that the iteration count is checked only once.  If
+ * fewer than @c count iterations remain, then no output is generated.
+ */
+int cx_drbg_generate_bulk ( struct cx_drbg *drbg, void *output, size_t len,
+			    unsigned int count ) {
+	struct cx_kernel_lane lane;
+	unsigned int i;
+
+	/* Fail if maximum iteration count would be exceeded */
+	if ( count > drbg->remaining ) {
+		DBG ( "DRBG %p maximum iteration count exceeded (%d "
+		      "requested, %d remaining)\n",
+		      drbg, count, drbg->remaining );
+		return 0;
+	}
+
+	/* Decrement maximum iteration count */
+	drbg->remaining -= count;
+
+	/* Generate using a single kernel lane, if possible */
+	if ( drbg->single && len && ( len <= CX_KERNEL_MAX_LEN ) ) {
+		lane.key = drbg->key;
+		lane.v = drbg->v;
+		lane.output = output;
+		drbg->single->generate ( &lane, 1, len, count );
+		return 1;
+	}
+
+	/* Generate random bytes */
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ! drbg->engine->generate ( drbg, output, len ) ) {
+			DBG ( "DRBG %p could not generate %zd bytes (x%d)\n",
+			      drbg, len, ( i + 1 ) );
+			/* Make this a permanent failure, as above */
+			cx_drbg_invalidate ( drbg );
+			return 0;
+		}
+		output += len;
+	}
+
+	return 1;
+}
+
+/**
+ * Generate multiple blocks of random bytes from multiple DRBGs
+ *
+ * @v drbgs		DRBGs
+ * @v count		Number of DRBGs
+ * @v output		Output buffer
+ * @v len		Length of each block
+ * @v iterations	Number of blocks to generate from each DRBG
+ * @ret ok		Success indicator
+ *
+ * This is equivalent to calling cx_drbg_generate_bulk() for each
+ * DRBG in turn, with the output from each DRBG placed consecutively
+ * in the output buffer.  Where possible, independent DRBGs are
+ * driven in lockstep by a generator kernel so that their block
+ * cipher operations may be interleaved.
+ *
+ * If fewer than @c iterations iterations remain for any DRBG, then
+ * no output is generated.
+ */
+int cx_drbg_generate_multi ( struct cx_drbg **drbgs, unsigned int count,
+			     void *output, size_t len,
+			     unsigned int iterations ) {
+	struct cx_kernel_lane lanes[CX_DRBG_MAX_LANES];
+	const struct cx_kernel_variant *variant;
+	const struct cx_kernel *kernel;
+	struct cx_drbg *drbg;
+	size_t stride = ( len * iterations );
+	unsigned int width;
+	unsigned int i;
+	unsigned int j;
+
+	/* Fail if maximum iteration count would be exceeded */
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( iterations > drbgs[i]->remaining ) {
+			DBG ( "DRBG %p maximum iteration count exceeded (%d "
+			      "requested, %d remaining)\n",
+			      drbgs[i], iterations, drbgs[i]->remaining );
+			return 0;
+		}
+	}
+
+	/* Fall back to generating from each DRBG in turn if necessary */
+	if ( ! cx_drbg_kernel_usable ( drbgs, count, len ) ) {
+		for ( i = 0 ; i < count ; i++ ) {
+			if ( ! cx_drbg_generate_bulk ( drbgs[i], output, len,
+						       iterations ) ) {
+				return 0;
+			}
+			output += stride;
+		}
+		return 1;
+	}
+
+	/* Generate using kernel */
+	kernel = drbgs[0]->kernel;
+	variant = drbgs[0]->variant;
+	for ( i = 0 ; i < count ; i += width ) {
+
+		/* Construct lanes */
+		width = ( count - i );
+		if ( width > kernel->width )
+			width = kernel->width;
+		for ( j = 0 ; j < width ; j++ ) {
+			drbg = drbgs[ i + j ];
+			drbg->remaining -= iterations;
+			lanes[j].key = drbg->key;
+			lanes[j].v = drbg->v;
+			lanes[j].output = ( output + ( ( i + j ) * stride ) );
+		}
+
+		/* Generate random bytes */
+		variant->generate ( lanes, width, len, iterations );
+	}
+
+	return 1;
+}
+
+/**
+ * Get DRBG generator type
+ *
+ * @v drbg		DRBG
+ * @ret type		Generator type
+ */
+enum cx_generator_type cx_drbg_type ( struct cx_drbg *drbg ) {
+
+	return ( drbg->info - cx_drbg_infos );
+}
+
+/**
+ * Get DRBG remaining iteration count
+ *
+ * @v drbg		DRBG
+ * @ret remaining	Number of iterations remaining
+ */
+unsigned int cx_drbg_remaining ( struct cx_drbg *drbg ) {
+
+	return drbg->remaining;
+}
+
+/**
+ * Save DRBG state
+ *
+ * @v drbg		DRBG
+ * @v state		Saved state to fill in
+ * @ret ok		Success indicator
+ *
+ * Only DRBGs using the native engine may be saved, since the
+ * internal state of OpenSSL's own CTR_DRBG is not accessible.
+ */
+int cx_drbg_save ( struct cx_drbg *drbg, struct cx_drbg_state *state ) {
+	const struct cx_drbg_info *info = drbg->info;
+	struct cx_drbg_saved *saved = ( ( void * ) state );
+
+	/* Check engine */
+	if ( drbg->engine != &cx_drbg_native ) {
+		DBG ( "DRBG %p cannot save state using %s engine\n",
+		      drbg, drbg->engine->name );
+		return 0;
+	}
+
+	/* Construct saved state */
+	memset ( saved, 0, sizeof ( *saved ) );
+	saved->version = CX_DRBG_STATE_VERSION;
+	saved->type = ( info - cx_drbg_infos );
+	saved->remaining[0] = ( drbg->remaining >> 24 );
+	saved->remaining[1] = ( drbg->remaining >> 16 );
+	saved->remaining[2] = ( drbg->remaining >> 8 );
+	saved->remaining[3] = ( drbg->remaining >> 0 );
+	memcpy ( saved->key, drbg->key, info->key_len );
+	memcpy ( saved->v, drbg->v, sizeof ( saved->v ) );
+
+	return 1;
+}
+
+/**
+ * Restore DRBG in place from saved state
+ *
+ * @v storage		DRBG storage
+ * @v state		Saved state
+ * @ret drbg		DRBG (or NULL on error)
+ *
+ * The restored DRBG always uses the native engine, and will produce
+ * exactly the output that the saved DRBG would have produced.  No
+ * derivation function or generate operations are performed, and no
+ * heap memory is allocated.  The DRBG must eventually be
+ * uninstantiated using cx_drbg_fini().
+ */
+struct cx_drbg * cx_drbg_restore ( struct cx_drbg_storage *storage,
+				   const struct cx_drbg_state *state ) {
+	struct cx_drbg *drbg = ( ( struct cx_drbg * ) storage );
+	const struct cx_drbg_saved *saved = ( ( const void * ) state );
+	const struct cx_drbg_info *info;
+	unsigned int remaining;
+	unsigned int nonzero;
+	unsigned int i;
+
+	/* Check version */
+	if ( saved->version != CX_DRBG_STATE_VERSION ) {
+		DBG ( "DRBG unsupported saved state version %d\n",
+		      saved->version );
+		goto err_version;
+	}
+
+	/* Identify generator type */
+	info = cx_drbg_info ( saved->type );
+	if ( ! info )
+		goto err_info;
+
+	/* Check remaining iteration count */
+	remaining = ( ( ( ( unsigned int ) saved->remaining[0] ) << 24 ) |
+		      ( ( ( unsigned int ) saved->remaining[1] ) << 16 ) |
+		      ( ( ( unsigned int ) saved->remaining[2] ) << 8 ) |
+		      ( ( ( unsigned int ) saved->remaining[3] ) << 0 ) );
+	if ( remaining > info->max ) {
+		DBG ( "DRBG invalid saved remaining count %d (max %d)\n",
+		      remaining, info->max );
+		goto err_remaining;
+	}
+
+	/* Check that all reserved fields and padding are zero */
+	nonzero = 0;
+	for ( i = 0 ; i < sizeof ( saved->reserved ) ; i++ )
+		nonzero |= saved->reserved[i];
+	for ( i = info->key_len ; i < sizeof ( saved->key ) ; i++ )
+		nonzero |= saved->key[i];
+	for ( i = 0 ; i < sizeof ( saved->pad ) ; i++ )
+		nonzero |= saved->pad[i];
+	if ( nonzero ) {
+		DBG ( "DRBG invalid saved state padding\n" );
+		goto err_padding;
+	}
+
+	/* Initialise DRBG */
+	memset ( drbg, 0, sizeof ( *drbg ) );
+	drbg->info = info;
+	drbg->engine = &cx_drbg_native;
+	drbg->remaining = remaining;
+	memcpy ( drbg->key, saved->key, info->key_len );
+	memcpy ( drbg->v, saved->v, sizeof ( drbg->v ) );
+	cx_drbg_native_bind ( drbg );
+
+	return drbg;
+
+ err_padding:
+ err_remaining:
+ err_info:
+ err_version:
+	return NULL;
+}
+
 /**
  * Invalidate DRBG
  *
@@ -655,6 +2491,23 @@ void cx_drbg_invalidate ( struct cx_drbg *drbg ) {
 	drbg->remaining = 0;
 }
 
+/**
+ * Uninstantiate DRBG in place
+ *
+ * @v drbg		DRBG
+ *
+ * This must be used only for DRBGs instantiated via cx_drbg_init()
+ * or cx_drbg_init_split().
+ */
+void cx_drbg_fini ( struct cx_drbg *drbg ) {
+
+	/* Uninstantiate DRBG */
+	drbg->engine->uninstantiate ( drbg );
+
+	/* Zero DRBG */
+	OPENSSL_cleanse ( drbg, sizeof ( *drbg ) );
+}
+
 /**
  * Uninstantiate DRBG
  *
@@ -663,13 +2516,7 @@ void cx_drbg_invalidate ( struct cx_drbg *drbg ) {
 void cx_drbg_uninstantiate ( struct cx_drbg *drbg ) {
 
 	/* Uninstantiate DRBG */
-	if ( ! RAND_DRBG_uninstantiate ( drbg->drbg ) ) {
-		DBG ( "DRBG %p could not uninstantiate\n", drbg );
-		/* Continue anyway; there is no alternative */
-	}
-
-	/* Free OpenSSL DRBG */
-	RAND_DRBG_free ( drbg->drbg );
+	cx_drbg_fini ( drbg );
 
 	/* Free DRBG */
 	free ( drbg );
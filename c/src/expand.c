@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Seed value expansion for matching
+ *
+ ******************************************************************************
+ *
+ * All matching strategies expand a list of seed values (each with an
+ * optional iteration range and start hint) and then process the
+ * generated contact IDs for each seed value in turn.  Expanding
+ * consecutive seed values of the same generator type and range
+ * together allows their block cipher operations to be interleaved,
+ * which is several times faster than expanding each seed value
+ * alone.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <cx/generator.h>
+#include "expand.h"
+#include "debug.h"
+
+/** Maximum number of seed values expanded concurrently */
+#define CX_EXPAND_BATCH 16
+
+/** Initial number of matches allocated */
+#define CX_EXPAND_MIN_HITS 16
+
+/**
+ * Expand seed values
+ *
+ * @v expand		Working storage
+ * @v seeds		Seed values
+ * @v first		Index of first seed value to expand
+ * @v count		Number of seed values to expand
+ * @v found		Method to process generated contact IDs
+ * @v ctx		Context passed to @c found
+ * @ret ok		Success indicator
+ *
+ * Each seed value is expanded over its iteration range, and @c found
+ * is called (in order of seed value) with the index of the seed
+ * value, the iteration at which the first contact ID was generated,
+ * and the generated contact IDs.  Seed values with an empty range
+ * are validated but otherwise skipped.  Seed values with a hint are
+ * expanded alone.
+ *
+ * The working storage must be zeroed before first use, may be reused
+ * across calls, and must eventually be freed using cx_expand_free().
+ */
+int cx_expand_seeds ( struct cx_expand *expand,
+		      const struct cx_match_seed *seeds,
+		      unsigned int first, unsigned int count,
+		      int ( * found ) ( void *ctx,
+					const struct cx_contact_id *ids,
+					unsigned int count, unsigned int seed,
+					unsigned int iteration ),
+		      void *ctx ) {
+	const struct cx_match_seed *seed;
+	enum cx_generator_type type;
+	unsigned char *buf;
+	unsigned int iterations;
+	unsigned int start;
+	unsigned int stop;
+	unsigned int batch;
+	unsigned int end = ( first + count );
+	unsigned int i;
+	unsigned int j;
+	size_t len;
+
+	/* Process seed values in batches */
+	for ( i = first ; i < end ; i += batch ) {
+
+		/* Identify expansion range */
+		seed = &seeds[i];
+		type = seed->type;
+		len = cx_gen_seed_len ( type );
+		iterations = cx_gen_max_iterations ( type );
+		if ( ( ! len ) || ( ! iterations ) ) {
+			DBG ( "EXPAND unsupported type %d\n", type );
+			return 0;
+		}
+		start = seed->first;
+		stop = ( seed->last ? seed->last : iterations );
+		if ( ( start > stop ) || ( stop > iterations ) ) {
+			DBG ( "EXPAND seed %d has invalid range [%d,%d)\n",
+			      i, start, stop );
+			return 0;
+		}
+		iterations = ( stop - start );
+
+		/* Identify batch of seed values of the same type and
+		 * range.  Seed values with a hint are expanded alone.
+		 */
+		for ( batch = 0 ; ( ( ( i + batch ) < end ) &&
+				    ( batch < CX_EXPAND_BATCH ) &&
+				    ( seed[batch].type == type ) &&
+				    ( seed[batch].first == seed->first ) &&
+				    ( seed[batch].last == seed->last ) ) ;
+		      batch++ ) {
+			if ( seed[batch].len != len ) {
+				DBG ( "EXPAND seed %d has invalid length "
+				      "%zd\n", ( i + batch ),
+				      seed[batch].len );
+				return 0;
+			}
+			if ( seed[batch].hint ) {
+				if ( ! batch )
+					batch = 1;
+				break;
+			}
+		}
+
+		/* Nothing to process for an empty range */
+		if ( ! iterations )
+			continue;
+
+		/* Allocate contact ID and seed value buffers */
+		if ( expand->alloc < ( CX_EXPAND_BATCH * iterations ) ) {
+			free ( expand->ids );
+			expand->alloc = ( CX_EXPAND_BATCH * iterations );
+			expand->ids = malloc ( expand->alloc *
+					       sizeof ( expand->ids[0] ) );
+			if ( ! expand->ids ) {
+				expand->alloc = 0;
+				return 0;
+			}
+		}
+		if ( expand->len < ( CX_EXPAND_BATCH * len ) ) {
+			free ( expand->buf );
+			expand->len = ( CX_EXPAND_BATCH * len );
+			expand->buf = malloc ( expand->len );
+			if ( ! expand->buf ) {
+				expand->len = 0;
+				return 0;
+			}
+		}
+		buf = expand->buf;
+
+		/* Expand seed values */
+		if ( seed->hint ) {
+			if ( ! cx_gen_expand_range ( type, seed->seed, len,
+						     seed->hint, start, stop,
+						     expand->ids ) ) {
+				DBG ( "EXPAND could not expand seed %d\n", i );
+				return 0;
+			}
+		} else {
+			for ( j = 0 ; j < batch ; j++ ) {
+				memcpy ( &buf[ j * len ], seed[j].seed,
+					 len );
+			}
+			if ( ! cx_gen_expand_multi_range ( type, buf, len,
+							   batch, start, stop,
+							   expand->ids ) ) {
+				DBG ( "EXPAND could not expand seeds %d-%d\n",
+				      i, ( i + batch - 1 ) );
+				return 0;
+			}
+		}
+
+		/* Process generated contact IDs */
+		for ( j = 0 ; j < batch ; j++ ) {
+			if ( ! found ( ctx, &expand->ids[ j * iterations ],
+				       iterations, ( i + j ), start ) )
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Record match
+ *
+ * @v result		Match result
+ * @v max		Number of matches allocated
+ * @v seed		Index of seed value
+ * @v iteration		Iteration index
+ * @v observation	Index of observed contact ID
+ * @ret ok		Success indicator
+ *
+ * The list of matches is grown geometrically as needed, and must
+ * eventually be freed by the caller (e.g. using cx_match_result_free()).
+ */
+int cx_expand_hit ( struct cx_match_result *result, unsigned int *max,
+		    unsigned int seed, unsigned int iteration,
+		    unsigned int observation ) {
+	struct cx_match_hit *hits;
+	struct cx_match_hit *hit;
+	unsigned int grow;
+
+	/* Grow list of matches, if necessary */
+	if ( result->count == *max ) {
+		grow = ( *max ? ( *max * 2 ) : CX_EXPAND_MIN_HITS );
+		if ( grow < *max )
+			return 0;
+		hits = realloc ( result->hits, ( grow * sizeof ( *hits ) ) );
+		if ( ! hits )
+			return 0;
+		result->hits = hits;
+		*max = grow;
+	}
+
+	/* Record match */
+	hit = &result->hits[ result->count++ ];
+	hit->seed = seed;
+	hit->iteration = iteration;
+	hit->observation = observation;
+
+	return 1;
+}
+
+/**
+ * Free working storage for expanding seed values
+ *
+ * @v expand		Working storage
+ */
+void cx_expand_free ( struct cx_expand *expand ) {
+
+	free ( expand->buf );
+	free ( expand->ids );
+	memset ( expand, 0, sizeof ( *expand ) );
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+#ifndef _CX_EXPAND_H
+#define _CX_EXPAND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cx.h>
+#include <cx/match.h>
+
+/** Working storage for expanding seed values */
+struct cx_expand {
+	/** Contact ID buffer */
+	struct cx_contact_id *ids;
+	/** Number of contact IDs allocated */
+	unsigned int alloc;
+	/** Seed value buffer */
+	unsigned char *buf;
+	/** Length of seed value buffer */
+	size_t len;
+};
+
+/**
+ * Read big-endian 64-bit value
+ *
+ * @v data		Data
+ * @ret value		Value
+ */
+static inline uint64_t cx_expand_be64 ( const unsigned char *data ) {
+
+	return ( ( ( ( uint64_t ) data[0] ) << 56 ) |
+		 ( ( ( uint64_t ) data[1] ) << 48 ) |
+		 ( ( ( uint64_t ) data[2] ) << 40 ) |
+		 ( ( ( uint64_t ) data[3] ) << 32 ) |
+		 ( ( ( uint64_t ) data[4] ) << 24 ) |
+		 ( ( ( uint64_t ) data[5] ) << 16 ) |
+		 ( ( ( uint64_t ) data[6] ) << 8 ) |
+		 ( ( ( uint64_t ) data[7] ) << 0 ) );
+}
+
+extern int cx_expand_seeds ( struct cx_expand *expand,
+			     const struct cx_match_seed *seeds,
+			     unsigned int first, unsigned int count,
+			     int ( * found ) ( void *ctx,
+					       const struct cx_contact_id *ids,
+					       unsigned int count,
+					       unsigned int seed,
+					       unsigned int iteration ),
+			     void *ctx );
+
+extern int cx_expand_hit ( struct cx_match_result *result, unsigned int *max,
+			   unsigned int seed, unsigned int iteration,
+			   unsigned int observation );
+
+extern void cx_expand_free ( struct cx_expand *expand );
+
+#endif /* _CX_EXPAND_H */
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Durable file I/O
+ *
+ ******************************************************************************
+ *
+ * The observation store and the seed value ledger both rely on
+ * writes that either complete in full or are reported as failed, and
+ * on synchronising a directory after renaming a file into place.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "fileio.h"
+#include "debug.h"
+
+/**
+ * Write data to file
+ *
+ * @v fd		File descriptor
+ * @v data		Data
+ * @v len		Length of data
+ * @v offset		Offset within file
+ * @ret ok		Success indicator
+ *
+ * Short writes and interrupted writes are retried until all data has
+ * been written.
+ */
+int cx_file_write ( int fd, const void *data, size_t len, off_t offset ) {
+	const uint8_t *bytes = data;
+	ssize_t done;
+
+	/* Write data, allowing for short writes */
+	while ( len ) {
+		done = pwrite ( fd, bytes, len, offset );
+		if ( ( done < 0 ) && ( errno == EINTR ) )
+			continue;
+		if ( done <= 0 ) {
+			DBG ( "FILE %d could not write %zd bytes at %lld: "
+			      "%s\n", fd, len, ( ( long long ) offset ),
+			      strerror ( errno ) );
+			return 0;
+		}
+		bytes += done;
+		len -= done;
+		offset += done;
+	}
+
+	return 1;
+}
+
+/**
+ * Synchronise directory
+ *
+ * @v dir		Directory
+ * @ret ok		Success indicator
+ */
+int cx_file_sync_dir ( const char *dir ) {
+	int fd;
+	int ok;
+
+	fd = open ( dir, ( O_RDONLY | O_DIRECTORY ) );
+	if ( fd < 0 ) {
+		DBG ( "FILE could not open %s: %s\n", dir, strerror ( errno ) );
+		return 0;
+	}
+	ok = ( fsync ( fd ) == 0 );
+	if ( ! ok ) {
+		DBG ( "FILE could not synchronise %s: %s\n",
+		      dir, strerror ( errno ) );
+	}
+	close ( fd );
+
+	return ok;
+}
@@ -0,0 +1,448 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Fingerprint matching
+ *
+ ******************************************************************************
+ *
+ * Contact IDs are random, and so a 64-bit fingerprint of each
+ * observed contact ID is sufficient to keep false positives
+ * negligible at any realistic number of observations.  With n
+ * distinct fingerprints, a generated contact ID that was not
+ * observed matches some fingerprint with probability n/2^64.
+ *
+ * The fingerprint is the exclusive-OR of the two 64-bit halves of
+ * the contact ID.  The fixed UUID version bits lie in the upper half
+ * and the fixed UUID variant bits lie in the lower half, at
+ * different bit positions, and so every bit of the fingerprint is
+ * random.
+ *
+ * The index is a sorted array of fingerprints with a fanout table
+ * indexed by the most significant bits, sized for between one and
+ * two fingerprints per entry.  Callers must supply the fingerprints
+ * already in ascending order (e.g. by first sorting the observed
+ * contact IDs using cx_fpmatch_sort()), and each match identifies
+ * the observation by its position in that order.  No separate
+ * observation indices are therefore required.  As for the full
+ * contact ID index, a binary fuse filter over the fingerprints is
+ * placed in front of the index so that most lookups touch only the
+ * filter.  The index occupies 8 bytes per observation for the
+ * fingerprint, 2 to 4 bytes for the fanout table and 2.25 to 2.8
+ * bytes for the filter, i.e. around 13 bytes per observation in
+ * total, compared with at least 24 bytes for the full contact ID
+ * index.  Callers need retain only the 64-bit fingerprint of each
+ * observation.
+ *
+ * Matches are only candidates.  If the full observed contact IDs are
+ * available (e.g. from an observation store on disk), each candidate
+ * may be confirmed by re-expanding the single matching seed value up
+ * to the matching iteration and comparing the full contact ID.
+ * Statistics record the theoretical and measured false positive
+ * rates.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <cx/generator.h>
+#include <cx/fpmatch.h>
+#include "fuse.h"
+#include "expand.h"
+#include "debug.h"
+
+/** Maximum number of fanout table index bits */
+#define CX_FPMATCH_MAX_BITS 24
+
+/** Prefilter fingerprint width */
+#define CX_FPMATCH_FILTER_BITS 16
+
+/** A fingerprint index */
+struct cx_fpmatch {
+	/** Sorted fingerprints */
+	uint64_t *fingerprints;
+	/** Fanout table */
+	unsigned int *fanout;
+	/** Fanout table index shift */
+	unsigned int shift;
+	/** Number of observed fingerprints */
+	unsigned int count;
+	/** Number of distinct fingerprints */
+	unsigned int distinct;
+	/** Prefilter */
+	struct cx_fuse filter;
+	/** Statistics */
+	struct cx_fpmatch_stats stats;
+};
+
+/** State for matching seed values */
+struct cx_fpmatch_state {
+	/** Fingerprint index */
+	struct cx_fpmatch *fp;
+	/** Match result */
+	struct cx_match_result *result;
+	/** Number of matches allocated */
+	unsigned int max;
+};
+
+/**
+ * Calculate contact ID fingerprint
+ *
+ * @v id		Contact ID
+ * @ret fingerprint	64-bit fingerprint
+ */
+uint64_t cx_fpmatch_fingerprint ( const struct cx_contact_id *id ) {
+
+	return ( cx_expand_be64 ( &id->bytes[0] ) ^
+		 cx_expand_be64 ( &id->bytes[8] ) );
+}
+
+/**
+ * Compare contact IDs by fingerprint
+ *
+ * @v a			First contact ID
+ * @v b			Second contact ID
+ * @ret order		Sort order
+ */
+static int cx_fpmatch_compare ( const void *a, const void *b ) {
+	const struct cx_contact_id *first = a;
+	const struct cx_contact_id *second = b;
+	uint64_t first_fingerprint = cx_fpmatch_fingerprint ( first );
+	uint64_t second_fingerprint = cx_fpmatch_fingerprint ( second );
+
+	if ( first_fingerprint != second_fingerprint )
+		return ( ( first_fingerprint < second_fingerprint ) ? -1 : 1 );
+	return memcmp ( first, second, sizeof ( *first ) );
+}
+
+/**
+ * Sort contact IDs into fingerprint order
+ *
+ * @v ids		Contact IDs
+ * @v count		Number of contact IDs
+ *
+ * Contact IDs sharing a fingerprint are sorted by value, so that the
+ * order is fully determined by the set of contact IDs.
+ */
+void cx_fpmatch_sort ( struct cx_contact_id *ids, unsigned int count ) {
+
+	if ( count )
+		qsort ( ids, count, sizeof ( ids[0] ), cx_fpmatch_compare );
+}
+
+/**
+ * Create fingerprint index
+ *
+ * @v fingerprints	Observed contact ID fingerprints, in ascending order
+ * @v count		Number of observed contact ID fingerprints
+ * @ret fp		Fingerprint index, or NULL on error
+ *
+ * Fingerprints should be calculated using cx_fpmatch_fingerprint().
+ * Each match identifies the observation by its position within @c
+ * fingerprints.  Fingerprints that are not in ascending order are
+ * rejected.
+ */
+struct cx_fpmatch * cx_fpmatch_create ( const uint64_t *fingerprints,
+					unsigned int count ) {
+	struct cx_fpmatch *fp;
+	unsigned int buckets;
+	unsigned int bucket;
+	unsigned int bits;
+	unsigned int i;
+
+	/* Check that fingerprints are in ascending order */
+	for ( i = 1 ; i < count ; i++ ) {
+		if ( fingerprints[i] < fingerprints[ i - 1 ] ) {
+			DBG ( "FPMATCH fingerprint %d out of order\n", i );
+			goto err_order;
+		}
+	}
+
+	/* Allocate and initialise structure */
+	fp = malloc ( sizeof ( *fp ) );
+	if ( ! fp )
+		goto err_alloc;
+	memset ( fp, 0, sizeof ( *fp ) );
+	fp->count = count;
+
+	/* Size fanout table for around two fingerprints per entry */
+	for ( bits = 1 ; ( ( bits < CX_FPMATCH_MAX_BITS ) &&
+			   ( ( 2ULL << bits ) < count ) ) ; bits++ ) {}
+	buckets = ( 1U << bits );
+	fp->shift = ( 64 - bits );
+
+	/* Allocate index */
+	fp->fingerprints = malloc ( ( count ? count : 1 ) *
+				    sizeof ( fp->fingerprints[0] ) );
+	if ( ! fp->fingerprints )
+		goto err_alloc_fingerprints;
+	fp->fanout = calloc ( ( buckets + 1 ), sizeof ( fp->fanout[0] ) );
+	if ( ! fp->fanout )
+		goto err_alloc_fanout;
+
+	/* Construct index */
+	memcpy ( fp->fingerprints, fingerprints,
+		 ( count * sizeof ( fp->fingerprints[0] ) ) );
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ( i == 0 ) || ( fingerprints[i] !=
+				     fingerprints[ i - 1 ] ) )
+			fp->distinct++;
+		bucket = ( fingerprints[i] >> fp->shift );
+		fp->fanout[ bucket + 1 ]++;
+	}
+	for ( i = 0 ; i < buckets ; i++ )
+		fp->fanout[ i + 1 ] += fp->fanout[i];
+
+	/* Construct prefilter */
+	if ( ! cx_fuse_build ( &fp->filter, fp->fingerprints, count,
+			       CX_FPMATCH_FILTER_BITS ) ) {
+		DBG ( "FPMATCH %p could not construct filter\n", fp );
+		goto err_build;
+	}
+
+	/* Record theoretical false positive rate */
+	fp->stats.expected = ( fp->distinct * 0x1p-64 );
+
+	DBG ( "FPMATCH %p indexed %d observations (%d distinct) with %d-bit "
+	      "fanout\n", fp, count, fp->distinct, bits );
+	return fp;
+
+	cx_fuse_free ( &fp->filter );
+ err_build:
+	free ( fp->fanout );
+ err_alloc_fanout:
+	free ( fp->fingerprints );
+ err_alloc_fingerprints:
+	free ( fp );
+ err_alloc:
+ err_order:
+	return NULL;
+}
+
+/**
+ * Look up generated contact IDs
+ *
+ * @v ctx		Matching state
+ * @v ids		Generated contact IDs
+ * @v count		Number of generated contact IDs
+ * @v seed		Index of seed value
+ * @v iteration		Iteration at which first contact ID was generated
+ * @ret ok		Success indicator
+ */
+static int cx_fpmatch_lookup ( void *ctx, const struct cx_contact_id *ids,
+			       unsigned int count, unsigned int seed,
+			       unsigned int iteration ) {
+	struct cx_fpmatch_state *state = ctx;
+	struct cx_fpmatch *fp = state->fp;
+	const uint64_t *fingerprints = fp->fingerprints;
+	uint64_t fingerprint;
+	unsigned int bucket;
+	unsigned int index;
+	unsigned int end;
+	unsigned int i;
+
+	/* Look up each contact ID */
+	for ( i = 0 ; i < count ; i++ ) {
+		fingerprint = cx_fpmatch_fingerprint ( &ids[i] );
+		if ( ! cx_fuse_contains ( &fp->filter, fingerprint ) )
+			continue;
+		bucket = ( fingerprint >> fp->shift );
+		index = fp->fanout[bucket];
+		end = fp->fanout[ bucket + 1 ];
+		while ( ( index < end ) &&
+			( fingerprints[index] < fingerprint ) )
+			index++;
+		while ( ( index < end ) &&
+			( fingerprints[index] == fingerprint ) ) {
+			if ( ! cx_expand_hit ( state->result, &state->max,
+					       seed, ( iteration + i ),
+					       index++ ) ) {
+				DBG ( "FPMATCH could not record match\n" );
+				return 0;
+			}
+		}
+	}
+	fp->stats.lookups += count;
+
+	return 1;
+}
+
+/**
+ * Match seed values against fingerprint index
+ *
+ * @v fp		Fingerprint index
+ * @v seeds		Seed values
+ * @v count		Number of seed values
+ * @ret result		Candidate match result, or NULL on error
+ *
+ * Every contact ID generated from each seed value within the seed
+ * value's range is looked up in the fingerprint index (as for
+ * cx_match_seeds()).  Each match is a candidate that may optionally
+ * be confirmed using cx_fpmatch_confirm().  The result must
+ * eventually be freed using cx_match_result_free().
+ */
+struct cx_match_result * cx_fpmatch_seeds ( struct cx_fpmatch *fp,
+					    const struct cx_match_seed *seeds,
+					    unsigned int count ) {
+	struct cx_fpmatch_state state;
+	struct cx_match_result *result;
+	struct cx_expand expand;
+
+	/* Allocate and initialise result */
+	result = malloc ( sizeof ( *result ) );
+	if ( ! result )
+		goto err_alloc;
+	memset ( result, 0, sizeof ( *result ) );
+	memset ( &expand, 0, sizeof ( expand ) );
+	state.fp = fp;
+	state.result = result;
+	state.max = 0;
+
+	/* Expand seed values and look up generated contact IDs */
+	if ( ! cx_expand_seeds ( &expand, seeds, 0, count, cx_fpmatch_lookup,
+				 &state ) )
+		goto err_expand;
+	fp->stats.candidates += result->count;
+
+	cx_expand_free ( &expand );
+	return result;
+
+ err_expand:
+	cx_expand_free ( &expand );
+	cx_match_result_free ( result );
+ err_alloc:
+	return NULL;
+}
+
+/**
+ * Confirm candidate matches against full contact IDs
+ *
+ * @v fp		Fingerprint index
+ * @v seeds		Seed values (as passed to cx_fpmatch_seeds())
+ * @v result		Candidate match result
+ * @v ids		Full observed contact IDs
+ * @ret ok		Success indicator
+ *
+ * The single seed value for each candidate match is re-expanded up
+ * to the matching iteration, and the generated contact ID is compared
+ * against the full observed contact ID.  Candidate matches that are
+ * false positives are removed from the result.
+ */
+int cx_fpmatch_confirm ( struct cx_fpmatch *fp,
+			 const struct cx_match_seed *seeds,
+			 struct cx_match_result *result,
+			 const struct cx_contact_id *ids ) {
+	const struct cx_match_seed *seed;
+	struct cx_match_hit *hit;
+	struct cx_contact_id id;
+	unsigned int kept = 0;
+	unsigned int i;
+
+	/* Check each candidate match */
+	for ( i = 0 ; i < result->count ; i++ ) {
+		hit = &result->hits[i];
+
+		/* Regenerate contact ID, unless unchanged from the
+		 * previously kept candidate match.
+		 */
+		if ( ( kept == 0 ) ||
+		     ( hit->seed != result->hits[ kept - 1 ].seed ) ||
+		     ( hit->iteration !=
+		       result->hits[ kept - 1 ].iteration ) ) {
+			seed = &seeds[hit->seed];
+			if ( ! cx_gen_expand_range ( seed->type, seed->seed,
+						     seed->len, seed->hint,
+						     hit->iteration,
+						     ( hit->iteration + 1 ),
+						     &id ) ) {
+				DBG ( "FPMATCH %p could not regenerate seed "
+				      "%d iteration %d\n", fp, hit->seed,
+				      hit->iteration );
+				goto err_expand;
+			}
+		}
+
+		/* Discard false positives */
+		if ( memcmp ( &id, &ids[hit->observation],
+			      sizeof ( id ) ) != 0 ) {
+			DBG ( "FPMATCH %p rejected seed %d iteration %d "
+			      "observation %d\n", fp, hit->seed,
+			      hit->iteration, hit->observation );
+			fp->stats.rejected++;
+			continue;
+		}
+		memmove ( &result->hits[kept++], hit, sizeof ( *hit ) );
+	}
+	fp->stats.checked += i;
+	result->count = kept;
+
+	return 1;
+
+ err_expand:
+	/* Retain all candidate matches not yet checked */
+	fp->stats.checked += i;
+	memmove ( &result->hits[kept], &result->hits[i],
+		  ( ( result->count - i ) * sizeof ( result->hits[0] ) ) );
+	result->count = ( kept + ( result->count - i ) );
+	return 0;
+}
+
+/**
+ * Get fingerprint matching statistics
+ *
+ * @v fp		Fingerprint index
+ * @v stats		Statistics to fill in
+ *
+ * Statistics are cumulative over the lifetime of the fingerprint
+ * index.  The measured false positive rate is meaningful only if
+ * every candidate match has been checked using cx_fpmatch_confirm().
+ */
+void cx_fpmatch_stats ( struct cx_fpmatch *fp,
+			struct cx_fpmatch_stats *stats ) {
+
+	memcpy ( stats, &fp->stats, sizeof ( *stats ) );
+	stats->measured = ( stats->lookups ?
+			    ( ( ( double ) stats->rejected ) /
+			      stats->lookups ) : 0 );
+}
+
+/**
+ * Free fingerprint index
+ *
+ * @v fp		Fingerprint index
+ */
+void cx_fpmatch_free ( struct cx_fpmatch *fp ) {
+
+	/* Do nothing if freeing a NULL pointer */
+	if ( ! fp )
+		return;
+
+	cx_fuse_free ( &fp->filter );
+	free ( fp->fanout );
+	free ( fp->fingerprints );
+	free ( fp );
+}
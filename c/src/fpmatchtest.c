@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Fingerprint matching self-tests
+ *
+ ******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <cx/match.h>
+#include <cx/fpmatch.h>
+#include "cxtest.h"
+#include "fpmatchtest.h"
+
+/** Number of seed values */
+#define FPMATCHTEST_SEEDS 12
+
+/** Number of observed contact IDs */
+#define FPMATCHTEST_OBSERVATIONS 200
+
+/** A fingerprint matching self-test */
+struct fpmatchtest {
+	/** Test name */
+	const char *name;
+	/** Iteration ranges are applied */
+	int window;
+};
+
+/** Fingerprint matching self-tests */
+static const struct fpmatchtest fpmatchtests_all[] = {
+	{ "default", 0 },
+	{ "window", 1 },
+};
+
+/**
+ * Run a fingerprint matching self-test
+ *
+ * @v test		Fingerprint matching self-test
+ * @v match		Observation index
+ * @v seeds		Seed values
+ * @v observed		Observed contact IDs
+ * @ret ok		Success indicator
+ *
+ * The observations include contact IDs constructed to share a
+ * fingerprint with a generated contact ID.  The candidate matches
+ * must include these false positives, and the confirmed matches must
+ * be identical to the result from the full observation index.
+ */
+static int fpmatchtest ( const struct fpmatchtest *test,
+			 struct cx_match *match, struct cx_match_seed *seeds,
+			 const struct cx_contact_id *observed ) {
+	uint64_t fingerprints[FPMATCHTEST_OBSERVATIONS];
+	struct cx_match_result *expected;
+	struct cx_match_result *result;
+	struct cx_fpmatch_stats stats;
+	struct cx_fpmatch *fp;
+	unsigned long long lookups = 0;
+	unsigned int candidates;
+	unsigned int i;
+
+	/* Apply iteration ranges, if applicable */
+	for ( i = 0 ; i < FPMATCHTEST_SEEDS ; i++ ) {
+		seeds[i].first = ( test->window ? ( i * 150 ) : 0 );
+		seeds[i].last = ( test->window ? ( i * 170 ) : 0 );
+		lookups += ( ( seeds[i].last ? seeds[i].last :
+			       CXTEST_MATCH_MAX ) - seeds[i].first );
+	}
+
+	/* Match using observation index */
+	expected = cx_match_seeds ( match, seeds, FPMATCHTEST_SEEDS );
+	if ( ! expected ) {
+		fprintf ( stderr, "FPMATCH %s fail: could not match using "
+			  "index\n", test->name );
+		goto err_expected;
+	}
+
+	/* Create fingerprint index */
+	for ( i = 0 ; i < FPMATCHTEST_OBSERVATIONS ; i++ )
+		fingerprints[i] = cx_fpmatch_fingerprint ( &observed[i] );
+	fp = cx_fpmatch_create ( fingerprints, FPMATCHTEST_OBSERVATIONS );
+	if ( ! fp ) {
+		fprintf ( stderr, "FPMATCH %s fail: could not create\n",
+			  test->name );
+		goto err_create;
+	}
+
+	/* Match seed values */
+	result = cx_fpmatch_seeds ( fp, seeds, FPMATCHTEST_SEEDS );
+	if ( ! result ) {
+		fprintf ( stderr, "FPMATCH %s fail: could not match\n",
+			  test->name );
+		goto err_seeds;
+	}
+	candidates = result->count;
+	if ( candidates <= expected->count ) {
+		fprintf ( stderr, "FPMATCH %s fail: %d candidates (expected "
+			  "more than %d)\n", test->name, candidates,
+			  expected->count );
+		goto err_candidates;
+	}
+
+	/* Confirm candidate matches */
+	if ( ! cx_fpmatch_confirm ( fp, seeds, result, observed ) ) {
+		fprintf ( stderr, "FPMATCH %s fail: could not confirm\n",
+			  test->name );
+		goto err_confirm;
+	}
+	if ( ( result->count != expected->count ) ||
+	     ( memcmp ( result->hits, expected->hits,
+			( expected->count *
+			  sizeof ( expected->hits[0] ) ) ) != 0 ) ) {
+		fprintf ( stderr, "FPMATCH %s fail: mismatch (%d hits, "
+			  "expected %d)\n", test->name, result->count,
+			  expected->count );
+		goto err_mismatch;
+	}
+
+	/* Check statistics */
+	cx_fpmatch_stats ( fp, &stats );
+	if ( ( stats.lookups != lookups ) ||
+	     ( stats.candidates != candidates ) ||
+	     ( stats.checked != candidates ) ||
+	     ( stats.rejected != ( candidates - expected->count ) ) ) {
+		fprintf ( stderr, "FPMATCH %s fail: bad statistics\n",
+			  test->name );
+		goto err_stats;
+	}
+	if ( ( stats.expected <= 0 ) || ( stats.expected > 1e-16 ) ||
+	     ( stats.measured != ( ( ( double ) stats.rejected ) /
+				   stats.lookups ) ) ) {
+		fprintf ( stderr, "FPMATCH %s fail: bad false positive "
+			  "rates %g/%g\n", test->name, stats.expected,
+			  stats.measured );
+		goto err_stats;
+	}
+
+	/* Free index and results */
+	cx_match_result_free ( result );
+	cx_fpmatch_free ( fp );
+	cx_match_result_free ( expected );
+
+	fprintf ( stderr, "FPMATCH %s ok\n", test->name );
+	return 1;
+
+ err_stats:
+ err_mismatch:
+ err_confirm:
+ err_candidates:
+	cx_match_result_free ( result );
+ err_seeds:
+	cx_fpmatch_free ( fp );
+ err_create:
+	cx_match_result_free ( expected );
+ err_expected:
+	return 0;
+}
+
+/**
+ * Run invalid fingerprint matching self-test
+ *
+ * @v seeds		Seed values
+ * @ret ok		Success indicator
+ */
+static int fpmatchtest_invalid ( struct cx_match_seed *seeds ) {
+	static const uint64_t unsorted[] = { 2, 3, 1 };
+	struct cx_match_result *result;
+	struct cx_fpmatch *fp;
+	size_t len;
+
+	/* Check that unsorted fingerprints are rejected */
+	fp = cx_fpmatch_create ( unsorted, ( sizeof ( unsorted ) /
+					     sizeof ( unsorted[0] ) ) );
+	if ( fp ) {
+		fprintf ( stderr, "FPMATCH invalid fail: accepted unsorted "
+			  "fingerprints\n" );
+		goto err_unsorted;
+	}
+
+	/* Check that an empty index matches nothing */
+	fp = cx_fpmatch_create ( NULL, 0 );
+	if ( ! fp ) {
+		fprintf ( stderr, "FPMATCH invalid fail: could not create\n" );
+		goto err_create;
+	}
+	result = cx_fpmatch_seeds ( fp, seeds, FPMATCHTEST_SEEDS );
+	if ( ( ! result ) || result->count ) {
+		fprintf ( stderr, "FPMATCH invalid fail: empty index "
+			  "matched\n" );
+		cx_match_result_free ( result );
+		goto err_empty;
+	}
+	cx_match_result_free ( result );
+
+	/* Check that an invalid seed value is rejected */
+	len = seeds[1].len--;
+	result = cx_fpmatch_seeds ( fp, seeds, FPMATCHTEST_SEEDS );
+	seeds[1].len = len;
+	if ( result ) {
+		fprintf ( stderr, "FPMATCH invalid fail: accepted invalid "
+			  "seed\n" );
+		cx_match_result_free ( result );
+		goto err_accepted;
+	}
+	cx_fpmatch_free ( fp );
+
+	/* Check that freeing a NULL pointer is harmless */
+	cx_fpmatch_free ( NULL );
+
+	fprintf ( stderr, "FPMATCH invalid ok\n" );
+	return 1;
+
+ err_accepted:
+ err_empty:
+ err_unsorted:
+	cx_fpmatch_free ( fp );
+ err_create:
+	return 0;
+}
+
+/**
+ * Run fingerprint matching self-tests
+ *
+ * @ret ok		Success indicator
+ */
+int fpmatchtests ( void ) {
+	unsigned char raw[FPMATCHTEST_SEEDS][CXTEST_MATCH_SEED_LEN];
+	struct cx_match_seed seeds[FPMATCHTEST_SEEDS];
+	struct cx_contact_id observed[FPMATCHTEST_OBSERVATIONS];
+	struct cx_match *match;
+	unsigned int i;
+	unsigned int j;
+	int ok = 1;
+
+	/* Construct seed values and observations */
+	cxtest_match_seeds ( seeds, raw, FPMATCHTEST_SEEDS );
+	if ( ! cxtest_match_observe ( "FPMATCH", seeds, FPMATCHTEST_SEEDS,
+				      observed, FPMATCHTEST_OBSERVATIONS ) )
+		return 0;
+
+	/* Include contact IDs that differ from a generated contact ID
+	 * but share its fingerprint.  These are derived from alternate
+	 * observations of the first seed value, which has an
+	 * unrestricted iteration range in every test.
+	 */
+	for ( i = 0 ; i < FPMATCHTEST_OBSERVATIONS ;
+	      i += ( 2 * FPMATCHTEST_SEEDS ) ) {
+		for ( j = 0 ; j < 8 ; j++ ) {
+			observed[i].bytes[j] ^= ( 0x5a + i + j );
+			observed[i].bytes[ 8 + j ] ^= ( 0x5a + i + j );
+		}
+	}
+
+	/* Sort observations into fingerprint order, as required for
+	 * the fingerprint index.
+	 */
+	cx_fpmatch_sort ( observed, FPMATCHTEST_OBSERVATIONS );
+	for ( i = 1 ; i < FPMATCHTEST_OBSERVATIONS ; i++ ) {
+		if ( cx_fpmatch_fingerprint ( &observed[i] ) <
+		     cx_fpmatch_fingerprint ( &observed[ i - 1 ] ) ) {
+			fprintf ( stderr, "FPMATCH fail: could not sort\n" );
+			return 0;
+		}
+	}
+
+	/* Create observation index for comparison */
+	match = cx_match_create ( observed, FPMATCHTEST_OBSERVATIONS );
+	if ( ! match ) {
+		fprintf ( stderr, "FPMATCH fail: could not create index\n" );
+		return 0;
+	}
+
+	/* Run tests */
+	for ( i = 0 ; i < ( sizeof ( fpmatchtests_all ) /
+			    sizeof ( fpmatchtests_all[0] ) ) ; i++ ) {
+		ok &= fpmatchtest ( &fpmatchtests_all[i], match, seeds,
+				    observed );
+	}
+	ok &= fpmatchtest_invalid ( seeds );
+
+	cx_match_free ( match );
+	return ok;
+}
@@ -0,0 +1,395 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Binary fuse filters
+ *
+ ******************************************************************************
+ *
+ * A binary fuse filter (Graf and Lemire, "Binary Fuse Filters: Fast
+ * and Smaller Than Xor Filters", 2022) is a static approximate
+ * membership filter over a set of 64-bit keys.  Each key maps to
+ * three fingerprint slots in consecutive segments, and a key is
+ * reported as possibly present if the XOR of the three slots equals
+ * the key's fingerprint.  The false positive rate is around 2^-bits
+ * for a fingerprint width of the specified number of bits, and the
+ * filter occupies between around 1.13 and 1.4 fingerprints per key.
+ *
+ * The filter is constructed by hypergraph peeling: a slot to which
+ * only a single key maps may be assigned last, after that key is
+ * removed from the remaining slots.  Construction fails with low
+ * probability, in which case it is retried with a new hash seed.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "fuse.h"
+#include "debug.h"
+
+/** Arity (number of slots per key) */
+#define CX_FUSE_ARITY 3
+
+/** Maximum segment length */
+#define CX_FUSE_MAX_SEGMENT_LENGTH 262144
+
+/** Maximum number of construction attempts */
+#define CX_FUSE_MAX_ATTEMPTS 100
+
+/** log2(3.33), used to calculate segment length */
+#define CX_FUSE_LOG2_3_33 1.7355
+
+/** log2(10^6), used to calculate size factor */
+#define CX_FUSE_LOG2_1E6 19.9316
+
+/**
+ * Approximate base-2 logarithm
+ *
+ * @v x			Value (at least 1)
+ * @ret log2		Approximate base-2 logarithm
+ *
+ * This is accurate to within 0.09, which is sufficient for sizing
+ * the filter, and avoids a dependency on libm.
+ */
+static double cx_fuse_log2 ( double x ) {
+	unsigned int exponent = 0;
+
+	while ( x >= 2 ) {
+		x /= 2;
+		exponent++;
+	}
+	return ( exponent + ( x - 1 ) );
+}
+
+/**
+ * Generate next hash seed
+ *
+ * @v state		Generator state
+ * @ret seed		Hash seed
+ */
+static uint64_t cx_fuse_next_seed ( uint64_t *state ) {
+	uint64_t seed;
+
+	/* Use SplitMix64 */
+	*state += 0x9e3779b97f4a7c15ULL;
+	seed = *state;
+	seed = ( ( seed ^ ( seed >> 30 ) ) * 0xbf58476d1ce4e5b9ULL );
+	seed = ( ( seed ^ ( seed >> 27 ) ) * 0x94d049bb133111ebULL );
+	return ( seed ^ ( seed >> 31 ) );
+}
+
+/**
+ * Compare keys
+ *
+ * @v first		First key
+ * @v second		Second key
+ * @ret diff		Difference
+ */
+static int cx_fuse_compare ( const void *first, const void *second ) {
+	const uint64_t *a = first;
+	const uint64_t *b = second;
+
+	if ( *a != *b )
+		return ( ( *a < *b ) ? -1 : 1 );
+	return 0;
+}
+
+/**
+ * Calculate filter dimensions
+ *
+ * @v fuse		Binary fuse filter
+ * @v count		Number of distinct keys
+ */
+static void cx_fuse_size ( struct cx_fuse *fuse, unsigned int count ) {
+	unsigned int exponent;
+	uint32_t segment_count;
+	uint32_t capacity;
+	double log2;
+	double factor;
+
+	/* Calculate segment length */
+	log2 = cx_fuse_log2 ( count ? count : 1 );
+	exponent = ( ( log2 / CX_FUSE_LOG2_3_33 ) + 2.25 );
+	fuse->segment_length = ( count ? ( 1UL << exponent ) : 4 );
+	if ( fuse->segment_length > CX_FUSE_MAX_SEGMENT_LENGTH )
+		fuse->segment_length = CX_FUSE_MAX_SEGMENT_LENGTH;
+	fuse->segment_mask = ( fuse->segment_length - 1 );
+
+	/* Calculate number of slots required */
+	if ( count > 1 ) {
+		factor = ( 0.875 + ( 0.25 * CX_FUSE_LOG2_1E6 / log2 ) );
+		if ( factor < 1.125 )
+			factor = 1.125;
+		capacity = ( ( count * factor ) + 0.5 );
+	} else {
+		capacity = 0;
+	}
+
+	/* Calculate number of segments in which a first slot may lie */
+	segment_count = ( ( capacity + fuse->segment_length - 1 ) /
+			  fuse->segment_length );
+	if ( segment_count <= ( CX_FUSE_ARITY - 1 ) ) {
+		segment_count = 1;
+	} else {
+		segment_count -= ( CX_FUSE_ARITY - 1 );
+	}
+	fuse->segment_count_length = ( segment_count * fuse->segment_length );
+	fuse->array_length = ( ( segment_count + CX_FUSE_ARITY - 1 ) *
+			       fuse->segment_length );
+}
+
+/**
+ * Build binary fuse filter
+ *
+ * @v fuse		Binary fuse filter to fill in
+ * @v keys		Keys (need not be distinct)
+ * @v count		Number of keys
+ * @v bits		Fingerprint width (8 or 16)
+ * @ret ok		Success indicator
+ */
+int cx_fuse_build ( struct cx_fuse *fuse, const uint64_t *keys,
+		    unsigned int count, unsigned int bits ) {
+	uint64_t *sorted;
+	uint64_t *order;
+	uint64_t *xhash;
+	uint32_t *alone;
+	uint32_t *start;
+	uint8_t *xcount;
+	uint8_t *which;
+	uint32_t slots[ CX_FUSE_ARITY + 2 ];
+	uint64_t state = 0;
+	uint64_t hash;
+	uint32_t block_bits;
+	uint32_t block;
+	uint32_t queue;
+	uint32_t stack;
+	uint32_t index;
+	uint32_t other;
+	uint32_t fp;
+	unsigned int attempt;
+	unsigned int distinct;
+	unsigned int found;
+	unsigned int i;
+	unsigned int j;
+	int error;
+
+	/* Initialise filter */
+	memset ( fuse, 0, sizeof ( *fuse ) );
+	if ( ( bits != 8 ) && ( bits != 16 ) ) {
+		DBG ( "FUSE unsupported fingerprint width %d\n", bits );
+		goto err_bits;
+	}
+	fuse->bits = bits;
+
+	/* Sort keys to eliminate duplicates */
+	sorted = malloc ( ( count ? count : 1 ) * sizeof ( sorted[0] ) );
+	if ( ! sorted )
+		goto err_alloc_sorted;
+	memcpy ( sorted, keys, ( count * sizeof ( sorted[0] ) ) );
+	qsort ( sorted, count, sizeof ( sorted[0] ), cx_fuse_compare );
+	for ( distinct = 0, i = 0 ; i < count ; i++ ) {
+		if ( ( i == 0 ) || ( sorted[i] != sorted[ i - 1 ] ) )
+			sorted[distinct++] = sorted[i];
+	}
+
+	/* Calculate dimensions */
+	cx_fuse_size ( fuse, distinct );
+	for ( block_bits = 1 ; ( ( 1UL << block_bits ) <
+				 ( fuse->segment_count_length /
+				   fuse->segment_length ) ) ; block_bits++ ) {}
+	block = ( 1UL << block_bits );
+
+	/* Allocate fingerprints and working storage */
+	fuse->fp.raw = calloc ( fuse->array_length, ( bits / 8 ) );
+	if ( ! fuse->fp.raw )
+		goto err_alloc_fp;
+	order = calloc ( ( distinct + 1 ), sizeof ( order[0] ) );
+	if ( ! order )
+		goto err_alloc_order;
+	xhash = calloc ( fuse->array_length, sizeof ( xhash[0] ) );
+	if ( ! xhash )
+		goto err_alloc_xhash;
+	xcount = calloc ( fuse->array_length, sizeof ( xcount[0] ) );
+	if ( ! xcount )
+		goto err_alloc_xcount;
+	alone = malloc ( fuse->array_length * sizeof ( alone[0] ) );
+	if ( ! alone )
+		goto err_alloc_alone;
+	which = malloc ( ( distinct ? distinct : 1 ) * sizeof ( which[0] ) );
+	if ( ! which )
+		goto err_alloc_which;
+	start = malloc ( block * sizeof ( start[0] ) );
+	if ( ! start )
+		goto err_alloc_start;
+
+	/* Attempt construction with successive hash seeds */
+	order[distinct] = 1;
+	for ( attempt = 0 ; ; attempt++ ) {
+
+		/* Fail if construction is repeatedly unsuccessful */
+		if ( attempt == CX_FUSE_MAX_ATTEMPTS ) {
+			DBG ( "FUSE could not construct filter for %d keys\n",
+			      distinct );
+			goto err_construct;
+		}
+		fuse->seed = cx_fuse_next_seed ( &state );
+
+		/* Order hashes approximately by first slot, for locality */
+		for ( i = 0 ; i < block ; i++ ) {
+			start[i] = ( ( ( ( uint64_t ) i ) * distinct ) >>
+				     block_bits );
+		}
+		for ( i = 0 ; i < distinct ; i++ ) {
+			hash = cx_fuse_hash ( fuse, sorted[i] );
+			j = ( hash >> ( 64 - block_bits ) );
+			while ( order[ start[j] ] != 0 )
+				j = ( ( j + 1 ) & ( block - 1 ) );
+			order[ start[j]++ ] = hash;
+		}
+
+		/* Record, for each slot, the number of keys mapping to
+		 * the slot (in the upper six bits), the XOR of the
+		 * positions of those slots within each key's slots (in
+		 * the lower two bits), and the XOR of the hashes.
+		 */
+		error = 0;
+		for ( i = 0 ; i < distinct ; i++ ) {
+			hash = order[i];
+			cx_fuse_slots ( fuse, hash, slots );
+			for ( j = 0 ; j < CX_FUSE_ARITY ; j++ ) {
+				xcount[ slots[j] ] += 4;
+				xcount[ slots[j] ] ^= j;
+				xhash[ slots[j] ] ^= hash;
+				if ( xcount[ slots[j] ] < 4 )
+					error = 1;
+			}
+		}
+
+		/* Peel slots to which only a single key maps */
+		stack = 0;
+		if ( ! error ) {
+			for ( queue = 0, i = 0 ; i < fuse->array_length ;
+			      i++ ) {
+				alone[queue] = i;
+				if ( ( xcount[i] >> 2 ) == 1 )
+					queue++;
+			}
+			while ( queue ) {
+				index = alone[--queue];
+				if ( ( xcount[index] >> 2 ) != 1 )
+					continue;
+				hash = xhash[index];
+				found = ( xcount[index] & 3 );
+				which[stack] = found;
+				order[stack++] = hash;
+				cx_fuse_slots ( fuse, hash, slots );
+				slots[3] = slots[0];
+				slots[4] = slots[1];
+				for ( j = 1 ; j < CX_FUSE_ARITY ; j++ ) {
+					other = slots[ found + j ];
+					alone[queue] = other;
+					if ( ( xcount[other] >> 2 ) == 2 )
+						queue++;
+					xcount[other] -= 4;
+					xcount[other] ^= ( ( found + j ) %
+							   CX_FUSE_ARITY );
+					xhash[other] ^= hash;
+				}
+			}
+		}
+		if ( stack == distinct )
+			break;
+
+		/* Reset working storage */
+		memset ( order, 0, ( distinct * sizeof ( order[0] ) ) );
+		memset ( xhash, 0, ( fuse->array_length *
+				     sizeof ( xhash[0] ) ) );
+		memset ( xcount, 0, ( fuse->array_length *
+				      sizeof ( xcount[0] ) ) );
+	}
+
+	/* Assign fingerprints in reverse peeling order */
+	for ( i = distinct ; i-- ; ) {
+		hash = order[i];
+		found = which[i];
+		cx_fuse_slots ( fuse, hash, slots );
+		slots[3] = slots[0];
+		slots[4] = slots[1];
+		fp = cx_fuse_fingerprint ( hash );
+		if ( bits == 8 ) {
+			fuse->fp.fp8[ slots[found] ] =
+				( fp ^ fuse->fp.fp8[ slots[ found + 1 ] ] ^
+				  fuse->fp.fp8[ slots[ found + 2 ] ] );
+		} else {
+			fuse->fp.fp16[ slots[found] ] =
+				( fp ^ fuse->fp.fp16[ slots[ found + 1 ] ] ^
+				  fuse->fp.fp16[ slots[ found + 2 ] ] );
+		}
+	}
+
+	/* Free working storage */
+	free ( start );
+	free ( which );
+	free ( alone );
+	free ( xcount );
+	free ( xhash );
+	free ( order );
+	free ( sorted );
+
+	return 1;
+
+ err_construct:
+	free ( start );
+ err_alloc_start:
+	free ( which );
+ err_alloc_which:
+	free ( alone );
+ err_alloc_alone:
+	free ( xcount );
+ err_alloc_xcount:
+	free ( xhash );
+ err_alloc_xhash:
+	free ( order );
+ err_alloc_order:
+	free ( fuse->fp.raw );
+	fuse->fp.raw = NULL;
+ err_alloc_fp:
+	free ( sorted );
+ err_alloc_sorted:
+ err_bits:
+	return 0;
+}
+
+/**
+ * Free binary fuse filter
+ *
+ * @v fuse		Binary fuse filter
+ */
+void cx_fuse_free ( struct cx_fuse *fuse ) {
+
+	free ( fuse->fp.raw );
+	memset ( fuse, 0, sizeof ( *fuse ) );
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+#ifndef _CX_FUSE_H
+#define _CX_FUSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** A binary fuse filter */
+struct cx_fuse {
+	/** Hash seed */
+	uint64_t seed;
+	/** Segment length */
+	uint32_t segment_length;
+	/** Segment length mask */
+	uint32_t segment_mask;
+	/** Total length of segments in which a first slot may lie */
+	uint32_t segment_count_length;
+	/** Number of fingerprint slots */
+	uint32_t array_length;
+	/** Fingerprint width (in bits) */
+	unsigned int bits;
+	/** Fingerprints */
+	union {
+		/** 8-bit fingerprints */
+		uint8_t *fp8;
+		/** 16-bit fingerprints */
+		uint16_t *fp16;
+		/** Fingerprint storage */
+		void *raw;
+	} fp;
+};
+
+/**
+ * Mix key into hash
+ *
+ * @v fuse		Binary fuse filter
+ * @v key		Key
+ * @ret hash		Hash
+ */
+static inline uint64_t cx_fuse_hash ( const struct cx_fuse *fuse,
+				      uint64_t key ) {
+	uint64_t hash = ( key + fuse->seed );
+
+	/* Apply MurmurHash3 finaliser */
+	hash ^= ( hash >> 33 );
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= ( hash >> 33 );
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= ( hash >> 33 );
+	return hash;
+}
+
+/**
+ * Calculate fingerprint slots for hash
+ *
+ * @v fuse		Binary fuse filter
+ * @v hash		Hash
+ * @v slots		Fingerprint slots to fill in
+ */
+static inline void cx_fuse_slots ( const struct cx_fuse *fuse,
+				   uint64_t hash, uint32_t *slots ) {
+	uint64_t len = fuse->segment_count_length;
+	uint32_t first;
+
+	/* Calculate most significant half of 64x32-bit product */
+	first = ( ( ( ( hash >> 32 ) * len ) +
+		    ( ( ( hash & 0xffffffffULL ) * len ) >> 32 ) ) >> 32 );
+
+	/* Place slots in consecutive segments */
+	slots[0] = first;
+	slots[1] = ( ( first + fuse->segment_length ) ^
+		     ( ( hash >> 18 ) & fuse->segment_mask ) );
+	slots[2] = ( ( first + ( 2 * fuse->segment_length ) ) ^
+		     ( hash & fuse->segment_mask ) );
+}
+
+/**
+ * Calculate fingerprint for hash
+ *
+ * @v hash		Hash
+ * @ret fp		Fingerprint (not yet truncated to filter width)
+ */
+static inline uint32_t cx_fuse_fingerprint ( uint64_t hash ) {
+
+	return ( hash ^ ( hash >> 32 ) );
+}
+
+/**
+ * Check whether or not key may be present in filter
+ *
+ * @v fuse		Binary fuse filter
+ * @v key		Key
+ * @ret maybe		Key may be present
+ */
+static inline int cx_fuse_contains ( const struct cx_fuse *fuse,
+				     uint64_t key ) {
+	uint64_t hash = cx_fuse_hash ( fuse, key );
+	uint32_t fp = cx_fuse_fingerprint ( hash );
+	uint32_t slots[3];
+
+	/* Compare fingerprint against XOR of slots */
+	cx_fuse_slots ( fuse, hash, slots );
+	if ( fuse->bits == 8 ) {
+		return ( ( ( uint8_t ) ( fp ^ fuse->fp.fp8[ slots[0] ] ^
+					 fuse->fp.fp8[ slots[1] ] ^
+					 fuse->fp.fp8[ slots[2] ] ) ) == 0 );
+	} else {
+		return ( ( ( uint16_t ) ( fp ^ fuse->fp.fp16[ slots[0] ] ^
+					  fuse->fp.fp16[ slots[1] ] ^
+					  fuse->fp.fp16[ slots[2] ] ) ) == 0 );
+	}
+}
+
+extern int cx_fuse_build ( struct cx_fuse *fuse, const uint64_t *keys,
+			   unsigned int count, unsigned int bits );
+
+extern void cx_fuse_free ( struct cx_fuse *fuse );
+
+#endif /* _CX_FUSE_H */
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <openssl/rand.h>
+#include <cx/drbg.h>
+#include <cx/generator.h>
+#include "cxbench.h"
+#include "genbench.h"
+
+/** Number of seed values expanded per batch */
+#define GENBENCH_BATCH 256
+
+/** Engines to be benchmarked */
+static const char *genbench_engines[] = {
+	"openssl",
+	"portable",
+	"aesni",
+	"vaes",
+	"armce",
+};
+
+/**
+ * Benchmark serial seed expansion
+ *
+ * @v name		Benchmark name
+ * @v engine		Engine name
+ * @v type		Generator type
+ * @v seeds		Seed values
+ * @v len		Length of each seed value
+ * @v count		Number of seed values
+ * @v ids		Contact ID buffer
+ * @ret ok		Success indicator
+ */
+static int genbench_serial ( const char *name, const char *engine,
+			     enum cx_generator_type type,
+			     const unsigned char *seeds, size_t len,
+			     unsigned int count, struct cx_contact_id *ids ) {
+	unsigned int max = cx_gen_max_iterations ( type );
+	char subname[32];
+	double start;
+	unsigned int i;
+
+	/* Expand each seed value in turn */
+	start = cxbench_now();
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ! cx_gen_expand ( type, &seeds[ i * len ], len, ids ) )
+			return 0;
+	}
+	snprintf ( subname, sizeof ( subname ), "serial %s", engine );
+	cxbench_report ( name, subname, ( ( unsigned long ) count * max ),
+			 ( cxbench_now() - start ) );
+
+	return 1;
+}
+
+/**
+ * Benchmark multiple seed expansion
+ *
+ * @v name		Benchmark name
+ * @v engine		Engine name
+ * @v type		Generator type
+ * @v seeds		Seed values
+ * @v len		Length of each seed value
+ * @v count		Number of seed values
+ * @v ids		Contact ID buffer
+ * @ret ok		Success indicator
+ */
+static int genbench_multi ( const char *name, const char *engine,
+			    enum cx_generator_type type,
+			    const unsigned char *seeds, size_t len,
+			    unsigned int count, struct cx_contact_id *ids ) {
+	unsigned int max = cx_gen_max_iterations ( type );
+	char subname[32];
+	unsigned int batch;
+	double start;
+	unsigned int i;
+
+	/* Expand seed values in batches */
+	start = cxbench_now();
+	for ( i = 0 ; i < count ; i += batch ) {
+		batch = ( count - i );
+		if ( batch > GENBENCH_BATCH )
+			batch = GENBENCH_BATCH;
+		if ( ! cx_gen_expand_multi ( type, &seeds[ i * len ], len,
+					     batch, ids ) ) {
+			return 0;
+		}
+	}
+	snprintf ( subname, sizeof ( subname ), "multi %s", engine );
+	cxbench_report ( name, subname, ( ( unsigned long ) count * max ),
+			 ( cxbench_now() - start ) );
+
+	return 1;
+}
+
+/**
+ * Run generator benchmarks for a generator type
+ *
+ * @v name		Benchmark name
+ * @v type		Generator type
+ * @v count		Number of seed values
+ * @ret ok		Success indicator
+ */
+static int genbench_type ( const char *name, enum cx_generator_type type,
+			   unsigned int count ) {
+	size_t len = cx_gen_seed_len ( type );
+	unsigned int max = cx_gen_max_iterations ( type );
+	struct cx_contact_id *ids;
+	unsigned char *seeds;
+	const char *engine;
+	unsigned int i;
+	int ok = 0;
+
+	/* Allocate seed values and contact IDs */
+	seeds = malloc ( count * len );
+	ids = calloc ( ( GENBENCH_BATCH * max ), sizeof ( *ids ) );
+	if ( ( ! seeds ) || ( ! ids ) )
+		goto err_alloc;
+
+	/* Generate random seed values */
+	if ( RAND_bytes ( seeds, ( count * len ) ) != 1 )
+		goto err_rand;
+
+	/* Run benchmarks for each engine supported on this CPU */
+	for ( i = 0 ; i < ( sizeof ( genbench_engines ) /
+			    sizeof ( genbench_engines[0] ) ) ; i++ ) {
+		engine = genbench_engines[i];
+		if ( ! cx_set_engine ( engine ) )
+			continue;
+		if ( ! genbench_serial ( name, engine, type, seeds, len,
+					 count, ids ) )
+			goto err_bench;
+		if ( ! genbench_multi ( name, engine, type, seeds, len,
+					count, ids ) )
+			goto err_bench;
+	}
+
+	ok = 1;
+ err_bench:
+	cx_set_engine ( "auto" );
+ err_rand:
+ err_alloc:
+	free ( ids );
+	free ( seeds );
+	return ok;
+}
+
+/**
+ * Run generator benchmarks
+ *
+ * @v count		Number of seed values
+ * @ret ok		Success indicator
+ */
+int genbench ( unsigned int count ) {
+	int ok = 1;
+
+	ok &= genbench_type ( "gen_type1", CX_GEN_AES_128_CTR_2048, count );
+	ok &= genbench_type ( "gen_type2", CX_GEN_AES_256_CTR_2048, count );
+
+	return ok;
+}
@@ -55,12 +55,55 @@
 /** UUID version byte value */
 #define CX_ID_VERSION_V4 0x40
 
+/** Maximum number of seed values expanded concurrently */
+#define CX_GEN_MULTI_BATCH 16
+
+/** Number of contact IDs discarded at a time from each DRBG */
+#define CX_GEN_DISCARD_CHUNK 32
+
 /** A generator */
 struct cx_generator {
 	/** Underlying DRBG */
 	struct cx_drbg *drbg;
+	/** Storage for underlying DRBG */
+	struct cx_drbg_storage drbg_storage;
 };
 
+/* Generator must fit within caller-provided storage */
+_Static_assert ( sizeof ( struct cx_generator ) <=
+		 sizeof ( struct cx_gen_storage ),
+		 "struct cx_gen_storage too small" );
+
+/* Saved generator state is saved DRBG state */
+_Static_assert ( sizeof ( struct cx_gen_state ) ==
+		 sizeof ( struct cx_drbg_state ),
+		 "struct cx_gen_state size mismatch" );
+
+/**
+ * Set reserved bits for RFC 4122 version 4 UUIDs
+ *
+ * @v ids		Contact IDs
+ * @v count		Number of contact IDs
+ *
+ * This is a single pass over a contiguous array with no
+ * loop-carried dependencies, which the compiler is free to
+ * vectorise.
+ */
+static void cx_gen_set_reserved ( struct cx_contact_id *ids,
+				  unsigned int count ) {
+	unsigned int i;
+
+	/* Set reserved bits */
+	for ( i = 0 ; i < count ; i++ ) {
+		ids[i].bytes[CX_ID_VARIANT_BYTE] =
+			( ( ids[i].bytes[CX_ID_VARIANT_BYTE] &
+			    ~CX_ID_VARIANT_MASK ) | CX_ID_VARIANT_RFC4122 );
+		ids[i].bytes[CX_ID_VERSION_BYTE] =
+			( ( ids[i].bytes[CX_ID_VERSION_BYTE] &
+			    ~CX_ID_VERSION_MASK ) | CX_ID_VERSION_V4 );
+	}
+}
+
 /**
  * Get generator seed length
  *
@@ -85,6 +128,48 @@ unsigned int cx_gen_max_iterations ( enum cx_generator_type type ) {
 	return cx_drbg_max_iterations ( type );
 }
 
+/**
+ * Get generator storage size
+ *
+ * @ret len		Storage size
+ *
+ * This is the number of bytes actually required by this build of
+ * the library, and will never exceed sizeof ( struct
+ * cx_gen_storage ).
+ */
+size_t cx_gen_storage_size ( void ) {
+
+	return sizeof ( struct cx_generator );
+}
+
+/**
+ * Instantiate generator in place
+ *
+ * @v storage		Generator storage
+ * @v type		Generator type
+ * @v seed		Seed value
+ * @v len		Seed value length
+ * @ret gen		Generator (or NULL on error)
+ *
+ * No heap memory is allocated.  The generator must eventually be
+ * uninstantiated using cx_gen_fini().
+ */
+struct cx_generator * cx_gen_init ( struct cx_gen_storage *storage,
+				    enum cx_generator_type type,
+				    const void *seed, size_t len ) {
+	struct cx_generator *gen = ( ( struct cx_generator * ) storage );
+
+	/* Instantiate DRBG */
+	gen->drbg = cx_drbg_init ( &gen->drbg_storage, type, seed, len, NULL );
+	if ( ! gen->drbg ) {
+		DBG ( "GEN %p could not instantiate DRBG type %d seed %zd "
+		      "bytes\n", gen, type, len );
+		return NULL;
+	}
+
+	return gen;
+}
+
 /**
  * Instantiate generator
  *
@@ -95,29 +180,26 @@ unsigned int cx_gen_max_iterations ( enum cx_generator_type type ) {
  */
 struct cx_generator * cx_gen_instantiate ( enum cx_generator_type type,
 					   const void *seed, size_t len ) {
+	struct cx_gen_storage *storage;
 	struct cx_generator *gen;
 
-	/* Allocate generator */
-	gen = malloc ( sizeof ( *gen ) );
-	if ( ! gen ) {
+	/* Allocate storage */
+	storage = malloc ( sizeof ( *storage ) );
+	if ( ! storage ) {
 		DBG ( "GEN out of memory\n" );
 		goto err_alloc;
 	}
-	memset ( gen, 0, sizeof ( *gen ) );
 
-	/* Instantiate DRBG */
-	gen->drbg = cx_drbg_instantiate ( type, seed, len, NULL );
-	if ( ! gen->drbg ) {
-		DBG ( "GEN %p could not instantiate DRBG type %d seed %zd "
-		      "bytes\n", gen, type, len );
-		goto err_drbg;
-	}
+	/* Instantiate generator */
+	gen = cx_gen_init ( storage, type, seed, len );
+	if ( ! gen )
+		goto err_init;
 
 	return gen;
 
-	cx_drbg_uninstantiate ( gen->drbg );
- err_drbg:
-	free ( gen );
+	cx_gen_fini ( gen );
+ err_init:
+	free ( storage );
  err_alloc:
 	return NULL;
 }
@@ -139,14 +221,353 @@ int cx_gen_iterate ( struct cx_generator *gen, struct cx_contact_id *id ) {
 	}
 
 	/* Set reserved bits for an RFC 4122 version 4 UUID */
-	id->bytes[CX_ID_VARIANT_BYTE] &= ~CX_ID_VARIANT_MASK;
-	id->bytes[CX_ID_VARIANT_BYTE] |= CX_ID_VARIANT_RFC4122;
-	id->bytes[CX_ID_VERSION_BYTE] &= ~CX_ID_VERSION_MASK;
-	id->bytes[CX_ID_VERSION_BYTE] |= CX_ID_VERSION_V4;
+	cx_gen_set_reserved ( id, 1 );
+
+	return 1;
+}
+
+/**
+ * Iterate generator multiple times
+ *
+ * @v gen		Generator
+ * @v ids		Contact IDs to fill in
+ * @v count		Number of contact IDs
+ * @ret ok		Success indicator
+ *
+ * This is equivalent to calling cx_gen_iterate() @c count times.  If
+ * fewer than @c count iterations remain, then no contact IDs are
+ * generated.
+ */
+int cx_gen_iterate_bulk ( struct cx_generator *gen, struct cx_contact_id *ids,
+			  unsigned int count ) {
+
+	/* Generate random bytes */
+	if ( ! cx_drbg_generate_bulk ( gen->drbg, ids, sizeof ( ids->bytes ),
+				       count ) ) {
+		DBG ( "GEN %p could not generate x%d\n", gen, count );
+		return 0;
+	}
+
+	/* Set reserved bits for RFC 4122 version 4 UUIDs */
+	cx_gen_set_reserved ( ids, count );
 
 	return 1;
 }
 
+/**
+ * Discard contact IDs
+ *
+ * @v drbgs		DRBGs
+ * @v count		Number of DRBGs
+ * @v iterations	Number of contact IDs to discard from each DRBG
+ * @ret ok		Success indicator
+ *
+ * CTR_DRBG has no way to seek forward, and so discarded contact IDs
+ * must still be generated.
+ */
+static int cx_gen_discard ( struct cx_drbg **drbgs, unsigned int count,
+			    unsigned int iterations ) {
+	struct cx_contact_id scratch[ CX_GEN_MULTI_BATCH *
+				      CX_GEN_DISCARD_CHUNK ];
+	unsigned int chunk;
+
+	/* Generate and discard contact IDs in chunks */
+	for ( ; iterations ; iterations -= chunk ) {
+		chunk = iterations;
+		if ( chunk > CX_GEN_DISCARD_CHUNK )
+			chunk = CX_GEN_DISCARD_CHUNK;
+		if ( ! cx_drbg_generate_multi ( drbgs, count, scratch,
+						sizeof ( scratch[0].bytes ),
+						chunk ) ) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Expand seed value into the complete sequence of contact IDs
+ *
+ * @v type		Generator type
+ * @v seed		Seed value
+ * @v len		Seed value length
+ * @v ids		Contact IDs to fill in
+ * @ret ok		Success indicator
+ *
+ * The caller must provide space for cx_gen_max_iterations() contact
+ * IDs.
+ */
+int cx_gen_expand ( enum cx_generator_type type, const void *seed, size_t len,
+		    struct cx_contact_id *ids ) {
+
+	/* Expand complete range */
+	return cx_gen_expand_range ( type, seed, len, NULL, 0,
+				     cx_gen_max_iterations ( type ), ids );
+}
+
+/**
+ * Expand seed value into a range of contact IDs
+ *
+ * @v type		Generator type
+ * @v seed		Seed value
+ * @v len		Seed value length
+ * @v hint		Saved generator state to start from, or NULL
+ * @v first		Index of first contact ID
+ * @v last		Index of last contact ID, plus one
+ * @v ids		Contact IDs to fill in
+ * @ret ok		Success indicator
+ *
+ * The caller must provide space for (@c last - @c first) contact
+ * IDs, which will be filled in with the contact IDs at iterations
+ * @c first to @c last - 1 inclusive.  No contact IDs beyond @c last
+ * are generated.
+ *
+ * Contact IDs before @c first must still be generated (and are then
+ * discarded), since each iteration updates the DRBG state.  If @c
+ * hint is provided, it must have been saved using cx_gen_save() from
+ * a generator instantiated with the same generator type and seed
+ * value.  If the hint is positioned at or before @c first, then
+ * expansion starts from the hint instead of from the seed value, and
+ * the preceding contact IDs are not generated at all.  A hint
+ * positioned after @c first is ignored.
+ */
+int cx_gen_expand_range ( enum cx_generator_type type, const void *seed,
+			  size_t len, const struct cx_gen_state *hint,
+			  unsigned int first, unsigned int last,
+			  struct cx_contact_id *ids ) {
+	struct cx_gen_storage storage;
+	struct cx_generator *gen = NULL;
+	unsigned int position = 0;
+	unsigned int max;
+
+	/* Check range */
+	max = cx_gen_max_iterations ( type );
+	if ( ( ! max ) || ( first > last ) || ( last > max ) ) {
+		DBG ( "GEN type %d invalid range [%d,%d)\n",
+		      type, first, last );
+		goto err_range;
+	}
+
+	/* Start from hint, if usable */
+	if ( hint ) {
+		gen = cx_gen_restore ( &storage, hint );
+		if ( gen ) {
+			position = ( max - cx_drbg_remaining ( gen->drbg ) );
+			if ( ( cx_drbg_type ( gen->drbg ) != type ) ||
+			     ( position > first ) ) {
+				cx_gen_fini ( gen );
+				gen = NULL;
+				position = 0;
+			}
+		}
+	}
+
+	/* Otherwise, instantiate generator from seed */
+	if ( ! gen ) {
+		gen = cx_gen_init ( &storage, type, seed, len );
+		if ( ! gen )
+			goto err_init;
+	}
+
+	/* Discard contact IDs before start of range */
+	if ( ! cx_gen_discard ( &gen->drbg, 1, ( first - position ) ) ) {
+		DBG ( "GEN %p could not discard x%d\n",
+		      gen, ( first - position ) );
+		goto err_discard;
+	}
+
+	/* Generate contact IDs within range */
+	if ( ! cx_gen_iterate_bulk ( gen, ids, ( last - first ) ) )
+		goto err_iterate;
+
+	/* Uninstantiate generator */
+	cx_gen_fini ( gen );
+
+	return 1;
+
+ err_iterate:
+ err_discard:
+	cx_gen_fini ( gen );
+ err_init:
+ err_range:
+	return 0;
+}
+
+/**
+ * Expand multiple seed values into their complete sequences of contact IDs
+ *
+ * @v type		Generator type
+ * @v seeds		Seed values
+ * @v len		Length of each seed value
+ * @v count		Number of seed values
+ * @v ids		Contact IDs to fill in
+ * @ret ok		Success indicator
+ *
+ * The seed values are provided as a contiguous array of @c count
+ * seed values each of length @c len.  The caller must provide space
+ * for @c count times cx_gen_max_iterations() contact IDs, which will
+ * be filled in with the complete sequence for each seed value in
+ * turn.
+ *
+ * The output is identical to calling cx_gen_expand() for each seed
+ * value in turn, but independent seed values are expanded in
+ * lockstep where possible so that their block cipher operations may
+ * be interleaved.
+ */
+int cx_gen_expand_multi ( enum cx_generator_type type, const void *seeds,
+			  size_t len, unsigned int count,
+			  struct cx_contact_id *ids ) {
+
+	/* Expand complete range */
+	return cx_gen_expand_multi_range ( type, seeds, len, count, 0,
+					   cx_gen_max_iterations ( type ),
+					   ids );
+}
+
+/**
+ * Expand multiple seed values into ranges of contact IDs
+ *
+ * @v type		Generator type
+ * @v seeds		Seed values
+ * @v len		Length of each seed value
+ * @v count		Number of seed values
+ * @v first		Index of first contact ID
+ * @v last		Index of last contact ID, plus one
+ * @v ids		Contact IDs to fill in
+ * @ret ok		Success indicator
+ *
+ * The caller must provide space for @c count times (@c last - @c
+ * first) contact IDs, which will be filled in with the range of
+ * contact IDs for each seed value in turn.  The output is identical
+ * to calling cx_gen_expand_range() (with no hint) for each seed
+ * value in turn.
+ */
+int cx_gen_expand_multi_range ( enum cx_generator_type type,
+				const void *seeds, size_t len,
+				unsigned int count, unsigned int first,
+				unsigned int last,
+				struct cx_contact_id *ids ) {
+	struct cx_drbg_storage storage[CX_GEN_MULTI_BATCH];
+	struct cx_drbg *drbgs[CX_GEN_MULTI_BATCH];
+	unsigned int iterations;
+	unsigned int batch;
+	unsigned int max;
+	unsigned int i;
+	unsigned int j;
+	int ok;
+
+	/* Check range */
+	max = cx_gen_max_iterations ( type );
+	if ( ( ! max ) || ( first > last ) || ( last > max ) ) {
+		DBG ( "GEN type %d invalid range [%d,%d)\n",
+		      type, first, last );
+		goto err_range;
+	}
+	iterations = ( last - first );
+
+	/* Expand seed values in batches */
+	for ( i = 0 ; i < count ; i += batch ) {
+
+		/* Instantiate DRBGs */
+		batch = ( count - i );
+		if ( batch > CX_GEN_MULTI_BATCH )
+			batch = CX_GEN_MULTI_BATCH;
+		for ( j = 0 ; j < batch ; j++ ) {
+			drbgs[j] = cx_drbg_init ( &storage[j], type, seeds,
+						  len, NULL );
+			if ( ! drbgs[j] ) {
+				DBG ( "GEN could not instantiate DRBG type %d "
+				      "seed %zd bytes\n", type, len );
+				goto err_instantiate;
+			}
+			seeds += len;
+		}
+
+		/* Discard contact IDs before start of range, and
+		 * generate contact IDs within range.
+		 */
+		ok = ( cx_gen_discard ( drbgs, batch, first ) &&
+		       cx_drbg_generate_multi ( drbgs, batch,
+						&ids[ i * iterations ],
+						sizeof ( ids->bytes ),
+						iterations ) );
+
+		/* Uninstantiate DRBGs */
+		for ( j = 0 ; j < batch ; j++ )
+			cx_drbg_fini ( drbgs[j] );
+		if ( ! ok ) {
+			DBG ( "GEN could not generate [%d,%d) for %d seeds\n",
+			      first, last, batch );
+			goto err_generate;
+		}
+	}
+
+	/* Set reserved bits for RFC 4122 version 4 UUIDs */
+	cx_gen_set_reserved ( ids, ( count * iterations ) );
+
+	return 1;
+
+ err_instantiate:
+	while ( j-- )
+		cx_drbg_fini ( drbgs[j] );
+ err_generate:
+ err_range:
+	return 0;
+}
+
+/**
+ * Save generator state
+ *
+ * @v gen		Generator
+ * @v state		Saved state to fill in
+ * @ret ok		Success indicator
+ *
+ * The saved state records the generator's position within its
+ * sequence of contact IDs, and may later be passed to
+ * cx_gen_restore() to resume iteration from that position without
+ * regenerating any of the preceding contact IDs.
+ *
+ * Generators using the "openssl" engine cannot be saved.
+ */
+int cx_gen_save ( struct cx_generator *gen, struct cx_gen_state *state ) {
+
+	/* Save DRBG state */
+	if ( ! cx_drbg_save ( gen->drbg,
+			      ( ( struct cx_drbg_state * ) state ) ) ) {
+		DBG ( "GEN %p could not save state\n", gen );
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Restore generator in place from saved state
+ *
+ * @v storage		Generator storage
+ * @v state		Saved state
+ * @ret gen		Generator (or NULL on error)
+ *
+ * No heap memory is allocated.  The generator must eventually be
+ * uninstantiated using cx_gen_fini().
+ */
+struct cx_generator * cx_gen_restore ( struct cx_gen_storage *storage,
+				       const struct cx_gen_state *state ) {
+	struct cx_generator *gen = ( ( struct cx_generator * ) storage );
+
+	/* Restore DRBG */
+	gen->drbg = cx_drbg_restore ( &gen->drbg_storage,
+				      ( ( const struct cx_drbg_state * )
+					state ) );
+	if ( ! gen->drbg ) {
+		DBG ( "GEN %p could not restore DRBG\n", gen );
+		return NULL;
+	}
+
+	return gen;
+}
+
 /**
  * Invalidate generator
  *
@@ -158,6 +579,21 @@ void cx_gen_invalidate ( struct cx_generator *gen ) {
 	cx_drbg_invalidate ( gen->drbg );
 }
 
+/**
+ * Uninstantiate generator in place
+ *
+ * @v gen		Generator
+ *
+ * This must be used only for generators instantiated via
+ * cx_gen_init().
+ */
+void cx_gen_fini ( struct cx_generator *gen ) {
+
+	/* Uninstantiate DRBG */
+	cx_drbg_fini ( gen->drbg );
+	gen->drbg = NULL;
+}
+
 /**
  * Uninstantiate generator
  *
@@ -165,8 +601,8 @@ void cx_gen_invalidate ( struct cx_generator *gen ) {
  */
 void cx_gen_uninstantiate ( struct cx_generator *gen ) {
 
-	/* Uninstantiate DRBG */
-	cx_drbg_uninstantiate ( gen->drbg );
+	/* Uninstantiate generator */
+	cx_gen_fini ( gen );
 
 	/* Free generator */
 	free ( gen );
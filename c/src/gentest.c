@@ -24,8 +24,10 @@
  * and the licenses of the other code concerned.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <cx/drbg.h>
 #include <cx/generator.h>
 #include "cxtest.h"
 #include "gentest.h"
@@ -45,7 +47,11 @@
 static int gentest ( const char *name, enum cx_generator_type type,
 		     const unsigned char *seed, size_t len, unsigned int max,
 		     const uuid_t *first, const uuid_t *last ) {
+	struct cx_contact_id ids[max];
+	struct cx_gen_storage storage;
+	struct cx_generator *inplace;
 	struct cx_generator *gen;
+	struct cx_contact_id inplace_id;
 	struct cx_contact_id id;
 	const uuid_t *ref;
 	unsigned int count;
@@ -65,6 +71,18 @@ static int gentest ( const char *name, enum cx_generator_type type,
 		goto err_max_iterations;
 	}
 
+	/* Expand seed value in bulk */
+	if ( ! cx_gen_expand ( type, seed, len, ids ) ) {
+		fprintf ( stderr, "GEN %s fail: could not expand\n", name );
+		goto err_expand;
+	}
+
+	/* Test storage size */
+	if ( cx_gen_storage_size() > sizeof ( storage ) ) {
+		fprintf ( stderr, "GEN %s fail: storage too small\n", name );
+		goto err_storage_size;
+	}
+
 	/* Instantiate generator */
 	gen = cx_gen_instantiate ( type, seed, len );
 	if ( ! gen ) {
@@ -73,6 +91,14 @@ static int gentest ( const char *name, enum cx_generator_type type,
 		goto err_instantiate;
 	}
 
+	/* Instantiate generator in place */
+	inplace = cx_gen_init ( &storage, type, seed, len );
+	if ( ! inplace ) {
+		fprintf ( stderr, "GEN %s fail: could not instantiate in "
+			  "place\n", name );
+		goto err_init;
+	}
+
 	/* Test iteration */
 	for ( count = 0 ; count < max ; count++ ) {
 
@@ -101,6 +127,25 @@ static int gentest ( const char *name, enum cx_generator_type type,
 				goto err_mismatch;
 			}
 		}
+
+		/* Compare against bulk expansion */
+		ok = ( memcmp ( id.bytes, ids[count].bytes,
+				sizeof ( id.bytes ) ) == 0 );
+		if ( ! ok ) {
+			fprintf ( stderr, "GEN %s fail: ID %d bulk mismatch\n",
+				  name, count );
+			goto err_bulk;
+		}
+
+		/* Compare against in-place generator */
+		ok = ( cx_gen_iterate ( inplace, &inplace_id ) &&
+		       ( memcmp ( id.bytes, inplace_id.bytes,
+				  sizeof ( id.bytes ) ) == 0 ) );
+		if ( ! ok ) {
+			fprintf ( stderr, "GEN %s fail: ID %d in-place "
+				  "mismatch\n", name, count );
+			goto err_inplace;
+		}
 	}
 
 	/* Test iteration limit */
@@ -110,23 +155,430 @@ static int gentest ( const char *name, enum cx_generator_type type,
 			  name, max );
 		goto err_limit;
 	}
+	ok = cx_gen_iterate_bulk ( gen, &id, 1 );
+	if ( ok ) {
+		fprintf ( stderr, "GEN %s fail: could bulk iterate over x%d\n",
+			  name, max );
+		goto err_limit;
+	}
+
+	ok = cx_gen_iterate ( inplace, &inplace_id );
+	if ( ok ) {
+		fprintf ( stderr, "GEN %s fail: could iterate in place over "
+			  "x%d\n", name, max );
+		goto err_limit;
+	}
 
-	/* Uninstantiate generator */
+	/* Uninstantiate generators */
+	cx_gen_fini ( inplace );
 	cx_gen_uninstantiate ( gen );
 
 	fprintf ( stderr, "GEN %s ok\n", name );
 	return 1;
 
  err_limit:
+ err_inplace:
+ err_bulk:
  err_mismatch:
  err_iterate:
+	cx_gen_fini ( inplace );
+ err_init:
 	cx_gen_uninstantiate ( gen );
  err_instantiate:
+ err_storage_size:
+ err_expand:
  err_max_iterations:
  err_seed_len:
 	return 0;
 }
 
+/** Number of seed values used for multiple seed expansion self-tests
+ *
+ * This is deliberately not a multiple of any kernel width.
+ */
+#define GENTEST_MULTI_COUNT 19
+
+/**
+ * Run a multiple seed expansion self-test
+ *
+ * @v name		Test name
+ * @v type		Generator type
+ * @v seed		Base seed value
+ * @v len		Length of seed value
+ * @ret ok		Success indicator
+ */
+static int gentest_multi ( const char *name, enum cx_generator_type type,
+			   const unsigned char *seed, size_t len ) {
+	unsigned char seeds[GENTEST_MULTI_COUNT][len];
+	struct cx_contact_id *multi;
+	struct cx_contact_id *single;
+	unsigned int max = cx_gen_max_iterations ( type );
+	unsigned int i;
+
+	/* Allocate contact IDs */
+	multi = calloc ( ( GENTEST_MULTI_COUNT * max ), sizeof ( *multi ) );
+	if ( ! multi ) {
+		fprintf ( stderr, "GEN %s multi fail: out of memory\n", name );
+		goto err_alloc_multi;
+	}
+	single = calloc ( max, sizeof ( *single ) );
+	if ( ! single ) {
+		fprintf ( stderr, "GEN %s multi fail: out of memory\n", name );
+		goto err_alloc_single;
+	}
+
+	/* Construct distinct seed values */
+	for ( i = 0 ; i < GENTEST_MULTI_COUNT ; i++ ) {
+		memcpy ( seeds[i], seed, len );
+		seeds[i][0] ^= i;
+	}
+
+	/* Expand all seed values */
+	if ( ! cx_gen_expand_multi ( type, seeds, len, GENTEST_MULTI_COUNT,
+				     multi ) ) {
+		fprintf ( stderr, "GEN %s multi fail: could not expand\n",
+			  name );
+		goto err_expand_multi;
+	}
+
+	/* Compare against individual expansion */
+	for ( i = 0 ; i < GENTEST_MULTI_COUNT ; i++ ) {
+		if ( ! cx_gen_expand ( type, seeds[i], len, single ) ) {
+			fprintf ( stderr, "GEN %s multi fail: could not "
+				  "expand seed %d\n", name, i );
+			goto err_expand;
+		}
+		if ( memcmp ( single, &multi[ i * max ],
+			      ( max * sizeof ( *single ) ) ) != 0 ) {
+			fprintf ( stderr, "GEN %s multi fail: seed %d "
+				  "mismatch\n", name, i );
+			goto err_mismatch;
+		}
+	}
+
+	/* Free contact IDs */
+	free ( single );
+	free ( multi );
+
+	fprintf ( stderr, "GEN %s multi ok\n", name );
+	return 1;
+
+ err_mismatch:
+ err_expand:
+ err_expand_multi:
+	free ( single );
+ err_alloc_single:
+	free ( multi );
+ err_alloc_multi:
+	return 0;
+}
+
+/** Iteration counts at which to save and restore generator state */
+static const unsigned int gentest_resume_points[] = { 0, 1, 1500, 2048 };
+
+/**
+ * Run a generator save and restore self-test
+ *
+ * @v name		Test name
+ * @v type		Generator type
+ * @v seed		Seed value
+ * @v len		Length of seed value
+ * @ret ok		Success indicator
+ */
+static int gentest_resume ( const char *name, enum cx_generator_type type,
+			    const unsigned char *seed, size_t len ) {
+	struct cx_gen_storage storage;
+	struct cx_gen_state state;
+	struct cx_generator *gen;
+	struct cx_contact_id *ids;
+	struct cx_contact_id *resumed;
+	struct cx_contact_id extra;
+	unsigned int max = cx_gen_max_iterations ( type );
+	unsigned int point;
+	unsigned int i;
+	int saveable;
+
+	/* The OpenSSL engine's internal state is not accessible */
+	saveable = ( strcmp ( cx_engine_name(), "openssl" ) != 0 );
+
+	/* Allocate contact IDs */
+	ids = calloc ( max, sizeof ( *ids ) );
+	if ( ! ids ) {
+		fprintf ( stderr, "GEN %s resume fail: out of memory\n",
+			  name );
+		goto err_alloc_ids;
+	}
+	resumed = calloc ( max, sizeof ( *resumed ) );
+	if ( ! resumed ) {
+		fprintf ( stderr, "GEN %s resume fail: out of memory\n",
+			  name );
+		goto err_alloc_resumed;
+	}
+
+	/* Expand seed value */
+	if ( ! cx_gen_expand ( type, seed, len, ids ) ) {
+		fprintf ( stderr, "GEN %s resume fail: could not expand\n",
+			  name );
+		goto err_expand;
+	}
+
+	/* Test each resume point */
+	for ( i = 0 ; i < ( sizeof ( gentest_resume_points ) /
+			    sizeof ( gentest_resume_points[0] ) ) ; i++ ) {
+		point = gentest_resume_points[i];
+
+		/* Iterate generator up to resume point and save state */
+		gen = cx_gen_init ( &storage, type, seed, len );
+		if ( ! gen ) {
+			fprintf ( stderr, "GEN %s resume fail: could not "
+				  "instantiate\n", name );
+			goto err_init;
+		}
+		if ( ! cx_gen_iterate_bulk ( gen, resumed, point ) ) {
+			fprintf ( stderr, "GEN %s resume fail: could not "
+				  "iterate x%d\n", name, point );
+			goto err_iterate;
+		}
+		if ( cx_gen_save ( gen, &state ) != saveable ) {
+			fprintf ( stderr, "GEN %s resume fail: unexpected "
+				  "save result at %d\n", name, point );
+			goto err_save;
+		}
+		cx_gen_fini ( gen );
+		if ( ! saveable )
+			continue;
+
+		/* Restore generator and complete the sequence */
+		gen = cx_gen_restore ( &storage, &state );
+		if ( ! gen ) {
+			fprintf ( stderr, "GEN %s resume fail: could not "
+				  "restore at %d\n", name, point );
+			goto err_restore;
+		}
+		if ( ! cx_gen_iterate_bulk ( gen, &resumed[point],
+					     ( max - point ) ) ) {
+			fprintf ( stderr, "GEN %s resume fail: could not "
+				  "iterate from %d\n", name, point );
+			goto err_iterate;
+		}
+		if ( cx_gen_iterate ( gen, &extra ) ) {
+			fprintf ( stderr, "GEN %s resume fail: iterated past "
+				  "end from %d\n", name, point );
+			goto err_iterate;
+		}
+		cx_gen_fini ( gen );
+
+		/* Compare against uninterrupted expansion */
+		if ( memcmp ( resumed, ids,
+			      ( max * sizeof ( *ids ) ) ) != 0 ) {
+			fprintf ( stderr, "GEN %s resume fail: mismatch from "
+				  "%d\n", name, point );
+			goto err_mismatch;
+		}
+	}
+
+	/* Test rejection of an unsupported version */
+	if ( saveable ) {
+		state.bytes[0] ^= 0xff;
+		if ( cx_gen_restore ( &storage, &state ) ) {
+			fprintf ( stderr, "GEN %s resume fail: accepted bad "
+				  "version\n", name );
+			cx_gen_fini ( ( struct cx_generator * ) &storage );
+			goto err_version;
+		}
+	}
+
+	/* Free contact IDs */
+	free ( resumed );
+	free ( ids );
+
+	fprintf ( stderr, "GEN %s resume ok\n", name );
+	return 1;
+
+ err_iterate:
+ err_save:
+	cx_gen_fini ( gen );
+ err_version:
+ err_mismatch:
+ err_restore:
+ err_init:
+ err_expand:
+	free ( resumed );
+ err_alloc_resumed:
+	free ( ids );
+ err_alloc_ids:
+	return 0;
+}
+
+/** A generator expansion range self-test */
+struct gentest_range {
+	/** Index of first contact ID */
+	unsigned int first;
+	/** Index of last contact ID, plus one */
+	unsigned int last;
+	/** Iteration count at which to save a hint */
+	unsigned int hint;
+};
+
+/** Expansion ranges to test */
+static const struct gentest_range gentest_ranges[] = {
+	{ 0, 2048, 0 },
+	{ 0, 0, 0 },
+	{ 0, 1, 0 },
+	{ 1500, 2048, 1000 },
+	{ 1500, 2048, 1500 },
+	{ 100, 200, 150 },
+	{ 100, 1700, 2048 },
+	{ 2047, 2048, 1 },
+	{ 2048, 2048, 2048 },
+};
+
+/** Number of copies of the seed value used for multiple range expansion */
+#define GENTEST_RANGE_COPIES 3
+
+/**
+ * Run a generator range expansion self-test
+ *
+ * @v name		Test name
+ * @v type		Generator type
+ * @v seed		Seed value
+ * @v len		Length of seed value
+ * @ret ok		Success indicator
+ */
+static int gentest_range ( const char *name, enum cx_generator_type type,
+			   const unsigned char *seed, size_t len ) {
+	unsigned char seeds[GENTEST_RANGE_COPIES][len];
+	const struct gentest_range *range;
+	struct cx_gen_storage storage;
+	struct cx_gen_state state;
+	struct cx_generator *gen;
+	struct cx_contact_id *ids;
+	struct cx_contact_id *ranged;
+	unsigned int max = cx_gen_max_iterations ( type );
+	unsigned int count;
+	unsigned int i;
+	unsigned int j;
+	int saved;
+
+	/* Allocate contact IDs */
+	ids = calloc ( max, sizeof ( *ids ) );
+	if ( ! ids ) {
+		fprintf ( stderr, "GEN %s range fail: out of memory\n", name );
+		goto err_alloc_ids;
+	}
+	ranged = calloc ( ( GENTEST_RANGE_COPIES * max ),
+			  sizeof ( *ranged ) );
+	if ( ! ranged ) {
+		fprintf ( stderr, "GEN %s range fail: out of memory\n", name );
+		goto err_alloc_ranged;
+	}
+
+	/* Construct identical seed values */
+	for ( i = 0 ; i < GENTEST_RANGE_COPIES ; i++ )
+		memcpy ( seeds[i], seed, len );
+
+	/* Expand seed value */
+	if ( ! cx_gen_expand ( type, seed, len, ids ) ) {
+		fprintf ( stderr, "GEN %s range fail: could not expand\n",
+			  name );
+		goto err_expand;
+	}
+
+	/* Test each range */
+	for ( i = 0 ; i < ( sizeof ( gentest_ranges ) /
+			    sizeof ( gentest_ranges[0] ) ) ; i++ ) {
+		range = &gentest_ranges[i];
+		count = ( range->last - range->first );
+
+		/* Expand range without hint */
+		memset ( ranged, 0, ( max * sizeof ( *ranged ) ) );
+		if ( ( ! cx_gen_expand_range ( type, seed, len, NULL,
+					       range->first, range->last,
+					       ranged ) ) ||
+		     ( memcmp ( ranged, &ids[range->first],
+				( count * sizeof ( *ranged ) ) ) != 0 ) ) {
+			fprintf ( stderr, "GEN %s range fail: [%d,%d) "
+				  "mismatch\n", name, range->first,
+				  range->last );
+			goto err_mismatch;
+		}
+
+		/* Save hint, where supported by the engine */
+		gen = cx_gen_init ( &storage, type, seed, len );
+		if ( ! gen ) {
+			fprintf ( stderr, "GEN %s range fail: could not "
+				  "instantiate\n", name );
+			goto err_init;
+		}
+		saved = ( cx_gen_iterate_bulk ( gen, ranged, range->hint ) &&
+			  cx_gen_save ( gen, &state ) );
+		cx_gen_fini ( gen );
+
+		/* Expand range with hint */
+		memset ( ranged, 0, ( max * sizeof ( *ranged ) ) );
+		if ( saved &&
+		     ( ( ! cx_gen_expand_range ( type, seed, len, &state,
+						 range->first, range->last,
+						 ranged ) ) ||
+		       ( memcmp ( ranged, &ids[range->first],
+				  ( count * sizeof ( *ranged ) ) ) != 0 ) ) ) {
+			fprintf ( stderr, "GEN %s range fail: [%d,%d) hint %d "
+				  "mismatch\n", name, range->first,
+				  range->last, range->hint );
+			goto err_mismatch;
+		}
+
+		/* Expand range for multiple seed values */
+		memset ( ranged, 0, ( max * sizeof ( *ranged ) ) );
+		if ( ! cx_gen_expand_multi_range ( type, seeds, len,
+						   GENTEST_RANGE_COPIES,
+						   range->first, range->last,
+						   ranged ) ) {
+			fprintf ( stderr, "GEN %s range fail: [%d,%d) could "
+				  "not expand multiple\n", name,
+				  range->first, range->last );
+			goto err_mismatch;
+		}
+		for ( j = 0 ; j < GENTEST_RANGE_COPIES ; j++ ) {
+			if ( memcmp ( &ranged[ j * count ], &ids[range->first],
+				      ( count * sizeof ( *ranged ) ) ) != 0 ) {
+				fprintf ( stderr, "GEN %s range fail: [%d,%d) "
+					  "copy %d mismatch\n", name,
+					  range->first, range->last, j );
+				goto err_mismatch;
+			}
+		}
+	}
+
+	/* Test rejection of invalid ranges */
+	if ( cx_gen_expand_range ( type, seed, len, NULL, 2, 1, ranged ) ||
+	     cx_gen_expand_range ( type, seed, len, NULL, 0, ( max + 1 ),
+				   ranged ) ||
+	     cx_gen_expand_multi_range ( type, seeds, len, 1, 2, 1,
+					 ranged ) ) {
+		fprintf ( stderr, "GEN %s range fail: accepted invalid "
+			  "range\n", name );
+		goto err_invalid;
+	}
+
+	/* Free contact IDs */
+	free ( ranged );
+	free ( ids );
+
+	fprintf ( stderr, "GEN %s range ok\n", name );
+	return 1;
+
+ err_invalid:
+ err_init:
+ err_mismatch:
+ err_expand:
+	free ( ranged );
+ err_alloc_ranged:
+	free ( ids );
+ err_alloc_ids:
+	return 0;
+}
+
 /**
  * Run a standard generator self-test
  *
@@ -140,6 +592,39 @@ static int gentest ( const char *name, enum cx_generator_type type,
 		  sizeof ( prefix ## _seed ), max,			\
 		  &prefix ## _first_id, &prefix ## _last_id )
 
+/**
+ * Run a standard multiple seed expansion self-test
+ *
+ * @v type		Generator type
+ * @v prefix		Self-test variable prefix
+ * @ret ok		Success indicator
+ */
+#define gentest_multi_std( type, prefix )				\
+	gentest_multi ( #prefix, type, prefix ## _seed,			\
+			sizeof ( prefix ## _seed ) )
+
+/**
+ * Run a standard generator save and restore self-test
+ *
+ * @v type		Generator type
+ * @v prefix		Self-test variable prefix
+ * @ret ok		Success indicator
+ */
+#define gentest_resume_std( type, prefix )				\
+	gentest_resume ( #prefix, type, prefix ## _seed,		\
+			 sizeof ( prefix ## _seed ) )
+
+/**
+ * Run a standard generator range expansion self-test
+ *
+ * @v type		Generator type
+ * @v prefix		Self-test variable prefix
+ * @ret ok		Success indicator
+ */
+#define gentest_range_std( type, prefix )				\
+	gentest_range ( #prefix, type, prefix ## _seed,			\
+			sizeof ( prefix ## _seed ) )
+
 /**
  * Run generator self-tests
  *
@@ -153,6 +638,12 @@ int gentests ( void ) {
 	ok &= gentest_std ( CX_GEN_AES_128_CTR_2048, gen_type1_test2, 2048 );
 	ok &= gentest_std ( CX_GEN_AES_256_CTR_2048, gen_type2_test1, 2048 );
 	ok &= gentest_std ( CX_GEN_AES_256_CTR_2048, gen_type2_test2, 2048 );
+	ok &= gentest_multi_std ( CX_GEN_AES_128_CTR_2048, gen_type1_test1 );
+	ok &= gentest_multi_std ( CX_GEN_AES_256_CTR_2048, gen_type2_test1 );
+	ok &= gentest_resume_std ( CX_GEN_AES_128_CTR_2048, gen_type1_test1 );
+	ok &= gentest_resume_std ( CX_GEN_AES_256_CTR_2048, gen_type2_test1 );
+	ok &= gentest_range_std ( CX_GEN_AES_128_CTR_2048, gen_type1_test1 );
+	ok &= gentest_range_std ( CX_GEN_AES_256_CTR_2048, gen_type2_test1 );
 
 	return ok;
 }
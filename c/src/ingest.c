@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Sighting deduplication
+ *
+ ******************************************************************************
+ *
+ * A nearby advertiser is typically heard many times per minute, and
+ * so a raw stream of observations is dominated by repeated sightings
+ * of the same contact ID.  An ingest table sits in front of any
+ * observation storage and collapses repeated sightings into a single
+ * record holding the first-seen and last-seen timestamps and the
+ * number of sightings.
+ *
+ * The table is an open-addressed hash table with linear probing,
+ * allocated once at creation time to hold a fixed number of distinct
+ * contact IDs.  Contact IDs are the output of a block cipher and so
+ * are hashed by simply folding the two halves together; a
+ * multiplicative step spreads any contact IDs that are not uniformly
+ * distributed.
+ *
+ * Buffered sightings are passed to the flush function in batches,
+ * and the table emptied, whenever the table is full, whenever the
+ * configured time window has elapsed since the earliest buffered
+ * sighting, or when explicitly requested.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <cx/ingest.h>
+#include "debug.h"
+
+/** Default number of distinct contact IDs */
+#define CX_INGEST_DEFAULT_CAPACITY 4096
+
+/** Maximum number of distinct contact IDs */
+#define CX_INGEST_MAX_CAPACITY ( 1U << 28 )
+
+/** Number of sightings passed to each call to the flush function */
+#define CX_INGEST_BATCH 256
+
+/** Multiplier used to spread hash values */
+#define CX_INGEST_MULTIPLIER 0x9e3779b97f4a7c15ULL
+
+/** An ingest table */
+struct cx_ingest {
+	/** Hash table slots (an empty slot has a zero count) */
+	struct cx_sighting *slots;
+	/** Number of hash table slots (a power of two) */
+	unsigned int size;
+	/** Shift applied to hash values */
+	unsigned int shift;
+	/** Maximum number of distinct contact IDs */
+	unsigned int capacity;
+	/** Number of distinct contact IDs */
+	unsigned int count;
+	/** Flush time window, or zero for no time window */
+	uint64_t window;
+	/** Earliest buffered timestamp */
+	uint64_t start;
+	/** Flush function */
+	int ( * flush ) ( void *ctx, const struct cx_sighting *sightings,
+			  unsigned int count );
+	/** Flush function context */
+	void *ctx;
+	/** Flush batch */
+	struct cx_sighting batch[CX_INGEST_BATCH];
+};
+
+/**
+ * Calculate hash table slot for contact ID
+ *
+ * @v ingest		Ingest table
+ * @v id		Contact ID
+ * @ret index		Preferred slot index
+ */
+static inline unsigned int cx_ingest_hash ( struct cx_ingest *ingest,
+					    const struct cx_contact_id *id ) {
+	uint64_t hi;
+	uint64_t lo;
+
+	memcpy ( &hi, &id->bytes[0], sizeof ( hi ) );
+	memcpy ( &lo, &id->bytes[8], sizeof ( lo ) );
+	return ( ( ( hi ^ lo ) * CX_INGEST_MULTIPLIER ) >> ingest->shift );
+}
+
+/**
+ * Find hash table slot for contact ID
+ *
+ * @v ingest		Ingest table
+ * @v id		Contact ID
+ * @ret slot		Matching slot, or empty slot if not present
+ */
+static struct cx_sighting * cx_ingest_find ( struct cx_ingest *ingest,
+					     const struct cx_contact_id *id ) {
+	unsigned int mask = ( ingest->size - 1 );
+	struct cx_sighting *slot;
+	unsigned int index;
+
+	/* There is always at least one empty slot, so this terminates */
+	for ( index = cx_ingest_hash ( ingest, id ) ; ;
+	      index = ( ( index + 1 ) & mask ) ) {
+		slot = &ingest->slots[index];
+		if ( ( ! slot->count ) ||
+		     ( memcmp ( &slot->id, id, sizeof ( *id ) ) == 0 ) )
+			return slot;
+	}
+}
+
+/**
+ * Rebuild hash table after removing entries
+ *
+ * @v ingest		Ingest table
+ *
+ * Removing an entry from a linearly probed table may break the probe
+ * sequence for any entries following it in the same cluster.  Each
+ * remaining entry is therefore removed and reinserted, starting from
+ * an empty slot so that each cluster is processed from its start.
+ */
+static void cx_ingest_rehash ( struct cx_ingest *ingest ) {
+	unsigned int mask = ( ingest->size - 1 );
+	struct cx_sighting sighting;
+	struct cx_sighting *slot;
+	unsigned int empty;
+	unsigned int index;
+	unsigned int i;
+
+	/* Find an empty slot */
+	for ( empty = 0 ; ingest->slots[empty].count ; empty++ ) {}
+
+	/* Reinsert each entry in probe order */
+	for ( i = 1 ; i <= ingest->size ; i++ ) {
+		index = ( ( empty + i ) & mask );
+		slot = &ingest->slots[index];
+		if ( ! slot->count )
+			continue;
+		memcpy ( &sighting, slot, sizeof ( sighting ) );
+		slot->count = 0;
+		slot = cx_ingest_find ( ingest, &sighting.id );
+		memcpy ( slot, &sighting, sizeof ( *slot ) );
+	}
+}
+
+/**
+ * Create ingest table
+ *
+ * @v capacity		Maximum number of distinct contact IDs to buffer,
+ *			or zero to use the default
+ * @v window		Maximum time span to buffer (in the same units as
+ *			sighting timestamps), or zero for no limit
+ * @v flush		Flush function
+ * @v ctx		Flush function context
+ * @ret ingest		Ingest table, or NULL on error
+ *
+ * The flush function is called with batches of deduplicated
+ * sightings, and must return a success indicator.
+ */
+struct cx_ingest *
+cx_ingest_create ( unsigned int capacity, uint64_t window,
+		   int ( * flush ) ( void *ctx,
+				     const struct cx_sighting *sightings,
+				     unsigned int count ),
+		   void *ctx ) {
+	struct cx_ingest *ingest;
+	unsigned int bits;
+
+	/* Use default capacity if applicable */
+	if ( ! capacity )
+		capacity = CX_INGEST_DEFAULT_CAPACITY;
+	if ( capacity > CX_INGEST_MAX_CAPACITY ) {
+		DBG ( "INGEST capacity %u too large\n", capacity );
+		goto err_capacity;
+	}
+
+	/* Allocate and initialise structure */
+	ingest = malloc ( sizeof ( *ingest ) );
+	if ( ! ingest )
+		goto err_alloc;
+	memset ( ingest, 0, sizeof ( *ingest ) );
+	ingest->capacity = capacity;
+	ingest->window = window;
+	ingest->flush = flush;
+	ingest->ctx = ctx;
+
+	/* Size hash table for a maximum load factor of 3/4, which also
+	 * guarantees that at least one slot is always empty.
+	 */
+	for ( bits = 1 ; ( ( 3ULL << bits ) < ( 4ULL * capacity ) ) ;
+	      bits++ ) {}
+	ingest->size = ( 1U << bits );
+	ingest->shift = ( 64 - bits );
+
+	/* Allocate hash table */
+	ingest->slots = calloc ( ingest->size, sizeof ( ingest->slots[0] ) );
+	if ( ! ingest->slots )
+		goto err_alloc_slots;
+
+	DBG ( "INGEST %p capacity %u using %u slots\n",
+	      ingest, capacity, ingest->size );
+	return ingest;
+
+	free ( ingest->slots );
+ err_alloc_slots:
+	free ( ingest );
+ err_alloc:
+ err_capacity:
+	return NULL;
+}
+
+/**
+ * Flush buffered sightings
+ *
+ * @v ingest		Ingest table
+ * @ret ok		Success indicator
+ *
+ * On failure, any sightings already accepted by the flush function
+ * are removed and all other sightings remain buffered.
+ */
+int cx_ingest_flush ( struct cx_ingest *ingest ) {
+	struct cx_sighting *slot;
+	unsigned int done = 0;
+	unsigned int fill = 0;
+	unsigned int i;
+	unsigned int j;
+
+	/* Pass sightings to flush function in batches */
+	for ( i = 0 ; i < ingest->size ; i++ ) {
+		slot = &ingest->slots[i];
+		if ( ! slot->count )
+			continue;
+		memcpy ( &ingest->batch[fill++], slot,
+			 sizeof ( ingest->batch[0] ) );
+		if ( ( fill == CX_INGEST_BATCH ) ||
+		     ( ( done + fill ) == ingest->count ) ) {
+			if ( ! ingest->flush ( ingest->ctx, ingest->batch,
+					       fill ) )
+				goto err_flush;
+			done += fill;
+			fill = 0;
+		}
+	}
+
+	/* Empty table */
+	memset ( ingest->slots, 0,
+		 ( ingest->size * sizeof ( ingest->slots[0] ) ) );
+	ingest->count = 0;
+	return 1;
+
+ err_flush:
+	DBG ( "INGEST %p could not flush (%u of %u flushed)\n",
+	      ingest, done, ingest->count );
+	/* Remove sightings accepted by earlier batches.  These are
+	 * exactly the occupied slots preceding the failed batch.
+	 */
+	if ( done ) {
+		for ( j = 0 ; ( ( j < i ) && done ) ; j++ ) {
+			slot = &ingest->slots[j];
+			if ( ! slot->count )
+				continue;
+			slot->count = 0;
+			ingest->count--;
+			done--;
+		}
+		cx_ingest_rehash ( ingest );
+	}
+	return 0;
+}
+
+/**
+ * Add sighting
+ *
+ * @v ingest		Ingest table
+ * @v id		Sighted contact ID
+ * @v time		Timestamp (in caller-defined units)
+ * @ret ok		Success indicator
+ *
+ * Buffered sightings are flushed first if the table is full, or if
+ * the time window has elapsed since the earliest buffered sighting.
+ * The sighting is discarded if this flush fails.
+ */
+int cx_ingest_add ( struct cx_ingest *ingest,
+		    const struct cx_contact_id *id, uint64_t time ) {
+	struct cx_sighting *slot;
+
+	/* Flush if time window has elapsed */
+	if ( ingest->window && ingest->count &&
+	     ( time >= ingest->start ) &&
+	     ( ( time - ingest->start ) >= ingest->window ) ) {
+		if ( ! cx_ingest_flush ( ingest ) )
+			return 0;
+	}
+
+	/* Update existing entry, if any */
+	slot = cx_ingest_find ( ingest, id );
+	if ( slot->count ) {
+		if ( time < slot->first )
+			slot->first = time;
+		if ( time > slot->last )
+			slot->last = time;
+		if ( slot->count < UINT_MAX )
+			slot->count++;
+		if ( time < ingest->start )
+			ingest->start = time;
+		return 1;
+	}
+
+	/* Flush if table is full */
+	if ( ingest->count == ingest->capacity ) {
+		if ( ! cx_ingest_flush ( ingest ) )
+			return 0;
+		slot = cx_ingest_find ( ingest, id );
+	}
+
+	/* Create new entry */
+	memcpy ( &slot->id, id, sizeof ( slot->id ) );
+	slot->first = time;
+	slot->last = time;
+	slot->count = 1;
+	if ( ( ! ingest->count ) || ( time < ingest->start ) )
+		ingest->start = time;
+	ingest->count++;
+	return 1;
+}
+
+/**
+ * Get number of buffered distinct contact IDs
+ *
+ * @v ingest		Ingest table
+ * @ret count		Number of buffered distinct contact IDs
+ */
+unsigned int cx_ingest_count ( struct cx_ingest *ingest ) {
+
+	return ingest->count;
+}
+
+/**
+ * Free ingest table
+ *
+ * @v ingest		Ingest table
+ *
+ * Any buffered sightings are discarded; call cx_ingest_flush() first
+ * to retain them.
+ */
+void cx_ingest_free ( struct cx_ingest *ingest ) {
+
+	/* Do nothing if freeing a NULL pointer */
+	if ( ! ingest )
+		return;
+
+	free ( ingest->slots );
+	free ( ingest );
+}
@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Sighting deduplication self-tests
+ *
+ ******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <cx/ingest.h>
+#include "cxtest.h"
+#include "ingesttest.h"
+
+/** Maximum number of distinct contact IDs */
+#define INGESTTEST_MAX_IDS 1024
+
+/** Maximum number of flushed sightings */
+#define INGESTTEST_MAX_FLUSHED 4096
+
+/** Flushed sightings */
+struct ingesttest_flushed {
+	/** Sightings */
+	struct cx_sighting sightings[INGESTTEST_MAX_FLUSHED];
+	/** Number of sightings */
+	unsigned int count;
+	/** Number of calls to flush function */
+	unsigned int calls;
+	/** Call number at which to fail, or zero to never fail */
+	unsigned int fail;
+};
+
+/** An ingest self-test */
+struct ingesttest {
+	/** Test name */
+	const char *name;
+	/** Table capacity */
+	unsigned int capacity;
+	/** Flush time window */
+	uint64_t window;
+	/** Number of distinct contact IDs */
+	unsigned int ids;
+	/** Number of sightings */
+	unsigned int sightings;
+	/** Number of sightings sharing each timestamp */
+	unsigned int per_time;
+	/** Expected number of flushed sightings, or zero if unknown */
+	unsigned int expected;
+};
+
+/** Ingest self-tests */
+static const struct ingesttest ingesttests_list[] = {
+	{ "dedup", 64, 0, 40, 1000, 1, 40 },
+	{ "full", 16, 0, 40, 40, 1, 40 },
+	{ "refull", 16, 0, 40, 400, 1, 0 },
+	{ "window", 64, 10, 5, 300, 2, 75 },
+	{ "single", 1, 0, 3, 30, 1, 30 },
+	{ "large", 1000, 0, 1000, 5000, 7, 1000 },
+};
+
+/**
+ * Construct test contact ID
+ *
+ * @v index		Contact ID index
+ * @v id		Contact ID to fill in
+ *
+ * Contact IDs are deliberately non-random, to exercise hashing of
+ * poorly distributed values.
+ */
+static void ingesttest_id ( unsigned int index, struct cx_contact_id *id ) {
+
+	memset ( id, 0, sizeof ( *id ) );
+	id->bytes[0] = ( index >> 8 );
+	id->bytes[1] = ( index >> 0 );
+	id->bytes[15] = 0x80;
+}
+
+/**
+ * Record flushed sightings
+ *
+ * @v ctx		Flushed sightings
+ * @v sightings		Sightings
+ * @v count		Number of sightings
+ * @ret ok		Success indicator
+ */
+static int ingesttest_flush ( void *ctx, const struct cx_sighting *sightings,
+			      unsigned int count ) {
+	struct ingesttest_flushed *flushed = ctx;
+
+	/* Fail if applicable */
+	if ( ++flushed->calls == flushed->fail )
+		return 0;
+
+	/* Record sightings */
+	if ( ( flushed->count + count ) > INGESTTEST_MAX_FLUSHED )
+		return 0;
+	memcpy ( &flushed->sightings[flushed->count], sightings,
+		 ( count * sizeof ( sightings[0] ) ) );
+	flushed->count += count;
+	return 1;
+}
+
+/**
+ * Check flushed sightings
+ *
+ * @v name		Test name
+ * @v flushed		Flushed sightings
+ * @v ids		Number of distinct contact IDs
+ * @v counts		Expected number of sightings of each contact ID
+ * @v first		Expected first-seen timestamp of each contact ID
+ * @v last		Expected last-seen timestamp of each contact ID
+ * @v window		Flush time window
+ * @ret ok		Success indicator
+ */
+static int ingesttest_check ( const char *name,
+			      struct ingesttest_flushed *flushed,
+			      unsigned int ids, const unsigned int *counts,
+			      const uint64_t *first, const uint64_t *last,
+			      uint64_t window ) {
+	static unsigned int seen[INGESTTEST_MAX_IDS];
+	static uint64_t earliest[INGESTTEST_MAX_IDS];
+	static uint64_t latest[INGESTTEST_MAX_IDS];
+	const struct cx_sighting *sighting;
+	struct cx_contact_id id;
+	unsigned int index;
+	unsigned int i;
+
+	/* Accumulate flushed sightings */
+	memset ( seen, 0, sizeof ( seen ) );
+	for ( i = 0 ; i < flushed->count ; i++ ) {
+		sighting = &flushed->sightings[i];
+		index = ( ( sighting->id.bytes[0] << 8 ) |
+			  ( sighting->id.bytes[1] << 0 ) );
+		ingesttest_id ( index, &id );
+		if ( ( index >= ids ) ||
+		     ( memcmp ( &sighting->id, &id, sizeof ( id ) ) != 0 ) ) {
+			fprintf ( stderr, "INGEST %s fail: sighting %d bad "
+				  "ID\n", name, i );
+			return 0;
+		}
+		if ( ( ! sighting->count ) ||
+		     ( sighting->first > sighting->last ) ||
+		     ( window && ( ( sighting->last - sighting->first ) >=
+				   window ) ) ) {
+			fprintf ( stderr, "INGEST %s fail: sighting %d bad "
+				  "range\n", name, i );
+			return 0;
+		}
+		if ( ( ! seen[index] ) ||
+		     ( sighting->first < earliest[index] ) )
+			earliest[index] = sighting->first;
+		if ( ( ! seen[index] ) || ( sighting->last > latest[index] ) )
+			latest[index] = sighting->last;
+		seen[index] += sighting->count;
+	}
+
+	/* Check each contact ID */
+	for ( i = 0 ; i < ids ; i++ ) {
+		if ( ( seen[i] != counts[i] ) ||
+		     ( counts[i] && ( ( earliest[i] != first[i] ) ||
+				      ( latest[i] != last[i] ) ) ) ) {
+			fprintf ( stderr, "INGEST %s fail: ID %d mismatch\n",
+				  name, i );
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Run ingest self-test
+ *
+ * @v test		Ingest self-test
+ * @v flushed		Flushed sightings
+ * @ret ok		Success indicator
+ */
+static int ingesttest_run ( const struct ingesttest *test,
+			    struct ingesttest_flushed *flushed ) {
+	static unsigned int counts[INGESTTEST_MAX_IDS];
+	static uint64_t first[INGESTTEST_MAX_IDS];
+	static uint64_t last[INGESTTEST_MAX_IDS];
+	struct cx_contact_id id;
+	struct cx_ingest *ingest;
+	unsigned int index;
+	uint64_t time;
+	unsigned int i;
+	int ok = 0;
+
+	/* Create ingest table */
+	memset ( flushed, 0, sizeof ( *flushed ) );
+	ingest = cx_ingest_create ( test->capacity, test->window,
+				    ingesttest_flush, flushed );
+	if ( ! ingest ) {
+		fprintf ( stderr, "INGEST %s fail: could not create\n",
+			  test->name );
+		goto err_create;
+	}
+
+	/* Add sightings, visiting contact IDs in a scrambled order */
+	memset ( counts, 0, sizeof ( counts ) );
+	for ( i = 0 ; i < test->sightings ; i++ ) {
+		index = ( ( i * 7 ) % test->ids );
+		time = ( i / test->per_time );
+		ingesttest_id ( index, &id );
+		if ( ! cx_ingest_add ( ingest, &id, time ) ) {
+			fprintf ( stderr, "INGEST %s fail: could not add %d\n",
+				  test->name, i );
+			goto err_add;
+		}
+		if ( ! counts[index]++ )
+			first[index] = time;
+		last[index] = time;
+	}
+	if ( cx_ingest_count ( ingest ) > test->capacity ) {
+		fprintf ( stderr, "INGEST %s fail: over capacity\n",
+			  test->name );
+		goto err_count;
+	}
+
+	/* Flush remaining sightings */
+	if ( ! cx_ingest_flush ( ingest ) ) {
+		fprintf ( stderr, "INGEST %s fail: could not flush\n",
+			  test->name );
+		goto err_flush;
+	}
+	if ( cx_ingest_count ( ingest ) != 0 ) {
+		fprintf ( stderr, "INGEST %s fail: not empty\n", test->name );
+		goto err_count;
+	}
+
+	/* Check flushed sightings */
+	if ( test->expected && ( flushed->count != test->expected ) ) {
+		fprintf ( stderr, "INGEST %s fail: flushed %d (expected "
+			  "%d)\n", test->name, flushed->count,
+			  test->expected );
+		goto err_count;
+	}
+	if ( ! ingesttest_check ( test->name, flushed, test->ids, counts,
+				  first, last, test->window ) )
+		goto err_check;
+
+	fprintf ( stderr, "INGEST %s ok\n", test->name );
+	ok = 1;
+
+ err_check:
+ err_count:
+ err_flush:
+ err_add:
+	cx_ingest_free ( ingest );
+ err_create:
+	return ok;
+}
+
+/**
+ * Run ingest flush failure self-test
+ *
+ * @v flushed		Flushed sightings
+ * @ret ok		Success indicator
+ *
+ * A flush failure part way through must retain exactly the sightings
+ * not yet accepted, and the table must remain usable.
+ */
+static int ingesttest_fail ( struct ingesttest_flushed *flushed ) {
+	static unsigned int counts[INGESTTEST_MAX_IDS];
+	static uint64_t first[INGESTTEST_MAX_IDS];
+	static uint64_t last[INGESTTEST_MAX_IDS];
+	struct cx_contact_id id;
+	struct cx_ingest *ingest;
+	unsigned int remaining;
+	unsigned int i;
+	int ok = 0;
+
+	/* Create ingest table */
+	memset ( flushed, 0, sizeof ( *flushed ) );
+	ingest = cx_ingest_create ( INGESTTEST_MAX_IDS, 0, ingesttest_flush,
+				    flushed );
+	if ( ! ingest ) {
+		fprintf ( stderr, "INGEST fail fail: could not create\n" );
+		goto err_create;
+	}
+
+	/* Add one sighting of each contact ID */
+	for ( i = 0 ; i < INGESTTEST_MAX_IDS ; i++ ) {
+		ingesttest_id ( i, &id );
+		if ( ! cx_ingest_add ( ingest, &id, i ) ) {
+			fprintf ( stderr, "INGEST fail fail: could not add "
+				  "%d\n", i );
+			goto err_add;
+		}
+		counts[i] = 1;
+		first[i] = last[i] = i;
+	}
+
+	/* Fail second batch */
+	flushed->fail = 2;
+	if ( cx_ingest_flush ( ingest ) ) {
+		fprintf ( stderr, "INGEST fail fail: flush succeeded\n" );
+		goto err_flush;
+	}
+	remaining = ( INGESTTEST_MAX_IDS - flushed->count );
+	if ( ( ! flushed->count ) ||
+	     ( cx_ingest_count ( ingest ) != remaining ) ) {
+		fprintf ( stderr, "INGEST fail fail: retained %d (expected "
+			  "%d)\n", cx_ingest_count ( ingest ), remaining );
+		goto err_flush;
+	}
+
+	/* Check that retained sightings are still found */
+	for ( i = 0 ; i < INGESTTEST_MAX_IDS ; i++ ) {
+		ingesttest_id ( i, &id );
+		if ( ! cx_ingest_add ( ingest, &id, i ) ) {
+			fprintf ( stderr, "INGEST fail fail: could not re-add "
+				  "%d\n", i );
+			goto err_add;
+		}
+		counts[i]++;
+	}
+	if ( cx_ingest_count ( ingest ) != INGESTTEST_MAX_IDS ) {
+		fprintf ( stderr, "INGEST fail fail: duplicated after "
+			  "rehash\n" );
+		goto err_flush;
+	}
+
+	/* Flush remaining sightings */
+	if ( ! cx_ingest_flush ( ingest ) ) {
+		fprintf ( stderr, "INGEST fail fail: could not flush\n" );
+		goto err_flush;
+	}
+	if ( ! ingesttest_check ( "fail", flushed, INGESTTEST_MAX_IDS, counts,
+				  first, last, 0 ) )
+		goto err_check;
+
+	fprintf ( stderr, "INGEST fail ok\n" );
+	ok = 1;
+
+ err_check:
+ err_flush:
+ err_add:
+	cx_ingest_free ( ingest );
+ err_create:
+	return ok;
+}
+
+/**
+ * Run ingest self-tests
+ *
+ * @ret ok		Success indicator
+ */
+int ingesttests ( void ) {
+	struct ingesttest_flushed *flushed;
+	unsigned int i;
+	int ok = 1;
+
+	/* Allocate flushed sightings */
+	flushed = malloc ( sizeof ( *flushed ) );
+	if ( ! flushed ) {
+		fprintf ( stderr, "INGEST fail: out of memory\n" );
+		return 0;
+	}
+
+	/* Run tests */
+	for ( i = 0 ; i < ( sizeof ( ingesttests_list ) /
+			    sizeof ( ingesttests_list[0] ) ) ; i++ ) {
+		ok &= ingesttest_run ( &ingesttests_list[i], flushed );
+	}
+	ok &= ingesttest_fail ( flushed );
+
+	free ( flushed );
+	return ok;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+#ifndef _CX_KERNEL_H
+#define _CX_KERNEL_H
+
+#include <stddef.h>
+
+/** Maximum output length per iteration supported by generator kernels */
+#define CX_KERNEL_MAX_LEN 48
+
+/** Output length per iteration when generating contact IDs */
+#define CX_KERNEL_ID_LEN 16
+
+/** Function attributes for generic kernel functions
+ *
+ * Generic kernel functions take the AES key length and the output
+ * length as parameters, and must be inlined into each specialised
+ * kernel function so that these become compile-time constants.
+ */
+#define CX_KERNEL_GENERIC inline __attribute__ (( always_inline ))
+
+/** A generator kernel lane
+ *
+ * Each lane represents the internal state (Key and V) of an
+ * independent CTR_DRBG instance.
+ */
+struct cx_kernel_lane {
+	/** Key */
+	unsigned char *key;
+	/** Counter value */
+	unsigned char *v;
+	/** Output buffer */
+	unsigned char *output;
+};
+
+/** A generator kernel specialised for a single AES key length */
+struct cx_kernel_variant {
+	/**
+	 * Generate random bytes
+	 *
+	 * @v lanes		Lanes
+	 * @v count		Number of lanes (at most the kernel width)
+	 * @v len		Length of output per iteration
+	 * @v iterations	Number of iterations
+	 *
+	 * Output for successive iterations is written contiguously to
+	 * each lane's output buffer, and each lane's key and counter
+	 * value are updated to reflect the final state.
+	 */
+	void ( * generate ) ( struct cx_kernel_lane *lanes, unsigned int count,
+			      size_t len, unsigned int iterations );
+};
+
+/** A generator kernel
+ *
+ * A generator kernel performs CTR_DRBG generate operations (with no
+ * additional input) for several independent DRBG instances in
+ * lockstep, so that the block cipher operations for each lane may be
+ * interleaved.
+ */
+struct cx_kernel {
+	/** Name */
+	const char *name;
+	/** Number of lanes processed in lockstep */
+	unsigned int width;
+	/**
+	 * Check if kernel is supported on this CPU
+	 *
+	 * @ret supported	Kernel is supported
+	 */
+	int ( * supported ) ( void );
+	/** Variant for AES-128 */
+	struct cx_kernel_variant aes128;
+	/** Variant for AES-256 */
+	struct cx_kernel_variant aes256;
+	/**
+	 * Kernel to use for a single lane (or NULL to use this kernel)
+	 *
+	 * Wide kernels may be slower than a narrower kernel when only
+	 * a single lane is in use.
+	 */
+	const struct cx_kernel *single;
+};
+
+/**
+ * Define generator kernel variant for a fixed AES key length
+ *
+ * @v prefix		Kernel function name prefix
+ * @v target		Kernel function attributes
+ * @v bits		AES key length (in bits)
+ *
+ * This defines prefix_generate_bits() by expanding the generic
+ * prefix_generate() with a constant AES key length, and with a
+ * constant output length for the common case of contact IDs.
+ */
+#define CX_KERNEL_VARIANT( prefix, target, bits )			\
+	static target void						\
+	prefix ## _generate_ ## bits ( struct cx_kernel_lane *lanes,	\
+				       unsigned int count, size_t len,	\
+				       unsigned int iterations ) {	\
+		if ( len == CX_KERNEL_ID_LEN ) {			\
+			prefix ## _generate ( lanes, count, ( bits / 8 ),\
+					      CX_KERNEL_ID_LEN,		\
+					      iterations );		\
+		} else {						\
+			prefix ## _generate ( lanes, count, ( bits / 8 ),\
+					      len, iterations );	\
+		}							\
+	}
+
+extern const struct cx_kernel cx_kernel_vaes;
+extern const struct cx_kernel cx_kernel_aesni;
+extern const struct cx_kernel cx_kernel_armce;
+
+#endif /* _CX_KERNEL_H */
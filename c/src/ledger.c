@@ -0,0 +1,976 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Seed value ledger
+ *
+ ******************************************************************************
+ *
+ * Observers repeatedly download overlapping publications of seed
+ * values, and re-expanding a seed value that has already been
+ * matched against the current observations is wasted work.  A ledger
+ * records which seed values have been checked, so that only new seed
+ * values need be expanded.
+ *
+ * Each seed value covers a range of observation times (in
+ * caller-defined units), and a checked seed value remains valid
+ * until a new observation is made within that range.  Recording new
+ * observations therefore invalidates only the seed values whose
+ * ranges overlap the new observations, rather than the whole ledger.
+ *
+ * Seed values are identified by a truncated SHA-256 hash of the
+ * generator type, seed value, and range of contact ID indices, so
+ * that the seed values themselves are never stored, and so that a
+ * seed value checked over only part of its sequence is not taken to
+ * have been checked over a wider part.
+ *
+ * The ledger is a single file comprising a header followed by
+ * fixed-size records, each recording either a checked seed value or
+ * a range of new observations.  Records are only ever appended, so
+ * the cost of each update is proportional to the number of new seed
+ * values.  On opening, the records are replayed in order: each
+ * observation range starts a new epoch, and a checked seed value is
+ * current if no later epoch has an overlapping observation range.
+ * Consecutive observation ranges with no intervening checks are
+ * merged into a single epoch, so that a stream of new observations
+ * does not grow the list of epochs without bound.
+ *
+ * An expired entry is never treated as current, and expired and
+ * invalidated entries are discarded by rewriting the ledger with only
+ * the remaining current entries, which then need no observation
+ * ranges at all.  A torn final record (e.g. after a crash) is
+ * discarded when the ledger is opened.
+ *
+ * Losing a checked seed value record in a crash causes only repeated
+ * work, but losing an observation range record would cause seed
+ * values to be skipped incorrectly.  Observation range records are
+ * therefore synchronised to disk before cx_ledger_observe() returns,
+ * and callers must record new observations in the ledger before
+ * persisting the observations themselves.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+#include <cx/generator.h>
+#include <cx/ledger.h>
+#include "fileio.h"
+#include "debug.h"
+
+/** Ledger magic */
+#define CX_LEDGER_MAGIC "CXLEDGER"
+
+/** Ledger format version */
+#define CX_LEDGER_VERSION 1
+
+/** Byte order marker */
+#define CX_LEDGER_ORDER 0x01020304UL
+
+/** Checked seed value record type */
+#define CX_LEDGER_CHECK 0x4b434843UL
+
+/** Observation range record type */
+#define CX_LEDGER_OBSERVE 0x53424f43UL
+
+/** Length of seed value key */
+#define CX_LEDGER_KEY_LEN 16
+
+/** Maximum seed value length */
+#define CX_LEDGER_MAX_SEED 64
+
+/** Initial number of hash table slots */
+#define CX_LEDGER_MIN_SIZE 64
+
+/** Initial number of observation ranges allocated */
+#define CX_LEDGER_MIN_RANGES 16
+
+/** Number of records read at a time during recovery */
+#define CX_LEDGER_READ_RECORDS 256
+
+/** Temporary file name suffix */
+#define CX_LEDGER_TMP ".tmp"
+
+/** Ledger file header */
+struct cx_ledger_header {
+	/** Magic */
+	char magic[8];
+	/** Format version */
+	uint32_t version;
+	/** Byte order marker */
+	uint32_t order;
+	/** Reserved */
+	uint8_t reserved[32];
+};
+
+/** A ledger record */
+struct cx_ledger_record {
+	/** Record type */
+	uint32_t type;
+	/** Reserved */
+	uint32_t reserved;
+	/** Seed value key (for a checked seed value) */
+	uint8_t key[CX_LEDGER_KEY_LEN];
+	/** Start time */
+	uint64_t start;
+	/** End time */
+	uint64_t end;
+	/** Expiry time (for a checked seed value) */
+	uint64_t expiry;
+};
+
+/** A ledger entry */
+struct cx_ledger_entry {
+	/** Seed value key */
+	uint8_t key[CX_LEDGER_KEY_LEN];
+	/** Start time */
+	uint64_t start;
+	/** End time */
+	uint64_t end;
+	/** Expiry time */
+	uint64_t expiry;
+	/** Epoch at which seed value was checked (zero if slot empty) */
+	uint64_t epoch;
+};
+
+/** A range of new observations */
+struct cx_ledger_observed {
+	/** Epoch started by these observations */
+	uint64_t epoch;
+	/** Start time */
+	uint64_t start;
+	/** End time */
+	uint64_t end;
+};
+
+/** A seed value ledger */
+struct cx_ledger {
+	/** Ledger file path */
+	char *path;
+	/** Ledger file descriptor */
+	int fd;
+	/** Offset at which to append next record */
+	off_t offset;
+	/** Hash table of entries */
+	struct cx_ledger_entry *entries;
+	/** Number of hash table slots (a power of two) */
+	unsigned int size;
+	/** Number of entries */
+	unsigned int count;
+	/** Observation ranges */
+	struct cx_ledger_observed *observed;
+	/** Number of observation ranges */
+	unsigned int ranges;
+	/** Number of observation ranges allocated */
+	unsigned int max;
+	/** Current epoch */
+	uint64_t epoch;
+	/** Latest observation range may be extended */
+	int merge;
+};
+
+/**
+ * Store little-endian 32-bit value
+ *
+ * @v pos		Position at which to store value
+ * @v value		Value
+ * @ret pos		Position following value
+ */
+static unsigned char * cx_ledger_le32 ( unsigned char *pos,
+					uint32_t value ) {
+	unsigned int i;
+
+	for ( i = 0 ; i < sizeof ( value ) ; i++ ) {
+		*(pos++) = value;
+		value >>= 8;
+	}
+	return pos;
+}
+
+/**
+ * Calculate seed value key
+ *
+ * @v seed		Seed value
+ * @v key		Key to fill in
+ * @ret ok		Success indicator
+ */
+static int cx_ledger_key ( const struct cx_match_seed *seed, uint8_t *key ) {
+	unsigned char buf[ 1 + ( 2 * sizeof ( uint32_t ) ) +
+			   CX_LEDGER_MAX_SEED ];
+	unsigned char *pos = buf;
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	size_t len = cx_gen_seed_len ( seed->type );
+
+	/* Check seed value */
+	if ( ( ! len ) || ( seed->len != len ) ||
+	     ( len > CX_LEDGER_MAX_SEED ) ) {
+		DBG ( "LEDGER invalid seed type %d length %zd\n",
+		      seed->type, seed->len );
+		return 0;
+	}
+
+	/* Hash generator type, contact ID index range, and seed value */
+	*(pos++) = seed->type;
+	pos = cx_ledger_le32 ( pos, seed->first );
+	pos = cx_ledger_le32 ( pos, seed->last );
+	memcpy ( pos, seed->seed, len );
+	pos += len;
+	if ( ! EVP_Digest ( buf, ( pos - buf ), digest, NULL, EVP_sha256(),
+			    NULL ) ) {
+		DBG ( "LEDGER could not hash seed value\n" );
+		return 0;
+	}
+	memcpy ( key, digest, CX_LEDGER_KEY_LEN );
+
+	return 1;
+}
+
+/**
+ * Find hash table slot for key
+ *
+ * @v ledger		Seed value ledger
+ * @v key		Seed value key
+ * @ret entry		Matching entry, or empty slot if not present
+ */
+static struct cx_ledger_entry * cx_ledger_find ( struct cx_ledger *ledger,
+						 const uint8_t *key ) {
+	unsigned int mask = ( ledger->size - 1 );
+	struct cx_ledger_entry *entry;
+	uint32_t hash;
+	unsigned int index;
+
+	/* Keys are hash outputs, so need no further mixing */
+	memcpy ( &hash, key, sizeof ( hash ) );
+	for ( index = ( hash & mask ) ; ; index = ( ( index + 1 ) & mask ) ) {
+		entry = &ledger->entries[index];
+		if ( ( ! entry->epoch ) ||
+		     ( memcmp ( entry->key, key,
+				sizeof ( entry->key ) ) == 0 ) )
+			return entry;
+	}
+}
+
+/**
+ * Resize hash table
+ *
+ * @v ledger		Seed value ledger
+ * @v size		New number of slots (a power of two)
+ * @ret ok		Success indicator
+ */
+static int cx_ledger_resize ( struct cx_ledger *ledger, unsigned int size ) {
+	struct cx_ledger_entry *entries = ledger->entries;
+	unsigned int old = ledger->size;
+	unsigned int i;
+
+	/* Allocate new table */
+	ledger->entries = calloc ( size, sizeof ( ledger->entries[0] ) );
+	if ( ! ledger->entries ) {
+		ledger->entries = entries;
+		return 0;
+	}
+	ledger->size = size;
+
+	/* Reinsert existing entries */
+	for ( i = 0 ; i < old ; i++ ) {
+		if ( entries[i].epoch ) {
+			memcpy ( cx_ledger_find ( ledger, entries[i].key ),
+				 &entries[i], sizeof ( entries[i] ) );
+		}
+	}
+	free ( entries );
+
+	return 1;
+}
+
+/**
+ * Check whether or not entry is current
+ *
+ * @v ledger		Seed value ledger
+ * @v entry		Entry
+ * @ret current		Entry is current
+ */
+static int cx_ledger_current ( struct cx_ledger *ledger,
+			       const struct cx_ledger_entry *entry ) {
+	const struct cx_ledger_observed *observed;
+	unsigned int i;
+
+	/* Check observation ranges from any later epochs */
+	for ( i = ledger->ranges ; i-- ; ) {
+		observed = &ledger->observed[i];
+		if ( observed->epoch <= entry->epoch )
+			break;
+		if ( ( observed->start < entry->end ) &&
+		     ( entry->start < observed->end ) )
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Look up current entry
+ *
+ * @v ledger		Seed value ledger
+ * @v key		Seed value key
+ * @v range		Observation time range
+ * @v now		Current time
+ * @ret current		Seed value has been checked and is current
+ */
+static int cx_ledger_lookup ( struct cx_ledger *ledger, const uint8_t *key,
+			      const struct cx_ledger_range *range,
+			      uint64_t now ) {
+	const struct cx_ledger_entry *entry;
+
+	entry = cx_ledger_find ( ledger, key );
+	return ( entry->epoch && ( entry->start == range->start ) &&
+		 ( entry->end == range->end ) && ( entry->expiry > now ) &&
+		 cx_ledger_current ( ledger, entry ) );
+}
+
+/**
+ * Apply record
+ *
+ * @v ledger		Seed value ledger
+ * @v record		Record
+ * @ret ok		Success indicator
+ */
+static int cx_ledger_apply ( struct cx_ledger *ledger,
+			     const struct cx_ledger_record *record ) {
+	struct cx_ledger_observed *observed;
+	struct cx_ledger_entry *entry;
+	unsigned int max;
+
+	switch ( record->type ) {
+
+	case CX_LEDGER_CHECK:
+
+		/* Grow hash table, if necessary */
+		if ( ( 4 * ( ledger->count + 1 ) ) > ( 3 * ledger->size ) ) {
+			if ( ! cx_ledger_resize ( ledger,
+						  ( ledger->size * 2 ) ) )
+				return 0;
+		}
+
+		/* Add or update entry */
+		entry = cx_ledger_find ( ledger, record->key );
+		if ( ! entry->epoch )
+			ledger->count++;
+		memcpy ( entry->key, record->key, sizeof ( entry->key ) );
+		entry->start = record->start;
+		entry->end = record->end;
+		entry->expiry = record->expiry;
+		entry->epoch = ledger->epoch;
+		ledger->merge = 0;
+		return 1;
+
+	case CX_LEDGER_OBSERVE:
+
+		/* Extend latest observation range, if possible */
+		if ( ledger->merge ) {
+			observed = &ledger->observed[ ledger->ranges - 1 ];
+			if ( record->start < observed->start )
+				observed->start = record->start;
+			if ( record->end > observed->end )
+				observed->end = record->end;
+			return 1;
+		}
+
+		/* Grow list of observation ranges, if necessary */
+		if ( ledger->ranges == ledger->max ) {
+			max = ( ledger->max ? ( ledger->max * 2 ) :
+				CX_LEDGER_MIN_RANGES );
+			observed = realloc ( ledger->observed,
+					     ( max * sizeof ( *observed ) ) );
+			if ( ! observed )
+				return 0;
+			ledger->observed = observed;
+			ledger->max = max;
+		}
+
+		/* Start new epoch */
+		observed = &ledger->observed[ ledger->ranges++ ];
+		observed->epoch = ++ledger->epoch;
+		observed->start = record->start;
+		observed->end = record->end;
+		ledger->merge = 1;
+		return 1;
+
+	default:
+		DBG ( "LEDGER %p unknown record type %#08x\n",
+		      ledger, record->type );
+		return 0;
+	}
+}
+
+/**
+ * Append records
+ *
+ * @v ledger		Seed value ledger
+ * @v records		Records
+ * @v count		Number of records
+ * @ret ok		Success indicator
+ *
+ * Records are written to the ledger file and then applied.
+ */
+static int cx_ledger_append ( struct cx_ledger *ledger,
+			      const struct cx_ledger_record *records,
+			      unsigned int count ) {
+	size_t len = ( count * sizeof ( records[0] ) );
+	unsigned int i;
+
+	/* Write records */
+	if ( ! cx_file_write ( ledger->fd, records, len, ledger->offset ) )
+		return 0;
+	ledger->offset += len;
+
+	/* Apply records */
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ! cx_ledger_apply ( ledger, &records[i] ) )
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Reset in-memory state
+ *
+ * @v ledger		Seed value ledger
+ * @ret ok		Success indicator
+ */
+static int cx_ledger_reset ( struct cx_ledger *ledger ) {
+	struct cx_ledger_entry *entries;
+
+	/* Allocate empty hash table */
+	entries = calloc ( CX_LEDGER_MIN_SIZE, sizeof ( entries[0] ) );
+	if ( ! entries )
+		return 0;
+	free ( ledger->entries );
+	ledger->entries = entries;
+	ledger->size = CX_LEDGER_MIN_SIZE;
+	ledger->count = 0;
+
+	/* Discard observation ranges */
+	free ( ledger->observed );
+	ledger->observed = NULL;
+	ledger->ranges = 0;
+	ledger->max = 0;
+	ledger->epoch = 1;
+	ledger->merge = 0;
+
+	return 1;
+}
+
+/**
+ * Initialise header
+ *
+ * @v header		Header to fill in
+ */
+static void cx_ledger_header ( struct cx_ledger_header *header ) {
+
+	memset ( header, 0, sizeof ( *header ) );
+	memcpy ( header->magic, CX_LEDGER_MAGIC, sizeof ( header->magic ) );
+	header->version = CX_LEDGER_VERSION;
+	header->order = CX_LEDGER_ORDER;
+}
+
+/**
+ * Recover ledger
+ *
+ * @v ledger		Seed value ledger
+ * @ret ok		Success indicator
+ *
+ * All valid records are replayed, and the file is truncated after
+ * the last valid record.
+ */
+static int cx_ledger_recover ( struct cx_ledger *ledger ) {
+	struct cx_ledger_record records[CX_LEDGER_READ_RECORDS];
+	struct cx_ledger_header expected;
+	struct cx_ledger_header header;
+	unsigned int count;
+	unsigned int i;
+	ssize_t done;
+
+	/* Write header to an empty ledger */
+	cx_ledger_header ( &expected );
+	done = pread ( ledger->fd, &header, sizeof ( header ), 0 );
+	if ( done == 0 ) {
+		if ( ! cx_file_write ( ledger->fd, &expected,
+				       sizeof ( expected ), 0 ) )
+			return 0;
+		ledger->offset = sizeof ( expected );
+		return 1;
+	}
+
+	/* Check header */
+	if ( ( done != ( ( ssize_t ) sizeof ( header ) ) ) ||
+	     ( memcmp ( &header, &expected, sizeof ( header ) ) != 0 ) ) {
+		DBG ( "LEDGER %p has invalid header\n", ledger );
+		return 0;
+	}
+	ledger->offset = sizeof ( header );
+
+	/* Replay whole valid records */
+	do {
+		done = pread ( ledger->fd, records, sizeof ( records ),
+			       ledger->offset );
+		if ( done < 0 ) {
+			DBG ( "LEDGER %p could not read: %s\n",
+			      ledger, strerror ( errno ) );
+			return 0;
+		}
+		count = ( done / sizeof ( records[0] ) );
+		for ( i = 0 ; i < count ; i++ ) {
+			if ( ( records[i].type != CX_LEDGER_CHECK ) &&
+			     ( records[i].type != CX_LEDGER_OBSERVE ) )
+				break;
+			if ( ! cx_ledger_apply ( ledger, &records[i] ) )
+				return 0;
+			ledger->offset += sizeof ( records[i] );
+		}
+	} while ( ( i == count ) && ( count == CX_LEDGER_READ_RECORDS ) );
+
+	/* Discard anything beyond the last valid record */
+	if ( ftruncate ( ledger->fd, ledger->offset ) != 0 ) {
+		DBG ( "LEDGER %p could not truncate: %s\n",
+		      ledger, strerror ( errno ) );
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Open seed value ledger
+ *
+ * @v path		Ledger file (which will be created if necessary)
+ * @ret ledger		Seed value ledger, or NULL on error
+ */
+struct cx_ledger * cx_ledger_open ( const char *path ) {
+	struct cx_ledger *ledger;
+
+	/* Allocate and initialise structure */
+	ledger = malloc ( sizeof ( *ledger ) );
+	if ( ! ledger )
+		goto err_alloc;
+	memset ( ledger, 0, sizeof ( *ledger ) );
+	ledger->path = strdup ( path );
+	if ( ! ledger->path )
+		goto err_path;
+	if ( ! cx_ledger_reset ( ledger ) )
+		goto err_reset;
+
+	/* Open and recover ledger */
+	ledger->fd = open ( path, ( O_RDWR | O_CREAT ), 0666 );
+	if ( ledger->fd < 0 ) {
+		DBG ( "LEDGER %p could not open %s: %s\n",
+		      ledger, path, strerror ( errno ) );
+		goto err_open;
+	}
+	if ( ! cx_ledger_recover ( ledger ) )
+		goto err_recover;
+
+	DBG ( "LEDGER %p opened %s with %d entries\n",
+	      ledger, path, ledger->count );
+	return ledger;
+
+ err_recover:
+	close ( ledger->fd );
+ err_open:
+	free ( ledger->observed );
+	free ( ledger->entries );
+ err_reset:
+	free ( ledger->path );
+ err_path:
+	free ( ledger );
+ err_alloc:
+	return NULL;
+}
+
+/**
+ * Check whether or not seed value has already been checked
+ *
+ * @v ledger		Seed value ledger
+ * @v seed		Seed value
+ * @v range		Observation time range covered by seed value
+ * @v now		Current time
+ * @ret checked		Seed value has been checked against all
+ *			observations within the range, and has not
+ *			expired
+ */
+int cx_ledger_checked ( struct cx_ledger *ledger,
+			const struct cx_match_seed *seed,
+			const struct cx_ledger_range *range, uint64_t now ) {
+	uint8_t key[CX_LEDGER_KEY_LEN];
+
+	if ( ! cx_ledger_key ( seed, key ) )
+		return 0;
+	return cx_ledger_lookup ( ledger, key, range, now );
+}
+
+/**
+ * Construct checked seed value record
+ *
+ * @v record		Record to fill in
+ * @v key		Seed value key
+ * @v range		Observation time range covered by seed value
+ */
+static void cx_ledger_check_record ( struct cx_ledger_record *record,
+				     const uint8_t *key,
+				     const struct cx_ledger_range *range ) {
+
+	memset ( record, 0, sizeof ( *record ) );
+	record->type = CX_LEDGER_CHECK;
+	memcpy ( record->key, key, sizeof ( record->key ) );
+	record->start = range->start;
+	record->end = range->end;
+	record->expiry = range->expiry;
+}
+
+/**
+ * Record seed value as checked
+ *
+ * @v ledger		Seed value ledger
+ * @v seed		Seed value
+ * @v range		Observation time range covered by seed value
+ * @ret ok		Success indicator
+ *
+ * The seed value should have been matched against all observations
+ * recorded via cx_ledger_observe().
+ */
+int cx_ledger_record ( struct cx_ledger *ledger,
+		       const struct cx_match_seed *seed,
+		       const struct cx_ledger_range *range ) {
+	struct cx_ledger_record record;
+	uint8_t key[CX_LEDGER_KEY_LEN];
+
+	if ( ! cx_ledger_key ( seed, key ) )
+		return 0;
+	cx_ledger_check_record ( &record, key, range );
+	return cx_ledger_append ( ledger, &record, 1 );
+}
+
+/**
+ * Record new observations
+ *
+ * @v ledger		Seed value ledger
+ * @v start		Earliest new observation time (inclusive)
+ * @v end		Latest new observation time (exclusive)
+ * @ret ok		Success indicator
+ *
+ * This invalidates all checked seed values with an overlapping
+ * observation time range.  The record is synchronised to disk before
+ * returning, and must be made before the new observations are
+ * persisted (e.g. via cx_obsstore_flush()): otherwise a crash could
+ * preserve the observations but lose the invalidation, causing seed
+ * values to be skipped incorrectly.
+ */
+int cx_ledger_observe ( struct cx_ledger *ledger, uint64_t start,
+			uint64_t end ) {
+	struct cx_ledger_record record;
+
+	memset ( &record, 0, sizeof ( record ) );
+	record.type = CX_LEDGER_OBSERVE;
+	record.start = start;
+	record.end = end;
+	if ( ! cx_ledger_append ( ledger, &record, 1 ) )
+		return 0;
+	if ( fdatasync ( ledger->fd ) != 0 ) {
+		DBG ( "LEDGER %p could not synchronise: %s\n",
+		      ledger, strerror ( errno ) );
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Match seed values not already checked
+ *
+ * @v ledger		Seed value ledger
+ * @v match		Observation index
+ * @v seeds		Seed values
+ * @v ranges		Observation time range covered by each seed value
+ * @v count		Number of seed values
+ * @v now		Current time
+ * @ret result		Match result, or NULL on error
+ *
+ * Seed values that have already been checked (and have not expired)
+ * are skipped, and all other seed values are matched against the
+ * observation index (as for cx_match_seeds()) and recorded as
+ * checked.  Matches are reported only for the seed values that were
+ * not skipped.  The result must eventually be freed using
+ * cx_match_result_free().
+ */
+struct cx_match_result *
+cx_ledger_match ( struct cx_ledger *ledger, struct cx_match *match,
+		  const struct cx_match_seed *seeds,
+		  const struct cx_ledger_range *ranges, unsigned int count,
+		  uint64_t now ) {
+	struct cx_ledger_record *records;
+	struct cx_match_result *result;
+	struct cx_match_seed *unchecked;
+	uint8_t key[CX_LEDGER_KEY_LEN];
+	unsigned int *indices;
+	unsigned int new = 0;
+	unsigned int i;
+
+	/* Allocate working storage */
+	unchecked = malloc ( ( count ? count : 1 ) * sizeof ( unchecked[0] ) );
+	if ( ! unchecked )
+		goto err_alloc_unchecked;
+	indices = malloc ( ( count ? count : 1 ) * sizeof ( indices[0] ) );
+	if ( ! indices )
+		goto err_alloc_indices;
+	records = malloc ( ( count ? count : 1 ) * sizeof ( records[0] ) );
+	if ( ! records )
+		goto err_alloc_records;
+
+	/* Identify seed values not already checked */
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ! cx_ledger_key ( &seeds[i], key ) )
+			goto err_key;
+		if ( cx_ledger_lookup ( ledger, key, &ranges[i], now ) )
+			continue;
+		cx_ledger_check_record ( &records[new], key, &ranges[i] );
+		memcpy ( &unchecked[new], &seeds[i], sizeof ( unchecked[0] ) );
+		indices[new] = i;
+		new++;
+	}
+	DBG ( "LEDGER %p matching %d of %d seed values\n",
+	      ledger, new, count );
+
+	/* Match unchecked seed values */
+	result = cx_match_seeds ( match, unchecked, new );
+	if ( ! result )
+		goto err_match;
+	for ( i = 0 ; i < result->count ; i++ )
+		result->hits[i].seed = indices[ result->hits[i].seed ];
+
+	/* Record seed values as checked */
+	if ( new && ( ! cx_ledger_append ( ledger, records, new ) ) )
+		goto err_append;
+
+	free ( records );
+	free ( indices );
+	free ( unchecked );
+	return result;
+
+ err_append:
+	cx_match_result_free ( result );
+ err_match:
+ err_key:
+	free ( records );
+ err_alloc_records:
+	free ( indices );
+ err_alloc_indices:
+	free ( unchecked );
+ err_alloc_unchecked:
+	return NULL;
+}
+
+/**
+ * Synchronise directory containing ledger file
+ *
+ * @v ledger		Seed value ledger
+ * @ret ok		Success indicator
+ */
+static int cx_ledger_sync_dir ( struct cx_ledger *ledger ) {
+	char *dir;
+	char *sep;
+	int ok;
+
+	/* Identify directory */
+	dir = strdup ( ledger->path );
+	if ( ! dir )
+		return 0;
+	sep = strrchr ( dir, '/' );
+	if ( sep ) {
+		sep[ ( sep == dir ) ? 1 : 0 ] = '\0';
+	} else {
+		strcpy ( dir, "." );
+	}
+
+	/* Synchronise directory */
+	ok = cx_file_sync_dir ( dir );
+
+	free ( dir );
+	return ok;
+}
+
+/**
+ * Discard expired and invalidated entries
+ *
+ * @v ledger		Seed value ledger
+ * @v now		Current time
+ * @ret ok		Success indicator
+ *
+ * Entries with an expiry time at or before the current time are
+ * discarded, as are entries invalidated by new observations.  The
+ * ledger file is rewritten to hold only the remaining entries.
+ */
+int cx_ledger_expire ( struct cx_ledger *ledger, uint64_t now ) {
+	struct cx_ledger_record *records;
+	struct cx_ledger_entry *entry;
+	struct cx_ledger_header header;
+	unsigned int count = 0;
+	unsigned int i;
+	size_t len;
+	char *tmp;
+	int fd;
+
+	/* Construct records for remaining entries */
+	records = malloc ( ( ledger->count ? ledger->count : 1 ) *
+			   sizeof ( records[0] ) );
+	if ( ! records )
+		goto err_alloc;
+	for ( i = 0 ; i < ledger->size ; i++ ) {
+		entry = &ledger->entries[i];
+		if ( ( ! entry->epoch ) || ( entry->expiry <= now ) ||
+		     ( ! cx_ledger_current ( ledger, entry ) ) )
+			continue;
+		memset ( &records[count], 0, sizeof ( records[0] ) );
+		records[count].type = CX_LEDGER_CHECK;
+		memcpy ( records[count].key, entry->key,
+			 sizeof ( records[count].key ) );
+		records[count].start = entry->start;
+		records[count].end = entry->end;
+		records[count].expiry = entry->expiry;
+		count++;
+	}
+
+	/* Write new ledger file and rename into place */
+	len = ( strlen ( ledger->path ) + sizeof ( CX_LEDGER_TMP ) );
+	tmp = malloc ( len );
+	if ( ! tmp )
+		goto err_tmp;
+	snprintf ( tmp, len, "%s%s", ledger->path, CX_LEDGER_TMP );
+	fd = open ( tmp, ( O_RDWR | O_CREAT | O_TRUNC ), 0666 );
+	if ( fd < 0 ) {
+		DBG ( "LEDGER %p could not create %s: %s\n",
+		      ledger, tmp, strerror ( errno ) );
+		goto err_open;
+	}
+	cx_ledger_header ( &header );
+	len = ( count * sizeof ( records[0] ) );
+	if ( ( ! cx_file_write ( fd, &header, sizeof ( header ), 0 ) ) ||
+	     ( ! cx_file_write ( fd, records, len, sizeof ( header ) ) ) ) {
+		DBG ( "LEDGER %p could not write %s\n", ledger, tmp );
+		goto err_write;
+	}
+	if ( fsync ( fd ) != 0 ) {
+		DBG ( "LEDGER %p could not sync %s: %s\n",
+		      ledger, tmp, strerror ( errno ) );
+		goto err_sync;
+	}
+	if ( rename ( tmp, ledger->path ) != 0 ) {
+		DBG ( "LEDGER %p could not rename %s: %s\n",
+		      ledger, tmp, strerror ( errno ) );
+		goto err_rename;
+	}
+	close ( ledger->fd );
+	ledger->fd = fd;
+	ledger->offset = ( sizeof ( header ) + len );
+
+	/* Ensure that later records cannot be appended to a file that
+	 * is lost in a crash.
+	 */
+	if ( ! cx_ledger_sync_dir ( ledger ) )
+		goto err_sync_dir;
+
+	/* Replace in-memory state */
+	DBG ( "LEDGER %p kept %d of %d entries\n",
+	      ledger, count, ledger->count );
+	if ( ! cx_ledger_reset ( ledger ) )
+		goto err_reset;
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ! cx_ledger_apply ( ledger, &records[i] ) )
+			goto err_apply;
+	}
+
+	free ( tmp );
+	free ( records );
+	return 1;
+
+ err_apply:
+ err_reset:
+ err_sync_dir:
+	/* The ledger file is already updated.  The in-memory state
+	 * may be stale or incomplete, which causes seed values to be
+	 * checked again but never skipped incorrectly.
+	 */
+	free ( tmp );
+	free ( records );
+	return 0;
+
+ err_rename:
+ err_sync:
+ err_write:
+	close ( fd );
+	unlink ( tmp );
+ err_open:
+	free ( tmp );
+ err_tmp:
+	free ( records );
+ err_alloc:
+	return 0;
+}
+
+/**
+ * Get number of entries
+ *
+ * @v ledger		Seed value ledger
+ * @ret count		Number of entries (including invalidated entries)
+ */
+unsigned int cx_ledger_count ( struct cx_ledger *ledger ) {
+
+	return ledger->count;
+}
+
+/**
+ * Close seed value ledger
+ *
+ * @v ledger		Seed value ledger
+ */
+void cx_ledger_close ( struct cx_ledger *ledger ) {
+
+	/* Do nothing if closing a NULL pointer */
+	if ( ! ledger )
+		return;
+
+	close ( ledger->fd );
+	free ( ledger->observed );
+	free ( ledger->entries );
+	free ( ledger->path );
+	free ( ledger );
+}
@@ -0,0 +1,443 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Seed value ledger self-tests
+ *
+ ******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cx/match.h>
+#include <cx/ledger.h>
+#include "cxtest.h"
+#include "ledgertest.h"
+
+/** Number of seed values */
+#define LEDGERTEST_SEEDS 6
+
+/** Number of initial observations */
+#define LEDGERTEST_INITIAL 100
+
+/** Number of later observations */
+#define LEDGERTEST_LATER 20
+
+/** Seed value whose range includes the later observations */
+#define LEDGERTEST_LATER_SEED 2
+
+/** Length of each seed value's observation time range */
+#define LEDGERTEST_RANGE 100
+
+/** Base expiry time */
+#define LEDGERTEST_EXPIRY 1000
+
+/** Current time (before any seed value expires) */
+#define LEDGERTEST_NOW 0
+
+/** Current time at expiry */
+#define LEDGERTEST_LATE ( LEDGERTEST_EXPIRY + 3 )
+
+/** Seed values remaining after expiry (all others expire or are stale) */
+#define LEDGERTEST_KEPT ( ( 1 << 4 ) | ( 1 << 5 ) )
+
+/** Seed value ledger self-test state */
+struct ledgertest {
+	/** Ledger directory */
+	char dir[32];
+	/** Ledger file */
+	char path[48];
+	/** Seed values */
+	struct cx_match_seed seeds[LEDGERTEST_SEEDS];
+	/** Raw seed values */
+	unsigned char raw[LEDGERTEST_SEEDS][CXTEST_MATCH_SEED_LEN];
+	/** Observation time ranges */
+	struct cx_ledger_range ranges[LEDGERTEST_SEEDS];
+	/** Observed contact IDs */
+	struct cx_contact_id observed[ LEDGERTEST_INITIAL +
+				       LEDGERTEST_LATER ];
+};
+
+/**
+ * Check ledger match result
+ *
+ * @v name		Test name
+ * @v test		Self-test state
+ * @v ledger		Seed value ledger
+ * @v match		Observation index
+ * @v matched		Bitmask of seed values expected to be matched
+ * @ret ok		Success indicator
+ *
+ * The result must be identical to the result from the observation
+ * index, restricted to the expected seed values.
+ */
+static int ledgertest_match ( const char *name, struct ledgertest *test,
+			      struct cx_ledger *ledger,
+			      struct cx_match *match, unsigned int matched ) {
+	struct cx_match_result *expected;
+	struct cx_match_result *result;
+	const struct cx_match_hit *hit;
+	unsigned int count = 0;
+	unsigned int i;
+	int ok = 0;
+
+	/* Match using observation index */
+	expected = cx_match_seeds ( match, test->seeds, LEDGERTEST_SEEDS );
+	if ( ! expected ) {
+		fprintf ( stderr, "LEDGER %s fail: could not match using "
+			  "index\n", name );
+		goto err_expected;
+	}
+
+	/* Match using ledger */
+	result = cx_ledger_match ( ledger, match, test->seeds, test->ranges,
+				   LEDGERTEST_SEEDS, LEDGERTEST_NOW );
+	if ( ! result ) {
+		fprintf ( stderr, "LEDGER %s fail: could not match\n", name );
+		goto err_result;
+	}
+
+	/* Compare results */
+	for ( i = 0 ; i < expected->count ; i++ ) {
+		hit = &expected->hits[i];
+		if ( ! ( matched & ( 1 << hit->seed ) ) )
+			continue;
+		if ( ( count >= result->count ) ||
+		     ( memcmp ( &result->hits[count++], hit,
+				sizeof ( *hit ) ) != 0 ) ) {
+			fprintf ( stderr, "LEDGER %s fail: hit %d mismatch\n",
+				  name, ( count - 1 ) );
+			goto err_mismatch;
+		}
+	}
+	if ( ( count != result->count ) || ( ! count ) ) {
+		fprintf ( stderr, "LEDGER %s fail: %d hits (expected %d)\n",
+			  name, result->count, count );
+		goto err_mismatch;
+	}
+
+	/* Check that nothing remains to be matched */
+	cx_match_result_free ( result );
+	result = cx_ledger_match ( ledger, match, test->seeds, test->ranges,
+				   LEDGERTEST_SEEDS, LEDGERTEST_NOW );
+	if ( ( ! result ) || result->count ) {
+		fprintf ( stderr, "LEDGER %s fail: rematched\n", name );
+		goto err_mismatch;
+	}
+
+	ok = 1;
+ err_mismatch:
+	cx_match_result_free ( result );
+ err_result:
+	cx_match_result_free ( expected );
+ err_expected:
+	return ok;
+}
+
+/**
+ * Check which seed values have been checked
+ *
+ * @v name		Test name
+ * @v test		Self-test state
+ * @v ledger		Seed value ledger
+ * @v now		Current time
+ * @v checked		Bitmask of seed values expected to be checked
+ * @ret ok		Success indicator
+ */
+static int ledgertest_checked ( const char *name, struct ledgertest *test,
+				struct cx_ledger *ledger, uint64_t now,
+				unsigned int checked ) {
+	unsigned int i;
+	int expected;
+
+	for ( i = 0 ; i < LEDGERTEST_SEEDS ; i++ ) {
+		expected = ( !! ( checked & ( 1 << i ) ) );
+		if ( cx_ledger_checked ( ledger, &test->seeds[i],
+					 &test->ranges[i],
+					 now ) != expected ) {
+			fprintf ( stderr, "LEDGER %s fail: seed %d "
+				  "%schecked\n", name, i,
+				  ( expected ? "not " : "" ) );
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Run seed value ledger self-tests
+ *
+ * @v test		Self-test state
+ * @ret ok		Success indicator
+ */
+static int ledgertest_run ( struct ledgertest *test ) {
+	struct cx_ledger_range range;
+	struct cx_match_seed seed;
+	struct cx_ledger *ledger;
+	struct cx_match *initial;
+	struct cx_match *later;
+	unsigned int all = ( ( 1 << LEDGERTEST_SEEDS ) - 1 );
+	unsigned int later_seed = ( 1 << LEDGERTEST_LATER_SEED );
+	size_t len;
+	int fd;
+	int ok = 0;
+
+	/* Create observation indices */
+	initial = cx_match_create ( test->observed, LEDGERTEST_INITIAL );
+	if ( ! initial ) {
+		fprintf ( stderr, "LEDGER fail: could not create index\n" );
+		goto err_initial;
+	}
+	later = cx_match_create ( test->observed,
+				  ( LEDGERTEST_INITIAL + LEDGERTEST_LATER ) );
+	if ( ! later ) {
+		fprintf ( stderr, "LEDGER fail: could not create index\n" );
+		goto err_later;
+	}
+
+	/* Match all seed values against initial observations */
+	ledger = cx_ledger_open ( test->path );
+	if ( ! ledger ) {
+		fprintf ( stderr, "LEDGER fail: could not create\n" );
+		goto err_open;
+	}
+	if ( ! ledgertest_checked ( "empty", test, ledger, LEDGERTEST_NOW,
+				    0 ) )
+		goto err_check;
+	if ( ! ledgertest_match ( "initial", test, ledger, initial, all ) )
+		goto err_check;
+	if ( ! ledgertest_checked ( "initial", test, ledger, LEDGERTEST_NOW,
+				    all ) )
+		goto err_check;
+
+	/* Add later observations, and rematch affected seed value */
+	if ( ! cx_ledger_observe ( ledger,
+				   ( ( LEDGERTEST_LATER_SEED *
+				       LEDGERTEST_RANGE ) + 50 ),
+				   ( ( LEDGERTEST_LATER_SEED *
+				       LEDGERTEST_RANGE ) + 51 ) ) ) {
+		fprintf ( stderr, "LEDGER fail: could not observe\n" );
+		goto err_check;
+	}
+	if ( ! ledgertest_checked ( "observed", test, ledger, LEDGERTEST_NOW,
+				    ( all & ~later_seed ) ) )
+		goto err_check;
+	if ( ! ledgertest_match ( "later", test, ledger, later, later_seed ) )
+		goto err_check;
+
+	/* Check that a different range is not treated as checked */
+	memcpy ( &range, &test->ranges[0], sizeof ( range ) );
+	range.end++;
+	if ( cx_ledger_checked ( ledger, &test->seeds[0], &range,
+				 LEDGERTEST_NOW ) ) {
+		fprintf ( stderr, "LEDGER fail: different range checked\n" );
+		goto err_check;
+	}
+
+	/* Check that a seed value checked over only part of its
+	 * sequence is not treated as checked over the whole sequence.
+	 */
+	memcpy ( &seed, &test->seeds[0], sizeof ( seed ) );
+	seed.last = ( seed.first + 1 );
+	if ( ! cx_ledger_record ( ledger, &seed, &range ) ) {
+		fprintf ( stderr, "LEDGER fail: could not record\n" );
+		goto err_check;
+	}
+	if ( ! cx_ledger_checked ( ledger, &seed, &range, LEDGERTEST_NOW ) ) {
+		fprintf ( stderr, "LEDGER fail: partial sequence not "
+			  "checked\n" );
+		goto err_check;
+	}
+	if ( cx_ledger_checked ( ledger, &test->seeds[0], &range,
+				 LEDGERTEST_NOW ) ) {
+		fprintf ( stderr, "LEDGER fail: partial sequence checked\n" );
+		goto err_check;
+	}
+
+	/* Check that an invalid seed value is rejected */
+	len = test->seeds[1].len--;
+	if ( cx_ledger_match ( ledger, later, test->seeds, test->ranges,
+			       LEDGERTEST_SEEDS, LEDGERTEST_NOW ) ) {
+		fprintf ( stderr, "LEDGER fail: accepted invalid seed\n" );
+		test->seeds[1].len = len;
+		goto err_check;
+	}
+	test->seeds[1].len = len;
+	cx_ledger_close ( ledger );
+
+	/* Simulate a torn write, and reopen */
+	fd = open ( test->path, ( O_WRONLY | O_APPEND ) );
+	if ( ( fd < 0 ) || ( write ( fd, "torn", 4 ) != 4 ) ) {
+		fprintf ( stderr, "LEDGER fail: could not tear\n" );
+		if ( fd >= 0 )
+			close ( fd );
+		goto err_open;
+	}
+	close ( fd );
+	ledger = cx_ledger_open ( test->path );
+	if ( ! ledger ) {
+		fprintf ( stderr, "LEDGER fail: could not reopen\n" );
+		goto err_open;
+	}
+	if ( ( cx_ledger_count ( ledger ) != ( LEDGERTEST_SEEDS + 1 ) ) ||
+	     ( ! ledgertest_checked ( "reopen", test, ledger,
+				      LEDGERTEST_NOW, all ) ) ) {
+		fprintf ( stderr, "LEDGER fail: reopen mismatch\n" );
+		goto err_check;
+	}
+
+	/* Add consecutive observations spanning two seed values */
+	if ( ( ! cx_ledger_observe ( ledger, 0, 50 ) ) ||
+	     ( ! cx_ledger_observe ( ledger, 90, 150 ) ) ) {
+		fprintf ( stderr, "LEDGER fail: could not observe\n" );
+		goto err_check;
+	}
+	if ( ! ledgertest_checked ( "merged", test, ledger, LEDGERTEST_NOW,
+				    ( all & ~3 ) ) )
+		goto err_check;
+	cx_ledger_close ( ledger );
+	ledger = cx_ledger_open ( test->path );
+	if ( ! ledger ) {
+		fprintf ( stderr, "LEDGER fail: could not reopen\n" );
+		goto err_open;
+	}
+	if ( ! ledgertest_checked ( "replay", test, ledger, LEDGERTEST_NOW,
+				    ( all & ~3 ) ) )
+		goto err_check;
+
+	/* Check that expired entries are not current even before
+	 * being discarded.
+	 */
+	if ( ! ledgertest_checked ( "expired", test, ledger, LEDGERTEST_LATE,
+				    LEDGERTEST_KEPT ) )
+		goto err_check;
+
+	/* Expire entries, discarding invalidated entries */
+	if ( ! cx_ledger_expire ( ledger, LEDGERTEST_LATE ) ) {
+		fprintf ( stderr, "LEDGER fail: could not expire\n" );
+		goto err_check;
+	}
+	if ( ( cx_ledger_count ( ledger ) != 2 ) ||
+	     ( ! ledgertest_checked ( "expire", test, ledger, LEDGERTEST_LATE,
+				      LEDGERTEST_KEPT ) ) ) {
+		fprintf ( stderr, "LEDGER fail: expire mismatch\n" );
+		goto err_check;
+	}
+	cx_ledger_close ( ledger );
+	ledger = cx_ledger_open ( test->path );
+	if ( ! ledger ) {
+		fprintf ( stderr, "LEDGER fail: could not reopen\n" );
+		goto err_open;
+	}
+	if ( ( cx_ledger_count ( ledger ) != 2 ) ||
+	     ( ! ledgertest_checked ( "compacted", test, ledger,
+				      LEDGERTEST_LATE, LEDGERTEST_KEPT ) ) ) {
+		fprintf ( stderr, "LEDGER fail: compacted mismatch\n" );
+		goto err_check;
+	}
+
+	/* Check that the ledger is still usable */
+	if ( ! ledgertest_match ( "rematch", test, ledger, later,
+				  ( all & ~LEDGERTEST_KEPT ) ) )
+		goto err_check;
+
+	ok = 1;
+ err_check:
+	cx_ledger_close ( ledger );
+ err_open:
+	cx_match_free ( later );
+ err_later:
+	cx_match_free ( initial );
+ err_initial:
+	return ok;
+}
+
+/**
+ * Run seed value ledger self-tests
+ *
+ * @ret ok		Success indicator
+ */
+int ledgertests ( void ) {
+	struct ledgertest *test;
+	unsigned int i;
+	int ok = 0;
+
+	/* Allocate test state */
+	test = malloc ( sizeof ( *test ) );
+	if ( ! test ) {
+		fprintf ( stderr, "LEDGER fail: out of memory\n" );
+		goto err_alloc;
+	}
+
+	/* Construct seed values and observation time ranges */
+	cxtest_match_seeds ( test->seeds, test->raw, LEDGERTEST_SEEDS );
+	for ( i = 0 ; i < LEDGERTEST_SEEDS ; i++ ) {
+		test->ranges[i].start = ( i * LEDGERTEST_RANGE );
+		test->ranges[i].end = ( ( i + 1 ) * LEDGERTEST_RANGE );
+		test->ranges[i].expiry = ( LEDGERTEST_EXPIRY + i );
+	}
+
+	/* Construct initial observations from all seed values, and
+	 * later observations from a single seed value.
+	 */
+	if ( ( ! cxtest_match_observe ( "LEDGER", test->seeds,
+					LEDGERTEST_SEEDS, test->observed,
+					LEDGERTEST_INITIAL ) ) ||
+	     ( ! cxtest_match_observe ( "LEDGER",
+					&test->seeds[LEDGERTEST_LATER_SEED], 1,
+					&test->observed[LEDGERTEST_INITIAL],
+					LEDGERTEST_LATER ) ) )
+		goto err_observe;
+
+	/* Create ledger directory */
+	snprintf ( test->dir, sizeof ( test->dir ), "/tmp/cxledgerXXXXXX" );
+	if ( ! mkdtemp ( test->dir ) ) {
+		fprintf ( stderr, "LEDGER fail: could not create "
+			  "directory\n" );
+		goto err_mkdtemp;
+	}
+	snprintf ( test->path, sizeof ( test->path ), "%s/ledger",
+		   test->dir );
+
+	/* Run tests */
+	ok = ledgertest_run ( test );
+	if ( ok )
+		fprintf ( stderr, "LEDGER ok\n" );
+
+	/* Remove ledger */
+	unlink ( test->path );
+	rmdir ( test->dir );
+ err_mkdtemp:
+ err_observe:
+	free ( test );
+ err_alloc:
+	return ok;
+}
@@ -0,0 +1,795 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Contact ID matching
+ *
+ ******************************************************************************
+ *
+ * A set of observed contact IDs is indexed once, and may then be
+ * matched against any number of seed values.  Each seed value is
+ * expanded to its full sequence of contact IDs, and each generated
+ * contact ID is looked up in the index.
+ *
+ * Contact IDs are uniformly distributed (other than the fixed UUID
+ * version and variant bits), and so no hash function is required:
+ * the most significant 64 bits of each contact ID are used directly.
+ *
+ * The index is a flat open-addressing table in the style of a Swiss
+ * table.  Slots are arranged in groups of sixteen, each described by
+ * sixteen control bytes.  A control byte holds either a seven-bit tag
+ * taken from the least significant bits of the 64-bit key, or a
+ * marker indicating an empty slot.  The home group is selected by
+ * the most significant bits of the key, and groups are probed
+ * linearly.  All sixteen control bytes within a group are compared
+ * against the tag at once, and the full contact ID is compared only
+ * for slots whose tag matches.  The table is never more than 7/8
+ * full, so that probing terminates at the first group containing an
+ * empty slot.
+ *
+ * The same contact ID may be observed more than once.  Repeated
+ * observations occupy separate slots, which are encountered in order
+ * of insertion (and hence in order of observation index) along the
+ * probe sequence.
+ *
+ * Almost all generated contact IDs will not have been observed.  An
+ * optional binary fuse filter over the same 64-bit keys may be placed
+ * in front of the table, so that most lookups touch only the (much
+ * smaller) filter.  The table is consulted only for contact IDs that
+ * pass the filter.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <cx/match.h>
+#include "fuse.h"
+#include "expand.h"
+#include "parallel.h"
+#include "debug.h"
+
+/** Number of seed values in each batch shared out between threads */
+#define CX_MATCH_PARALLEL_BATCH 64
+
+/** Number of slots in a group */
+#define CX_MATCH_GROUP 16
+
+/** Maximum number of group index bits */
+#define CX_MATCH_MAX_BITS 28
+
+/** Control byte for an empty slot */
+#define CX_MATCH_EMPTY 0x80
+
+/** Tag mask */
+#define CX_MATCH_TAG_MASK 0x7f
+
+/** Default prefilter fingerprint width */
+#define CX_MATCH_DEFAULT_FILTER 16
+
+/** An indexed contact ID */
+struct cx_match_entry {
+	/** Most significant 64 bits */
+	uint64_t hi;
+	/** Least significant 64 bits */
+	uint64_t lo;
+};
+
+/** An observation index */
+struct cx_match {
+	/** Control bytes */
+	unsigned char *ctrl;
+	/** Indexed contact IDs */
+	struct cx_match_entry *entries;
+	/**
+	 * Observation indices
+	 *
+	 * These are held separately from the indexed contact IDs,
+	 * since they are needed only for lookups that match.
+	 */
+	unsigned int *observations;
+	/** Group index mask */
+	size_t mask;
+	/** Group index shift */
+	unsigned int shift;
+	/** Number of observed contact IDs */
+	unsigned int count;
+	/** Prefilter (if fingerprint width is non-zero) */
+	struct cx_fuse filter;
+};
+
+/** State for matching a range of seed values */
+struct cx_match_state {
+	/** Observation index */
+	struct cx_match *match;
+	/** Match result */
+	struct cx_match_result *result;
+	/** Number of matches allocated */
+	unsigned int *max;
+};
+
+/** Matches for a batch of seed values */
+struct cx_match_part {
+	/** Matches */
+	struct cx_match_result result;
+	/** Number of matches allocated */
+	unsigned int max;
+};
+
+/** A matching worker */
+struct cx_match_worker {
+	/** Batches remaining in deque
+	 *
+	 * The upper 32 bits hold the index of the first remaining batch,
+	 * and the lower 32 bits hold the index of the last remaining
+	 * batch plus one, so that both ends may be updated atomically.
+	 */
+	uint64_t deque;
+	/** Working storage */
+	struct cx_expand expand;
+};
+
+/** A parallel matching job */
+struct cx_match_job {
+	/** Observation index */
+	struct cx_match *match;
+	/** Seed values */
+	const struct cx_match_seed *seeds;
+	/** Number of seed values */
+	unsigned int count;
+	/** Per-batch matches */
+	struct cx_match_part *parts;
+	/** Workers */
+	struct cx_match_worker *workers;
+	/** Number of workers */
+	unsigned int threads;
+	/** A worker has failed */
+	int failed;
+};
+
+/**
+ * Compare group control bytes against tag
+ *
+ * @v ctrl		Group control bytes
+ * @v tag		Tag
+ * @v empty		Bitmask of empty slots to fill in
+ * @ret found		Bitmask of slots with a matching tag
+ */
+static inline unsigned int cx_match_group ( const unsigned char *ctrl,
+					    unsigned int tag,
+					    unsigned int *empty ) {
+#ifdef __SSE2__
+	__m128i group;
+
+	/* Compare all control bytes at once */
+	group = _mm_loadu_si128 ( ( const __m128i * ) ctrl );
+	*empty = _mm_movemask_epi8 ( group );
+	return _mm_movemask_epi8 ( _mm_cmpeq_epi8 ( group,
+						    _mm_set1_epi8 ( tag ) ) );
+#else
+	unsigned int found = 0;
+	unsigned int i;
+
+	/* Compare each control byte in turn */
+	*empty = 0;
+	for ( i = 0 ; i < CX_MATCH_GROUP ; i++ ) {
+		if ( ctrl[i] == tag )
+			found |= ( 1U << i );
+		if ( ctrl[i] & CX_MATCH_EMPTY )
+			*empty |= ( 1U << i );
+	}
+	return found;
+#endif
+}
+
+/**
+ * Get home group for key
+ *
+ * @v match		Observation index
+ * @v hi		Most significant 64 bits of contact ID
+ * @ret group		Group index
+ */
+static inline size_t cx_match_home ( struct cx_match *match, uint64_t hi ) {
+
+	return ( hi >> match->shift );
+}
+
+/**
+ * Create observation index
+ *
+ * @v ids		Observed contact IDs
+ * @v count		Number of observed contact IDs
+ * @ret match		Observation index, or NULL on error
+ *
+ * The observed contact IDs are copied into the index, and need not
+ * remain valid after this call.  Observations are identified by
+ * their index within @c ids; the same contact ID may be observed
+ * more than once.  A 16-bit prefilter is constructed by default; use
+ * cx_match_filter() to change or remove it.
+ */
+struct cx_match * cx_match_create ( const struct cx_contact_id *ids,
+				    unsigned int count ) {
+	struct cx_match *match;
+	struct cx_match_entry *entry;
+	unsigned char *ctrl;
+	unsigned int empty;
+	unsigned int bits;
+	size_t groups;
+	size_t slots;
+	size_t group;
+	size_t slot;
+	uint64_t hi;
+	unsigned int i;
+
+	/* Allocate and initialise structure */
+	match = malloc ( sizeof ( *match ) );
+	if ( ! match )
+		goto err_alloc;
+	memset ( match, 0, sizeof ( *match ) );
+	match->count = count;
+
+	/* Size table to be at most 7/8 full */
+	for ( bits = 1 ; ( ( ( ( ( size_t ) CX_MATCH_GROUP << bits ) * 7 ) /
+			     8 ) < count ) ; bits++ ) {
+		if ( bits == CX_MATCH_MAX_BITS ) {
+			DBG ( "MATCH too many observations (%d)\n", count );
+			goto err_count;
+		}
+	}
+	groups = ( ( ( size_t ) 1 ) << bits );
+	slots = ( groups * CX_MATCH_GROUP );
+	match->mask = ( groups - 1 );
+	match->shift = ( ( 8 * sizeof ( hi ) ) - bits );
+
+	/* Allocate table */
+	match->ctrl = malloc ( slots );
+	if ( ! match->ctrl )
+		goto err_alloc_ctrl;
+	match->entries = malloc ( slots * sizeof ( match->entries[0] ) );
+	if ( ! match->entries )
+		goto err_alloc_entries;
+	match->observations = malloc ( slots *
+				       sizeof ( match->observations[0] ) );
+	if ( ! match->observations )
+		goto err_alloc_observations;
+	memset ( match->ctrl, CX_MATCH_EMPTY, slots );
+
+	/* Insert each observation into the first empty slot along
+	 * its probe sequence.
+	 */
+	for ( i = 0 ; i < count ; i++ ) {
+		hi = cx_expand_be64 ( &ids[i].bytes[0] );
+		for ( group = cx_match_home ( match, hi ) ; ;
+		      group = ( ( group + 1 ) & match->mask ) ) {
+			ctrl = &match->ctrl[ group * CX_MATCH_GROUP ];
+			cx_match_group ( ctrl, CX_MATCH_EMPTY, &empty );
+			if ( empty )
+				break;
+		}
+		slot = ( ( group * CX_MATCH_GROUP ) +
+			 __builtin_ctz ( empty ) );
+		entry = &match->entries[slot];
+		entry->hi = hi;
+		entry->lo = cx_expand_be64 ( &ids[i].bytes[8] );
+		match->ctrl[slot] = ( hi & CX_MATCH_TAG_MASK );
+		match->observations[slot] = i;
+	}
+
+	/* Construct default prefilter */
+	if ( ! cx_match_filter ( match, CX_MATCH_DEFAULT_FILTER ) )
+		goto err_filter;
+
+	return match;
+
+ err_filter:
+	free ( match->observations );
+ err_alloc_observations:
+	free ( match->entries );
+ err_alloc_entries:
+	free ( match->ctrl );
+ err_alloc_ctrl:
+ err_count:
+	free ( match );
+ err_alloc:
+	return NULL;
+}
+
+/**
+ * Set observation index prefilter
+ *
+ * @v match		Observation index
+ * @v bits		Fingerprint width (8 or 16), or zero to remove
+ * @ret ok		Success indicator
+ *
+ * The prefilter has a false positive rate of around 2^-bits, and
+ * occupies around 1.2 fingerprints per distinct observed contact ID.
+ * The prefilter does not affect the result of matching, only its
+ * speed.  Any existing prefilter is retained if a new prefilter
+ * cannot be constructed.
+ */
+int cx_match_filter ( struct cx_match *match, unsigned int bits ) {
+	struct cx_fuse filter;
+	uint64_t *keys;
+	size_t slots;
+	size_t slot;
+	unsigned int i;
+
+	/* Remove prefilter, if applicable */
+	if ( ! bits ) {
+		cx_fuse_free ( &match->filter );
+		return 1;
+	}
+
+	/* Collect keys from occupied slots */
+	keys = malloc ( ( match->count ? match->count : 1 ) *
+			sizeof ( keys[0] ) );
+	if ( ! keys )
+		goto err_alloc;
+	slots = ( ( match->mask + 1 ) * CX_MATCH_GROUP );
+	for ( i = 0, slot = 0 ; slot < slots ; slot++ ) {
+		if ( ! ( match->ctrl[slot] & CX_MATCH_EMPTY ) )
+			keys[i++] = match->entries[slot].hi;
+	}
+
+	/* Construct prefilter */
+	if ( ! cx_fuse_build ( &filter, keys, i, bits ) ) {
+		DBG ( "MATCH could not construct %d-bit filter\n", bits );
+		goto err_build;
+	}
+
+	/* Replace any existing prefilter */
+	cx_fuse_free ( &match->filter );
+	memcpy ( &match->filter, &filter, sizeof ( match->filter ) );
+
+	free ( keys );
+	return 1;
+
+ err_build:
+	free ( keys );
+ err_alloc:
+	return 0;
+}
+
+/**
+ * Look up generated contact IDs
+ *
+ * @v ctx		Matching state
+ * @v ids		Generated contact IDs
+ * @v count		Number of generated contact IDs
+ * @v seed		Index of seed value
+ * @v iteration		Iteration at which first contact ID was generated
+ * @ret ok		Success indicator
+ */
+static int cx_match_lookup ( void *ctx, const struct cx_contact_id *ids,
+			     unsigned int count, unsigned int seed,
+			     unsigned int iteration ) {
+	struct cx_match_state *state = ctx;
+	struct cx_match *match = state->match;
+	const struct cx_match_entry *entry;
+	const unsigned char *ctrl;
+	unsigned int observation;
+	unsigned int found;
+	unsigned int empty;
+	unsigned int tag;
+	unsigned int i;
+	size_t group;
+	size_t slot;
+	uint64_t hi;
+	uint64_t lo;
+
+	/* Look up each contact ID */
+	for ( i = 0 ; i < count ; i++ ) {
+
+		/* Reject most contact IDs using the prefilter */
+		hi = cx_expand_be64 ( &ids[i].bytes[0] );
+		if ( match->filter.bits &&
+		     ( ! cx_fuse_contains ( &match->filter, hi ) ) )
+			continue;
+
+		/* Probe groups until a group with an empty slot */
+		tag = ( hi & CX_MATCH_TAG_MASK );
+		for ( group = cx_match_home ( match, hi ) ; ;
+		      group = ( ( group + 1 ) & match->mask ) ) {
+
+			/* Check each slot with a matching tag */
+			ctrl = &match->ctrl[ group * CX_MATCH_GROUP ];
+			found = cx_match_group ( ctrl, tag, &empty );
+			for ( ; found ; found &= ( found - 1 ) ) {
+				slot = ( ( group * CX_MATCH_GROUP ) +
+					 __builtin_ctz ( found ) );
+				entry = &match->entries[slot];
+				if ( entry->hi != hi )
+					continue;
+				lo = cx_expand_be64 ( &ids[i].bytes[8] );
+				if ( entry->lo != lo )
+					continue;
+				observation = match->observations[slot];
+				if ( ! cx_expand_hit ( state->result,
+						       state->max, seed,
+						       ( iteration + i ),
+						       observation ) ) {
+					DBG ( "MATCH could not record "
+					      "match\n" );
+					return 0;
+				}
+			}
+			if ( empty )
+				break;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Match a range of seed values against observation index
+ *
+ * @v match		Observation index
+ * @v seeds		Seed values
+ * @v first		Index of first seed value in range
+ * @v count		Number of seed values in range
+ * @v expand		Working storage
+ * @v result		Match result
+ * @v max		Number of matches allocated
+ * @ret ok		Success indicator
+ */
+static int cx_match_range ( struct cx_match *match,
+			    const struct cx_match_seed *seeds,
+			    unsigned int first, unsigned int count,
+			    struct cx_expand *expand,
+			    struct cx_match_result *result,
+			    unsigned int *max ) {
+	struct cx_match_state state = {
+		.match = match,
+		.result = result,
+		.max = max,
+	};
+
+	return cx_expand_seeds ( expand, seeds, first, count,
+				 cx_match_lookup, &state );
+}
+
+/**
+ * Match seed values against observation index
+ *
+ * @v match		Observation index
+ * @v seeds		Seed values
+ * @v count		Number of seed values
+ * @ret result		Match result, or NULL on error
+ *
+ * Every contact ID generated from each seed value within the seed
+ * value's range is looked up in the observation index.  Generation
+ * stops at the end of the range.  Consecutive seed values of the
+ * same generator type and range are expanded together.  The result
+ * must eventually be freed using cx_match_result_free().
+ */
+struct cx_match_result * cx_match_seeds ( struct cx_match *match,
+					  const struct cx_match_seed *seeds,
+					  unsigned int count ) {
+	struct cx_match_result *result;
+	struct cx_expand expand;
+	unsigned int hits = 0;
+
+	/* Allocate and initialise result */
+	result = malloc ( sizeof ( *result ) );
+	if ( ! result )
+		goto err_alloc;
+	memset ( result, 0, sizeof ( *result ) );
+	memset ( &expand, 0, sizeof ( expand ) );
+
+	/* Match all seed values */
+	if ( ! cx_match_range ( match, seeds, 0, count, &expand, result,
+				&hits ) )
+		goto err_range;
+
+	cx_expand_free ( &expand );
+	return result;
+
+ err_range:
+	cx_expand_free ( &expand );
+	cx_match_result_free ( result );
+ err_alloc:
+	return NULL;
+}
+
+/**
+ * Take next batch from a worker's own deque
+ *
+ * @v worker		Matching worker
+ * @v batch		Batch index to fill in
+ * @ret ok		A batch was taken
+ */
+static int cx_match_take ( struct cx_match_worker *worker,
+			   unsigned int *batch ) {
+	uint64_t deque = __atomic_load_n ( &worker->deque, __ATOMIC_RELAXED );
+	uint32_t head;
+	uint32_t tail;
+
+	do {
+		head = ( deque >> 32 );
+		tail = deque;
+		if ( head >= tail )
+			return 0;
+	} while ( ! __atomic_compare_exchange_n ( &worker->deque, &deque,
+						  ( deque + ( 1ULL << 32 ) ),
+						  0, __ATOMIC_RELAXED,
+						  __ATOMIC_RELAXED ) );
+	*batch = head;
+	return 1;
+}
+
+/**
+ * Steal last batch from another worker's deque
+ *
+ * @v victim		Matching worker
+ * @v batch		Batch index to fill in
+ * @ret ok		A batch was stolen
+ */
+static int cx_match_steal ( struct cx_match_worker *victim,
+			    unsigned int *batch ) {
+	uint64_t deque = __atomic_load_n ( &victim->deque, __ATOMIC_RELAXED );
+	uint32_t head;
+	uint32_t tail;
+
+	do {
+		head = ( deque >> 32 );
+		tail = deque;
+		if ( head >= tail )
+			return 0;
+	} while ( ! __atomic_compare_exchange_n ( &victim->deque, &deque,
+						  ( deque - 1 ), 0,
+						  __ATOMIC_RELAXED,
+						  __ATOMIC_RELAXED ) );
+	*batch = ( tail - 1 );
+	return 1;
+}
+
+/**
+ * Take next batch for a worker
+ *
+ * @v job		Parallel matching job
+ * @v index		Worker index
+ * @v batch		Batch index to fill in
+ * @ret ok		A batch was taken
+ *
+ * Work is taken from the worker's own deque if possible, otherwise
+ * stolen from each other worker in turn.
+ */
+static int cx_match_next ( struct cx_match_job *job, unsigned int index,
+			   unsigned int *batch ) {
+	struct cx_match_worker *victim;
+	unsigned int i;
+
+	/* Take work from own deque, if possible */
+	if ( cx_match_take ( &job->workers[index], batch ) )
+		return 1;
+
+	/* Steal work from another deque, if possible */
+	for ( i = 1 ; i < job->threads ; i++ ) {
+		victim = &job->workers[ ( index + i ) % job->threads ];
+		if ( cx_match_steal ( victim, batch ) )
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Run matching worker
+ *
+ * @v ctx		Parallel matching job
+ * @v index		Worker index
+ *
+ * The worker processes batches from the front of its own deque, and
+ * then steals batches from the back of other workers' deques until
+ * no work remains.  Since no work is ever added, a worker may exit
+ * as soon as it finds every deque empty.
+ */
+static void cx_match_worker ( void *ctx, unsigned int index ) {
+	struct cx_match_job *job = ctx;
+	struct cx_match_worker *worker = &job->workers[index];
+	struct cx_match_part *part;
+	unsigned int batch;
+	unsigned int first;
+	unsigned int count;
+
+	while ( ( ! __atomic_load_n ( &job->failed, __ATOMIC_RELAXED ) ) &&
+		cx_match_next ( job, index, &batch ) ) {
+
+		/* Match batch */
+		first = ( batch * CX_MATCH_PARALLEL_BATCH );
+		count = ( job->count - first );
+		if ( count > CX_MATCH_PARALLEL_BATCH )
+			count = CX_MATCH_PARALLEL_BATCH;
+		part = &job->parts[batch];
+		if ( ! cx_match_range ( job->match, job->seeds, first, count,
+					&worker->expand, &part->result,
+					&part->max ) ) {
+			__atomic_store_n ( &job->failed, 1, __ATOMIC_RELAXED );
+			break;
+		}
+	}
+}
+
+/**
+ * Match seed values against observation index using multiple threads
+ *
+ * @v match		Observation index
+ * @v seeds		Seed values
+ * @v count		Number of seed values
+ * @v threads		Number of threads, or zero to use all processors
+ * @ret result		Match result, or NULL on error
+ *
+ * This is equivalent to cx_match_seeds(), and produces an identical
+ * result regardless of the number of threads.  Seed values are
+ * divided into fixed batches, which are initially shared out between
+ * the threads as contiguous ranges and subsequently redistributed by
+ * work stealing.  Each thread expands seed values using its own
+ * generator state, and records matches separately for each batch.
+ * The per-batch matches are concatenated in batch order once all
+ * threads have completed.
+ *
+ * The threads are taken from the shared worker pool (see
+ * cx_parallel_run()), and the calling thread participates as one of
+ * them.
+ */
+struct cx_match_result *
+cx_match_seeds_parallel ( struct cx_match *match,
+			  const struct cx_match_seed *seeds,
+			  unsigned int count, unsigned int threads ) {
+	struct cx_match_result *result;
+	struct cx_match_worker *worker;
+	struct cx_match_part *part;
+	struct cx_match_job job;
+	uint64_t head;
+	uint64_t tail;
+	unsigned int batches;
+	unsigned int total;
+	unsigned int i;
+
+	/* Determine number of threads */
+	threads = cx_parallel_threads ( threads );
+	batches = ( ( count + CX_MATCH_PARALLEL_BATCH - 1 ) /
+		    CX_MATCH_PARALLEL_BATCH );
+	if ( threads > batches )
+		threads = batches;
+	if ( threads <= 1 )
+		return cx_match_seeds ( match, seeds, count );
+
+	/* Allocate and initialise job */
+	memset ( &job, 0, sizeof ( job ) );
+	job.match = match;
+	job.seeds = seeds;
+	job.count = count;
+	job.threads = threads;
+	job.parts = calloc ( batches, sizeof ( job.parts[0] ) );
+	if ( ! job.parts )
+		goto err_alloc_parts;
+	job.workers = calloc ( threads, sizeof ( job.workers[0] ) );
+	if ( ! job.workers )
+		goto err_alloc_workers;
+
+	/* Share out batches as contiguous ranges */
+	for ( i = 0 ; i < threads ; i++ ) {
+		worker = &job.workers[i];
+		head = ( ( ( ( uint64_t ) i ) * batches ) / threads );
+		tail = ( ( ( ( uint64_t ) ( i + 1 ) ) * batches ) / threads );
+		worker->deque = ( ( head << 32 ) | tail );
+	}
+
+	/* Run workers */
+	cx_parallel_run ( threads, cx_match_worker, &job );
+	if ( job.failed )
+		goto err_failed;
+
+	/* Allocate and initialise result */
+	for ( total = 0, i = 0 ; i < batches ; i++ ) {
+		if ( ( total + job.parts[i].result.count ) < total ) {
+			DBG ( "MATCH too many matches\n" );
+			goto err_total;
+		}
+		total += job.parts[i].result.count;
+	}
+	result = malloc ( sizeof ( *result ) );
+	if ( ! result )
+		goto err_alloc_result;
+	result->count = total;
+	result->hits = malloc ( ( total ? total : 1 ) *
+				sizeof ( result->hits[0] ) );
+	if ( ! result->hits )
+		goto err_alloc_hits;
+
+	/* Concatenate matches in batch order */
+	for ( total = 0, i = 0 ; i < batches ; i++ ) {
+		part = &job.parts[i];
+		memcpy ( &result->hits[total], part->result.hits,
+			 ( part->result.count *
+			   sizeof ( result->hits[0] ) ) );
+		total += part->result.count;
+	}
+
+	/* Free job */
+	for ( i = 0 ; i < threads ; i++ )
+		cx_expand_free ( &job.workers[i].expand );
+	for ( i = 0 ; i < batches ; i++ )
+		free ( job.parts[i].result.hits );
+	free ( job.workers );
+	free ( job.parts );
+
+	return result;
+
+	free ( result->hits );
+ err_alloc_hits:
+	free ( result );
+ err_alloc_result:
+ err_total:
+ err_failed:
+	for ( i = 0 ; i < threads ; i++ )
+		cx_expand_free ( &job.workers[i].expand );
+	for ( i = 0 ; i < batches ; i++ )
+		free ( job.parts[i].result.hits );
+	free ( job.workers );
+ err_alloc_workers:
+	free ( job.parts );
+ err_alloc_parts:
+	return NULL;
+}
+
+/**
+ * Free match result
+ *
+ * @v result		Match result
+ */
+void cx_match_result_free ( struct cx_match_result *result ) {
+
+	/* Do nothing if freeing a NULL pointer */
+	if ( ! result )
+		return;
+
+	free ( result->hits );
+	free ( result );
+}
+
+/**
+ * Free observation index
+ *
+ * @v match		Observation index
+ */
+void cx_match_free ( struct cx_match *match ) {
+
+	/* Do nothing if freeing a NULL pointer */
+	if ( ! match )
+		return;
+
+	cx_fuse_free ( &match->filter );
+	free ( match->observations );
+	free ( match->entries );
+	free ( match->ctrl );
+	free ( match );
+}
@@ -0,0 +1,850 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Contact ID matching benchmarks
+ *
+ ******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <openssl/rand.h>
+#include <cx/generator.h>
+#include <cx/match.h>
+#include <cx/fpmatch.h>
+#include <cx/sortmatch.h>
+#include <cx/ingest.h>
+#include <cx/obsstore.h>
+#include <cx/ledger.h>
+#include "cxbench.h"
+#include "matchbench.h"
+
+/** Interval between seed values with a planted observation */
+#define MATCHBENCH_PLANT_INTERVAL 1000
+
+/** Number of seed values expanded at a time for the baseline */
+#define MATCHBENCH_BATCH 16
+
+/** Fraction of seed values used for sort-merge matching */
+#define MATCHBENCH_SORT_DIVISOR 64
+
+/** Fraction of the sort-merge working set held in memory */
+#define MATCHBENCH_SORT_MEMORY 4
+
+/** Size of a partitioned contact ID within the sort-merge working set */
+#define MATCHBENCH_SORT_RECORD 24
+
+/** Number of segments in the observation store */
+#define MATCHBENCH_STORE_SEGMENTS 4
+
+/** Number of observations sharing each observation store timestamp */
+#define MATCHBENCH_STORE_PER_TIME 1000
+
+/** Fraction of seed values replaced in each repeated publication */
+#define MATCHBENCH_LEDGER_NEW 10
+
+/** Number of times each advertiser is sighted */
+#define MATCHBENCH_INGEST_REPEAT 32
+
+/** Number of advertisers sighted concurrently */
+#define MATCHBENCH_INGEST_NEARBY 64
+
+/** Ingest deduplication time window */
+#define MATCHBENCH_INGEST_WINDOW 60
+
+/**
+ * Plant observations of generated contact IDs
+ *
+ * @v type		Generator type
+ * @v seeds		Seed values
+ * @v len		Length of each seed value
+ * @v count		Number of seed values
+ * @v observed		Observed contact IDs
+ * @v observations	Number of observed contact IDs
+ * @ret planted		Number of planted observations, or negative error
+ */
+static int matchbench_plant ( enum cx_generator_type type,
+			      const unsigned char *seeds, size_t len,
+			      unsigned int count,
+			      struct cx_contact_id *observed,
+			      unsigned int observations ) {
+	unsigned int max = cx_gen_max_iterations ( type );
+	struct cx_contact_id ids[max];
+	unsigned int planted = 0;
+	unsigned int i;
+
+	/* Plant one observation from every few seed values */
+	for ( i = 0 ; i < count ; i += MATCHBENCH_PLANT_INTERVAL ) {
+		if ( planted >= observations )
+			break;
+		if ( ! cx_gen_expand ( type, &seeds[ i * len ], len, ids ) )
+			return -1;
+		memcpy ( &observed[ ( i * 7 ) % observations ],
+			 &ids[ ( i * 13 ) % max ], sizeof ( ids[0] ) );
+		planted++;
+	}
+
+	return planted;
+}
+
+/** Prefilter fingerprint widths to be benchmarked */
+static const unsigned int matchbench_filters[] = { 16, 8, 0 };
+
+/**
+ * Benchmark matching
+ *
+ * @v name		Benchmark name
+ * @v match		Observation index
+ * @v bits		Prefilter fingerprint width
+ * @v seeds		Seed values
+ * @v count		Number of seed values
+ * @v planted		Number of planted observations
+ * @ret ok		Success indicator
+ */
+static int matchbench_match ( const char *name, struct cx_match *match,
+			      unsigned int bits,
+			      const struct cx_match_seed *seeds,
+			      unsigned int count, unsigned int planted ) {
+	unsigned int max = cx_gen_max_iterations ( seeds->type );
+	struct cx_match_result *result;
+	char subname[32];
+	double start;
+	int ok = 0;
+
+	/* Set prefilter */
+	if ( ! cx_match_filter ( match, bits ) )
+		goto err_filter;
+
+	/* Match seed values */
+	start = cxbench_now();
+	result = cx_match_seeds ( match, seeds, count );
+	if ( ! result )
+		goto err_seeds;
+	if ( bits ) {
+		snprintf ( subname, sizeof ( subname ), "match filter%d",
+			   bits );
+	} else {
+		snprintf ( subname, sizeof ( subname ), "match unfiltered" );
+	}
+	cxbench_report ( name, subname, ( ( unsigned long ) count * max ),
+			 ( cxbench_now() - start ) );
+
+	/* Check that all planted observations were found */
+	if ( result->count < planted ) {
+		fprintf ( stderr, "%s found only %d of %d planted hits\n",
+			  name, result->count, planted );
+		goto err_hits;
+	}
+
+	ok = 1;
+ err_hits:
+	cx_match_result_free ( result );
+ err_seeds:
+ err_filter:
+	return ok;
+}
+
+/**
+ * Benchmark fingerprint matching
+ *
+ * @v name		Benchmark name
+ * @v observed		Observed contact IDs
+ * @v observations	Number of observed contact IDs
+ * @v seeds		Seed values
+ * @v count		Number of seed values
+ * @v planted		Number of planted observations
+ * @ret ok		Success indicator
+ */
+static int matchbench_fingerprint ( const char *name,
+				    const struct cx_contact_id *observed,
+				    unsigned int observations,
+				    const struct cx_match_seed *seeds,
+				    unsigned int count,
+				    unsigned int planted ) {
+	unsigned int max = cx_gen_max_iterations ( seeds->type );
+	struct cx_match_result *result;
+	struct cx_fpmatch_stats stats;
+	struct cx_contact_id *sorted;
+	struct cx_fpmatch *fp;
+	uint64_t *fingerprints;
+	unsigned int i;
+	double start;
+	int ok = 0;
+
+	/* Sort observations into fingerprint order */
+	sorted = malloc ( observations * sizeof ( sorted[0] ) );
+	if ( ! sorted )
+		goto err_alloc_sorted;
+	memcpy ( sorted, observed, ( observations * sizeof ( sorted[0] ) ) );
+	start = cxbench_now();
+	cx_fpmatch_sort ( sorted, observations );
+	cxbench_report ( name, "fpmatch sort", observations,
+			 ( cxbench_now() - start ) );
+
+	/* Calculate fingerprints */
+	fingerprints = malloc ( observations * sizeof ( fingerprints[0] ) );
+	if ( ! fingerprints )
+		goto err_alloc;
+	for ( i = 0 ; i < observations ; i++ )
+		fingerprints[i] = cx_fpmatch_fingerprint ( &sorted[i] );
+
+	/* Benchmark index construction */
+	start = cxbench_now();
+	fp = cx_fpmatch_create ( fingerprints, observations );
+	if ( ! fp )
+		goto err_create;
+	cxbench_report ( name, "fpmatch index", observations,
+			 ( cxbench_now() - start ) );
+
+	/* Benchmark matching */
+	start = cxbench_now();
+	result = cx_fpmatch_seeds ( fp, seeds, count );
+	if ( ! result )
+		goto err_seeds;
+	cxbench_report ( name, "fpmatch", ( ( unsigned long ) count * max ),
+			 ( cxbench_now() - start ) );
+
+	/* Benchmark confirmation */
+	start = cxbench_now();
+	if ( ! cx_fpmatch_confirm ( fp, seeds, result, sorted ) )
+		goto err_confirm;
+	cxbench_report ( name, "fpmatch confirm", result->count,
+			 ( cxbench_now() - start ) );
+
+	/* Check that all planted observations were found */
+	if ( result->count < planted ) {
+		fprintf ( stderr, "%s found only %d of %d planted hits\n",
+			  name, result->count, planted );
+		goto err_hits;
+	}
+
+	/* Report false positive rates */
+	cx_fpmatch_stats ( fp, &stats );
+	printf ( "BENCH %-16s %-24s %12llu rejected, rate %.3g (expected "
+		 "%.3g)\n", name, "fpmatch false positives", stats.rejected,
+		 stats.measured, stats.expected );
+
+	ok = 1;
+ err_hits:
+ err_confirm:
+	cx_match_result_free ( result );
+ err_seeds:
+	cx_fpmatch_free ( fp );
+ err_create:
+	free ( fingerprints );
+ err_alloc:
+	free ( sorted );
+ err_alloc_sorted:
+	return ok;
+}
+
+/**
+ * Benchmark parallel matching
+ *
+ * @v name		Benchmark name
+ * @v match		Observation index
+ * @v threads		Number of threads
+ * @v seeds		Seed values
+ * @v count		Number of seed values
+ * @v planted		Number of planted observations
+ * @ret ok		Success indicator
+ */
+static int matchbench_parallel ( const char *name, struct cx_match *match,
+				 unsigned int threads,
+				 const struct cx_match_seed *seeds,
+				 unsigned int count, unsigned int planted ) {
+	unsigned int max = cx_gen_max_iterations ( seeds->type );
+	struct cx_match_result *result;
+	char subname[32];
+	double start;
+	int ok = 0;
+
+	/* Match seed values */
+	start = cxbench_now();
+	result = cx_match_seeds_parallel ( match, seeds, count, threads );
+	if ( ! result )
+		goto err_seeds;
+	snprintf ( subname, sizeof ( subname ), "match %d threads", threads );
+	cxbench_report ( name, subname, ( ( unsigned long ) count * max ),
+			 ( cxbench_now() - start ) );
+
+	/* Check that all planted observations were found */
+	if ( result->count < planted ) {
+		fprintf ( stderr, "%s found only %d of %d planted hits\n",
+			  name, result->count, planted );
+		goto err_hits;
+	}
+
+	ok = 1;
+ err_hits:
+	cx_match_result_free ( result );
+ err_seeds:
+	return ok;
+}
+
+/** Iteration windows to be benchmarked */
+static const unsigned int matchbench_windows[] = { 256, 1024 };
+
+/**
+ * Benchmark windowed matching
+ *
+ * @v name		Benchmark name
+ * @v match		Observation index
+ * @v last		Index of last contact ID in window, plus one
+ * @v seeds		Seed values
+ * @v count		Number of seed values
+ * @ret ok		Success indicator
+ *
+ * The window always starts at the first contact ID, so that the
+ * benchmark measures the saving from stopping generation early.
+ */
+static int matchbench_window ( const char *name, struct cx_match *match,
+			       unsigned int last, struct cx_match_seed *seeds,
+			       unsigned int count ) {
+	struct cx_match_result *result;
+	char subname[32];
+	unsigned int i;
+	double start;
+
+	/* Match seed values within window */
+	for ( i = 0 ; i < count ; i++ )
+		seeds[i].last = last;
+	start = cxbench_now();
+	result = cx_match_seeds ( match, seeds, count );
+	for ( i = 0 ; i < count ; i++ )
+		seeds[i].last = 0;
+	if ( ! result )
+		return 0;
+	snprintf ( subname, sizeof ( subname ), "match window [0,%d)",
+		   last );
+	cxbench_report ( name, subname, ( ( unsigned long ) count * last ),
+			 ( cxbench_now() - start ) );
+	cx_match_result_free ( result );
+
+	return 1;
+}
+
+/**
+ * Benchmark sort-merge matching
+ *
+ * @v name		Benchmark name
+ * @v observed		Observed contact IDs
+ * @v observations	Number of observed contact IDs
+ * @v seeds		Seed values
+ * @v count		Number of seed values
+ * @ret ok		Success indicator
+ *
+ * Only a fraction of the seed values are used, since every generated
+ * contact ID is written to disk.  The memory budget is set to a
+ * fraction of the working set, so that both sides are spilled.
+ */
+static int matchbench_sorted ( const char *name,
+			       const struct cx_contact_id *observed,
+			       unsigned int observations,
+			       const struct cx_match_seed *seeds,
+			       unsigned int count ) {
+	unsigned int max = cx_gen_max_iterations ( seeds->type );
+	struct cx_sortmatch_stats stats;
+	struct cx_match_result *result;
+	struct cx_sortmatch *sort;
+	unsigned long ids;
+	size_t memory;
+	double start;
+	int ok = 0;
+
+	/* Choose number of seed values and memory budget */
+	count /= MATCHBENCH_SORT_DIVISOR;
+	if ( ! count )
+		count = 1;
+	ids = ( ( unsigned long ) count * max );
+	memory = ( ( ( ids + observations ) * MATCHBENCH_SORT_RECORD ) /
+		   MATCHBENCH_SORT_MEMORY );
+
+	/* Match seed values */
+	start = cxbench_now();
+	sort = cx_sortmatch_create ( NULL, memory );
+	if ( ! sort )
+		goto err_create;
+	if ( ! cx_sortmatch_observe ( sort, observed, observations ) )
+		goto err_observe;
+	result = cx_sortmatch_seeds ( sort, seeds, count );
+	if ( ! result )
+		goto err_seeds;
+	cxbench_report ( name, "sortmatch", ids, ( cxbench_now() - start ) );
+
+	/* Report CPU and I/O time separately */
+	cx_sortmatch_stats ( sort, &stats );
+	cxbench_report ( name, "sortmatch cpu", ids, stats.cpu );
+	cxbench_report ( name, "sortmatch io", ids, stats.io );
+	printf ( "BENCH %-16s %-24s %12llu bytes written %llu read\n",
+		 name, "sortmatch spill", stats.written, stats.read );
+
+	ok = 1;
+	cx_match_result_free ( result );
+ err_seeds:
+ err_observe:
+	cx_sortmatch_free ( sort );
+ err_create:
+	return ok;
+}
+
+/**
+ * Benchmark observation store
+ *
+ * @v name		Benchmark name
+ * @v observed		Observed contact IDs
+ * @v observations	Number of observed contact IDs
+ * @v seeds		Seed values
+ * @v count		Number of seed values
+ * @ret ok		Success indicator
+ *
+ * As for sort-merge matching, only a fraction of the seed values are
+ * used, since each generated contact ID is looked up in every
+ * segment.
+ */
+static int matchbench_store ( const char *name,
+			      const struct cx_contact_id *observed,
+			      unsigned int observations,
+			      const struct cx_match_seed *seeds,
+			      unsigned int count ) {
+	unsigned int max = cx_gen_max_iterations ( seeds->type );
+	struct cx_match_result *result;
+	struct cx_obsstore *store;
+	char dir[] = "/tmp/cxbenchXXXXXX";
+	char path[ sizeof ( dir ) + 16 ];
+	unsigned int records;
+	unsigned int i;
+	double start;
+	int ok = 0;
+
+	/* Create store directory */
+	if ( ! mkdtemp ( dir ) )
+		goto err_mkdtemp;
+	records = ( ( observations / MATCHBENCH_STORE_SEGMENTS ) + 1 );
+	count /= MATCHBENCH_SORT_DIVISOR;
+	if ( ! count )
+		count = 1;
+
+	/* Benchmark appending and sealing observations */
+	start = cxbench_now();
+	store = cx_obsstore_open ( dir, records );
+	if ( ! store )
+		goto err_create;
+	for ( i = 0 ; i < observations ; i++ ) {
+		if ( ! cx_obsstore_append ( store, &observed[i],
+					    ( i / MATCHBENCH_STORE_PER_TIME ),
+					    1 ) )
+			goto err_append;
+	}
+	if ( ! cx_obsstore_seal ( store ) )
+		goto err_seal;
+	cx_obsstore_close ( store );
+	cxbench_report ( name, "obsstore append", observations,
+			 ( cxbench_now() - start ) );
+
+	/* Benchmark opening store */
+	start = cxbench_now();
+	store = cx_obsstore_open ( dir, records );
+	if ( ! store )
+		goto err_open;
+	cxbench_report ( name, "obsstore open", observations,
+			 ( cxbench_now() - start ) );
+
+	/* Benchmark matching */
+	start = cxbench_now();
+	result = cx_obsstore_match ( store, seeds, count );
+	if ( ! result )
+		goto err_match;
+	cxbench_report ( name, "obsstore match",
+			 ( ( unsigned long ) count * max ),
+			 ( cxbench_now() - start ) );
+	cx_match_result_free ( result );
+
+	ok = 1;
+ err_match:
+ err_seal:
+ err_append:
+	cx_obsstore_prune ( store, -1ULL );
+	cx_obsstore_close ( store );
+ err_open:
+ err_create:
+	snprintf ( path, sizeof ( path ), "%s/active.log", dir );
+	unlink ( path );
+	rmdir ( dir );
+ err_mkdtemp:
+	return ok;
+}
+
+/**
+ * Benchmark matching repeated publications via seed value ledger
+ *
+ * @v name		Benchmark name
+ * @v match		Observation index
+ * @v seeds		Seed values
+ * @v count		Number of seed values
+ * @ret ok		Success indicator
+ *
+ * A first publication is matched in full, and a second publication
+ * overlapping all but a fraction of the first is then matched.  Only
+ * a fraction of the seed values are used, as for sort-merge matching.
+ */
+static int matchbench_ledger ( const char *name, struct cx_match *match,
+			       const struct cx_match_seed *seeds,
+			       unsigned int count ) {
+	unsigned int max = cx_gen_max_iterations ( seeds->type );
+	struct cx_ledger_range *ranges;
+	struct cx_match_result *result;
+	struct cx_ledger *ledger;
+	char dir[] = "/tmp/cxbenchXXXXXX";
+	char path[ sizeof ( dir ) + 16 ];
+	unsigned int offset;
+	unsigned int i;
+	double start;
+	int ok = 0;
+
+	/* Choose publications */
+	count /= MATCHBENCH_SORT_DIVISOR;
+	offset = ( count / MATCHBENCH_LEDGER_NEW );
+	if ( ! offset )
+		offset = 1;
+	ranges = calloc ( ( count + offset ), sizeof ( ranges[0] ) );
+	if ( ! ranges )
+		goto err_alloc;
+	for ( i = 0 ; i < ( count + offset ) ; i++ ) {
+		ranges[i].end = 1;
+		ranges[i].expiry = -1ULL;
+	}
+
+	/* Create ledger */
+	if ( ! mkdtemp ( dir ) )
+		goto err_mkdtemp;
+	snprintf ( path, sizeof ( path ), "%s/ledger", dir );
+	ledger = cx_ledger_open ( path );
+	if ( ! ledger )
+		goto err_open;
+
+	/* Benchmark first publication */
+	start = cxbench_now();
+	result = cx_ledger_match ( ledger, match, seeds, ranges, count, 0 );
+	if ( ! result )
+		goto err_match;
+	cxbench_report ( name, "ledger first",
+			 ( ( unsigned long ) count * max ),
+			 ( cxbench_now() - start ) );
+	cx_match_result_free ( result );
+
+	/* Benchmark overlapping publication */
+	start = cxbench_now();
+	result = cx_ledger_match ( ledger, match, &seeds[offset],
+				   &ranges[offset], count, 0 );
+	if ( ! result )
+		goto err_match;
+	cxbench_report ( name, "ledger overlapping",
+			 ( ( unsigned long ) count * max ),
+			 ( cxbench_now() - start ) );
+	cx_match_result_free ( result );
+
+	ok = 1;
+ err_match:
+	cx_ledger_close ( ledger );
+ err_open:
+	unlink ( path );
+	rmdir ( dir );
+ err_mkdtemp:
+	free ( ranges );
+ err_alloc:
+	return ok;
+}
+
+/**
+ * Benchmark deduplicated ingest into observation store
+ *
+ * @v name		Benchmark name
+ * @v observed		Observed contact IDs
+ * @v observations	Number of observed contact IDs
+ * @ret ok		Success indicator
+ *
+ * Each observed contact ID is sighted repeatedly, interleaved with
+ * sightings of other nearby advertisers, at a rate of one thousand
+ * sightings per timestamp unit.
+ */
+static int matchbench_ingest ( const char *name,
+			       const struct cx_contact_id *observed,
+			       unsigned int observations ) {
+	unsigned long sightings =
+		( ( unsigned long ) observations * MATCHBENCH_INGEST_REPEAT );
+	unsigned long group = ( MATCHBENCH_INGEST_NEARBY *
+				MATCHBENCH_INGEST_REPEAT );
+	struct cx_ingest *ingest;
+	struct cx_obsstore *store;
+	char dir[] = "/tmp/cxbenchXXXXXX";
+	char path[ sizeof ( dir ) + 16 ];
+	unsigned long index;
+	unsigned long i;
+	double start;
+	int ok = 0;
+
+	/* Create store directory */
+	if ( ! mkdtemp ( dir ) )
+		goto err_mkdtemp;
+	store = cx_obsstore_open ( dir, 0 );
+	if ( ! store )
+		goto err_open;
+	ingest = cx_ingest_create ( 0, MATCHBENCH_INGEST_WINDOW,
+				    cx_obsstore_ingest, store );
+	if ( ! ingest )
+		goto err_create;
+
+	/* Benchmark ingesting sightings */
+	start = cxbench_now();
+	for ( i = 0 ; i < sightings ; i++ ) {
+		index = ( ( ( i / group ) * MATCHBENCH_INGEST_NEARBY ) +
+			  ( i % MATCHBENCH_INGEST_NEARBY ) );
+		if ( index >= observations )
+			index = ( i % observations );
+		if ( ! cx_ingest_add ( ingest, &observed[index],
+				       ( i / MATCHBENCH_STORE_PER_TIME ) ) )
+			goto err_add;
+	}
+	if ( ! cx_ingest_flush ( ingest ) )
+		goto err_flush;
+	if ( ! cx_obsstore_seal ( store ) )
+		goto err_seal;
+	cxbench_report ( name, "ingest", sightings,
+			 ( cxbench_now() - start ) );
+	printf ( "BENCH %-16s %-24s %12lu sightings stored as %u records\n",
+		 name, "ingest dedup", sightings,
+		 cx_obsstore_count ( store ) );
+
+	ok = 1;
+ err_seal:
+ err_flush:
+ err_add:
+	cx_ingest_free ( ingest );
+ err_create:
+	cx_obsstore_prune ( store, -1ULL );
+	cx_obsstore_close ( store );
+ err_open:
+	snprintf ( path, sizeof ( path ), "%s/active.log", dir );
+	unlink ( path );
+	rmdir ( dir );
+ err_mkdtemp:
+	return ok;
+}
+
+/**
+ * Benchmark seed value expansion without matching
+ *
+ * @v name		Benchmark name
+ * @v type		Generator type
+ * @v seeds		Seed values
+ * @v len		Length of each seed value
+ * @v count		Number of seed values
+ * @ret ok		Success indicator
+ */
+static int matchbench_expand ( const char *name, enum cx_generator_type type,
+			       const unsigned char *seeds, size_t len,
+			       unsigned int count ) {
+	unsigned int max = cx_gen_max_iterations ( type );
+	struct cx_contact_id *ids;
+	unsigned int batch;
+	unsigned int i;
+	double start;
+	int ok = 0;
+
+	/* Allocate contact IDs */
+	ids = malloc ( MATCHBENCH_BATCH * max * sizeof ( *ids ) );
+	if ( ! ids )
+		goto err_alloc;
+
+	/* Expand seed values */
+	start = cxbench_now();
+	for ( i = 0 ; i < count ; i += batch ) {
+		batch = ( count - i );
+		if ( batch > MATCHBENCH_BATCH )
+			batch = MATCHBENCH_BATCH;
+		if ( ! cx_gen_expand_multi ( type, &seeds[ i * len ], len,
+					     batch, ids ) )
+			goto err_expand;
+	}
+	cxbench_report ( name, "expand only",
+			 ( ( unsigned long ) count * max ),
+			 ( cxbench_now() - start ) );
+
+	ok = 1;
+ err_expand:
+	free ( ids );
+ err_alloc:
+	return ok;
+}
+
+/**
+ * Run contact ID matching benchmarks for a generator type
+ *
+ * @v name		Benchmark name
+ * @v type		Generator type
+ * @v count		Number of seed values and of observed contact IDs
+ * @ret ok		Success indicator
+ */
+static int matchbench_type ( const char *name, enum cx_generator_type type,
+			     unsigned int count ) {
+	size_t len = cx_gen_seed_len ( type );
+	long online = sysconf ( _SC_NPROCESSORS_ONLN );
+	struct cx_contact_id *observed;
+	struct cx_match_seed *seeds;
+	long threads;
+	struct cx_match *match;
+	unsigned char *raw;
+	unsigned int i;
+	double start;
+	int planted;
+	int ok = 0;
+
+	/* Allocate seed values and observations */
+	raw = malloc ( count * len );
+	if ( ! raw )
+		goto err_alloc_raw;
+	seeds = malloc ( count * sizeof ( *seeds ) );
+	if ( ! seeds )
+		goto err_alloc_seeds;
+	observed = malloc ( count * sizeof ( *observed ) );
+	if ( ! observed )
+		goto err_alloc_observed;
+
+	/* Generate random seed values and observations */
+	if ( RAND_bytes ( raw, ( count * len ) ) != 1 )
+		goto err_rand;
+	if ( RAND_bytes ( observed->bytes,
+			  ( count * sizeof ( *observed ) ) ) != 1 )
+		goto err_rand;
+	for ( i = 0 ; i < count ; i++ ) {
+		seeds[i].type = type;
+		seeds[i].seed = &raw[ i * len ];
+		seeds[i].len = len;
+		seeds[i].first = 0;
+		seeds[i].last = 0;
+		seeds[i].hint = NULL;
+	}
+
+	/* Plant some observations that are expected to match */
+	planted = matchbench_plant ( type, raw, len, count, observed, count );
+	if ( planted < 0 )
+		goto err_plant;
+
+	/* Benchmark index construction */
+	start = cxbench_now();
+	match = cx_match_create ( observed, count );
+	if ( ! match )
+		goto err_create;
+	cxbench_report ( name, "index", count, ( cxbench_now() - start ) );
+
+	/* Benchmark matching with each prefilter width */
+	for ( i = 0 ; i < ( sizeof ( matchbench_filters ) /
+			    sizeof ( matchbench_filters[0] ) ) ; i++ ) {
+		if ( ! matchbench_match ( name, match, matchbench_filters[i],
+					  seeds, count, planted ) )
+			goto err_match;
+	}
+
+	/* Benchmark fingerprint matching */
+	if ( ! matchbench_fingerprint ( name, observed, count, seeds, count,
+					planted ) )
+		goto err_match;
+
+	/* Benchmark parallel matching with the default prefilter */
+	if ( ! cx_match_filter ( match, 16 ) )
+		goto err_match;
+	for ( threads = 1 ; threads <= online ; threads *= 2 ) {
+		if ( ! matchbench_parallel ( name, match, threads, seeds,
+					     count, planted ) )
+			goto err_match;
+	}
+
+	/* Benchmark windowed matching with the default prefilter */
+	for ( i = 0 ; i < ( sizeof ( matchbench_windows ) /
+			    sizeof ( matchbench_windows[0] ) ) ; i++ ) {
+		if ( ! matchbench_window ( name, match, matchbench_windows[i],
+					   seeds, count ) )
+			goto err_match;
+	}
+
+	/* Benchmark matching repeated publications */
+	if ( ! matchbench_ledger ( name, match, seeds, count ) )
+		goto err_match;
+
+	/* Benchmark sort-merge matching */
+	if ( ! matchbench_sorted ( name, observed, count, seeds, count ) )
+		goto err_match;
+
+	/* Benchmark observation store */
+	if ( ! matchbench_store ( name, observed, count, seeds, count ) )
+		goto err_match;
+
+	/* Benchmark deduplicated ingest */
+	if ( ! matchbench_ingest ( name, observed, count ) )
+		goto err_match;
+
+	/* Benchmark expansion alone, for comparison */
+	if ( ! matchbench_expand ( name, type, raw, len, count ) )
+		goto err_expand;
+
+	ok = 1;
+ err_expand:
+ err_match:
+	cx_match_free ( match );
+ err_create:
+ err_plant:
+ err_rand:
+	free ( observed );
+ err_alloc_observed:
+	free ( seeds );
+ err_alloc_seeds:
+	free ( raw );
+ err_alloc_raw:
+	return ok;
+}
+
+/**
+ * Run contact ID matching benchmarks
+ *
+ * @v count		Number of seed values and of observed contact IDs
+ * @ret ok		Success indicator
+ */
+int matchbench ( unsigned int count ) {
+	int ok = 1;
+
+	/* Run benchmarks */
+	ok &= matchbench_type ( "match_type1", CX_GEN_AES_128_CTR_2048,
+				count );
+	ok &= matchbench_type ( "match_type2", CX_GEN_AES_256_CTR_2048,
+				count );
+
+	return ok;
+}
@@ -0,0 +1,774 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Contact ID matching self-tests
+ *
+ ******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <cx/generator.h>
+#include <cx/match.h>
+#include "parallel.h"
+#include "cxtest.h"
+#include "matchtest.h"
+
+/** Number of contact IDs per seed value */
+#define MATCHTEST_MAX 2048
+
+/** Number of observed contact IDs */
+#define MATCHTEST_OBSERVATIONS 96
+
+/** Number of seed values for parallel matching self-test */
+#define MATCHTEST_PARALLEL_SEEDS 300
+
+/** Length of runs of seed values of the same type for parallel self-test */
+#define MATCHTEST_PARALLEL_RUN 37
+
+/** Number of seed values in each run of the mixed type test
+ *
+ * This exceeds the number of seed values expanded together, so that
+ * a full batch of longer seed values follows a full batch of shorter
+ * seed values with the same number of iterations.
+ */
+#define MATCHTEST_RUN 32
+
+/** Number of runs in the mixed type test */
+#define MATCHTEST_RUNS 4
+
+/** Define a seed value from a standard generator test vector */
+#define MATCHTEST_SEED( type, name ) \
+	{ type, name ## _seed, sizeof ( name ## _seed ), 0, 0, NULL }
+
+/** Seed values
+ *
+ * Generator types are interleaved, and one seed value is repeated,
+ * so that seed values are expanded in several batches and a single
+ * observation may be matched by more than one seed value.
+ */
+static const struct cx_match_seed matchtest_seeds[] = {
+	MATCHTEST_SEED ( CX_GEN_AES_128_CTR_2048, gen_type1_test1 ),
+	MATCHTEST_SEED ( CX_GEN_AES_128_CTR_2048, gen_type1_test2 ),
+	MATCHTEST_SEED ( CX_GEN_AES_256_CTR_2048, gen_type2_test1 ),
+	MATCHTEST_SEED ( CX_GEN_AES_128_CTR_2048, gen_type1_test1 ),
+	MATCHTEST_SEED ( CX_GEN_AES_256_CTR_2048, gen_type2_test2 ),
+};
+
+/** Number of seed values */
+#define MATCHTEST_SEEDS \
+	( sizeof ( matchtest_seeds ) / sizeof ( matchtest_seeds[0] ) )
+
+/**
+ * Construct observed contact IDs
+ *
+ * @v ids		Generated contact IDs
+ * @v observed		Observed contact IDs to fill in
+ *
+ * The observations include contact IDs generated from each seed
+ * value, repeated observations, near misses that differ only in the
+ * least significant half, and the standard test vector first and
+ * last contact IDs.
+ */
+static void matchtest_observe ( const struct cx_contact_id *ids,
+				struct cx_contact_id *observed ) {
+	const struct cx_contact_id *id;
+	unsigned int seed;
+	unsigned int iteration;
+	unsigned int i;
+
+	/* Construct observations */
+	for ( i = 0 ; i < MATCHTEST_OBSERVATIONS ; i++ ) {
+		seed = ( i % MATCHTEST_SEEDS );
+		iteration = ( ( i * 397 ) % MATCHTEST_MAX );
+		id = &ids[ seed * MATCHTEST_MAX + iteration ];
+		memcpy ( &observed[i], id, sizeof ( observed[i] ) );
+		if ( ( i % 7 ) == 3 ) {
+			/* Repeat previous observation */
+			memcpy ( &observed[i], &observed[ i - 1 ],
+				 sizeof ( observed[i] ) );
+		} else if ( ( i % 7 ) == 5 ) {
+			/* Near miss */
+			observed[i].bytes[15] ^= 0x01;
+		}
+	}
+
+	/* Include standard test vectors */
+	memcpy ( &observed[0], gen_type1_test1_first_id,
+		 sizeof ( observed[0] ) );
+	memcpy ( &observed[1], gen_type2_test2_last_id,
+		 sizeof ( observed[1] ) );
+}
+
+/**
+ * Construct repeatedly observed contact IDs
+ *
+ * @v ids		Generated contact IDs
+ * @v observed		Observed contact IDs to fill in
+ *
+ * A single contact ID is observed many more times than fit within a
+ * single group of index slots, interleaved with other observations.
+ */
+static void matchtest_observe_repeated ( const struct cx_contact_id *ids,
+					 struct cx_contact_id *observed ) {
+	unsigned int i;
+
+	/* Construct observations */
+	for ( i = 0 ; i < MATCHTEST_OBSERVATIONS ; i++ ) {
+		memcpy ( &observed[i], &ids[ ( i % 3 ) ? 0 : i ],
+			 sizeof ( observed[i] ) );
+	}
+}
+
+/**
+ * Check match result against exhaustive comparison
+ *
+ * @v name		Test name
+ * @v ids		Generated contact IDs
+ * @v observed		Observed contact IDs
+ * @v count		Number of observed contact IDs
+ * @v result		Match result
+ * @ret ok		Success indicator
+ */
+static int matchtest_check ( const char *name,
+			     const struct cx_contact_id *ids,
+			     const struct cx_contact_id *observed,
+			     unsigned int count,
+			     const struct cx_match_result *result ) {
+	const struct cx_match_hit *hit;
+	unsigned int expected = 0;
+	unsigned int seed;
+	unsigned int iteration;
+	unsigned int i;
+
+	/* Compare each generated contact ID against each observation */
+	for ( seed = 0 ; seed < MATCHTEST_SEEDS ; seed++ ) {
+		for ( iteration = 0 ; iteration < MATCHTEST_MAX ;
+		      iteration++ ) {
+			for ( i = 0 ; i < count ; i++ ) {
+				if ( memcmp ( &ids[ seed * MATCHTEST_MAX +
+						    iteration ],
+					      &observed[i],
+					      sizeof ( observed[i] ) ) != 0 )
+					continue;
+				if ( expected >= result->count ) {
+					fprintf ( stderr, "MATCH %s fail: "
+						  "missing hit %d\n",
+						  name, expected );
+					return 0;
+				}
+				hit = &result->hits[expected++];
+				if ( ( hit->seed != seed ) ||
+				     ( hit->iteration != iteration ) ||
+				     ( hit->observation != i ) ) {
+					fprintf ( stderr, "MATCH %s fail: hit "
+						  "%d mismatch\n", name,
+						  ( expected - 1 ) );
+					return 0;
+				}
+			}
+		}
+	}
+	if ( expected != result->count ) {
+		fprintf ( stderr, "MATCH %s fail: %d unexpected hits\n",
+			  name, ( result->count - expected ) );
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Match seed values and check result
+ *
+ * @v name		Test name
+ * @v match		Observation index
+ * @v bits		Prefilter fingerprint width
+ * @v ids		Generated contact IDs
+ * @v observed		Observed contact IDs
+ * @v count		Number of observed contact IDs
+ * @v min		Minimum expected number of hits
+ * @ret ok		Success indicator
+ */
+static int matchtest_filter ( const char *name, struct cx_match *match,
+			      unsigned int bits,
+			      const struct cx_contact_id *ids,
+			      const struct cx_contact_id *observed,
+			      unsigned int count, unsigned int min ) {
+	struct cx_match_result *result;
+	int ok;
+
+	/* Set prefilter */
+	if ( ! cx_match_filter ( match, bits ) ) {
+		fprintf ( stderr, "MATCH %s fail: could not set %d-bit "
+			  "filter\n", name, bits );
+		goto err_filter;
+	}
+
+	/* Match seed values */
+	result = cx_match_seeds ( match, matchtest_seeds, MATCHTEST_SEEDS );
+	if ( ! result ) {
+		fprintf ( stderr, "MATCH %s fail: could not match with %d-bit "
+			  "filter\n", name, bits );
+		goto err_seeds;
+	}
+
+	/* Check result */
+	if ( result->count < min ) {
+		fprintf ( stderr, "MATCH %s fail: only %d hits with %d-bit "
+			  "filter\n", name, result->count, bits );
+		goto err_min;
+	}
+	ok = matchtest_check ( name, ids, observed, count, result );
+	if ( ! ok )
+		goto err_check;
+
+	cx_match_result_free ( result );
+	return 1;
+
+ err_check:
+ err_min:
+	cx_match_result_free ( result );
+ err_seeds:
+ err_filter:
+	return 0;
+}
+
+/**
+ * Run a match self-test
+ *
+ * @v name		Test name
+ * @v ids		Generated contact IDs
+ * @v observed		Observed contact IDs
+ * @v count		Number of observed contact IDs
+ * @v min		Minimum expected number of hits
+ * @ret ok		Success indicator
+ *
+ * The test is repeated without a prefilter, with each supported
+ * prefilter width, and again after removing the prefilter.
+ */
+static int matchtest ( const char *name, const struct cx_contact_id *ids,
+		       const struct cx_contact_id *observed,
+		       unsigned int count, unsigned int min ) {
+	static const unsigned int bits[] = { 0, 8, 16, 0 };
+	struct cx_match *match;
+	unsigned int i;
+
+	/* Create observation index */
+	match = cx_match_create ( observed, count );
+	if ( ! match ) {
+		fprintf ( stderr, "MATCH %s fail: could not create index\n",
+			  name );
+		goto err_create;
+	}
+
+	/* Match seed values with each prefilter width */
+	for ( i = 0 ; i < ( sizeof ( bits ) / sizeof ( bits[0] ) ) ; i++ ) {
+		if ( ! matchtest_filter ( name, match, bits[i], ids, observed,
+					  count, min ) )
+			goto err_seeds;
+	}
+
+	/* Free index */
+	cx_match_free ( match );
+
+	fprintf ( stderr, "MATCH %s ok\n", name );
+	return 1;
+
+ err_seeds:
+	cx_match_free ( match );
+ err_create:
+	return 0;
+}
+
+/**
+ * Run invalid seed value self-test
+ *
+ * @ret ok		Success indicator
+ */
+static int matchtest_invalid ( void ) {
+	struct cx_match_seed seeds[2];
+	struct cx_match_result *result;
+	struct cx_match *match;
+
+	/* Create empty observation index */
+	match = cx_match_create ( NULL, 0 );
+	if ( ! match ) {
+		fprintf ( stderr, "MATCH invalid fail: could not create "
+			  "index\n" );
+		goto err_create;
+	}
+
+	/* Attempt to set a prefilter with an unsupported width */
+	if ( cx_match_filter ( match, 12 ) ) {
+		fprintf ( stderr, "MATCH invalid fail: accepted invalid "
+			  "filter width\n" );
+		goto err_filter;
+	}
+
+	/* Attempt to match a seed value with an incorrect length */
+	memcpy ( seeds, matchtest_seeds, sizeof ( seeds ) );
+	seeds[1].len--;
+	result = cx_match_seeds ( match, seeds, 2 );
+	if ( result ) {
+		fprintf ( stderr, "MATCH invalid fail: accepted invalid "
+			  "seed\n" );
+		goto err_accepted;
+	}
+
+	/* Free index */
+	cx_match_free ( match );
+
+	fprintf ( stderr, "MATCH invalid ok\n" );
+	return 1;
+
+ err_accepted:
+	cx_match_result_free ( result );
+ err_filter:
+	cx_match_free ( match );
+ err_create:
+	return 0;
+}
+
+/**
+ * Run parallel matching self-test
+ *
+ * @ret ok		Success indicator
+ *
+ * The result of parallel matching is compared against the result of
+ * serial matching for several different numbers of threads.
+ */
+static int matchtest_parallel ( void ) {
+	static const unsigned int threads[] = { 2, 3, 8, 0 };
+	unsigned char raw[MATCHTEST_PARALLEL_SEEDS][48];
+	struct cx_match_seed seeds[MATCHTEST_PARALLEL_SEEDS];
+	const struct cx_match_seed *seed;
+	struct cx_contact_id observed[MATCHTEST_OBSERVATIONS];
+	struct cx_contact_id ids[MATCHTEST_MAX];
+	struct cx_match_result *serial;
+	struct cx_match_result *result;
+	struct cx_match *match;
+	unsigned int i;
+
+	/* Construct seed values, in runs of alternating types */
+	for ( i = 0 ; i < MATCHTEST_PARALLEL_SEEDS ; i++ ) {
+		seeds[i] = matchtest_seeds[ ( i / MATCHTEST_PARALLEL_RUN ) %
+					    2 + 1 ];
+		memcpy ( raw[i], seeds[i].seed, seeds[i].len );
+		raw[i][0] ^= i;
+		raw[i][1] ^= ( i >> 8 );
+		seeds[i].seed = raw[i];
+	}
+
+	/* Construct observations, including a repeated observation */
+	for ( i = 0 ; i < MATCHTEST_OBSERVATIONS ; i++ ) {
+		seed = &seeds[ ( i * 7 ) % MATCHTEST_PARALLEL_SEEDS ];
+		if ( ! cx_gen_expand ( seed->type, seed->seed, seed->len,
+				       ids ) ) {
+			fprintf ( stderr, "MATCH parallel fail: could not "
+				  "expand\n" );
+			goto err_expand;
+		}
+		memcpy ( &observed[i], &ids[ ( i * 131 ) % MATCHTEST_MAX ],
+			 sizeof ( observed[i] ) );
+	}
+	memcpy ( &observed[1], &observed[0], sizeof ( observed[1] ) );
+
+	/* Create observation index */
+	match = cx_match_create ( observed, MATCHTEST_OBSERVATIONS );
+	if ( ! match ) {
+		fprintf ( stderr, "MATCH parallel fail: could not create "
+			  "index\n" );
+		goto err_create;
+	}
+
+	/* Match serially */
+	serial = cx_match_seeds ( match, seeds, MATCHTEST_PARALLEL_SEEDS );
+	if ( ! serial ) {
+		fprintf ( stderr, "MATCH parallel fail: could not match\n" );
+		goto err_serial;
+	}
+	if ( serial->count < MATCHTEST_OBSERVATIONS ) {
+		fprintf ( stderr, "MATCH parallel fail: only %d hits\n",
+			  serial->count );
+		goto err_count;
+	}
+
+	/* Match in parallel with varying numbers of threads */
+	for ( i = 0 ; i < ( sizeof ( threads ) / sizeof ( threads[0] ) ) ;
+	      i++ ) {
+		result = cx_match_seeds_parallel ( match, seeds,
+						   MATCHTEST_PARALLEL_SEEDS,
+						   threads[i] );
+		if ( ! result ) {
+			fprintf ( stderr, "MATCH parallel fail: could not "
+				  "match with %d threads\n", threads[i] );
+			goto err_parallel;
+		}
+		if ( ( result->count != serial->count ) ||
+		     ( memcmp ( result->hits, serial->hits,
+				( serial->count *
+				  sizeof ( serial->hits[0] ) ) ) != 0 ) ) {
+			fprintf ( stderr, "MATCH parallel fail: mismatch "
+				  "with %d threads\n", threads[i] );
+			cx_match_result_free ( result );
+			goto err_parallel;
+		}
+		cx_match_result_free ( result );
+
+		/* Tear down worker pool, to be recreated on demand */
+		cx_parallel_fini();
+	}
+
+	/* Free results and index */
+	cx_match_result_free ( serial );
+	cx_match_free ( match );
+
+	fprintf ( stderr, "MATCH parallel ok\n" );
+	return 1;
+
+ err_parallel:
+ err_count:
+	cx_match_result_free ( serial );
+ err_serial:
+	cx_match_free ( match );
+ err_create:
+ err_expand:
+	return 0;
+}
+
+/** Iteration ranges for windowed matching self-test */
+static const unsigned int matchtest_windows[MATCHTEST_SEEDS][2] = {
+	{ 100, 1500 },
+	{ 100, 1500 },
+	{ 1500, 0 },
+	{ 0, 1 },
+	{ 2047, 0 },
+};
+
+/**
+ * Check windowed match result against a complete match result
+ *
+ * @v name		Test name
+ * @v full		Complete match result
+ * @v seeds		Windowed seed values
+ * @v result		Windowed match result
+ * @ret ok		Success indicator
+ */
+static int matchtest_window_check ( const char *name,
+				    const struct cx_match_result *full,
+				    const struct cx_match_seed *seeds,
+				    const struct cx_match_result *result ) {
+	const struct cx_match_seed *seed;
+	const struct cx_match_hit *hit;
+	unsigned int expected = 0;
+	unsigned int last;
+	unsigned int i;
+
+	/* Compare against hits within each window */
+	for ( i = 0 ; i < full->count ; i++ ) {
+		hit = &full->hits[i];
+		seed = &seeds[hit->seed];
+		last = ( seed->last ? seed->last : MATCHTEST_MAX );
+		if ( ( hit->iteration < seed->first ) ||
+		     ( hit->iteration >= last ) )
+			continue;
+		if ( ( expected >= result->count ) ||
+		     ( memcmp ( &result->hits[expected++], hit,
+				sizeof ( *hit ) ) != 0 ) ) {
+			fprintf ( stderr, "MATCH window fail: %s hit %d "
+				  "mismatch\n", name, ( expected - 1 ) );
+			return 0;
+		}
+	}
+	if ( expected != result->count ) {
+		fprintf ( stderr, "MATCH window fail: %s has %d unexpected "
+			  "hits\n", name, ( result->count - expected ) );
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Run windowed matching self-test
+ *
+ * @v observed		Observed contact IDs
+ * @ret ok		Success indicator
+ *
+ * Each seed value is matched only within an iteration range, both
+ * with and (where supported by the engine) without generator state
+ * hints.
+ */
+static int matchtest_window ( const struct cx_contact_id *observed ) {
+	struct cx_match_seed seeds[MATCHTEST_SEEDS];
+	struct cx_gen_state hints[MATCHTEST_SEEDS];
+	struct cx_contact_id ids[MATCHTEST_MAX];
+	struct cx_gen_storage storage;
+	struct cx_match_result *full;
+	struct cx_match_result *result;
+	struct cx_generator *gen;
+	struct cx_match *match;
+	unsigned int i;
+	int saved;
+
+	/* Create observation index */
+	match = cx_match_create ( observed, MATCHTEST_OBSERVATIONS );
+	if ( ! match ) {
+		fprintf ( stderr, "MATCH window fail: could not create "
+			  "index\n" );
+		goto err_create;
+	}
+
+	/* Match complete sequences */
+	full = cx_match_seeds ( match, matchtest_seeds, MATCHTEST_SEEDS );
+	if ( ! full ) {
+		fprintf ( stderr, "MATCH window fail: could not match\n" );
+		goto err_full;
+	}
+
+	/* Match within windows */
+	memcpy ( seeds, matchtest_seeds, sizeof ( seeds ) );
+	for ( i = 0 ; i < MATCHTEST_SEEDS ; i++ ) {
+		seeds[i].first = matchtest_windows[i][0];
+		seeds[i].last = matchtest_windows[i][1];
+	}
+	result = cx_match_seeds ( match, seeds, MATCHTEST_SEEDS );
+	if ( ! result ) {
+		fprintf ( stderr, "MATCH window fail: could not match\n" );
+		goto err_result;
+	}
+	if ( ! matchtest_window_check ( "serial", full, seeds, result ) )
+		goto err_check;
+	cx_match_result_free ( result );
+	result = cx_match_seeds_parallel ( match, seeds, MATCHTEST_SEEDS, 3 );
+	if ( ! result ) {
+		fprintf ( stderr, "MATCH window fail: could not match in "
+			  "parallel\n" );
+		goto err_result;
+	}
+	if ( ! matchtest_window_check ( "parallel", full, seeds, result ) )
+		goto err_check;
+	cx_match_result_free ( result );
+
+	/* Match within windows starting from hints, if supported */
+	for ( saved = 1, i = 0 ; i < MATCHTEST_SEEDS ; i++ ) {
+		gen = cx_gen_init ( &storage, seeds[i].type, seeds[i].seed,
+				    seeds[i].len );
+		if ( ! gen ) {
+			fprintf ( stderr, "MATCH window fail: could not "
+				  "instantiate\n" );
+			goto err_init;
+		}
+		saved &= ( cx_gen_iterate_bulk ( gen, ids,
+						 ( seeds[i].first / 2 ) ) &&
+			   cx_gen_save ( gen, &hints[i] ) );
+		cx_gen_fini ( gen );
+		seeds[i].hint = &hints[i];
+	}
+	if ( saved ) {
+		result = cx_match_seeds ( match, seeds, MATCHTEST_SEEDS );
+		if ( ! result ) {
+			fprintf ( stderr, "MATCH window fail: could not match "
+				  "with hints\n" );
+			goto err_result;
+		}
+		if ( ! matchtest_window_check ( "hinted", full, seeds,
+						result ) )
+			goto err_check;
+		cx_match_result_free ( result );
+	}
+
+	/* Attempt to match with an invalid window */
+	seeds[1].first = 1501;
+	result = cx_match_seeds ( match, seeds, MATCHTEST_SEEDS );
+	if ( result ) {
+		fprintf ( stderr, "MATCH window fail: accepted invalid "
+			  "window\n" );
+		goto err_check;
+	}
+
+	/* Free results and index */
+	cx_match_result_free ( full );
+	cx_match_free ( match );
+
+	fprintf ( stderr, "MATCH window ok\n" );
+	return 1;
+
+ err_check:
+	cx_match_result_free ( result );
+ err_result:
+ err_init:
+	cx_match_result_free ( full );
+ err_full:
+	cx_match_free ( match );
+ err_create:
+	return 0;
+}
+
+/**
+ * Run mixed type self-test
+ *
+ * @ret ok		Success indicator
+ *
+ * Seed values alternate between runs of each generator type, and the
+ * observations are the first contact ID from the type 1 test vector
+ * and the last contact ID from the type 2 test vector.
+ */
+static int matchtest_mixed ( void ) {
+	struct cx_match_seed seeds[ MATCHTEST_RUN * MATCHTEST_RUNS ];
+	struct cx_contact_id observed[2];
+	struct cx_match_result *result;
+	const struct cx_match_hit *hit;
+	struct cx_match *match;
+	unsigned int count = ( sizeof ( seeds ) / sizeof ( seeds[0] ) );
+	unsigned int iteration;
+	unsigned int type2;
+	unsigned int i;
+
+	/* Construct seed values and observations */
+	memset ( seeds, 0, sizeof ( seeds ) );
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ( i / MATCHTEST_RUN ) & 1 ) {
+			seeds[i].type = CX_GEN_AES_256_CTR_2048;
+			seeds[i].seed = gen_type2_test2_seed;
+			seeds[i].len = sizeof ( gen_type2_test2_seed );
+		} else {
+			seeds[i].type = CX_GEN_AES_128_CTR_2048;
+			seeds[i].seed = gen_type1_test1_seed;
+			seeds[i].len = sizeof ( gen_type1_test1_seed );
+		}
+	}
+	memcpy ( &observed[0], gen_type1_test1_first_id,
+		 sizeof ( observed[0] ) );
+	memcpy ( &observed[1], gen_type2_test2_last_id,
+		 sizeof ( observed[1] ) );
+
+	/* Create observation index */
+	match = cx_match_create ( observed, 2 );
+	if ( ! match ) {
+		fprintf ( stderr, "MATCH mixed fail: could not create "
+			  "index\n" );
+		goto err_create;
+	}
+
+	/* Match seed values */
+	result = cx_match_seeds ( match, seeds, count );
+	if ( ! result ) {
+		fprintf ( stderr, "MATCH mixed fail: could not match\n" );
+		goto err_seeds;
+	}
+
+	/* Check that each seed value matches its own observation */
+	if ( result->count != count ) {
+		fprintf ( stderr, "MATCH mixed fail: %d hits\n",
+			  result->count );
+		goto err_count;
+	}
+	for ( i = 0 ; i < count ; i++ ) {
+		hit = &result->hits[i];
+		type2 = ( ( i / MATCHTEST_RUN ) & 1 );
+		iteration = ( type2 ? ( MATCHTEST_MAX - 1 ) : 0 );
+		if ( ( hit->seed != i ) || ( hit->iteration != iteration ) ||
+		     ( hit->observation != type2 ) ) {
+			fprintf ( stderr, "MATCH mixed fail: hit %d "
+				  "mismatch\n", i );
+			goto err_hit;
+		}
+	}
+
+	/* Free result and index */
+	cx_match_result_free ( result );
+	cx_match_free ( match );
+
+	fprintf ( stderr, "MATCH mixed ok\n" );
+	return 1;
+
+ err_hit:
+ err_count:
+	cx_match_result_free ( result );
+ err_seeds:
+	cx_match_free ( match );
+ err_create:
+	return 0;
+}
+
+/**
+ * Run match self-tests
+ *
+ * @ret ok		Success indicator
+ */
+int matchtests ( void ) {
+	struct cx_contact_id *observed;
+	struct cx_contact_id *ids;
+	unsigned int i;
+	int ok = 1;
+
+	/* Allocate contact IDs */
+	ids = malloc ( MATCHTEST_SEEDS * MATCHTEST_MAX * sizeof ( *ids ) );
+	observed = malloc ( MATCHTEST_OBSERVATIONS * sizeof ( *observed ) );
+	if ( ( ! ids ) || ( ! observed ) ) {
+		fprintf ( stderr, "MATCH fail: out of memory\n" );
+		ok = 0;
+		goto err_alloc;
+	}
+
+	/* Expand seed values */
+	for ( i = 0 ; i < MATCHTEST_SEEDS ; i++ ) {
+		if ( ! cx_gen_expand ( matchtest_seeds[i].type,
+				       matchtest_seeds[i].seed,
+				       matchtest_seeds[i].len,
+				       &ids[ i * MATCHTEST_MAX ] ) ) {
+			fprintf ( stderr, "MATCH fail: could not expand seed "
+				  "%d\n", i );
+			ok = 0;
+			goto err_expand;
+		}
+	}
+
+	/* Run tests */
+	matchtest_observe ( ids, observed );
+	ok &= matchtest ( "full", ids, observed, MATCHTEST_OBSERVATIONS,
+			  ( MATCHTEST_OBSERVATIONS / 2 ) );
+	ok &= matchtest ( "single", ids, observed, 1, 2 );
+	ok &= matchtest ( "empty", ids, observed, 0, 0 );
+	ok &= matchtest_window ( observed );
+	matchtest_observe_repeated ( ids, observed );
+	ok &= matchtest ( "repeated", ids, observed, MATCHTEST_OBSERVATIONS,
+			  MATCHTEST_OBSERVATIONS );
+	ok &= matchtest_invalid();
+	ok &= matchtest_mixed();
+	ok &= matchtest_parallel();
+
+ err_expand:
+ err_alloc:
+	free ( observed );
+	free ( ids );
+	return ok;
+}
@@ -0,0 +1,1622 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Observation store
+ *
+ ******************************************************************************
+ *
+ * An observation store is a directory holding an append-only log of
+ * recently observed contact IDs, and any number of sealed segments.
+ *
+ * The log ("active.log") is a sequence of fixed-size pages.  Each
+ * page starts with a header giving the number of valid records in
+ * the page and a base timestamp, and each record holds a contact ID,
+ * a signed timestamp delta relative to the page base, and an
+ * observation count.  Appended records are accumulated in a page
+ * buffer, and the log is only ever written a whole page at a time.
+ *
+ * Each page occupies two consecutive page-aligned slots.  A partially
+ * filled page may be rewritten by a subsequent flush, and successive
+ * writes of a page alternate between its two slots, so that a write
+ * never overwrites the most recently written copy.  The page header
+ * counts the number of times the page has been written, and recovery
+ * uses the most recently written valid copy of each page.  A torn
+ * rewrite therefore loses only the records that it was adding, never
+ * records that an earlier flush has already made durable.
+ *
+ * Each page header also holds a CRC-32 of the whole page, so that a
+ * torn or corrupted page is detected on recovery.  The log is
+ * truncated at the first page with no valid copy, since any later
+ * page may depend on it having been written.
+ *
+ * Each page also records the generation of the log to which it
+ * belongs.  The generation is incremented each time the log is
+ * sealed, and each segment records the log generation that it
+ * absorbed.  A log whose generation has already been absorbed (left
+ * behind by a crash between writing a segment and truncating the
+ * log) is discarded on recovery rather than replayed, and stale pages
+ * from an earlier generation are never mistaken for part of the
+ * current log.
+ *
+ * When the log reaches the configured number of records (or when
+ * explicitly requested), it is sealed into a segment file named by a
+ * hexadecimal sequence number.  The log is also sealed before
+ * appending an observation that would widen the range of timestamps
+ * in the log beyond the 32-bit deltas used within a segment, and so
+ * the log never spans too wide a range to be sealed.  Records are
+ * sorted by contact ID, repeated observations of the same contact
+ * ID at the same timestamp are combined, and timestamps are stored
+ * as unsigned deltas from the oldest timestamp in the segment.  The
+ * segment is written to a temporary file and renamed into place.
+ * The sequence number and log generation are advanced as soon as the
+ * rename succeeds, and the log is truncated only once the new segment
+ * has been mapped.
+ *
+ * A segment comprises (each starting on a page boundary):
+ *
+ *  - a header page,
+ *  - a fanout table indexed by the most significant bits of the
+ *    contact ID, giving the range of records with each prefix,
+ *  - the sorted contact IDs, and
+ *  - the timestamp deltas and observation counts.
+ *
+ * Segments are memory-mapped read-only when the store is opened.
+ * Only the header and the (bounded size) fanout table are checked;
+ * the contact IDs and metadata are used in place with no parsing, and
+ * so opening a store takes time independent of the number of records.
+ * Contact IDs are held separately from their metadata so that lookups
+ * touch only the fanout table and the contact IDs.
+ *
+ * Retention is applied by dropping whole segments, by unmapping and
+ * unlinking the segment file.
+ *
+ * Segment files use native byte order, and include a byte order
+ * marker so that a store copied to a machine with different byte
+ * order is rejected rather than misread.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <cx/obsstore.h>
+#include "expand.h"
+#include "fileio.h"
+#include "debug.h"
+
+/** Page size */
+#define CX_OBSSTORE_PAGE 4096
+
+/** Log page magic */
+#define CX_OBSSTORE_LOG_MAGIC 0x344c5843UL
+
+/** Segment magic */
+#define CX_OBSSTORE_MAGIC "CXOBSSEG"
+
+/** Segment format version */
+#define CX_OBSSTORE_VERSION 2
+
+/** Byte order marker */
+#define CX_OBSSTORE_ORDER 0x01020304UL
+
+/** Maximum number of fanout table index bits */
+#define CX_OBSSTORE_MAX_BITS 16
+
+/** Default number of records per segment */
+#define CX_OBSSTORE_DEFAULT_RECORDS ( 1024 * 1024 )
+
+/** Log file name */
+#define CX_OBSSTORE_LOG "active.log"
+
+/** Temporary segment file name */
+#define CX_OBSSTORE_TMP "segment.tmp"
+
+/** Segment file name suffix */
+#define CX_OBSSTORE_SUFFIX ".seg"
+
+/** Length of segment file name (excluding terminating NUL) */
+#define CX_OBSSTORE_NAME_LEN ( 16 + sizeof ( CX_OBSSTORE_SUFFIX ) - 1 )
+
+/** A log record */
+struct cx_obsstore_log_record {
+	/** Contact ID */
+	struct cx_contact_id id;
+	/** Timestamp delta from page base */
+	int32_t delta;
+	/** Observation count */
+	uint32_t count;
+};
+
+/** A log page header */
+struct cx_obsstore_log_header {
+	/** Magic */
+	uint32_t magic;
+	/** Number of valid records */
+	uint32_t count;
+	/** Base timestamp */
+	uint64_t base;
+	/** Log generation */
+	uint64_t generation;
+	/** CRC-32 of page (calculated with this field set to zero) */
+	uint32_t crc;
+	/** Number of previous writes of this page */
+	uint32_t serial;
+};
+
+/** Number of records in a log page */
+#define CX_OBSSTORE_LOG_RECORDS						\
+	( ( CX_OBSSTORE_PAGE - sizeof ( struct cx_obsstore_log_header ) ) / \
+	  sizeof ( struct cx_obsstore_log_record ) )
+
+/** A log page */
+struct cx_obsstore_log_page {
+	/** Header */
+	struct cx_obsstore_log_header header;
+	/** Records */
+	struct cx_obsstore_log_record records[CX_OBSSTORE_LOG_RECORDS];
+	/** Padding to page size */
+	uint8_t pad[ CX_OBSSTORE_PAGE -
+		     sizeof ( struct cx_obsstore_log_header ) -
+		     ( CX_OBSSTORE_LOG_RECORDS *
+		       sizeof ( struct cx_obsstore_log_record ) ) ];
+};
+
+/** Spacing of log pages (each page having two alternate slots) */
+#define CX_OBSSTORE_LOG_STRIDE ( 2 * sizeof ( struct cx_obsstore_log_page ) )
+
+/** A segment header */
+struct cx_obsstore_header {
+	/** Magic */
+	char magic[8];
+	/** Format version */
+	uint32_t version;
+	/** Byte order marker */
+	uint32_t order;
+	/** Number of records */
+	uint32_t count;
+	/** Number of fanout table index bits */
+	uint32_t bits;
+	/** Oldest timestamp (the base for timestamp deltas) */
+	uint64_t base;
+	/** Newest timestamp */
+	uint64_t last;
+	/** Offset of contact IDs */
+	uint64_t ids;
+	/** Offset of metadata */
+	uint64_t meta;
+	/** Length of segment file */
+	uint64_t len;
+	/** Log generation absorbed into this segment */
+	uint64_t generation;
+};
+
+/** Segment record metadata */
+struct cx_obsstore_meta {
+	/** Timestamp delta from segment base */
+	uint32_t delta;
+	/** Observation count */
+	uint32_t count;
+};
+
+/** A memory-mapped segment */
+struct cx_obsstore_segment {
+	/** Segment header (and start of mapping) */
+	const struct cx_obsstore_header *header;
+	/** Fanout table */
+	const uint32_t *fanout;
+	/** Contact IDs */
+	const struct cx_contact_id *ids;
+	/** Metadata */
+	const struct cx_obsstore_meta *meta;
+	/** Sequence number */
+	unsigned long long sequence;
+};
+
+/** An observation store */
+struct cx_obsstore {
+	/** Directory */
+	char *dir;
+	/** Number of records at which the log is sealed */
+	unsigned int records;
+	/** Log file descriptor */
+	int fd;
+	/** Current log page */
+	struct cx_obsstore_log_page page;
+	/** Offset of current log page */
+	off_t offset;
+	/** Current log page has records not yet written */
+	int dirty;
+	/** Number of records in log */
+	unsigned int pending;
+	/** An automatic seal has failed */
+	int stalled;
+	/** Oldest timestamp in log */
+	uint64_t first;
+	/** Newest timestamp in log */
+	uint64_t last;
+	/** Segments, oldest first */
+	struct cx_obsstore_segment *segments;
+	/** Number of segments */
+	unsigned int count;
+	/** Next segment sequence number */
+	unsigned long long sequence;
+	/** Current log generation */
+	uint64_t generation;
+	/** Latest log generation absorbed into a segment */
+	uint64_t absorbed;
+};
+
+/** State for matching seed values */
+struct cx_obsstore_state {
+	/** Observation store */
+	struct cx_obsstore *store;
+	/** Match result */
+	struct cx_match_result *result;
+	/** Number of matches allocated */
+	unsigned int *max;
+};
+
+/**
+ * Round up to a whole number of pages
+ *
+ * @v len		Length
+ * @ret len		Rounded length
+ */
+static inline uint64_t cx_obsstore_pages ( uint64_t len ) {
+
+	return ( ( len + CX_OBSSTORE_PAGE - 1 ) &
+		 ~( ( uint64_t ) ( CX_OBSSTORE_PAGE - 1 ) ) );
+}
+
+/**
+ * Construct path within store directory
+ *
+ * @v store		Observation store
+ * @v name		File name
+ * @ret path		Path (to be freed by caller), or NULL on error
+ */
+static char * cx_obsstore_path ( struct cx_obsstore *store,
+				 const char *name ) {
+	size_t len = ( strlen ( store->dir ) + 1 /* "/" */ +
+		       strlen ( name ) + 1 /* NUL */ );
+	char *path;
+
+	path = malloc ( len );
+	if ( path )
+		snprintf ( path, len, "%s/%s", store->dir, name );
+	return path;
+}
+
+/**
+ * Construct segment file name
+ *
+ * @v sequence		Sequence number
+ * @v name		Name buffer to fill in
+ */
+static void cx_obsstore_name ( unsigned long long sequence,
+			       char name[ CX_OBSSTORE_NAME_LEN + 1 ] ) {
+
+	snprintf ( name, ( CX_OBSSTORE_NAME_LEN + 1 ), "%016llx%s",
+		   sequence, CX_OBSSTORE_SUFFIX );
+}
+
+/**
+ * Update CRC-32
+ *
+ * @v crc		CRC-32 so far
+ * @v data		Data
+ * @v len		Length of data
+ * @ret crc		Updated CRC-32
+ */
+static uint32_t cx_obsstore_crc ( uint32_t crc, const void *data,
+				  size_t len ) {
+	static const uint32_t table[16] = {
+		0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+		0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+		0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+		0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+	};
+	const uint8_t *bytes = data;
+
+	while ( len-- ) {
+		crc ^= *(bytes++);
+		crc = ( ( crc >> 4 ) ^ table[ crc & 0x0f ] );
+		crc = ( ( crc >> 4 ) ^ table[ crc & 0x0f ] );
+	}
+	return crc;
+}
+
+/**
+ * Calculate log page CRC-32
+ *
+ * @v page		Log page
+ * @ret crc		CRC-32 (with the CRC-32 field treated as zero)
+ */
+static uint32_t cx_obsstore_page_crc ( const struct cx_obsstore_log_page
+				       *page ) {
+	static const uint32_t zero = 0;
+	const uint8_t *bytes = ( ( const void * ) page );
+	size_t offset = offsetof ( struct cx_obsstore_log_page, header.crc );
+	uint32_t crc = 0xffffffffUL;
+
+	crc = cx_obsstore_crc ( crc, bytes, offset );
+	crc = cx_obsstore_crc ( crc, &zero, sizeof ( zero ) );
+	offset += sizeof ( zero );
+	crc = cx_obsstore_crc ( crc, ( bytes + offset ),
+				( sizeof ( *page ) - offset ) );
+	return ( crc ^ 0xffffffffUL );
+}
+
+/**
+ * Read log page
+ *
+ * @v store		Observation store
+ * @v offset		Offset of page within log
+ * @v page		Page to fill in
+ * @ret ok		Success indicator (and page is valid)
+ */
+static int cx_obsstore_read_page ( struct cx_obsstore *store, off_t offset,
+				   struct cx_obsstore_log_page *page ) {
+	ssize_t done;
+
+	/* Read page */
+	do {
+		done = pread ( store->fd, page, sizeof ( *page ), offset );
+	} while ( ( done < 0 ) && ( errno == EINTR ) );
+	if ( done != ( ( ssize_t ) sizeof ( *page ) ) )
+		return 0;
+
+	/* Check page */
+	if ( ( page->header.magic != CX_OBSSTORE_LOG_MAGIC ) ||
+	     ( page->header.count > CX_OBSSTORE_LOG_RECORDS ) ||
+	     ( page->header.crc != cx_obsstore_page_crc ( page ) ) )
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Get offset of log page slot
+ *
+ * @v offset		Offset of page within log
+ * @v serial		Number of previous writes of the page
+ * @ret offset		Offset of slot used by the next write of the page
+ */
+static inline off_t cx_obsstore_slot ( off_t offset, uint32_t serial ) {
+
+	return ( offset + ( ( serial & 1 ) *
+			    sizeof ( struct cx_obsstore_log_page ) ) );
+}
+
+/**
+ * Read most recently written copy of log page
+ *
+ * @v store		Observation store
+ * @v offset		Offset of page within log
+ * @v page		Page to fill in
+ * @ret ok		Success indicator (and page is valid)
+ *
+ * Only copies belonging to the current log generation are
+ * considered.  A copy found in the wrong slot is ignored.
+ */
+static int cx_obsstore_read_latest ( struct cx_obsstore *store,
+				     off_t offset,
+				     struct cx_obsstore_log_page *page ) {
+	struct cx_obsstore_log_page copy;
+	unsigned int i;
+	off_t slot;
+	int ok = 0;
+
+	for ( i = 0 ; i < 2 ; i++ ) {
+		slot = ( offset + ( i * sizeof ( copy ) ) );
+		if ( ( ! cx_obsstore_read_page ( store, slot, &copy ) ) ||
+		     ( copy.header.generation != store->generation ) ||
+		     ( ( copy.header.serial & 1 ) != i ) )
+			continue;
+		if ( ok && ( copy.header.serial < page->header.serial ) )
+			continue;
+		memcpy ( page, &copy, sizeof ( *page ) );
+		ok = 1;
+	}
+
+	return ok;
+}
+
+/**
+ * Start new log page
+ *
+ * @v store		Observation store
+ * @v offset		Offset of page within log
+ */
+static void cx_obsstore_new_page ( struct cx_obsstore *store, off_t offset ) {
+
+	memset ( &store->page, 0, sizeof ( store->page ) );
+	store->page.header.magic = CX_OBSSTORE_LOG_MAGIC;
+	store->page.header.generation = store->generation;
+	store->offset = offset;
+	store->dirty = 0;
+}
+
+/**
+ * Update range of timestamps in log
+ *
+ * @v store		Observation store
+ * @v time		Timestamp
+ */
+static void cx_obsstore_span ( struct cx_obsstore *store, uint64_t time ) {
+
+	if ( ( ! store->pending ) || ( time < store->first ) )
+		store->first = time;
+	if ( ( ! store->pending ) || ( time > store->last ) )
+		store->last = time;
+}
+
+/**
+ * Recover log
+ *
+ * @v store		Observation store
+ * @ret ok		Success indicator
+ *
+ * Valid pages are counted up to the first page with no valid copy
+ * from the current generation, and the log is truncated there.  A
+ * partially filled final page is reloaded into the page buffer so
+ * that appending may continue.
+ *
+ * Segments must already have been loaded.  If the log generation has
+ * already been absorbed into a segment, the whole log is discarded.
+ */
+static int cx_obsstore_recover ( struct cx_obsstore *store ) {
+	struct cx_obsstore_log_page page;
+	uint64_t generation = 0;
+	unsigned int i;
+	off_t offset;
+
+	/* Identify log generation from the newest copy of the first page */
+	for ( offset = 0 ; offset < ( ( off_t ) CX_OBSSTORE_LOG_STRIDE ) ;
+	      offset += sizeof ( page ) ) {
+		if ( cx_obsstore_read_page ( store, offset, &page ) &&
+		     ( page.header.generation > generation ) )
+			generation = page.header.generation;
+	}
+	store->generation = ( store->absorbed + 1 );
+	if ( generation > store->absorbed ) {
+		store->generation = generation;
+	} else if ( generation ) {
+		DBG ( "OBSSTORE %p discarding absorbed log generation %llu\n",
+		      store, ( ( unsigned long long ) generation ) );
+	}
+
+	/* Count valid pages belonging to the current generation.  A
+	 * partially filled page is not necessarily the last page, since
+	 * a new page is started whenever a timestamp cannot be
+	 * represented relative to the current page base.
+	 */
+	store->pending = 0;
+	for ( offset = 0 ; cx_obsstore_read_latest ( store, offset, &page ) ;
+	      offset += CX_OBSSTORE_LOG_STRIDE ) {
+		for ( i = 0 ; i < page.header.count ; i++ ) {
+			cx_obsstore_span ( store, ( page.header.base +
+						    page.records[i].delta ) );
+			store->pending++;
+		}
+	}
+
+	/* Reload a partially filled final page into the page buffer.
+	 * The next write of the page goes to the other slot, leaving
+	 * the recovered copy intact.
+	 */
+	cx_obsstore_new_page ( store, offset );
+	if ( offset &&
+	     cx_obsstore_read_latest ( store, ( offset -
+						CX_OBSSTORE_LOG_STRIDE ),
+				       &page ) &&
+	     ( page.header.count < CX_OBSSTORE_LOG_RECORDS ) ) {
+		memcpy ( &store->page, &page, sizeof ( page ) );
+		store->page.header.serial++;
+		store->offset = ( offset - CX_OBSSTORE_LOG_STRIDE );
+	}
+
+	/* Discard anything beyond the last valid page */
+	if ( ftruncate ( store->fd, offset ) != 0 ) {
+		DBG ( "OBSSTORE %p could not truncate log: %s\n",
+		      store, strerror ( errno ) );
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Map segment
+ *
+ * @v store		Observation store
+ * @v sequence		Sequence number
+ * @v segment		Segment to fill in
+ * @ret ok		Success indicator
+ */
+static int cx_obsstore_map ( struct cx_obsstore *store,
+			     unsigned long long sequence,
+			     struct cx_obsstore_segment *segment ) {
+	char name[ CX_OBSSTORE_NAME_LEN + 1 ];
+	const struct cx_obsstore_header *header;
+	struct stat stat;
+	uint64_t fanout;
+	uint64_t ids;
+	uint64_t meta;
+	const uint8_t *bytes;
+	unsigned int i;
+	char *path;
+	void *map;
+	int fd;
+
+	/* Open segment file */
+	cx_obsstore_name ( sequence, name );
+	path = cx_obsstore_path ( store, name );
+	if ( ! path )
+		goto err_path;
+	fd = open ( path, O_RDONLY );
+	if ( fd < 0 ) {
+		DBG ( "OBSSTORE %p could not open %s: %s\n",
+		      store, path, strerror ( errno ) );
+		goto err_open;
+	}
+	if ( fstat ( fd, &stat ) != 0 )
+		goto err_stat;
+	if ( stat.st_size < ( ( off_t ) sizeof ( *header ) ) ) {
+		DBG ( "OBSSTORE %p segment %s is truncated\n", store, path );
+		goto err_size;
+	}
+
+	/* Map segment file */
+	map = mmap ( NULL, stat.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	if ( map == MAP_FAILED ) {
+		DBG ( "OBSSTORE %p could not map %s: %s\n",
+		      store, path, strerror ( errno ) );
+		goto err_mmap;
+	}
+	header = map;
+	bytes = map;
+
+	/* Check header */
+	if ( ( memcmp ( header->magic, CX_OBSSTORE_MAGIC,
+			sizeof ( header->magic ) ) != 0 ) ||
+	     ( header->version != CX_OBSSTORE_VERSION ) ||
+	     ( header->order != CX_OBSSTORE_ORDER ) ||
+	     ( header->bits > CX_OBSSTORE_MAX_BITS ) ) {
+		DBG ( "OBSSTORE %p segment %s has invalid header\n",
+		      store, path );
+		goto err_header;
+	}
+
+	/* Check layout.  Each offset is checked against the file length
+	 * before being added to anything, so that no sum of values read
+	 * from the file can wrap around.
+	 */
+	fanout = ( ( ( 1ULL << header->bits ) + 1 ) * sizeof ( uint32_t ) );
+	ids = ( ( ( uint64_t ) header->count ) * sizeof ( segment->ids[0] ) );
+	meta = ( ( ( uint64_t ) header->count ) *
+		 sizeof ( segment->meta[0] ) );
+	if ( ( header->len != ( ( uint64_t ) stat.st_size ) ) ||
+	     ( header->ids % CX_OBSSTORE_PAGE ) ||
+	     ( header->meta % CX_OBSSTORE_PAGE ) ||
+	     ( header->ids < ( CX_OBSSTORE_PAGE + fanout ) ) ||
+	     ( header->ids > header->len ) ||
+	     ( ids > ( header->len - header->ids ) ) ||
+	     ( header->meta < ( header->ids + ids ) ) ||
+	     ( header->meta > header->len ) ||
+	     ( meta > ( header->len - header->meta ) ) ) {
+		DBG ( "OBSSTORE %p segment %s has invalid layout\n",
+		      store, path );
+		goto err_layout;
+	}
+
+	/* Fill in segment */
+	segment->header = header;
+	segment->fanout = ( ( void * ) ( bytes + CX_OBSSTORE_PAGE ) );
+	segment->ids = ( ( void * ) ( bytes + header->ids ) );
+	segment->meta = ( ( void * ) ( bytes + header->meta ) );
+	segment->sequence = sequence;
+
+	/* Check fanout table, since lookups rely on each range lying
+	 * within the contact IDs.
+	 */
+	for ( i = 0 ; i <= ( 1U << header->bits ) ; i++ ) {
+		if ( ( segment->fanout[i] > header->count ) ||
+		     ( i && ( segment->fanout[i] <
+			      segment->fanout[ i - 1 ] ) ) )
+			break;
+	}
+	if ( ( i <= ( 1U << header->bits ) ) ||
+	     ( segment->fanout[ 1U << header->bits ] != header->count ) ) {
+		DBG ( "OBSSTORE %p segment %s has invalid fanout\n",
+		      store, path );
+		goto err_fanout;
+	}
+
+	/* Close file (the mapping remains valid) */
+	close ( fd );
+	free ( path );
+
+	return 1;
+
+ err_fanout:
+ err_layout:
+ err_header:
+	munmap ( map, stat.st_size );
+ err_mmap:
+ err_size:
+ err_stat:
+	close ( fd );
+ err_open:
+	free ( path );
+ err_path:
+	return 0;
+}
+
+/**
+ * Unmap segment
+ *
+ * @v segment		Segment
+ */
+static void cx_obsstore_unmap ( struct cx_obsstore_segment *segment ) {
+
+	munmap ( ( void * ) segment->header, segment->header->len );
+}
+
+/**
+ * Add segment
+ *
+ * @v store		Observation store
+ * @v sequence		Sequence number
+ * @ret ok		Success indicator
+ */
+static int cx_obsstore_add ( struct cx_obsstore *store,
+			     unsigned long long sequence ) {
+	struct cx_obsstore_segment *segments;
+	struct cx_obsstore_segment *segment;
+
+	/* Grow list of segments */
+	segments = realloc ( store->segments, ( ( store->count + 1 ) *
+						sizeof ( segments[0] ) ) );
+	if ( ! segments )
+		return 0;
+	store->segments = segments;
+
+	/* Map segment */
+	segment = &store->segments[store->count];
+	if ( ! cx_obsstore_map ( store, sequence, segment ) )
+		return 0;
+	store->count++;
+
+	/* Update next sequence number and latest absorbed generation */
+	if ( store->sequence <= sequence )
+		store->sequence = ( sequence + 1 );
+	if ( store->absorbed < segment->header->generation )
+		store->absorbed = segment->header->generation;
+
+	return 1;
+}
+
+/**
+ * Compare sequence numbers
+ *
+ * @v first		First sequence number
+ * @v second		Second sequence number
+ * @ret diff		Difference
+ */
+static int cx_obsstore_compare_sequence ( const void *first,
+					  const void *second ) {
+	const unsigned long long *a = first;
+	const unsigned long long *b = second;
+
+	return ( ( *a < *b ) ? -1 : ( ( *a > *b ) ? 1 : 0 ) );
+}
+
+/**
+ * Load segments
+ *
+ * @v store		Observation store
+ * @ret ok		Success indicator
+ */
+static int cx_obsstore_load ( struct cx_obsstore *store ) {
+	unsigned long long *sequences = NULL;
+	unsigned long long *tmp;
+	unsigned long long sequence;
+	unsigned int count = 0;
+	unsigned int i;
+	struct dirent *dirent;
+	size_t len;
+	char *end;
+	DIR *dir;
+
+	/* Find segment files */
+	dir = opendir ( store->dir );
+	if ( ! dir ) {
+		DBG ( "OBSSTORE %p could not open %s: %s\n",
+		      store, store->dir, strerror ( errno ) );
+		goto err_opendir;
+	}
+	while ( ( dirent = readdir ( dir ) ) ) {
+		len = strlen ( dirent->d_name );
+		if ( ( len != CX_OBSSTORE_NAME_LEN ) ||
+		     ( strcmp ( &dirent->d_name[16],
+				CX_OBSSTORE_SUFFIX ) != 0 ) )
+			continue;
+		sequence = strtoull ( dirent->d_name, &end, 16 );
+		if ( end != &dirent->d_name[16] )
+			continue;
+		tmp = realloc ( sequences, ( ( count + 1 ) *
+					     sizeof ( sequences[0] ) ) );
+		if ( ! tmp )
+			goto err_alloc;
+		sequences = tmp;
+		sequences[count++] = sequence;
+	}
+
+	/* Map segments in sequence order */
+	if ( count ) {
+		qsort ( sequences, count, sizeof ( sequences[0] ),
+			cx_obsstore_compare_sequence );
+	}
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ! cx_obsstore_add ( store, sequences[i] ) )
+			goto err_add;
+	}
+
+	free ( sequences );
+	closedir ( dir );
+	return 1;
+
+ err_add:
+ err_alloc:
+	free ( sequences );
+	closedir ( dir );
+ err_opendir:
+	return 0;
+}
+
+/**
+ * Open observation store
+ *
+ * @v dir		Directory (which will be created if necessary)
+ * @v records		Number of log records at which to seal a segment,
+ *			or zero to use the default
+ * @ret store		Observation store, or NULL on error
+ */
+struct cx_obsstore * cx_obsstore_open ( const char *dir,
+					unsigned int records ) {
+	struct cx_obsstore *store;
+	unsigned int i;
+	char *path;
+
+	/* Allocate and initialise structure */
+	store = malloc ( sizeof ( *store ) );
+	if ( ! store )
+		goto err_alloc;
+	memset ( store, 0, sizeof ( *store ) );
+	store->records = ( records ? records : CX_OBSSTORE_DEFAULT_RECORDS );
+	store->dir = strdup ( dir );
+	if ( ! store->dir )
+		goto err_dir;
+
+	/* Create directory, if necessary */
+	if ( ( mkdir ( dir, 0777 ) != 0 ) && ( errno != EEXIST ) ) {
+		DBG ( "OBSSTORE %p could not create %s: %s\n",
+		      store, dir, strerror ( errno ) );
+		goto err_mkdir;
+	}
+
+	/* Open log */
+	path = cx_obsstore_path ( store, CX_OBSSTORE_LOG );
+	if ( ! path )
+		goto err_path;
+	store->fd = open ( path, ( O_RDWR | O_CREAT ), 0666 );
+	free ( path );
+	if ( store->fd < 0 ) {
+		DBG ( "OBSSTORE %p could not open log: %s\n",
+		      store, strerror ( errno ) );
+		goto err_open;
+	}
+
+	/* Load segments, and then recover log */
+	if ( ! cx_obsstore_load ( store ) )
+		goto err_load;
+	if ( ! cx_obsstore_recover ( store ) )
+		goto err_recover;
+
+	return store;
+
+ err_recover:
+ err_load:
+	for ( i = 0 ; i < store->count ; i++ )
+		cx_obsstore_unmap ( &store->segments[i] );
+	free ( store->segments );
+	close ( store->fd );
+ err_open:
+ err_path:
+ err_mkdir:
+	free ( store->dir );
+ err_dir:
+	free ( store );
+ err_alloc:
+	return NULL;
+}
+
+/**
+ * Write current log page
+ *
+ * @v store		Observation store
+ * @ret ok		Success indicator
+ */
+static int cx_obsstore_write_page ( struct cx_obsstore *store ) {
+	struct cx_obsstore_log_header *header = &store->page.header;
+
+	/* Do nothing unless page has unwritten records */
+	if ( ! store->dirty )
+		return 1;
+
+	/* Write whole page to the slot not holding the previous copy */
+	header->crc = cx_obsstore_page_crc ( &store->page );
+	if ( ! cx_file_write ( store->fd, &store->page,
+			       sizeof ( store->page ),
+			       cx_obsstore_slot ( store->offset,
+						  header->serial ) ) )
+		return 0;
+	header->serial++;
+	store->dirty = 0;
+
+	return 1;
+}
+
+/**
+ * Append observation
+ *
+ * @v store		Observation store
+ * @v id		Observed contact ID
+ * @v time		Coarse timestamp (in caller-defined units)
+ * @v count		Number of times observed
+ * @ret ok		Success indicator
+ *
+ * The observation is buffered, and is written to the log when the
+ * current log page is full or when cx_obsstore_flush() is called.
+ * The log is sealed into a new segment when it reaches the
+ * configured number of records, and is sealed before the observation
+ * is added if the range of timestamps in the log would otherwise
+ * become too wide to be represented within a single segment.
+ *
+ * Success is reported once the observation has been buffered.  If
+ * the automatic seal fails, the observation remains in the log, and
+ * the failure is reported by the next call to cx_obsstore_flush()
+ * (which retries the seal).  No further automatic seal is attempted
+ * until then.
+ */
+int cx_obsstore_append ( struct cx_obsstore *store,
+			 const struct cx_contact_id *id,
+			 uint64_t time, unsigned int count ) {
+	struct cx_obsstore_log_header *header = &store->page.header;
+	struct cx_obsstore_log_record *record;
+	int64_t delta;
+
+	/* Seal log first if the timestamp span would become too wide */
+	if ( store->pending &&
+	     ( ( ( time > store->first ) &&
+		 ( ( time - store->first ) > UINT32_MAX ) ) ||
+	       ( ( time < store->last ) &&
+		 ( ( store->last - time ) > UINT32_MAX ) ) ) ) {
+		if ( ! cx_obsstore_seal ( store ) )
+			return 0;
+	}
+
+	/* Start a new page if the current page is full, or if the
+	 * timestamp cannot be represented relative to the page base.
+	 */
+	delta = ( time - header->base );
+	if ( header->count &&
+	     ( ( header->count == CX_OBSSTORE_LOG_RECORDS ) ||
+	       ( delta != ( ( int32_t ) delta ) ) ) ) {
+		if ( ! cx_obsstore_write_page ( store ) )
+			return 0;
+		cx_obsstore_new_page ( store, ( store->offset +
+						CX_OBSSTORE_LOG_STRIDE ) );
+	}
+	if ( ! header->count )
+		header->base = time;
+
+	/* Add record */
+	record = &store->page.records[ header->count++ ];
+	memcpy ( &record->id, id, sizeof ( record->id ) );
+	record->delta = ( time - header->base );
+	record->count = count;
+	cx_obsstore_span ( store, time );
+	store->pending++;
+	store->dirty = 1;
+
+	/* Seal log, if applicable */
+	if ( ( store->pending >= store->records ) && ( ! store->stalled ) &&
+	     ( ! cx_obsstore_seal ( store ) ) ) {
+		DBG ( "OBSSTORE %p could not seal %u records\n",
+		      store, store->pending );
+		store->stalled = 1;
+	}
+
+	return 1;
+}
+
+/**
+ * Append deduplicated sightings
+ *
+ * @v ctx		Observation store
+ * @v sightings		Deduplicated sightings
+ * @v count		Number of sightings
+ * @ret ok		Success indicator
+ *
+ * This may be used as the flush function for an ingest table.  Each
+ * sighting is recorded as a single observation at its first-seen
+ * timestamp.
+ */
+int cx_obsstore_ingest ( void *ctx, const struct cx_sighting *sightings,
+			 unsigned int count ) {
+	struct cx_obsstore *store = ctx;
+	unsigned int i;
+
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ! cx_obsstore_append ( store, &sightings[i].id,
+					    sightings[i].first,
+					    sightings[i].count ) )
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Flush log
+ *
+ * @v store		Observation store
+ * @ret ok		Success indicator
+ *
+ * Any partially filled log page is written out, and the log is
+ * synchronised to disk.  If an automatic seal has failed, the seal
+ * is retried first, and failure is reported even though the log
+ * itself has been written and synchronised.
+ */
+int cx_obsstore_flush ( struct cx_obsstore *store ) {
+	int sealed = 1;
+
+	/* Retry any failed automatic seal */
+	if ( store->stalled || ( store->pending >= store->records ) ) {
+		store->stalled = 0;
+		sealed = cx_obsstore_seal ( store );
+	}
+
+	/* Write current page */
+	if ( ! cx_obsstore_write_page ( store ) )
+		return 0;
+
+	/* Synchronise log */
+	if ( fdatasync ( store->fd ) != 0 ) {
+		DBG ( "OBSSTORE %p could not synchronise log: %s\n",
+		      store, strerror ( errno ) );
+		return 0;
+	}
+
+	return sealed;
+}
+
+/**
+ * Compare observation records
+ *
+ * @v first		First record
+ * @v second		Second record
+ * @ret diff		Difference
+ */
+static int cx_obsstore_compare ( const void *first, const void *second ) {
+	const struct cx_obs_record *a = first;
+	const struct cx_obs_record *b = second;
+	int diff;
+
+	diff = memcmp ( &a->id, &b->id, sizeof ( a->id ) );
+	if ( diff )
+		return diff;
+	if ( a->time != b->time )
+		return ( ( a->time < b->time ) ? -1 : 1 );
+	return 0;
+}
+
+/**
+ * Read all log records
+ *
+ * @v store		Observation store
+ * @v records		Records to fill in
+ * @ret count		Number of records, or negative error
+ */
+static int cx_obsstore_read_log ( struct cx_obsstore *store,
+				  struct cx_obs_record *records ) {
+	struct cx_obsstore_log_page page;
+	struct cx_obsstore_log_page *source;
+	struct cx_obsstore_log_record *record;
+	unsigned int count = 0;
+	unsigned int i;
+	off_t offset;
+
+	/* Read each page, using the page buffer for the current page */
+	for ( offset = 0 ; offset <= store->offset ;
+	      offset += CX_OBSSTORE_LOG_STRIDE ) {
+		if ( offset == store->offset ) {
+			source = &store->page;
+		} else {
+			if ( ! cx_obsstore_read_latest ( store, offset,
+							 &page ) ) {
+				DBG ( "OBSSTORE %p could not read log page at "
+				      "%lld\n", store,
+				      ( ( long long ) offset ) );
+				return -1;
+			}
+			source = &page;
+		}
+		for ( i = 0 ; i < source->header.count ; i++ ) {
+			record = &source->records[i];
+			memcpy ( &records[count].id, &record->id,
+				 sizeof ( records[count].id ) );
+			records[count].time = ( source->header.base +
+						record->delta );
+			records[count].count = record->count;
+			count++;
+		}
+	}
+
+	return count;
+}
+
+/**
+ * Write segment file
+ *
+ * @v store		Observation store
+ * @v name		Segment file name
+ * @v data		Segment data
+ * @v len		Length of segment data
+ * @ret ok		Success indicator
+ *
+ * The segment is written to a temporary file, synchronised, and then
+ * atomically renamed into place.  On failure, no segment file is
+ * created.
+ */
+static int cx_obsstore_write_segment ( struct cx_obsstore *store,
+				       const char *name, const void *data,
+				       size_t len ) {
+	char *path;
+	char *tmp;
+	int fd;
+
+	/* Construct paths */
+	tmp = cx_obsstore_path ( store, CX_OBSSTORE_TMP );
+	if ( ! tmp )
+		goto err_tmp;
+	path = cx_obsstore_path ( store, name );
+	if ( ! path )
+		goto err_path;
+
+	/* Write segment to temporary file */
+	fd = open ( tmp, ( O_WRONLY | O_CREAT | O_TRUNC ), 0666 );
+	if ( fd < 0 ) {
+		DBG ( "OBSSTORE %p could not create %s: %s\n",
+		      store, tmp, strerror ( errno ) );
+		goto err_open;
+	}
+	if ( ! cx_file_write ( fd, data, len, 0 ) )
+		goto err_write;
+	if ( fsync ( fd ) != 0 ) {
+		DBG ( "OBSSTORE %p could not synchronise %s: %s\n",
+		      store, tmp, strerror ( errno ) );
+		goto err_sync;
+	}
+
+	/* Rename into place */
+	if ( rename ( tmp, path ) != 0 ) {
+		DBG ( "OBSSTORE %p could not rename %s: %s\n",
+		      store, tmp, strerror ( errno ) );
+		goto err_rename;
+	}
+
+	close ( fd );
+	free ( path );
+	free ( tmp );
+	return 1;
+
+ err_rename:
+ err_sync:
+ err_write:
+	close ( fd );
+	unlink ( tmp );
+ err_open:
+	free ( path );
+ err_path:
+	free ( tmp );
+ err_tmp:
+	return 0;
+}
+
+/**
+ * Seal log into a new segment
+ *
+ * @v store		Observation store
+ * @ret ok		Success indicator
+ *
+ * If sealing fails after the segment file has been written, the
+ * records are not lost: they are held in the new segment, which is
+ * loaded the next time the store is opened even if it could not be
+ * mapped now.
+ */
+int cx_obsstore_seal ( struct cx_obsstore *store ) {
+	char name[ CX_OBSSTORE_NAME_LEN + 1 ];
+	struct cx_obsstore_header *header;
+	struct cx_obsstore_meta *meta;
+	struct cx_contact_id *ids;
+	struct cx_obs_record *records;
+	unsigned long long sequence;
+	uint32_t *fanout;
+	uint64_t total;
+	uint64_t first;
+	uint64_t last;
+	unsigned int count;
+	unsigned int bits;
+	unsigned int prefix;
+	unsigned int i;
+	unsigned int j;
+	uint8_t *data;
+	int len;
+
+	/* Do nothing if log is empty */
+	if ( ! store->pending )
+		return 1;
+
+	/* Read, sort, and combine log records */
+	records = malloc ( store->pending * sizeof ( records[0] ) );
+	if ( ! records )
+		goto err_alloc_records;
+	len = cx_obsstore_read_log ( store, records );
+	if ( len < 0 )
+		goto err_read;
+	qsort ( records, len, sizeof ( records[0] ), cx_obsstore_compare );
+	first = last = records[0].time;
+	for ( count = 0, i = 0 ; i < ( ( unsigned int ) len ) ; i++ ) {
+		if ( records[i].time < first )
+			first = records[i].time;
+		if ( records[i].time > last )
+			last = records[i].time;
+		if ( count && ( cx_obsstore_compare ( &records[ count - 1 ],
+						      &records[i] ) == 0 ) ) {
+			total = ( ( uint64_t ) records[ count - 1 ].count +
+				  records[i].count );
+			if ( total > UINT32_MAX )
+				total = UINT32_MAX;
+			records[ count - 1 ].count = total;
+		} else {
+			memcpy ( &records[count++], &records[i],
+				 sizeof ( records[0] ) );
+		}
+	}
+	if ( ( last - first ) > UINT32_MAX ) {
+		DBG ( "OBSSTORE %p timestamps %llu-%llu span too wide\n",
+		      store, ( ( unsigned long long ) first ),
+		      ( ( unsigned long long ) last ) );
+		goto err_span;
+	}
+
+	/* Choose fanout table size (around four records per entry) */
+	for ( bits = 0 ; ( ( bits < CX_OBSSTORE_MAX_BITS ) &&
+			   ( ( 4U << bits ) < count ) ) ; bits++ ) {}
+
+	/* Construct segment header */
+	header = calloc ( 1, sizeof ( *header ) );
+	if ( ! header )
+		goto err_alloc_header;
+	memcpy ( header->magic, CX_OBSSTORE_MAGIC, sizeof ( header->magic ) );
+	header->version = CX_OBSSTORE_VERSION;
+	header->order = CX_OBSSTORE_ORDER;
+	header->count = count;
+	header->bits = bits;
+	header->base = first;
+	header->last = last;
+	header->ids = cx_obsstore_pages ( CX_OBSSTORE_PAGE +
+					  ( ( ( 1U << bits ) + 1 ) *
+					    sizeof ( fanout[0] ) ) );
+	header->meta = cx_obsstore_pages ( header->ids +
+					   ( count * sizeof ( ids[0] ) ) );
+	header->len = cx_obsstore_pages ( header->meta +
+					  ( count * sizeof ( meta[0] ) ) );
+	header->generation = store->generation;
+
+	/* Construct segment */
+	data = calloc ( 1, header->len );
+	if ( ! data )
+		goto err_alloc_data;
+	memcpy ( data, header, sizeof ( *header ) );
+	fanout = ( ( uint32_t * ) ( data + CX_OBSSTORE_PAGE ) );
+	ids = ( ( struct cx_contact_id * ) ( data + header->ids ) );
+	meta = ( ( struct cx_obsstore_meta * ) ( data + header->meta ) );
+	for ( i = 0, prefix = 0 ; i < count ; i++ ) {
+		j = ( ( ( records[i].id.bytes[0] << 8 ) |
+			records[i].id.bytes[1] ) >> ( 16 - bits ) );
+		while ( prefix <= j )
+			fanout[prefix++] = i;
+		memcpy ( &ids[i], &records[i].id, sizeof ( ids[i] ) );
+		meta[i].delta = ( records[i].time - first );
+		meta[i].count = records[i].count;
+	}
+	while ( prefix <= ( 1U << bits ) )
+		fanout[prefix++] = count;
+
+	/* Write segment */
+	sequence = store->sequence;
+	cx_obsstore_name ( sequence, name );
+	if ( ! cx_obsstore_write_segment ( store, name, data, header->len ) )
+		goto err_write;
+
+	/* The segment now holds every record in the log, so start a new
+	 * log generation and never reuse this sequence number, even if
+	 * a later step fails.  The records remain in the old log
+	 * generation on disk until the log is truncated; recovery
+	 * discards them since the segment has absorbed that generation.
+	 */
+	store->sequence = ( sequence + 1 );
+	store->generation++;
+	store->pending = 0;
+	cx_obsstore_new_page ( store, 0 );
+
+	/* Map new segment */
+	if ( ! cx_obsstore_add ( store, sequence ) )
+		goto err_add;
+
+	/* Ensure the segment is durable, then truncate the log */
+	if ( ! cx_file_sync_dir ( store->dir ) )
+		goto err_sync_dir;
+	if ( ftruncate ( store->fd, 0 ) != 0 ) {
+		DBG ( "OBSSTORE %p could not truncate log: %s\n",
+		      store, strerror ( errno ) );
+		goto err_truncate;
+	}
+
+	free ( data );
+	free ( header );
+	free ( records );
+	return 1;
+
+ err_truncate:
+ err_sync_dir:
+ err_add:
+ err_write:
+	free ( data );
+ err_alloc_data:
+	free ( header );
+ err_alloc_header:
+ err_span:
+ err_read:
+	free ( records );
+ err_alloc_records:
+	return 0;
+}
+
+/**
+ * Drop segments containing only old observations
+ *
+ * @v store		Observation store
+ * @v before		Timestamp before which observations may be dropped
+ * @ret dropped		Number of segments dropped
+ *
+ * Each segment whose newest observation is older than @c before is
+ * unmapped and deleted in its entirety.  Segments containing any
+ * newer observation are retained intact, and so some observations
+ * older than @c before may remain.  Observations in the log are
+ * never dropped.
+ *
+ * Dropping segments changes the indices of observations in later
+ * segments.
+ */
+unsigned int cx_obsstore_prune ( struct cx_obsstore *store,
+				 uint64_t before ) {
+	char name[ CX_OBSSTORE_NAME_LEN + 1 ];
+	struct cx_obsstore_segment *segment;
+	unsigned int dropped = 0;
+	unsigned int i;
+	char *path;
+
+	/* Drop old segments */
+	for ( i = 0 ; i < store->count ; i++ ) {
+		segment = &store->segments[i];
+		if ( segment->header->last >= before ) {
+			if ( dropped )
+				store->segments[ i - dropped ] = *segment;
+			continue;
+		}
+		cx_obsstore_name ( segment->sequence, name );
+		path = cx_obsstore_path ( store, name );
+		if ( ( ! path ) || ( unlink ( path ) != 0 ) ) {
+			DBG ( "OBSSTORE %p could not delete segment %s\n",
+			      store, name );
+			free ( path );
+			if ( dropped )
+				store->segments[ i - dropped ] = *segment;
+			continue;
+		}
+		free ( path );
+		cx_obsstore_unmap ( segment );
+		dropped++;
+	}
+	store->count -= dropped;
+
+	return dropped;
+}
+
+/**
+ * Get number of segments
+ *
+ * @v store		Observation store
+ * @ret count		Number of segments
+ */
+unsigned int cx_obsstore_segments ( struct cx_obsstore *store ) {
+
+	return store->count;
+}
+
+/**
+ * Get number of observation records within segments
+ *
+ * @v store		Observation store
+ * @ret count		Number of observation records
+ *
+ * Observations that have not yet been sealed into a segment are not
+ * included.
+ */
+unsigned int cx_obsstore_count ( struct cx_obsstore *store ) {
+	unsigned int count = 0;
+	unsigned int i;
+
+	for ( i = 0 ; i < store->count ; i++ )
+		count += store->segments[i].header->count;
+	return count;
+}
+
+/**
+ * Get observation record
+ *
+ * @v store		Observation store
+ * @v index		Index of observation record
+ * @v record		Observation record to fill in
+ * @ret ok		Success indicator
+ *
+ * Observation records are numbered consecutively from zero across all
+ * segments, oldest segment first and in order of contact ID within
+ * each segment.
+ */
+int cx_obsstore_record ( struct cx_obsstore *store, unsigned int index,
+			 struct cx_obs_record *record ) {
+	struct cx_obsstore_segment *segment;
+	unsigned int i;
+
+	/* Find segment */
+	for ( i = 0 ; i < store->count ; i++ ) {
+		segment = &store->segments[i];
+		if ( index < segment->header->count ) {
+			memcpy ( &record->id, &segment->ids[index],
+				 sizeof ( record->id ) );
+			record->time = ( segment->header->base +
+					 segment->meta[index].delta );
+			record->count = segment->meta[index].count;
+			return 1;
+		}
+		index -= segment->header->count;
+	}
+
+	return 0;
+}
+
+/**
+ * Check if stored contact ID sorts before a contact ID
+ *
+ * @v id		Stored contact ID
+ * @v hi		Most significant 64 bits of contact ID
+ * @v lo		Least significant 64 bits of contact ID
+ * @ret less		Stored contact ID sorts first
+ */
+static inline int cx_obsstore_less ( const struct cx_contact_id *id,
+				     uint64_t hi, uint64_t lo ) {
+	uint64_t id_hi = cx_expand_be64 ( &id->bytes[0] );
+
+	return ( ( id_hi < hi ) ||
+		 ( ( id_hi == hi ) &&
+		   ( cx_expand_be64 ( &id->bytes[8] ) < lo ) ) );
+}
+
+/**
+ * Check if stored contact ID is equal to a contact ID
+ *
+ * @v id		Stored contact ID
+ * @v hi		Most significant 64 bits of contact ID
+ * @v lo		Least significant 64 bits of contact ID
+ * @ret equal		Contact IDs are equal
+ */
+static inline int cx_obsstore_equal ( const struct cx_contact_id *id,
+				      uint64_t hi, uint64_t lo ) {
+
+	return ( ( cx_expand_be64 ( &id->bytes[0] ) == hi ) &&
+		 ( cx_expand_be64 ( &id->bytes[8] ) == lo ) );
+}
+
+/**
+ * Look up generated contact IDs
+ *
+ * @v ctx		Matching state
+ * @v ids		Generated contact IDs
+ * @v count		Number of generated contact IDs
+ * @v seed		Index of seed value
+ * @v iteration		Iteration at which first contact ID was generated
+ * @ret ok		Success indicator
+ */
+static int cx_obsstore_lookup ( void *ctx, const struct cx_contact_id *ids,
+				unsigned int count, unsigned int seed,
+				unsigned int iteration ) {
+	struct cx_obsstore_state *state = ctx;
+	struct cx_obsstore *store = state->store;
+	const struct cx_obsstore_segment *segment;
+	unsigned int first;
+	unsigned int low;
+	unsigned int high;
+	unsigned int mid;
+	unsigned int i;
+	unsigned int j;
+	uint64_t hi;
+	uint64_t lo;
+
+	/* Look up each contact ID in each segment */
+	for ( i = 0 ; i < count ; i++ ) {
+		hi = cx_expand_be64 ( &ids[i].bytes[0] );
+		lo = cx_expand_be64 ( &ids[i].bytes[8] );
+		for ( first = 0, j = 0 ; j < store->count ;
+		      first += segment->header->count, j++ ) {
+			segment = &store->segments[j];
+
+			/* Find first matching record within fanout range */
+			mid = ( segment->header->bits ?
+				( hi >> ( 64 - segment->header->bits ) ) : 0 );
+			low = segment->fanout[mid];
+			high = segment->fanout[ mid + 1 ];
+			while ( low < high ) {
+				mid = ( low + ( ( high - low ) / 2 ) );
+				if ( cx_obsstore_less ( &segment->ids[mid],
+							hi, lo ) ) {
+					low = ( mid + 1 );
+				} else {
+					high = mid;
+				}
+			}
+
+			/* Record each matching record */
+			for ( ; ( ( low < segment->header->count ) &&
+				  cx_obsstore_equal ( &segment->ids[low],
+						      hi, lo ) ) ; low++ ) {
+				if ( ! cx_expand_hit ( state->result,
+						       state->max, seed,
+						       ( iteration + i ),
+						       ( first + low ) ) ) {
+					DBG ( "OBSSTORE %p could not record "
+					      "match\n", store );
+					return 0;
+				}
+			}
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Match seed values against observation store
+ *
+ * @v store		Observation store
+ * @v seeds		Seed values
+ * @v count		Number of seed values
+ * @ret result		Match result, or NULL on error
+ *
+ * Seed values are expanded over their iteration ranges (as for
+ * cx_match_seeds()), and every generated contact ID is looked up
+ * directly within the memory-mapped segments.  Observations that
+ * have not yet been sealed into a segment are not matched.  Matched
+ * observation indices may be passed to cx_obsstore_record().  The
+ * result must eventually be freed using cx_match_result_free().
+ */
+struct cx_match_result * cx_obsstore_match ( struct cx_obsstore *store,
+					     const struct cx_match_seed *seeds,
+					     unsigned int count ) {
+	struct cx_obsstore_state state;
+	struct cx_match_result *result;
+	struct cx_expand expand;
+	unsigned int hits = 0;
+
+	/* Allocate and initialise result */
+	result = malloc ( sizeof ( *result ) );
+	if ( ! result )
+		goto err_alloc;
+	result->hits = NULL;
+	result->count = 0;
+	memset ( &expand, 0, sizeof ( expand ) );
+	state.store = store;
+	state.result = result;
+	state.max = &hits;
+
+	/* Expand seed values and look up generated contact IDs */
+	if ( ! cx_expand_seeds ( &expand, seeds, 0, count, cx_obsstore_lookup,
+				 &state ) )
+		goto err_expand;
+
+	cx_expand_free ( &expand );
+	return result;
+
+ err_expand:
+	cx_expand_free ( &expand );
+	cx_match_result_free ( result );
+ err_alloc:
+	return NULL;
+}
+
+/**
+ * Close observation store
+ *
+ * @v store		Observation store
+ *
+ * Any buffered observations are written to the log.
+ */
+void cx_obsstore_close ( struct cx_obsstore *store ) {
+	unsigned int i;
+
+	/* Do nothing if closing a NULL pointer */
+	if ( ! store )
+		return;
+
+	/* Write any buffered observations */
+	if ( ! cx_obsstore_flush ( store ) ) {
+		DBG ( "OBSSTORE %p could not flush log on close\n", store );
+	}
+
+	/* Unmap segments */
+	for ( i = 0 ; i < store->count ; i++ )
+		cx_obsstore_unmap ( &store->segments[i] );
+	free ( store->segments );
+
+	/* Close log and free structure */
+	close ( store->fd );
+	free ( store->dir );
+	free ( store );
+}
@@ -0,0 +1,1276 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Observation store self-tests
+ *
+ ******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cx/generator.h>
+#include <cx/match.h>
+#include <cx/obsstore.h>
+#include "cxtest.h"
+#include "obsstoretest.h"
+
+/** Number of seed values */
+#define OBSSTORETEST_SEEDS 6
+
+/** Number of observations */
+#define OBSSTORETEST_OBSERVATIONS 250
+
+/** Number of log records per segment */
+#define OBSSTORETEST_RECORDS 100
+
+/** Base timestamp */
+#define OBSSTORETEST_TIME 1000
+
+/** Number of observations sharing each timestamp */
+#define OBSSTORETEST_PER_TIME 10
+
+/** Observation store self-test state */
+struct obsstoretest {
+	/** Store directory */
+	char dir[32];
+	/** Seed values */
+	struct cx_match_seed seeds[OBSSTORETEST_SEEDS];
+	/** Raw seed values */
+	unsigned char raw[OBSSTORETEST_SEEDS][CXTEST_MATCH_SEED_LEN];
+	/** Generated contact IDs */
+	struct cx_contact_id ids[OBSSTORETEST_SEEDS][CXTEST_MATCH_MAX];
+	/** Observed contact IDs */
+	struct cx_contact_id observed[OBSSTORETEST_OBSERVATIONS];
+};
+
+/**
+ * Check match result from observation store
+ *
+ * @v name		Test name
+ * @v test		Self-test state
+ * @v store		Observation store
+ * @v expected		Expected total observation count
+ * @ret ok		Success indicator
+ *
+ * Every match must identify a stored observation of the generated
+ * contact ID, and the observation counts of all matches must sum to
+ * the expected total.
+ */
+static int obsstoretest_check ( const char *name, struct obsstoretest *test,
+				struct cx_obsstore *store,
+				unsigned int expected ) {
+	struct cx_match_result *result;
+	const struct cx_match_hit *hit;
+	struct cx_obs_record record;
+	unsigned int total = 0;
+	unsigned int i;
+
+	/* Match seed values */
+	result = cx_obsstore_match ( store, test->seeds, OBSSTORETEST_SEEDS );
+	if ( ! result ) {
+		fprintf ( stderr, "OBSSTORE %s fail: could not match\n",
+			  name );
+		goto err_match;
+	}
+
+	/* Check each match */
+	for ( i = 0 ; i < result->count ; i++ ) {
+		hit = &result->hits[i];
+		if ( ! cx_obsstore_record ( store, hit->observation,
+					    &record ) ) {
+			fprintf ( stderr, "OBSSTORE %s fail: no record %d\n",
+				  name, hit->observation );
+			goto err_record;
+		}
+		if ( memcmp ( &record.id,
+			      &test->ids[hit->seed][hit->iteration],
+			      sizeof ( record.id ) ) != 0 ) {
+			fprintf ( stderr, "OBSSTORE %s fail: hit %d "
+				  "mismatch\n", name, i );
+			goto err_mismatch;
+		}
+		if ( ( record.time < OBSSTORETEST_TIME ) ||
+		     ( record.time >= ( OBSSTORETEST_TIME +
+					( OBSSTORETEST_OBSERVATIONS /
+					  OBSSTORETEST_PER_TIME ) ) ) ) {
+			fprintf ( stderr, "OBSSTORE %s fail: hit %d bad "
+				  "time\n", name, i );
+			goto err_mismatch;
+		}
+		if ( ( i > 0 ) &&
+		     ( ( hit->seed < hit[-1].seed ) ||
+		       ( ( hit->seed == hit[-1].seed ) &&
+			 ( hit->iteration < hit[-1].iteration ) ) ) ) {
+			fprintf ( stderr, "OBSSTORE %s fail: hit %d out of "
+				  "order\n", name, i );
+			goto err_mismatch;
+		}
+		total += record.count;
+	}
+	if ( total != expected ) {
+		fprintf ( stderr, "OBSSTORE %s fail: matched %d observations, "
+			  "expected %d\n", name, total, expected );
+		goto err_total;
+	}
+
+	cx_match_result_free ( result );
+	return 1;
+
+ err_total:
+ err_mismatch:
+ err_record:
+	cx_match_result_free ( result );
+ err_match:
+	return 0;
+}
+
+/**
+ * Count expected matches using an observation index
+ *
+ * @v test		Self-test state
+ * @v first		Index of first observation to include
+ * @v count		Number of observations to include
+ * @ret hits		Number of matches, or negative error
+ */
+static int obsstoretest_expected ( struct obsstoretest *test,
+				   unsigned int first, unsigned int count ) {
+	struct cx_match_result *result;
+	struct cx_match *match;
+	int hits;
+
+	match = cx_match_create ( &test->observed[first], count );
+	if ( ! match )
+		return -1;
+	result = cx_match_seeds ( match, test->seeds, OBSSTORETEST_SEEDS );
+	cx_match_free ( match );
+	if ( ! result )
+		return -1;
+	hits = result->count;
+	cx_match_result_free ( result );
+	return hits;
+}
+
+/**
+ * Append observations
+ *
+ * @v test		Self-test state
+ * @v store		Observation store
+ * @v first		Index of first observation
+ * @v count		Number of observations
+ * @ret ok		Success indicator
+ */
+static int obsstoretest_append ( struct obsstoretest *test,
+				 struct cx_obsstore *store,
+				 unsigned int first, unsigned int count ) {
+	unsigned int i;
+
+	for ( i = first ; i < ( first + count ) ; i++ ) {
+		if ( ! cx_obsstore_append ( store, &test->observed[i],
+					    ( OBSSTORETEST_TIME +
+					      ( i / OBSSTORETEST_PER_TIME ) ),
+					    1 ) ) {
+			fprintf ( stderr, "OBSSTORE fail: could not append "
+				  "%d\n", i );
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Remove file within store directory
+ *
+ * @v test		Self-test state
+ * @v name		File name
+ */
+static void obsstoretest_unlink ( struct obsstoretest *test,
+				  const char *name ) {
+	char path[64];
+
+	snprintf ( path, sizeof ( path ), "%s/%s", test->dir, name );
+	unlink ( path );
+}
+
+/**
+ * Write junk file within store directory
+ *
+ * @v test		Self-test state
+ * @v name		File name
+ * @v len		Length of junk
+ * @v flags		Additional open flags
+ * @ret ok		Success indicator
+ */
+static int obsstoretest_junk ( struct obsstoretest *test, const char *name,
+			       size_t len, int flags ) {
+	unsigned char junk[len];
+	char path[64];
+	int fd;
+	int ok;
+
+	memset ( junk, 0x5a, len );
+	snprintf ( path, sizeof ( path ), "%s/%s", test->dir, name );
+	fd = open ( path, ( O_WRONLY | O_CREAT | flags ), 0666 );
+	if ( fd < 0 )
+		return 0;
+	ok = ( write ( fd, junk, len ) == ( ( ssize_t ) len ) );
+	close ( fd );
+	return ok;
+}
+
+/**
+ * Run observation store self-tests
+ *
+ * @v test		Self-test state
+ * @ret ok		Success indicator
+ */
+static int obsstoretest_run ( struct obsstoretest *test ) {
+	struct cx_obsstore *store;
+	unsigned int half = ( OBSSTORETEST_OBSERVATIONS / 2 );
+	uint64_t before;
+	int all;
+	int kept;
+
+	/* Calculate expected matches */
+	all = obsstoretest_expected ( test, 0, OBSSTORETEST_OBSERVATIONS );
+	kept = obsstoretest_expected ( test, OBSSTORETEST_RECORDS,
+				       ( OBSSTORETEST_OBSERVATIONS -
+					 OBSSTORETEST_RECORDS ) );
+	if ( ( all <= 0 ) || ( kept <= 0 ) || ( kept >= all ) ) {
+		fprintf ( stderr, "OBSSTORE fail: bad expected matches "
+			  "%d/%d\n", kept, all );
+		goto err_expected;
+	}
+
+	/* Append half of the observations, with an explicit flush */
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE fail: could not create\n" );
+		goto err_create;
+	}
+	if ( ! obsstoretest_append ( test, store, 0, half ) )
+		goto err_append;
+	if ( ! cx_obsstore_flush ( store ) ) {
+		fprintf ( stderr, "OBSSTORE fail: could not flush\n" );
+		goto err_flush;
+	}
+	if ( cx_obsstore_segments ( store ) != 1 ) {
+		fprintf ( stderr, "OBSSTORE fail: %d segments after %d "
+			  "records\n", cx_obsstore_segments ( store ), half );
+		goto err_segments;
+	}
+	cx_obsstore_close ( store );
+
+	/* Simulate a torn write at the end of the log */
+	if ( ! obsstoretest_junk ( test, "active.log", 100, O_APPEND ) ) {
+		fprintf ( stderr, "OBSSTORE fail: could not tear log\n" );
+		goto err_tear;
+	}
+
+	/* Reopen store, recover log, and append remaining observations */
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE fail: could not reopen\n" );
+		goto err_reopen;
+	}
+	if ( ! obsstoretest_append ( test, store, half,
+				     ( OBSSTORETEST_OBSERVATIONS - half ) ) )
+		goto err_append;
+	if ( ! cx_obsstore_seal ( store ) ) {
+		fprintf ( stderr, "OBSSTORE fail: could not seal\n" );
+		goto err_seal;
+	}
+	if ( ( cx_obsstore_segments ( store ) != 3 ) ||
+	     ( cx_obsstore_count ( store ) > OBSSTORETEST_OBSERVATIONS ) ) {
+		fprintf ( stderr, "OBSSTORE fail: %d segments with %d "
+			  "records\n", cx_obsstore_segments ( store ),
+			  cx_obsstore_count ( store ) );
+		goto err_segments;
+	}
+	if ( ! obsstoretest_check ( "all", test, store, all ) )
+		goto err_check;
+	cx_obsstore_close ( store );
+
+	/* Reject a corrupt segment */
+	if ( ! obsstoretest_junk ( test, "00000000000000ff.seg", 8192, 0 ) ) {
+		fprintf ( stderr, "OBSSTORE fail: could not corrupt\n" );
+		goto err_corrupt;
+	}
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( store ) {
+		fprintf ( stderr, "OBSSTORE fail: accepted corrupt "
+			  "segment\n" );
+		goto err_accepted;
+	}
+	obsstoretest_unlink ( test, "00000000000000ff.seg" );
+
+	/* Reopen store and drop the oldest segment */
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE fail: could not reopen\n" );
+		goto err_reopen;
+	}
+	if ( ! obsstoretest_check ( "reopened", test, store, all ) )
+		goto err_check;
+	before = ( OBSSTORETEST_TIME +
+		   ( OBSSTORETEST_RECORDS / OBSSTORETEST_PER_TIME ) );
+	if ( cx_obsstore_prune ( store, before ) != 1 ) {
+		fprintf ( stderr, "OBSSTORE fail: could not prune\n" );
+		goto err_prune;
+	}
+	if ( ! obsstoretest_check ( "pruned", test, store, kept ) )
+		goto err_check;
+
+	/* Drop all segments */
+	if ( ( cx_obsstore_prune ( store, -1ULL ) != 2 ) ||
+	     ( cx_obsstore_segments ( store ) != 0 ) ||
+	     ( cx_obsstore_count ( store ) != 0 ) ) {
+		fprintf ( stderr, "OBSSTORE fail: could not prune all\n" );
+		goto err_prune;
+	}
+	if ( ! obsstoretest_check ( "empty", test, store, 0 ) )
+		goto err_check;
+	cx_obsstore_close ( store );
+
+	return 1;
+
+ err_prune:
+ err_check:
+ err_seal:
+ err_segments:
+ err_flush:
+ err_append:
+	cx_obsstore_close ( store );
+ err_accepted:
+ err_corrupt:
+ err_reopen:
+ err_tear:
+ err_create:
+ err_expected:
+	return 0;
+}
+
+/**
+ * Run interrupted seal self-test
+ *
+ * @v test		Self-test state
+ * @ret ok		Success indicator
+ *
+ * A crash after a new segment has been renamed into place but before
+ * the log has been truncated is simulated by restoring the log as it
+ * was before sealing.  Reopening the store must not replay the
+ * restored log, since its records are already in the segment.
+ */
+static int obsstoretest_replay ( struct obsstoretest *test ) {
+	static unsigned char log[ 16 * 4096 ];
+	struct cx_obsstore *store;
+	char path[64];
+	ssize_t len;
+	int all;
+	int fd;
+
+	/* Calculate expected matches */
+	all = obsstoretest_expected ( test, 0, OBSSTORETEST_OBSERVATIONS );
+	if ( all <= 0 ) {
+		fprintf ( stderr, "OBSSTORE replay fail: bad expected "
+			  "matches %d\n", all );
+		goto err_expected;
+	}
+
+	/* Append and flush all observations, without sealing */
+	store = cx_obsstore_open ( test->dir, ( 2 *
+						OBSSTORETEST_OBSERVATIONS ) );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE replay fail: could not open\n" );
+		goto err_open;
+	}
+	if ( ! obsstoretest_append ( test, store, 0,
+				     OBSSTORETEST_OBSERVATIONS ) )
+		goto err_append;
+	if ( ! cx_obsstore_flush ( store ) ) {
+		fprintf ( stderr, "OBSSTORE replay fail: could not flush\n" );
+		goto err_flush;
+	}
+
+	/* Save log, then seal */
+	snprintf ( path, sizeof ( path ), "%s/active.log", test->dir );
+	fd = open ( path, O_RDONLY );
+	len = ( ( fd >= 0 ) ? read ( fd, log, sizeof ( log ) ) : -1 );
+	if ( fd >= 0 )
+		close ( fd );
+	if ( len <= 0 ) {
+		fprintf ( stderr, "OBSSTORE replay fail: could not save "
+			  "log\n" );
+		goto err_save;
+	}
+	if ( ! cx_obsstore_seal ( store ) ) {
+		fprintf ( stderr, "OBSSTORE replay fail: could not seal\n" );
+		goto err_seal;
+	}
+	cx_obsstore_close ( store );
+
+	/* Restore log as if truncation never happened */
+	fd = open ( path, ( O_WRONLY | O_TRUNC ) );
+	if ( ( fd < 0 ) || ( write ( fd, log, len ) != len ) ) {
+		fprintf ( stderr, "OBSSTORE replay fail: could not restore "
+			  "log\n" );
+		if ( fd >= 0 )
+			close ( fd );
+		goto err_restore;
+	}
+	close ( fd );
+
+	/* Reopen store and check that no observation is duplicated */
+	store = cx_obsstore_open ( test->dir, ( 2 *
+						OBSSTORETEST_OBSERVATIONS ) );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE replay fail: could not "
+			  "reopen\n" );
+		goto err_reopen;
+	}
+	if ( ! cx_obsstore_seal ( store ) ) {
+		fprintf ( stderr, "OBSSTORE replay fail: could not "
+			  "reseal\n" );
+		goto err_seal;
+	}
+	if ( ( cx_obsstore_segments ( store ) != 1 ) ||
+	     ( cx_obsstore_count ( store ) > OBSSTORETEST_OBSERVATIONS ) ) {
+		fprintf ( stderr, "OBSSTORE replay fail: %d segments with "
+			  "%d records\n", cx_obsstore_segments ( store ),
+			  cx_obsstore_count ( store ) );
+		goto err_segments;
+	}
+	if ( ! obsstoretest_check ( "replay", test, store, all ) )
+		goto err_check;
+
+	/* Drop all segments */
+	cx_obsstore_prune ( store, -1ULL );
+	cx_obsstore_close ( store );
+
+	return 1;
+
+ err_check:
+ err_segments:
+ err_save:
+ err_seal:
+ err_flush:
+ err_append:
+	cx_obsstore_prune ( store, -1ULL );
+	cx_obsstore_close ( store );
+ err_reopen:
+ err_restore:
+ err_open:
+ err_expected:
+	return 0;
+}
+
+/**
+ * Run corrupt log page self-test
+ *
+ * @v test		Self-test state
+ * @ret ok		Success indicator
+ *
+ * A single byte within a record in the first of several log pages is
+ * corrupted.  Recovery must reject the corrupted page and truncate
+ * the log there, discarding every later page.
+ */
+static int obsstoretest_corrupt ( struct obsstoretest *test ) {
+	static const unsigned char junk = 0x5a;
+	struct cx_obsstore *store;
+	char path[64];
+	int fd;
+
+	/* Append and flush all observations, without sealing */
+	store = cx_obsstore_open ( test->dir, ( 2 *
+						OBSSTORETEST_OBSERVATIONS ) );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE corrupt fail: could not "
+			  "open\n" );
+		goto err_open;
+	}
+	if ( ! obsstoretest_append ( test, store, 0,
+				     OBSSTORETEST_OBSERVATIONS ) )
+		goto err_append;
+	if ( ! cx_obsstore_flush ( store ) ) {
+		fprintf ( stderr, "OBSSTORE corrupt fail: could not "
+			  "flush\n" );
+		goto err_flush;
+	}
+	cx_obsstore_close ( store );
+
+	/* Corrupt a record in the first page */
+	snprintf ( path, sizeof ( path ), "%s/active.log", test->dir );
+	fd = open ( path, O_WRONLY );
+	if ( ( fd < 0 ) || ( pwrite ( fd, &junk, sizeof ( junk ), 100 ) !=
+			     ( ( ssize_t ) sizeof ( junk ) ) ) ) {
+		fprintf ( stderr, "OBSSTORE corrupt fail: could not "
+			  "corrupt log\n" );
+		if ( fd >= 0 )
+			close ( fd );
+		goto err_corrupt;
+	}
+	close ( fd );
+
+	/* Reopen store and check that nothing is recovered */
+	store = cx_obsstore_open ( test->dir, ( 2 *
+						OBSSTORETEST_OBSERVATIONS ) );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE corrupt fail: could not "
+			  "reopen\n" );
+		goto err_reopen;
+	}
+	if ( ! cx_obsstore_seal ( store ) ) {
+		fprintf ( stderr, "OBSSTORE corrupt fail: could not "
+			  "seal\n" );
+		goto err_seal;
+	}
+	if ( cx_obsstore_segments ( store ) != 0 ) {
+		fprintf ( stderr, "OBSSTORE corrupt fail: recovered %d "
+			  "records\n", cx_obsstore_count ( store ) );
+		goto err_segments;
+	}
+	cx_obsstore_close ( store );
+
+	return 1;
+
+ err_segments:
+ err_seal:
+ err_flush:
+ err_append:
+	cx_obsstore_prune ( store, -1ULL );
+	cx_obsstore_close ( store );
+ err_reopen:
+ err_corrupt:
+ err_open:
+	return 0;
+}
+
+/**
+ * Run torn log page rewrite self-test
+ *
+ * @v test		Self-test state
+ * @ret ok		Success indicator
+ *
+ * A partially filled log page is flushed, and then rewritten by a
+ * second flush that is torn: every log page written by the second
+ * flush is corrupted.  Recovery must retain the observation made
+ * durable by the first flush, and appending must then continue
+ * without overwriting it.
+ */
+static int obsstoretest_torn ( struct obsstoretest *test ) {
+	static unsigned char before[ 4 * 4096 ];
+	static unsigned char after[ 4 * 4096 ];
+	static const unsigned int order[] = { 0, 1, 2 };
+	struct cx_obsstore *store;
+	struct cx_obs_record record;
+	ssize_t saved = 0;
+	ssize_t len;
+	unsigned int i;
+	char path[64];
+	int fd;
+
+	/* Append observations, flushing after each and saving the log
+	 * as it was after the first flush.
+	 */
+	snprintf ( path, sizeof ( path ), "%s/active.log", test->dir );
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE torn fail: could not open\n" );
+		goto err_open;
+	}
+	for ( i = 0 ; i < 2 ; i++ ) {
+		if ( ! cx_obsstore_append ( store, &test->observed[ order[i] ],
+					    OBSSTORETEST_TIME, 1 ) ) {
+			fprintf ( stderr, "OBSSTORE torn fail: could not "
+				  "append %d\n", i );
+			goto err_append;
+		}
+		if ( ! cx_obsstore_flush ( store ) ) {
+			fprintf ( stderr, "OBSSTORE torn fail: could not "
+				  "flush %d\n", i );
+			goto err_flush;
+		}
+		if ( i == 0 ) {
+			fd = open ( path, O_RDONLY );
+			saved = ( ( fd >= 0 ) ?
+				  read ( fd, before, sizeof ( before ) ) : -1 );
+			if ( fd >= 0 )
+				close ( fd );
+			if ( saved <= 0 ) {
+				fprintf ( stderr, "OBSSTORE torn fail: could "
+					  "not save log\n" );
+				goto err_save;
+			}
+		}
+	}
+	cx_obsstore_close ( store );
+
+	/* Tear every page written by the second flush */
+	fd = open ( path, O_RDWR );
+	len = ( ( fd >= 0 ) ? read ( fd, after, sizeof ( after ) ) : -1 );
+	if ( len <= 0 ) {
+		fprintf ( stderr, "OBSSTORE torn fail: could not read log\n" );
+		if ( fd >= 0 )
+			close ( fd );
+		goto err_tear;
+	}
+	for ( i = 0 ; i < ( ( unsigned int ) len ) ; i += 4096 ) {
+		if ( ( i < saved ) &&
+		     ( memcmp ( &before[i], &after[i], 4096 ) == 0 ) )
+			continue;
+		after[ i + 100 ] ^= 0x5a;
+		if ( pwrite ( fd, &after[ i + 100 ], 1, ( i + 100 ) ) != 1 ) {
+			fprintf ( stderr, "OBSSTORE torn fail: could not tear "
+				  "log\n" );
+			close ( fd );
+			goto err_tear;
+		}
+	}
+	close ( fd );
+
+	/* Reopen store, and append and flush another observation */
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE torn fail: could not reopen\n" );
+		goto err_reopen;
+	}
+	if ( ( ! cx_obsstore_append ( store, &test->observed[ order[2] ],
+				      OBSSTORETEST_TIME, 1 ) ) ||
+	     ( ! cx_obsstore_flush ( store ) ) ) {
+		fprintf ( stderr, "OBSSTORE torn fail: could not append "
+			  "after recovery\n" );
+		goto err_append;
+	}
+	cx_obsstore_close ( store );
+
+	/* Reopen store and check recovered observations */
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE torn fail: could not reopen\n" );
+		goto err_reopen;
+	}
+	if ( ! cx_obsstore_seal ( store ) ) {
+		fprintf ( stderr, "OBSSTORE torn fail: could not seal\n" );
+		goto err_seal;
+	}
+	if ( cx_obsstore_count ( store ) != 2 ) {
+		fprintf ( stderr, "OBSSTORE torn fail: recovered %d "
+			  "records\n", cx_obsstore_count ( store ) );
+		goto err_count;
+	}
+	for ( i = 0 ; i < 2 ; i++ ) {
+		if ( ( ! cx_obsstore_record ( store, i, &record ) ) ||
+		     ( ( memcmp ( &record.id, &test->observed[ order[0] ],
+				  sizeof ( record.id ) ) != 0 ) &&
+		       ( memcmp ( &record.id, &test->observed[ order[2] ],
+				  sizeof ( record.id ) ) != 0 ) ) ) {
+			fprintf ( stderr, "OBSSTORE torn fail: record %d "
+				  "mismatch\n", i );
+			goto err_record;
+		}
+	}
+
+	/* Drop all segments */
+	cx_obsstore_prune ( store, -1ULL );
+	cx_obsstore_close ( store );
+
+	return 1;
+
+ err_record:
+ err_count:
+ err_seal:
+ err_save:
+ err_flush:
+ err_append:
+	cx_obsstore_prune ( store, -1ULL );
+	cx_obsstore_close ( store );
+ err_reopen:
+ err_tear:
+ err_open:
+	return 0;
+}
+
+/**
+ * Run failed automatic seal self-test
+ *
+ * @v test		Self-test state
+ * @ret ok		Success indicator
+ *
+ * Sealing is made to fail by occupying the temporary segment file
+ * name with a directory.  Every observation must still be accepted,
+ * the failure must be reported by the next flush, and a flush after
+ * the obstruction is removed must seal each observation exactly once.
+ */
+static int obsstoretest_stalled ( struct obsstoretest *test ) {
+	struct cx_obsstore *store;
+	char path[64];
+	int all;
+
+	/* Calculate expected matches */
+	all = obsstoretest_expected ( test, 0, OBSSTORETEST_OBSERVATIONS );
+	if ( all <= 0 ) {
+		fprintf ( stderr, "OBSSTORE stalled fail: bad expected "
+			  "matches %d\n", all );
+		goto err_expected;
+	}
+
+	/* Obstruct temporary segment file */
+	snprintf ( path, sizeof ( path ), "%s/segment.tmp", test->dir );
+	if ( mkdir ( path, 0777 ) != 0 ) {
+		fprintf ( stderr, "OBSSTORE stalled fail: could not "
+			  "obstruct\n" );
+		goto err_mkdir;
+	}
+
+	/* Append all observations, and check that flush fails */
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE stalled fail: could not open\n" );
+		goto err_open;
+	}
+	if ( ! obsstoretest_append ( test, store, 0,
+				     OBSSTORETEST_OBSERVATIONS ) )
+		goto err_append;
+	if ( cx_obsstore_flush ( store ) ||
+	     ( cx_obsstore_segments ( store ) != 0 ) ) {
+		fprintf ( stderr, "OBSSTORE stalled fail: seal did not "
+			  "fail\n" );
+		goto err_stalled;
+	}
+
+	/* Remove obstruction, and check that flush seals the log */
+	rmdir ( path );
+	if ( ! cx_obsstore_flush ( store ) ) {
+		fprintf ( stderr, "OBSSTORE stalled fail: could not "
+			  "flush\n" );
+		goto err_flush;
+	}
+	if ( ( cx_obsstore_segments ( store ) != 1 ) ||
+	     ( cx_obsstore_count ( store ) > OBSSTORETEST_OBSERVATIONS ) ) {
+		fprintf ( stderr, "OBSSTORE stalled fail: %d segments with "
+			  "%d records\n", cx_obsstore_segments ( store ),
+			  cx_obsstore_count ( store ) );
+		goto err_segments;
+	}
+	if ( ! obsstoretest_check ( "stalled", test, store, all ) )
+		goto err_check;
+
+	/* Drop all segments */
+	cx_obsstore_prune ( store, -1ULL );
+	cx_obsstore_close ( store );
+
+	return 1;
+
+ err_check:
+ err_segments:
+ err_flush:
+ err_stalled:
+ err_append:
+	cx_obsstore_prune ( store, -1ULL );
+	cx_obsstore_close ( store );
+ err_open:
+	rmdir ( path );
+ err_mkdir:
+ err_expected:
+	return 0;
+}
+
+/**
+ * Run wide timestamp span self-test
+ *
+ * @v test		Self-test state
+ * @ret ok		Success indicator
+ *
+ * Observations whose timestamps are too far apart to share a segment
+ * must be sealed into separate segments, with each timestamp
+ * preserved.
+ */
+static int obsstoretest_span ( struct obsstoretest *test ) {
+	static const uint64_t times[] = {
+		OBSSTORETEST_TIME,
+		( OBSSTORETEST_TIME + 0xffffffffULL ),
+		( OBSSTORETEST_TIME + 0x100000000ULL ),
+		OBSSTORETEST_TIME,
+	};
+	unsigned int count = ( sizeof ( times ) / sizeof ( times[0] ) );
+	struct cx_obsstore *store;
+	struct cx_obs_record record;
+	unsigned int i;
+	unsigned int j;
+
+	/* Append observations */
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE span fail: could not open\n" );
+		goto err_open;
+	}
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ! cx_obsstore_append ( store, &test->observed[i],
+					    times[i], 1 ) ) {
+			fprintf ( stderr, "OBSSTORE span fail: could not "
+				  "append %d\n", i );
+			goto err_append;
+		}
+	}
+	if ( ! cx_obsstore_seal ( store ) ) {
+		fprintf ( stderr, "OBSSTORE span fail: could not seal\n" );
+		goto err_seal;
+	}
+
+	/* Check that the log was split at each span boundary */
+	if ( ( cx_obsstore_segments ( store ) != 3 ) ||
+	     ( cx_obsstore_count ( store ) != count ) ) {
+		fprintf ( stderr, "OBSSTORE span fail: %d segments with %d "
+			  "records\n", cx_obsstore_segments ( store ),
+			  cx_obsstore_count ( store ) );
+		goto err_segments;
+	}
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ! cx_obsstore_record ( store, i, &record ) ) {
+			fprintf ( stderr, "OBSSTORE span fail: no record "
+				  "%d\n", i );
+			goto err_record;
+		}
+		for ( j = 0 ; j < count ; j++ ) {
+			if ( memcmp ( &record.id, &test->observed[j],
+				      sizeof ( record.id ) ) == 0 )
+				break;
+		}
+		if ( ( j == count ) || ( record.time != times[j] ) ) {
+			fprintf ( stderr, "OBSSTORE span fail: record %d "
+				  "mismatch\n", i );
+			goto err_record;
+		}
+	}
+
+	/* Drop all segments */
+	cx_obsstore_prune ( store, -1ULL );
+	cx_obsstore_close ( store );
+
+	return 1;
+
+ err_record:
+ err_segments:
+ err_seal:
+ err_append:
+	cx_obsstore_prune ( store, -1ULL );
+	cx_obsstore_close ( store );
+ err_open:
+	return 0;
+}
+
+/**
+ * Run partially filled log page self-test
+ *
+ * @v test		Self-test state
+ * @ret ok		Success indicator
+ *
+ * A timestamp that cannot be represented relative to the current log
+ * page base starts a new log page, leaving the previous page only
+ * partially filled.  Recovery must continue past the partially
+ * filled page and recover every flushed observation.
+ */
+static int obsstoretest_gap ( struct obsstoretest *test ) {
+	static const uint64_t times[] = { 0, 3000000000ULL };
+	unsigned int count = ( sizeof ( times ) / sizeof ( times[0] ) );
+	struct cx_obsstore *store;
+	struct cx_obs_record record;
+	unsigned int i;
+
+	/* Append and flush observations, without sealing */
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE gap fail: could not open\n" );
+		goto err_open;
+	}
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ! cx_obsstore_append ( store, &test->observed[i],
+					    times[i], 1 ) ) {
+			fprintf ( stderr, "OBSSTORE gap fail: could not "
+				  "append %d\n", i );
+			goto err_append;
+		}
+	}
+	if ( ! cx_obsstore_flush ( store ) ) {
+		fprintf ( stderr, "OBSSTORE gap fail: could not flush\n" );
+		goto err_flush;
+	}
+	cx_obsstore_close ( store );
+
+	/* Reopen store and check that every observation is recovered */
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE gap fail: could not reopen\n" );
+		goto err_reopen;
+	}
+	if ( ! cx_obsstore_seal ( store ) ) {
+		fprintf ( stderr, "OBSSTORE gap fail: could not seal\n" );
+		goto err_seal;
+	}
+	if ( ( cx_obsstore_segments ( store ) != 1 ) ||
+	     ( cx_obsstore_count ( store ) != count ) ) {
+		fprintf ( stderr, "OBSSTORE gap fail: %d segments with %d "
+			  "records\n", cx_obsstore_segments ( store ),
+			  cx_obsstore_count ( store ) );
+		goto err_segments;
+	}
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ( ! cx_obsstore_record ( store, i, &record ) ) ||
+		     ( ( record.time != times[0] ) &&
+		       ( record.time != times[1] ) ) ) {
+			fprintf ( stderr, "OBSSTORE gap fail: record %d "
+				  "mismatch\n", i );
+			goto err_record;
+		}
+	}
+
+	/* Drop all segments */
+	cx_obsstore_prune ( store, -1ULL );
+	cx_obsstore_close ( store );
+
+	return 1;
+
+ err_record:
+ err_segments:
+ err_seal:
+ err_flush:
+ err_append:
+	cx_obsstore_prune ( store, -1ULL );
+	cx_obsstore_close ( store );
+ err_reopen:
+ err_open:
+	return 0;
+}
+
+/**
+ * Run corrupt fanout table self-test
+ *
+ * @v test		Self-test state
+ * @ret ok		Success indicator
+ *
+ * A segment whose fanout table has an entry beyond the number of
+ * records, or entries that are not in ascending order, must be
+ * rejected.
+ */
+static int obsstoretest_fanout ( struct obsstoretest *test ) {
+	struct cx_obsstore *store;
+	uint32_t fanout[3];
+	uint32_t entry;
+	off_t offset;
+	char path[64];
+	int fd;
+
+	/* Seal all observations into a single segment */
+	store = cx_obsstore_open ( test->dir, ( 2 *
+						OBSSTORETEST_OBSERVATIONS ) );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE fanout fail: could not open\n" );
+		goto err_open;
+	}
+	if ( ( cx_obsstore_segments ( store ) != 0 ) ||
+	     ( ! obsstoretest_append ( test, store, 0,
+				       OBSSTORETEST_OBSERVATIONS ) ) ||
+	     ( ! cx_obsstore_seal ( store ) ) ) {
+		fprintf ( stderr, "OBSSTORE fanout fail: could not seal\n" );
+		cx_obsstore_prune ( store, -1ULL );
+		cx_obsstore_close ( store );
+		goto err_seal;
+	}
+	cx_obsstore_close ( store );
+
+	/* Read start of fanout table */
+	snprintf ( path, sizeof ( path ), "%s/%016llx.seg", test->dir, 0ULL );
+	offset = 4096;
+	fd = open ( path, O_RDWR );
+	if ( ( fd < 0 ) || ( pread ( fd, fanout, sizeof ( fanout ), offset ) !=
+			     ( ( ssize_t ) sizeof ( fanout ) ) ) ) {
+		fprintf ( stderr, "OBSSTORE fanout fail: could not read\n" );
+		goto err_read;
+	}
+	offset += sizeof ( fanout[0] );
+
+	/* Check that an out-of-range entry is rejected */
+	entry = 0xffffffffUL;
+	if ( pwrite ( fd, &entry, sizeof ( entry ), offset ) !=
+	     ( ( ssize_t ) sizeof ( entry ) ) ) {
+		fprintf ( stderr, "OBSSTORE fanout fail: could not "
+			  "corrupt\n" );
+		goto err_corrupt;
+	}
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( store ) {
+		fprintf ( stderr, "OBSSTORE fanout fail: accepted "
+			  "out-of-range entry\n" );
+		goto err_accepted;
+	}
+
+	/* Check that a descending entry is rejected */
+	entry = ( fanout[2] + 1 );
+	if ( pwrite ( fd, &entry, sizeof ( entry ), offset ) !=
+	     ( ( ssize_t ) sizeof ( entry ) ) ) {
+		fprintf ( stderr, "OBSSTORE fanout fail: could not "
+			  "corrupt\n" );
+		goto err_corrupt;
+	}
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( store ) {
+		fprintf ( stderr, "OBSSTORE fanout fail: accepted "
+			  "descending entry\n" );
+		goto err_accepted;
+	}
+
+	/* Restore entry and check that the segment is accepted */
+	if ( pwrite ( fd, &fanout[1], sizeof ( fanout[1] ), offset ) !=
+	     ( ( ssize_t ) sizeof ( fanout[1] ) ) ) {
+		fprintf ( stderr, "OBSSTORE fanout fail: could not "
+			  "restore\n" );
+		goto err_restore;
+	}
+	close ( fd );
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE fanout fail: could not "
+			  "reopen\n" );
+		goto err_reopen;
+	}
+
+	/* Drop all segments */
+	cx_obsstore_prune ( store, -1ULL );
+	cx_obsstore_close ( store );
+
+	return 1;
+
+ err_accepted:
+	cx_obsstore_close ( store );
+ err_restore:
+ err_corrupt:
+ err_read:
+	if ( fd >= 0 )
+		close ( fd );
+ err_reopen:
+	unlink ( path );
+ err_seal:
+ err_open:
+	return 0;
+}
+
+/**
+ * Run corrupt segment layout self-test
+ *
+ * @v test		Self-test state
+ * @ret ok		Success indicator
+ *
+ * A segment whose contact ID offset wraps around when the length of
+ * the contact IDs is added, or whose metadata offset is misaligned,
+ * must be rejected.
+ */
+static int obsstoretest_layout ( struct obsstoretest *test ) {
+	static const off_t count_offset = 16;
+	static const off_t ids_offset = 40;
+	static const off_t meta_offset = 48;
+	struct cx_obsstore *store;
+	uint32_t count;
+	uint64_t ids;
+	uint64_t meta;
+	uint64_t value;
+	char path[64];
+	int fd;
+
+	/* Seal all observations into a single segment */
+	store = cx_obsstore_open ( test->dir, ( 2 *
+						OBSSTORETEST_OBSERVATIONS ) );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE layout fail: could not open\n" );
+		goto err_open;
+	}
+	if ( ( cx_obsstore_segments ( store ) != 0 ) ||
+	     ( ! obsstoretest_append ( test, store, 0,
+				       OBSSTORETEST_OBSERVATIONS ) ) ||
+	     ( ! cx_obsstore_seal ( store ) ) ) {
+		fprintf ( stderr, "OBSSTORE layout fail: could not seal\n" );
+		cx_obsstore_prune ( store, -1ULL );
+		cx_obsstore_close ( store );
+		goto err_seal;
+	}
+	cx_obsstore_close ( store );
+
+	/* Read record count and contact ID and metadata offsets */
+	snprintf ( path, sizeof ( path ), "%s/%016llx.seg", test->dir, 0ULL );
+	fd = open ( path, O_RDWR );
+	if ( ( fd < 0 ) ||
+	     ( pread ( fd, &count, sizeof ( count ), count_offset ) !=
+	       ( ( ssize_t ) sizeof ( count ) ) ) ||
+	     ( pread ( fd, &ids, sizeof ( ids ), ids_offset ) !=
+	       ( ( ssize_t ) sizeof ( ids ) ) ) ||
+	     ( pread ( fd, &meta, sizeof ( meta ), meta_offset ) !=
+	       ( ( ssize_t ) sizeof ( meta ) ) ) ) {
+		fprintf ( stderr, "OBSSTORE layout fail: could not read\n" );
+		goto err_read;
+	}
+
+	/* Check that a contact ID offset that wraps to zero is rejected */
+	value = -( ( ( uint64_t ) count ) * sizeof ( struct cx_contact_id ) );
+	if ( pwrite ( fd, &value, sizeof ( value ), ids_offset ) !=
+	     ( ( ssize_t ) sizeof ( value ) ) ) {
+		fprintf ( stderr, "OBSSTORE layout fail: could not "
+			  "corrupt\n" );
+		goto err_corrupt;
+	}
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( store ) {
+		fprintf ( stderr, "OBSSTORE layout fail: accepted wrapping "
+			  "offset\n" );
+		goto err_accepted;
+	}
+	if ( pwrite ( fd, &ids, sizeof ( ids ), ids_offset ) !=
+	     ( ( ssize_t ) sizeof ( ids ) ) ) {
+		fprintf ( stderr, "OBSSTORE layout fail: could not "
+			  "restore\n" );
+		goto err_restore;
+	}
+
+	/* Check that a misaligned metadata offset is rejected */
+	value = ( meta + sizeof ( uint32_t ) );
+	if ( pwrite ( fd, &value, sizeof ( value ), meta_offset ) !=
+	     ( ( ssize_t ) sizeof ( value ) ) ) {
+		fprintf ( stderr, "OBSSTORE layout fail: could not "
+			  "corrupt\n" );
+		goto err_corrupt;
+	}
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( store ) {
+		fprintf ( stderr, "OBSSTORE layout fail: accepted misaligned "
+			  "offset\n" );
+		goto err_accepted;
+	}
+
+	/* Restore offset and check that the segment is accepted */
+	if ( pwrite ( fd, &meta, sizeof ( meta ), meta_offset ) !=
+	     ( ( ssize_t ) sizeof ( meta ) ) ) {
+		fprintf ( stderr, "OBSSTORE layout fail: could not "
+			  "restore\n" );
+		goto err_restore;
+	}
+	close ( fd );
+	store = cx_obsstore_open ( test->dir, OBSSTORETEST_RECORDS );
+	if ( ! store ) {
+		fprintf ( stderr, "OBSSTORE layout fail: could not "
+			  "reopen\n" );
+		goto err_reopen;
+	}
+
+	/* Drop all segments */
+	cx_obsstore_prune ( store, -1ULL );
+	cx_obsstore_close ( store );
+
+	return 1;
+
+ err_accepted:
+	cx_obsstore_close ( store );
+ err_restore:
+ err_corrupt:
+ err_read:
+	if ( fd >= 0 )
+		close ( fd );
+ err_reopen:
+ err_seal:
+ err_open:
+	return 0;
+}
+
+/**
+ * Run observation store self-tests
+ *
+ * @ret ok		Success indicator
+ */
+int obsstoretests ( void ) {
+	struct obsstoretest *test;
+	struct cx_match_seed *seed;
+	unsigned int i;
+	int ok = 0;
+
+	/* Allocate test state */
+	test = malloc ( sizeof ( *test ) );
+	if ( ! test ) {
+		fprintf ( stderr, "OBSSTORE fail: out of memory\n" );
+		goto err_alloc;
+	}
+
+	/* Construct seed values and observations */
+	cxtest_match_seeds ( test->seeds, test->raw, OBSSTORETEST_SEEDS );
+	if ( ! cxtest_match_observe ( "OBSSTORE", test->seeds,
+				      OBSSTORETEST_SEEDS, test->observed,
+				      OBSSTORETEST_OBSERVATIONS ) )
+		goto err_observe;
+
+	/* Expand seed values for checking matches */
+	for ( i = 0 ; i < OBSSTORETEST_SEEDS ; i++ ) {
+		seed = &test->seeds[i];
+		if ( ! cx_gen_expand ( seed->type, seed->seed, seed->len,
+				       test->ids[i] ) ) {
+			fprintf ( stderr, "OBSSTORE fail: could not "
+				  "expand\n" );
+			goto err_expand;
+		}
+	}
+
+	/* Create store directory */
+	snprintf ( test->dir, sizeof ( test->dir ), "/tmp/cxobsXXXXXX" );
+	if ( ! mkdtemp ( test->dir ) ) {
+		fprintf ( stderr, "OBSSTORE fail: could not create "
+			  "directory\n" );
+		goto err_mkdtemp;
+	}
+
+	/* Run tests */
+	ok = obsstoretest_run ( test );
+	ok &= obsstoretest_replay ( test );
+	ok &= obsstoretest_corrupt ( test );
+	ok &= obsstoretest_torn ( test );
+	ok &= obsstoretest_stalled ( test );
+	ok &= obsstoretest_span ( test );
+	ok &= obsstoretest_gap ( test );
+	ok &= obsstoretest_fanout ( test );
+	ok &= obsstoretest_layout ( test );
+
+	/* Remove store directory */
+	obsstoretest_unlink ( test, "active.log" );
+	rmdir ( test->dir );
+
+	if ( ok )
+		fprintf ( stderr, "OBSSTORE ok\n" );
+ err_mkdtemp:
+ err_expand:
+ err_observe:
+	free ( test );
+ err_alloc:
+	return ok;
+}
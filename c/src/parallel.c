@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Worker thread pool
+ *
+ ******************************************************************************
+ *
+ * Parallel operations (matching seed values, signing and verifying
+ * seed reports) share a single pool of worker threads.  Threads are
+ * created on first demand and then persist until the pool is torn
+ * down by cx_parallel_fini() (which also runs automatically when the
+ * library is unloaded or the process exits), so that repeated calls
+ * do not pay the cost of creating and joining threads.
+ *
+ * A parallel job comprises a fixed number of worker indices.  The
+ * calling thread always runs the first index itself, queues the job
+ * so that idle pool threads may claim the remaining indices, and then
+ * runs any indices that are still unclaimed once it has finished.  A
+ * job therefore always completes even if the pool is busy with other
+ * jobs, or if no pool threads could be created (e.g. in a child
+ * process after fork()), and jobs may safely be nested.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include "parallel.h"
+#include "debug.h"
+
+/** Maximum number of pool threads */
+#define CX_PARALLEL_MAX_THREADS 256
+
+/** A parallel job */
+struct cx_parallel_job {
+	/** Next queued job */
+	struct cx_parallel_job *next;
+	/** Method to run for each worker index */
+	void ( * run ) ( void *ctx, unsigned int index );
+	/** Context passed to @c run */
+	void *ctx;
+	/** Number of worker indices */
+	unsigned int count;
+	/** Next unclaimed worker index */
+	unsigned int claimed;
+	/** Number of claimed worker indices still running in the pool */
+	unsigned int active;
+};
+
+/** Lock protecting the worker pool */
+static pthread_mutex_t cx_parallel_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Work available condition */
+static pthread_cond_t cx_parallel_work = PTHREAD_COND_INITIALIZER;
+
+/** Work completed condition */
+static pthread_cond_t cx_parallel_done = PTHREAD_COND_INITIALIZER;
+
+/** Queued jobs with unclaimed worker indices */
+static struct cx_parallel_job *cx_parallel_queue;
+
+/** Number of pool threads */
+static unsigned int cx_parallel_pool;
+
+/** Pool threads */
+static pthread_t cx_parallel_pool_threads[CX_PARALLEL_MAX_THREADS];
+
+/** Process that created the pool threads */
+static pid_t cx_parallel_pool_pid;
+
+/** Pool threads should exit */
+static int cx_parallel_exit;
+
+/**
+ * Determine number of threads
+ *
+ * @v threads		Number of threads, or zero to use all processors
+ * @ret threads		Number of threads
+ */
+unsigned int cx_parallel_threads ( unsigned int threads ) {
+	long online;
+
+	if ( ! threads ) {
+		online = sysconf ( _SC_NPROCESSORS_ONLN );
+		threads = ( ( online > 0 ) ? online : 1 );
+	}
+	return threads;
+}
+
+/**
+ * Remove job from queue
+ *
+ * @v job		Parallel job
+ *
+ * The pool lock must be held.
+ */
+static void cx_parallel_dequeue ( struct cx_parallel_job *job ) {
+	struct cx_parallel_job **prev;
+
+	for ( prev = &cx_parallel_queue ; *prev ; prev = &(*prev)->next ) {
+		if ( *prev == job ) {
+			*prev = job->next;
+			break;
+		}
+	}
+}
+
+/**
+ * Claim next worker index
+ *
+ * @v job		Parallel job
+ * @ret index		Worker index
+ *
+ * The pool lock must be held, and the job must have an unclaimed
+ * worker index.  The job is removed from the queue once its last
+ * worker index has been claimed.
+ */
+static unsigned int cx_parallel_claim ( struct cx_parallel_job *job ) {
+	unsigned int index = job->claimed++;
+
+	if ( job->claimed == job->count )
+		cx_parallel_dequeue ( job );
+	return index;
+}
+
+/**
+ * Run pool thread
+ *
+ * @v arg		Unused
+ * @ret ret		Return value (unused)
+ */
+static void * cx_parallel_thread ( void *arg ) {
+	struct cx_parallel_job *job;
+	unsigned int index;
+
+	( void ) arg;
+	pthread_mutex_lock ( &cx_parallel_lock );
+	while ( 1 ) {
+
+		/* Wait for work, or for the pool to be torn down */
+		while ( ( ! cx_parallel_queue ) && ( ! cx_parallel_exit ) ) {
+			pthread_cond_wait ( &cx_parallel_work,
+					    &cx_parallel_lock );
+		}
+		if ( cx_parallel_exit )
+			break;
+
+		/* Claim and run a worker index from the oldest job */
+		job = cx_parallel_queue;
+		index = cx_parallel_claim ( job );
+		job->active++;
+		pthread_mutex_unlock ( &cx_parallel_lock );
+		job->run ( job->ctx, index );
+		pthread_mutex_lock ( &cx_parallel_lock );
+
+		/* Wake the job's caller if this was the last index
+		 * running.  The job may cease to exist as soon as the
+		 * lock is released.
+		 */
+		if ( ! --job->active )
+			pthread_cond_broadcast ( &cx_parallel_done );
+	}
+	pthread_mutex_unlock ( &cx_parallel_lock );
+
+	return NULL;
+}
+
+/**
+ * Grow worker pool
+ *
+ * @v threads		Required number of pool threads
+ *
+ * The pool lock must be held.  Failure to create a thread is not an
+ * error, since the calling thread will run any worker indices left
+ * unclaimed.  The pool is not grown while it is being torn down.
+ */
+static void cx_parallel_grow ( unsigned int threads ) {
+
+	if ( threads > CX_PARALLEL_MAX_THREADS )
+		threads = CX_PARALLEL_MAX_THREADS;
+	if ( cx_parallel_exit )
+		return;
+	while ( cx_parallel_pool < threads ) {
+		if ( pthread_create ( &cx_parallel_pool_threads
+				      [cx_parallel_pool], NULL,
+				      cx_parallel_thread, NULL ) != 0 ) {
+			DBG ( "PARALLEL could not start thread %u\n",
+			      cx_parallel_pool );
+			break;
+		}
+		cx_parallel_pool_pid = getpid();
+		cx_parallel_pool++;
+	}
+}
+
+/**
+ * Tear down worker pool
+ *
+ * All pool threads are signalled to exit and are then joined.  Pool
+ * threads finish any worker index that they have already claimed, and
+ * the callers of any jobs still running will run the remaining worker
+ * indices themselves.  The pool will be recreated on demand by any
+ * subsequent call to cx_parallel_run().
+ *
+ * This is called automatically when the library is unloaded or the
+ * process exits.  In a child process created by fork(), the pool
+ * threads do not exist and so are simply forgotten.
+ */
+void __attribute__ (( destructor )) cx_parallel_fini ( void ) {
+	unsigned int count;
+	unsigned int i;
+
+	/* Signal pool threads to exit */
+	pthread_mutex_lock ( &cx_parallel_lock );
+	count = cx_parallel_pool;
+	if ( cx_parallel_pool_pid != getpid() )
+		count = 0;
+	cx_parallel_exit = 1;
+	pthread_cond_broadcast ( &cx_parallel_work );
+	pthread_mutex_unlock ( &cx_parallel_lock );
+
+	/* Wait for pool threads to exit */
+	for ( i = 0 ; i < count ; i++ )
+		pthread_join ( cx_parallel_pool_threads[i], NULL );
+
+	/* Allow pool to be recreated */
+	pthread_mutex_lock ( &cx_parallel_lock );
+	cx_parallel_pool = 0;
+	cx_parallel_exit = 0;
+	pthread_mutex_unlock ( &cx_parallel_lock );
+}
+
+/**
+ * Run job using worker pool
+ *
+ * @v threads		Number of worker indices
+ * @v run		Method to run for each worker index
+ * @v ctx		Context passed to @c run
+ *
+ * The method is called exactly once for each worker index from zero
+ * to @c threads - 1, and this function returns only once all calls
+ * have returned.  Calls may take place concurrently on different
+ * threads, or in turn on the same thread, and so the method should
+ * take work from a shared source (e.g. by work stealing) rather than
+ * assuming that any other index is running concurrently.  Index zero
+ * is always run by the calling thread.
+ */
+void cx_parallel_run ( unsigned int threads,
+		       void ( * run ) ( void *ctx, unsigned int index ),
+		       void *ctx ) {
+	struct cx_parallel_job **tail;
+	struct cx_parallel_job job;
+	unsigned int index;
+
+	/* Run directly if only a single index exists */
+	if ( threads <= 1 ) {
+		run ( ctx, 0 );
+		return;
+	}
+
+	/* Queue job for the pool threads */
+	memset ( &job, 0, sizeof ( job ) );
+	job.run = run;
+	job.ctx = ctx;
+	job.count = threads;
+	job.claimed = 1;
+	pthread_mutex_lock ( &cx_parallel_lock );
+	cx_parallel_grow ( threads - 1 );
+	for ( tail = &cx_parallel_queue ; *tail ; tail = &(*tail)->next ) {}
+	*tail = &job;
+	pthread_cond_broadcast ( &cx_parallel_work );
+	pthread_mutex_unlock ( &cx_parallel_lock );
+
+	/* Participate as the first index */
+	run ( ctx, 0 );
+
+	/* Run any indices still unclaimed, and wait for the rest */
+	pthread_mutex_lock ( &cx_parallel_lock );
+	while ( job.claimed < job.count ) {
+		index = cx_parallel_claim ( &job );
+		pthread_mutex_unlock ( &cx_parallel_lock );
+		run ( ctx, index );
+		pthread_mutex_lock ( &cx_parallel_lock );
+	}
+	while ( job.active )
+		pthread_cond_wait ( &cx_parallel_done, &cx_parallel_lock );
+	pthread_mutex_unlock ( &cx_parallel_lock );
+}
@@ -48,6 +48,7 @@
  */
 int cx_preseed_value ( enum cx_generator_type type, void *preseed,
 		       size_t len ) {
+	struct cx_drbg_storage storage;
 	struct cx_drbg *drbg;
 	size_t expected;
 
@@ -60,7 +61,8 @@ int cx_preseed_value ( enum cx_generator_type type, void *preseed,
 	}
 
 	/* Instantiate DRBG */
-	drbg = cx_drbg_instantiate_fresh ( type );
+	drbg = cx_drbg_init_split ( &storage, type, NULL, 0, NULL, 0,
+				    NULL, 0 );
 	if ( ! drbg ) {
 		DBG ( "PRESEED type %d could not instantiate\n", type );
 		goto err_instantiate;
@@ -74,12 +76,12 @@ int cx_preseed_value ( enum cx_generator_type type, void *preseed,
 	}
 
 	/* Uninstantiate DRBG */
-	cx_drbg_uninstantiate ( drbg );
+	cx_drbg_fini ( drbg );
 
 	return 1;
 
  err_generate:
-	cx_drbg_uninstantiate ( drbg );
+	cx_drbg_fini ( drbg );
  err_instantiate:
  err_len:
 	return 0;
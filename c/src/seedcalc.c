@@ -47,10 +47,11 @@
  */
 int cx_seedcalc ( enum cx_generator_type type, const void *preseed, size_t len,
 		  EVP_PKEY *key, void *seed ) {
+	struct cx_drbg_storage storage;
 	struct cx_drbg *drbg;
 
 	/* Instantiate DRBG */
-	drbg = cx_drbg_instantiate ( type, preseed, len, key );
+	drbg = cx_drbg_init ( &storage, type, preseed, len, key );
 	if ( ! drbg ) {
 		DBG ( "SEEDCALC could not instantiate type %d preseed %zd "
 		      "bytes\n", type, len );
@@ -64,12 +65,12 @@ int cx_seedcalc ( enum cx_generator_type type, const void *preseed, size_t len,
 	}
 
 	/* Uninstantiate DRBG */
-	cx_drbg_uninstantiate ( drbg );
+	cx_drbg_fini ( drbg );
 
 	return 1;
 
  err_generate:
-	cx_drbg_uninstantiate ( drbg );
+	cx_drbg_fini ( drbg );
  err_instantiate:
 	return 0;
 }
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <openssl/rand.h>
+#include <cx/drbg.h>
+#include <cx/seedcalc.h>
+#include <cx/preseed.h>
+#include "cxbench.h"
+#include "seedcalcbench.h"
+
+/** Engines to be benchmarked */
+static const char *seedcalcbench_engines[] = {
+	"openssl",
+	"portable",
+};
+
+/**
+ * Benchmark seed calculation
+ *
+ * @v name		Benchmark name
+ * @v engine		Engine name
+ * @v type		Generator type
+ * @v preseeds		Preseed values
+ * @v len		Length of each preseed value
+ * @v count		Number of preseed values
+ * @v key		Preseed verification key
+ * @ret ok		Success indicator
+ */
+static int seedcalcbench_seedcalc ( const char *name, const char *engine,
+				    enum cx_generator_type type,
+				    const unsigned char *preseeds, size_t len,
+				    unsigned int count, EVP_PKEY *key ) {
+	unsigned char seed[len];
+	char subname[32];
+	double start;
+	unsigned int i;
+
+	/* Calculate each seed value in turn */
+	start = cxbench_now();
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ! cx_seedcalc ( type, &preseeds[ i * len ], len, key,
+				     seed ) ) {
+			return 0;
+		}
+	}
+	snprintf ( subname, sizeof ( subname ), "seedcalc %s", engine );
+	cxbench_report ( name, subname, count, ( cxbench_now() - start ) );
+
+	return 1;
+}
+
+/**
+ * Benchmark preseed value construction
+ *
+ * @v name		Benchmark name
+ * @v engine		Engine name
+ * @v type		Generator type
+ * @v len		Length of each preseed value
+ * @v count		Number of preseed values
+ * @ret ok		Success indicator
+ */
+static int seedcalcbench_preseed ( const char *name, const char *engine,
+				   enum cx_generator_type type, size_t len,
+				   unsigned int count ) {
+	unsigned char preseed[len];
+	char subname[32];
+	double start;
+	unsigned int i;
+
+	/* Construct each preseed value in turn */
+	start = cxbench_now();
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ! cx_preseed_value ( type, preseed, len ) )
+			return 0;
+	}
+	snprintf ( subname, sizeof ( subname ), "preseed %s", engine );
+	cxbench_report ( name, subname, count, ( cxbench_now() - start ) );
+
+	return 1;
+}
+
+/**
+ * Run seed calculator benchmarks for a generator type
+ *
+ * @v name		Benchmark name
+ * @v type		Generator type
+ * @v count		Number of preseed values
+ * @v key		Preseed verification key
+ * @ret ok		Success indicator
+ */
+static int seedcalcbench_type ( const char *name,
+				enum cx_generator_type type,
+				unsigned int count, EVP_PKEY *key ) {
+	size_t len = cx_drbg_seed_len ( type );
+	unsigned char *preseeds;
+	const char *engine;
+	unsigned int i;
+	int ok = 0;
+
+	/* Allocate preseed values */
+	preseeds = malloc ( count * len );
+	if ( ! preseeds )
+		goto err_alloc;
+
+	/* Generate random preseed values */
+	if ( RAND_bytes ( preseeds, ( count * len ) ) != 1 )
+		goto err_rand;
+
+	/* Run benchmarks for each engine */
+	for ( i = 0 ; i < ( sizeof ( seedcalcbench_engines ) /
+			    sizeof ( seedcalcbench_engines[0] ) ) ; i++ ) {
+		engine = seedcalcbench_engines[i];
+		if ( ! cx_set_engine ( engine ) )
+			continue;
+		if ( ! seedcalcbench_seedcalc ( name, engine, type, preseeds,
+						len, count, key ) )
+			goto err_bench;
+		if ( ! seedcalcbench_preseed ( name, engine, type, len,
+					       count ) )
+			goto err_bench;
+	}
+
+	ok = 1;
+ err_bench:
+	cx_set_engine ( "auto" );
+ err_rand:
+	free ( preseeds );
+ err_alloc:
+	return ok;
+}
+
+/**
+ * Run seed calculator benchmarks
+ *
+ * @v count		Number of preseed values
+ * @ret ok		Success indicator
+ */
+int seedcalcbench ( unsigned int count ) {
+	EVP_PKEY *key;
+	int ok = 1;
+
+	/* Construct preseed verification key */
+	key = cx_preseed_key();
+	if ( ! key )
+		return 0;
+
+	/* Run benchmarks */
+	ok &= seedcalcbench_type ( "seedcalc_type1", CX_GEN_AES_128_CTR_2048,
+				   count, key );
+	ok &= seedcalcbench_type ( "seedcalc_type2", CX_GEN_AES_256_CTR_2048,
+				   count, key );
+
+	EVP_PKEY_free ( key );
+	return ok;
+}
@@ -36,14 +36,74 @@
 #include <openssl/objects.h>
 #include <openssl/evp.h>
 #include <cx/asn1.h>
+#include <cx/drbg.h>
 #include <cx/seedrep.h>
+#include "parallel.h"
 #include "debug.h"
 
+/** DER INTEGER tag */
+#define CX_SEEDREP_TAG_INTEGER 0x02
+
+/** DER BIT STRING tag */
+#define CX_SEEDREP_TAG_BIT_STRING 0x03
+
+/** DER OCTET STRING tag */
+#define CX_SEEDREP_TAG_OCTET_STRING 0x04
+
+/** DER OBJECT IDENTIFIER tag */
+#define CX_SEEDREP_TAG_OID 0x06
+
+/** DER UTF8String tag */
+#define CX_SEEDREP_TAG_UTF8STRING 0x0c
+
+/** DER SEQUENCE tag (constructed) */
+#define CX_SEEDREP_TAG_SEQUENCE 0x30
+
+/** A position within DER data */
+struct cx_seedrep_cursor {
+	/** Remaining data */
+	const unsigned char *data;
+	/** Length of remaining data */
+	size_t len;
+};
+
+/** A batch seed report verification job */
+struct cx_seedrep_batch {
+	/** Seed reports in DER format */
+	const struct cx_seed_report_der *ders;
+	/** Pre-validation limits */
+	const struct cx_seedrep_limits *limits;
+	/** Verified seed reports to fill in */
+	struct cx_seed_report **reports;
+	/** Number of seed reports */
+	unsigned int count;
+	/** Index of next unclaimed seed report */
+	unsigned int next;
+	/** Number of seed reports successfully verified */
+	unsigned int verified;
+};
+
+/**
+ * Default pre-validation limits
+ *
+ * These are far beyond anything produced by cx_seedrep_sign_der(),
+ * and serve only to bound the work done on hostile input.
+ */
+const struct cx_seedrep_limits cx_seedrep_default_limits = {
+	.max_len = ( 4 * 1024 * 1024 ),
+	.max_descriptors = 4096,
+	.max_publisher = 4096,
+	.max_challenge = 4096,
+	.max_key = 4096,
+	.max_signature = 2048,
+};
+
 /**
  * Construct a signed seed report
  *
  * @v report		Seed report
  * @v md		Digest type (or NULL to use default)
+ * @v flags		Signing flags (CX_SEED_REPORT_SIGN_xxx)
  * @ret seedReport	Seed report ASN.1 object (or NULL on error)
  *
  * The caller is responsible for calling CX_SEED_REPORT_free() on the
@@ -53,8 +113,9 @@
  * CX_SEED_REPORT_print_fp() may be used to dump the contents of the
  * returned ASN.1 object for inspection.
  */
-CX_SEED_REPORT * cx_seedrep_sign_asn1 ( const struct cx_seed_report *report,
-					const EVP_MD *md ) {
+CX_SEED_REPORT *
+cx_seedrep_sign_asn1_ex ( const struct cx_seed_report *report,
+			  const EVP_MD *md, unsigned int flags ) {
 	const struct cx_seed_descriptor *desc;
 	CX_SEED_REPORT *seedReport;
 	CX_SEED_DESCRIPTOR *seedDescriptor;
@@ -97,7 +158,7 @@ CX_SEED_REPORT * cx_seedrep_sign_asn1 ( const struct cx_seed_report *report,
 	}
 
 	/* Add signatures */
-	if ( ! CX_SEED_REPORT_sign ( seedReport, md ) ) {
+	if ( ! CX_SEED_REPORT_sign_ex ( seedReport, md, flags ) ) {
 		DBG ( "SEEDREP could not sign\n" );
 		DBG_SEEDREP ( seedReport );
 		goto err_sign;
@@ -114,25 +175,43 @@ CX_SEED_REPORT * cx_seedrep_sign_asn1 ( const struct cx_seed_report *report,
 	return NULL;
 }
 
+/**
+ * Construct a signed seed report
+ *
+ * @v report		Seed report
+ * @v md		Digest type (or NULL to use default)
+ * @ret seedReport	Seed report ASN.1 object (or NULL on error)
+ *
+ * The caller is responsible for calling CX_SEED_REPORT_free() on the
+ * returned ASN.1 object.
+ */
+CX_SEED_REPORT * cx_seedrep_sign_asn1 ( const struct cx_seed_report *report,
+					const EVP_MD *md ) {
+
+	return cx_seedrep_sign_asn1_ex ( report, md, 0 );
+}
+
 /**
  * Construct a signed seed report in DER format
  *
  * @v report		Seed report
  * @v md		Digest type (or NULL to use default)
+ * @v flags		Signing flags (CX_SEED_REPORT_SIGN_xxx)
  * @v len		Length of DER data to fill in (or NULL)
  * @ret der		Seed report in DER format (or NULL on error)
  *
  * The caller is reponsible for calling OPENSSL_free() on the returned
  * DER format data.
  */
-void * cx_seedrep_sign_der ( const struct cx_seed_report *report,
-			     const EVP_MD *md, size_t *len ) {
+void * cx_seedrep_sign_der_ex ( const struct cx_seed_report *report,
+				const EVP_MD *md, unsigned int flags,
+				size_t *len ) {
 	CX_SEED_REPORT *seedReport;
 	unsigned char *der;
 	int der_len;
 
 	/* Construct signed seed report */
-	seedReport = cx_seedrep_sign_asn1 ( report, md );
+	seedReport = cx_seedrep_sign_asn1_ex ( report, md, flags );
 	if ( ! seedReport ) {
 		DBG ( "SEEDREP could not construct and sign\n" );
 		goto err_sign;
@@ -163,6 +242,23 @@ void * cx_seedrep_sign_der ( const struct cx_seed_report *report,
 	return NULL;
 }
 
+/**
+ * Construct a signed seed report in DER format
+ *
+ * @v report		Seed report
+ * @v md		Digest type (or NULL to use default)
+ * @v len		Length of DER data to fill in (or NULL)
+ * @ret der		Seed report in DER format (or NULL on error)
+ *
+ * The caller is reponsible for calling OPENSSL_free() on the returned
+ * DER format data.
+ */
+void * cx_seedrep_sign_der ( const struct cx_seed_report *report,
+			     const EVP_MD *md, size_t *len ) {
+
+	return cx_seedrep_sign_der_ex ( report, md, 0, len );
+}
+
 /**
  * Verify and parse a signed seed report
  *
@@ -292,22 +388,357 @@ struct cx_seed_report * cx_seedrep_verify_asn1 ( CX_SEED_REPORT *seedReport ) {
 	return NULL;
 }
 
+/**
+ * Enter DER element
+ *
+ * @v cursor		DER cursor (advanced past the element)
+ * @v tag		Expected tag
+ * @v contents		DER cursor to fill in for the element contents
+ * @ret ok		Success indicator
+ *
+ * Only single-byte tags and definite lengths in minimal form are
+ * accepted, as required by DER.
+ */
+static int cx_seedrep_enter ( struct cx_seedrep_cursor *cursor,
+			      unsigned int tag,
+			      struct cx_seedrep_cursor *contents ) {
+	const unsigned char *data = cursor->data;
+	size_t remaining = cursor->len;
+	unsigned int bytes;
+	size_t len;
+
+	/* Check tag */
+	if ( ( remaining < 2 ) || ( data[0] != tag ) )
+		return 0;
+	data++;
+	remaining--;
+
+	/* Parse length */
+	len = *(data++);
+	remaining--;
+	if ( len & 0x80 ) {
+		bytes = ( len & 0x7f );
+		if ( ( bytes == 0 ) || ( bytes > 4 ) || ( bytes > remaining ) )
+			return 0;
+		if ( data[0] == 0 )
+			return 0;
+		for ( len = 0 ; bytes-- ; remaining-- )
+			len = ( ( len << 8 ) | *(data++) );
+		if ( len < 0x80 )
+			return 0;
+	}
+	if ( len > remaining )
+		return 0;
+
+	/* Record contents and advance past element */
+	contents->data = data;
+	contents->len = len;
+	cursor->data = ( data + len );
+	cursor->len = ( remaining - len );
+
+	return 1;
+}
+
+/**
+ * Parse DER unsigned 32-bit integer
+ *
+ * @v cursor		DER cursor (advanced past the element)
+ * @v value		Value to fill in
+ * @ret ok		Success indicator
+ */
+static int cx_seedrep_uint32 ( struct cx_seedrep_cursor *cursor,
+			       uint32_t *value ) {
+	struct cx_seedrep_cursor contents;
+	const unsigned char *data;
+	size_t len;
+
+	/* Enter integer */
+	if ( ! cx_seedrep_enter ( cursor, CX_SEEDREP_TAG_INTEGER, &contents ) )
+		return 0;
+	data = contents.data;
+	len = contents.len;
+
+	/* Reject empty, negative, non-minimal, and oversized values */
+	if ( ( len == 0 ) || ( data[0] & 0x80 ) )
+		return 0;
+	if ( ( len > 1 ) && ( data[0] == 0 ) && ( ! ( data[1] & 0x80 ) ) )
+		return 0;
+	if ( ( len > 5 ) || ( ( len == 5 ) && data[0] ) )
+		return 0;
+
+	/* Parse value */
+	for ( *value = 0 ; len-- ; data++ )
+		*value = ( ( *value << 8 ) | *data );
+
+	return 1;
+}
+
+/**
+ * Check DER AlgorithmIdentifier
+ *
+ * @v cursor		DER cursor (advanced past the element)
+ * @ret ok		Success indicator
+ */
+static int cx_seedrep_check_algorithm ( struct cx_seedrep_cursor *cursor ) {
+	struct cx_seedrep_cursor algorithm;
+	struct cx_seedrep_cursor oid;
+
+	/* Require a non-empty algorithm OID (parameters are not checked) */
+	if ( ! cx_seedrep_enter ( cursor, CX_SEEDREP_TAG_SEQUENCE,
+				  &algorithm ) )
+		return 0;
+	if ( ! cx_seedrep_enter ( &algorithm, CX_SEEDREP_TAG_OID, &oid ) )
+		return 0;
+	if ( ! oid.len )
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Check DER SeedDescriptor
+ *
+ * @v cursor		DER cursor (advanced past the element)
+ * @v limits		Limits
+ * @v index		Seed descriptor index
+ * @ret ok		Success indicator
+ */
+static int
+cx_seedrep_check_descriptor ( struct cx_seedrep_cursor *cursor,
+			      const struct cx_seedrep_limits *limits,
+			      unsigned int index ) {
+	struct cx_seedrep_cursor desc;
+	struct cx_seedrep_cursor preseed;
+	struct cx_seedrep_cursor spki;
+	struct cx_seedrep_cursor key;
+	uint32_t type;
+	size_t len;
+
+	/* Enter seed descriptor */
+	if ( ! cx_seedrep_enter ( cursor, CX_SEEDREP_TAG_SEQUENCE, &desc ) ) {
+		DBG ( "SEEDREP check descriptor %d malformed\n", index );
+		return 0;
+	}
+
+	/* Check generator type and preseed value length */
+	if ( ! cx_seedrep_uint32 ( &desc, &type ) ) {
+		DBG ( "SEEDREP check descriptor %d malformed type\n", index );
+		return 0;
+	}
+	len = cx_drbg_seed_len ( ( enum cx_generator_type ) type );
+	if ( ! len ) {
+		DBG ( "SEEDREP check descriptor %d unknown type %d\n",
+		      index, type );
+		return 0;
+	}
+	if ( ( ! cx_seedrep_enter ( &desc, CX_SEEDREP_TAG_OCTET_STRING,
+				    &preseed ) ) || ( preseed.len != len ) ) {
+		DBG ( "SEEDREP check descriptor %d bad preseed\n", index );
+		return 0;
+	}
+
+	/* Check preseed verification key */
+	if ( ( ! cx_seedrep_enter ( &desc, CX_SEEDREP_TAG_SEQUENCE,
+				    &spki ) ) ||
+	     ( spki.len > limits->max_key ) ||
+	     ( ! cx_seedrep_check_algorithm ( &spki ) ) ||
+	     ( ! cx_seedrep_enter ( &spki, CX_SEEDREP_TAG_BIT_STRING,
+				    &key ) ) ||
+	     ( ! key.len ) || spki.len ) {
+		DBG ( "SEEDREP check descriptor %d bad key\n", index );
+		return 0;
+	}
+
+	/* Check for trailing data */
+	if ( desc.len ) {
+		DBG ( "SEEDREP check descriptor %d trailing data\n", index );
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Check DER Signature
+ *
+ * @v cursor		DER cursor (advanced past the element)
+ * @v limits		Limits
+ * @v index		Signature index
+ * @ret ok		Success indicator
+ */
+static int
+cx_seedrep_check_signature ( struct cx_seedrep_cursor *cursor,
+			     const struct cx_seedrep_limits *limits,
+			     unsigned int index ) {
+	struct cx_seedrep_cursor signature;
+	struct cx_seedrep_cursor value;
+
+	/* Check signature algorithm and value */
+	if ( ( ! cx_seedrep_enter ( cursor, CX_SEEDREP_TAG_SEQUENCE,
+				    &signature ) ) ||
+	     ( ! cx_seedrep_check_algorithm ( &signature ) ) ||
+	     ( ! cx_seedrep_enter ( &signature, CX_SEEDREP_TAG_OCTET_STRING,
+				    &value ) ) ||
+	     ( ! value.len ) || ( value.len > limits->max_signature ) ||
+	     signature.len ) {
+		DBG ( "SEEDREP check signature %d malformed\n", index );
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Pre-validate a signed seed report in DER format
+ *
+ * @v der		Seed report in DER format
+ * @v len		Length of DER data
+ * @v limits		Limits (or NULL to use default limits)
+ * @ret ok		Success indicator
+ *
+ * This performs a single pass over the DER data, without allocating
+ * memory or performing any cryptographic operations, and rejects any
+ * seed report that is malformed, internally inconsistent, or exceeds
+ * the specified limits.  In particular, each generator type must be
+ * known, each preseed value must have the length required by its
+ * generator type, and there must be exactly one signature for each
+ * seed descriptor.
+ *
+ * Passing this check does not imply that the seed report will
+ * subsequently decode or verify successfully.
+ */
+int cx_seedrep_check_der ( const void *der, size_t der_len,
+			   const struct cx_seedrep_limits *limits ) {
+	struct cx_seedrep_cursor cursor;
+	struct cx_seedrep_cursor report;
+	struct cx_seedrep_cursor content;
+	struct cx_seedrep_cursor descriptors;
+	struct cx_seedrep_cursor signatures;
+	struct cx_seedrep_cursor string;
+	unsigned int num_descriptors;
+	unsigned int num_signatures;
+	uint32_t version;
+
+	/* Use default limits if applicable */
+	if ( ! limits )
+		limits = &cx_seedrep_default_limits;
+
+	/* Check overall length */
+	if ( der_len > limits->max_len ) {
+		DBG ( "SEEDREP check length %zd exceeds limit\n", der_len );
+		return 0;
+	}
+
+	/* Enter seed report, which must occupy all of the DER data */
+	cursor.data = der;
+	cursor.len = der_len;
+	if ( ( ! cx_seedrep_enter ( &cursor, CX_SEEDREP_TAG_SEQUENCE,
+				    &report ) ) || cursor.len ) {
+		DBG ( "SEEDREP check report malformed\n" );
+		return 0;
+	}
+
+	/* Enter seed report content */
+	if ( ( ! cx_seedrep_enter ( &report, CX_SEEDREP_TAG_SEQUENCE,
+				    &content ) ) ||
+	     ( ! cx_seedrep_uint32 ( &content, &version ) ) ||
+	     ( ! cx_seedrep_enter ( &content, CX_SEEDREP_TAG_SEQUENCE,
+				    &descriptors ) ) ) {
+		DBG ( "SEEDREP check content malformed\n" );
+		return 0;
+	}
+
+	/* Check seed descriptors */
+	for ( num_descriptors = 0 ; descriptors.len ; num_descriptors++ ) {
+		if ( num_descriptors >= limits->max_descriptors ) {
+			DBG ( "SEEDREP check too many descriptors\n" );
+			return 0;
+		}
+		if ( ! cx_seedrep_check_descriptor ( &descriptors, limits,
+						     num_descriptors ) ) {
+			return 0;
+		}
+	}
+	if ( ! num_descriptors ) {
+		DBG ( "SEEDREP check has no descriptors\n" );
+		return 0;
+	}
+
+	/* Check publisher name and seed report challenge */
+	if ( ( ! cx_seedrep_enter ( &content, CX_SEEDREP_TAG_UTF8STRING,
+				    &string ) ) ||
+	     ( string.len > limits->max_publisher ) ) {
+		DBG ( "SEEDREP check bad publisher name\n" );
+		return 0;
+	}
+	if ( ( ! cx_seedrep_enter ( &content, CX_SEEDREP_TAG_UTF8STRING,
+				    &string ) ) ||
+	     ( string.len > limits->max_challenge ) ) {
+		DBG ( "SEEDREP check bad seed report challenge\n" );
+		return 0;
+	}
+
+	if ( content.len ) {
+		DBG ( "SEEDREP check content trailing data\n" );
+		return 0;
+	}
+
+	/* Check signatures */
+	if ( ! cx_seedrep_enter ( &report, CX_SEEDREP_TAG_SEQUENCE,
+				  &signatures ) ) {
+		DBG ( "SEEDREP check signatures malformed\n" );
+		return 0;
+	}
+	for ( num_signatures = 0 ; signatures.len ; num_signatures++ ) {
+		if ( num_signatures >= num_descriptors ) {
+			DBG ( "SEEDREP check too many signatures\n" );
+			return 0;
+		}
+		if ( ! cx_seedrep_check_signature ( &signatures, limits,
+						    num_signatures ) ) {
+			return 0;
+		}
+	}
+	if ( num_signatures != num_descriptors ) {
+		DBG ( "SEEDREP check has %d signatures for %d descriptors\n",
+		      num_signatures, num_descriptors );
+		return 0;
+	}
+	if ( report.len ) {
+		DBG ( "SEEDREP check report trailing data\n" );
+		return 0;
+	}
+
+	return 1;
+}
+
 /**
  * Verify and parse a signed seed report in DER format
  *
  * @v der		Seed report in DER format
  * @v len		Length of DER data
+ * @v limits		Pre-validation limits (or NULL to use default limits)
  * @ret report		Seed report (or NULL on error)
  *
+ * The DER data is checked using cx_seedrep_check_der() before any
+ * decoding or signature verification is attempted.
+ *
  * The caller is responsible for calling cx_seedrep_free() on the
  * returned seed report.
  */
-struct cx_seed_report * cx_seedrep_verify_der ( const void *der,
-						size_t der_len ) {
+struct cx_seed_report *
+cx_seedrep_verify_der_ex ( const void *der, size_t der_len,
+			   const struct cx_seedrep_limits *limits ) {
 	CX_SEED_REPORT *seedReport;
 	const unsigned char *der_tmp;
 	struct cx_seed_report *report;
 
+	/* Pre-validate DER data */
+	if ( ! cx_seedrep_check_der ( der, der_len, limits ) ) {
+		DBG ( "SEEDREP failed pre-validation\n" );
+		goto err_check;
+	}
+
 	/* Decode DER data */
 	der_tmp = der;
 	seedReport = d2i_CX_SEED_REPORT ( NULL, &der_tmp, der_len );
@@ -332,16 +763,133 @@ struct cx_seed_report * cx_seedrep_verify_der ( const void *der,
  err_verify:
 	CX_SEED_REPORT_free ( seedReport );
  err_d2i:
+ err_check:
 	return NULL;
 }
 
+/**
+ * Verify and parse a signed seed report in DER format
+ *
+ * @v der		Seed report in DER format
+ * @v len		Length of DER data
+ * @ret report		Seed report (or NULL on error)
+ *
+ * The DER data is pre-validated using the default limits.
+ *
+ * The caller is responsible for calling cx_seedrep_free() on the
+ * returned seed report.
+ */
+struct cx_seed_report * cx_seedrep_verify_der ( const void *der,
+						size_t der_len ) {
+
+	return cx_seedrep_verify_der_ex ( der, der_len, NULL );
+}
+
+/**
+ * Claim next seed report in a batch
+ *
+ * @v batch		Batch verification job
+ * @v index		Seed report index to fill in
+ * @ret ok		A seed report was claimed
+ */
+static int cx_seedrep_next ( struct cx_seedrep_batch *batch,
+			     unsigned int *index ) {
+
+	*index = __atomic_fetch_add ( &batch->next, 1, __ATOMIC_RELAXED );
+	return ( *index < batch->count );
+}
+
+/**
+ * Run batch seed report verification worker
+ *
+ * @v ctx		Batch verification job
+ * @v index		Worker index (unused)
+ *
+ * The worker claims one seed report at a time, and carries it
+ * through decoding, verification, and parsing before claiming the
+ * next.  The decoded ASN.1 object is freed before moving on, so that
+ * each worker holds at most one decoded seed report at any time.
+ */
+static void cx_seedrep_worker ( void *ctx, unsigned int index ) {
+	struct cx_seedrep_batch *batch = ctx;
+	const struct cx_seed_report_der *der;
+	unsigned int i;
+
+	( void ) index;
+
+	/* Verify seed reports until none remain */
+	while ( cx_seedrep_next ( batch, &i ) ) {
+		der = &batch->ders[i];
+		batch->reports[i] = cx_seedrep_verify_der_ex ( der->der,
+							       der->len,
+							       batch->limits );
+		if ( batch->reports[i] ) {
+			__atomic_fetch_add ( &batch->verified, 1,
+					     __ATOMIC_RELAXED );
+		} else {
+			DBG ( "SEEDREP batch report %d failed\n", i );
+		}
+	}
+}
+
+/**
+ * Verify and parse a batch of signed seed reports in DER format
+ *
+ * @v ders		Seed reports in DER format
+ * @v count		Number of seed reports
+ * @v limits		Pre-validation limits (or NULL to use default limits)
+ * @v reports		Seed reports to fill in (NULL for each failure)
+ * @v threads		Number of threads, or zero to use all processors
+ * @ret verified	Number of seed reports successfully verified
+ *
+ * This is equivalent to calling cx_seedrep_verify_der_ex() for each
+ * seed report in turn, and produces identical results regardless of
+ * the number of threads.  Seed reports are shared out between the
+ * threads one at a time, so that large and small seed reports are
+ * balanced automatically.  Since each thread holds at most one
+ * decoded seed report at a time, the working memory is bounded by
+ * the number of threads rather than the size of the batch.
+ *
+ * The threads are taken from the shared worker pool (see
+ * cx_parallel_run()).
+ *
+ * The caller is responsible for calling cx_seedrep_free() on each
+ * returned seed report.
+ */
+unsigned int cx_seedrep_verify_batch ( const struct cx_seed_report_der *ders,
+				       unsigned int count,
+				       const struct cx_seedrep_limits *limits,
+				       struct cx_seed_report **reports,
+				       unsigned int threads ) {
+	struct cx_seedrep_batch batch;
+
+	/* Clear results */
+	memset ( reports, 0, ( count * sizeof ( reports[0] ) ) );
+
+	/* Determine number of threads */
+	threads = cx_parallel_threads ( threads );
+	if ( threads > count )
+		threads = count;
+
+	/* Verify seed reports */
+	memset ( &batch, 0, sizeof ( batch ) );
+	batch.ders = ders;
+	batch.limits = limits;
+	batch.reports = reports;
+	batch.count = count;
+	cx_parallel_run ( threads, cx_seedrep_worker, &batch );
+
+	return batch.verified;
+}
+
 /**
  * Free seed report
  *
  * @v report		Seed report
  *
  * This must be used only for seed reports returned by
- * cx_seedrep_verify() or cx_seedrep_verify_der().
+ * cx_seedrep_verify_asn1(), cx_seedrep_verify_der(), or
+ * cx_seedrep_verify_batch().
  */
 void cx_seedrep_free ( struct cx_seed_report *report ) {
 	unsigned int i;
@@ -0,0 +1,448 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <openssl/rand.h>
+#include <cx/drbg.h>
+#include <cx/preseed.h>
+#include <cx/seedrep.h>
+#include "cxbench.h"
+#include "seedrepbench.h"
+
+/** Number of distinct preseed verification keys */
+#define SEEDREPBENCH_KEYS 4
+
+/** Seed report publisher name */
+#define SEEDREPBENCH_PUBLISHER "Benchmark Publisher"
+
+/** Seed report challenge */
+#define SEEDREPBENCH_CHALLENGE "Benchmark Challenge"
+
+/** Number of seed descriptors per seed report for parallel benchmarks */
+#define SEEDREPBENCH_PARALLEL 64
+
+/** Number of seed descriptors per seed report for batch benchmarks */
+#define SEEDREPBENCH_BATCH 4
+
+/** Numbers of seed descriptors per seed report */
+static const unsigned int seedrepbench_num[] = { 1, 16, 256 };
+
+/**
+ * Construct seed report
+ *
+ * @v report		Seed report to fill in
+ * @v num		Number of seed descriptors
+ * @v keys		Preseed signing keys
+ * @ret ok		Success indicator
+ *
+ * The caller is responsible for calling seedrepbench_free() on the
+ * constructed seed report.
+ */
+static int seedrepbench_report ( struct cx_seed_report *report,
+				 unsigned int num, EVP_PKEY **keys ) {
+	enum cx_generator_type type = CX_GEN_AES_128_CTR_2048;
+	size_t len = cx_drbg_seed_len ( type );
+	struct cx_seed_descriptor *desc;
+	unsigned char *preseeds;
+	unsigned int i;
+
+	/* Allocate seed descriptors and preseed values */
+	desc = calloc ( num, sizeof ( desc[0] ) );
+	if ( ! desc )
+		goto err_alloc_desc;
+	preseeds = malloc ( num * len );
+	if ( ! preseeds )
+		goto err_alloc_preseeds;
+
+	/* Generate random preseed values */
+	if ( RAND_bytes ( preseeds, ( num * len ) ) != 1 )
+		goto err_rand;
+
+	/* Construct seed report */
+	for ( i = 0 ; i < num ; i++ ) {
+		desc[i].type = type;
+		desc[i].preseed = &preseeds[ i * len ];
+		desc[i].len = len;
+		desc[i].key = keys[ i % SEEDREPBENCH_KEYS ];
+	}
+	report->desc = desc;
+	report->count = num;
+	report->publisher = SEEDREPBENCH_PUBLISHER;
+	report->challenge = SEEDREPBENCH_CHALLENGE;
+
+	return 1;
+
+ err_rand:
+	free ( preseeds );
+ err_alloc_preseeds:
+	free ( desc );
+ err_alloc_desc:
+	return 0;
+}
+
+/**
+ * Free seed report
+ *
+ * @v report		Seed report
+ */
+static void seedrepbench_free ( struct cx_seed_report *report ) {
+
+	/* Free preseed values and seed descriptors */
+	free ( ( void * ) report->desc[0].preseed );
+	free ( ( void * ) report->desc );
+}
+
+/**
+ * Benchmark seed report signing
+ *
+ * @v name		Benchmark name
+ * @v num		Number of seed descriptors per seed report
+ * @v count		Total number of signatures to create
+ * @v keys		Preseed signing keys
+ * @v flags		Signing flags
+ * @ret ok		Success indicator
+ */
+static int seedrepbench_sign ( const char *name, unsigned int num,
+			       unsigned int count, EVP_PKEY **keys,
+			       unsigned int flags ) {
+	struct cx_seed_report report;
+	unsigned int iterations;
+	char subname[32];
+	double start;
+	size_t der_len;
+	void *der;
+	unsigned int i;
+	int ok = 0;
+
+	/* Construct seed report */
+	if ( ! seedrepbench_report ( &report, num, keys ) )
+		goto err_report;
+
+	/* Sign seed report repeatedly */
+	iterations = ( ( count + num - 1 ) / num );
+	start = cxbench_now();
+	for ( i = 0 ; i < iterations ; i++ ) {
+		der = cx_seedrep_sign_der_ex ( &report, NULL, flags,
+					       &der_len );
+		if ( ! der )
+			goto err_sign;
+		OPENSSL_free ( der );
+	}
+	snprintf ( subname, sizeof ( subname ), "sign %u desc%s", num,
+		   ( ( flags & CX_SEED_REPORT_SIGN_NO_VERIFY ) ?
+		     " noverify" : "" ) );
+	cxbench_report ( name, subname, ( iterations * num ),
+			 ( cxbench_now() - start ) );
+
+	ok = 1;
+ err_sign:
+	seedrepbench_free ( &report );
+ err_report:
+	return ok;
+}
+
+/**
+ * Benchmark seed report verification
+ *
+ * @v name		Benchmark name
+ * @v num		Number of seed descriptors per seed report
+ * @v count		Total number of signatures to verify
+ * @v keys		Preseed verification keys
+ * @ret ok		Success indicator
+ */
+static int seedrepbench_verify ( const char *name, unsigned int num,
+				 unsigned int count, EVP_PKEY **keys ) {
+	struct cx_seed_report report;
+	struct cx_seed_report *verified;
+	unsigned int iterations;
+	char subname[32];
+	double start;
+	size_t der_len;
+	void *der;
+	unsigned int i;
+	int ok = 0;
+
+	/* Construct and sign seed report */
+	if ( ! seedrepbench_report ( &report, num, keys ) )
+		goto err_report;
+	der = cx_seedrep_sign_der ( &report, NULL, &der_len );
+	if ( ! der )
+		goto err_sign;
+
+	/* Verify seed report repeatedly */
+	iterations = ( ( count + num - 1 ) / num );
+	start = cxbench_now();
+	for ( i = 0 ; i < iterations ; i++ ) {
+		verified = cx_seedrep_verify_der ( der, der_len );
+		if ( ! verified )
+			goto err_verify;
+		cx_seedrep_free ( verified );
+	}
+	snprintf ( subname, sizeof ( subname ), "verify %u desc", num );
+	cxbench_report ( name, subname, ( iterations * num ),
+			 ( cxbench_now() - start ) );
+
+	ok = 1;
+ err_verify:
+	OPENSSL_free ( der );
+ err_sign:
+	seedrepbench_free ( &report );
+ err_report:
+	return ok;
+}
+
+/**
+ * Benchmark seed report pre-validation
+ *
+ * @v name		Benchmark name
+ * @v num		Number of seed descriptors per seed report
+ * @v count		Number of seed reports to check
+ * @v keys		Preseed signing keys
+ * @ret ok		Success indicator
+ *
+ * The result is reported per seed descriptor, for direct comparison
+ * with the cost of verification.
+ */
+static int seedrepbench_check ( const char *name, unsigned int num,
+				unsigned int count, EVP_PKEY **keys ) {
+	struct cx_seed_report report;
+	char subname[32];
+	double start;
+	size_t der_len;
+	void *der;
+	unsigned int i;
+	int ok = 0;
+
+	/* Construct and sign seed report */
+	if ( ! seedrepbench_report ( &report, num, keys ) )
+		goto err_report;
+	der = cx_seedrep_sign_der ( &report, NULL, &der_len );
+	if ( ! der )
+		goto err_sign;
+
+	/* Check seed report repeatedly */
+	start = cxbench_now();
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ! cx_seedrep_check_der ( der, der_len, NULL ) )
+			goto err_check;
+	}
+	snprintf ( subname, sizeof ( subname ), "check %u desc", num );
+	cxbench_report ( name, subname, ( count * num ),
+			 ( cxbench_now() - start ) );
+
+	ok = 1;
+ err_check:
+	OPENSSL_free ( der );
+ err_sign:
+	seedrepbench_free ( &report );
+ err_report:
+	return ok;
+}
+
+/**
+ * Benchmark parallel seed report signing and verification
+ *
+ * @v name		Benchmark name
+ * @v num		Number of seed descriptors per seed report
+ * @v count		Total number of signatures to create and verify
+ * @v keys		Preseed signing keys
+ * @v threads		Number of threads
+ * @ret ok		Success indicator
+ */
+static int seedrepbench_parallel ( const char *name, unsigned int num,
+				   unsigned int count, EVP_PKEY **keys,
+				   unsigned int threads ) {
+	unsigned int flags = CX_SEED_REPORT_SIGN_NO_VERIFY;
+	struct cx_seed_report report;
+	CX_SEED_REPORT *seedReport;
+	unsigned int iterations;
+	char subname[32];
+	double start;
+	unsigned int i;
+	int ok = 0;
+
+	/* Construct seed report */
+	if ( ! seedrepbench_report ( &report, num, keys ) )
+		goto err_report;
+	seedReport = cx_seedrep_sign_asn1_ex ( &report, NULL, flags );
+	if ( ! seedReport )
+		goto err_asn1;
+
+	/* Re-sign seed report repeatedly */
+	iterations = ( ( count + num - 1 ) / num );
+	start = cxbench_now();
+	for ( i = 0 ; i < iterations ; i++ ) {
+		if ( ! CX_SEED_REPORT_sign_parallel ( seedReport, NULL, flags,
+						      threads ) ) {
+			goto err_sign;
+		}
+	}
+	snprintf ( subname, sizeof ( subname ), "sign %u desc %u threads",
+		   num, threads );
+	cxbench_report ( name, subname, ( iterations * num ),
+			 ( cxbench_now() - start ) );
+
+	/* Verify seed report repeatedly */
+	start = cxbench_now();
+	for ( i = 0 ; i < iterations ; i++ ) {
+		if ( ! CX_SEED_REPORT_verify_parallel ( seedReport, threads ) )
+			goto err_verify;
+	}
+	snprintf ( subname, sizeof ( subname ), "verify %u desc %u threads",
+		   num, threads );
+	cxbench_report ( name, subname, ( iterations * num ),
+			 ( cxbench_now() - start ) );
+
+	ok = 1;
+ err_verify:
+ err_sign:
+	CX_SEED_REPORT_free ( seedReport );
+ err_asn1:
+	seedrepbench_free ( &report );
+ err_report:
+	return ok;
+}
+
+/**
+ * Benchmark batch seed report verification
+ *
+ * @v name		Benchmark name
+ * @v num		Number of seed descriptors per seed report
+ * @v count		Number of seed reports
+ * @v keys		Preseed signing keys
+ * @v threads		Number of threads
+ * @ret ok		Success indicator
+ *
+ * The batch consists of copies of a single signed seed report, since
+ * the verification cost does not depend upon the seed report content.
+ */
+static int seedrepbench_batch ( const char *name, unsigned int num,
+				unsigned int count, EVP_PKEY **keys,
+				unsigned int threads ) {
+	struct cx_seed_report report;
+	struct cx_seed_report_der *ders;
+	struct cx_seed_report **reports;
+	unsigned int verified;
+	char subname[32];
+	double start;
+	size_t der_len;
+	void *der;
+	unsigned int i;
+	int ok = 0;
+
+	/* Construct and sign seed report */
+	if ( ! seedrepbench_report ( &report, num, keys ) )
+		goto err_report;
+	der = cx_seedrep_sign_der ( &report, NULL, &der_len );
+	if ( ! der )
+		goto err_sign;
+
+	/* Construct batch */
+	ders = calloc ( count, sizeof ( ders[0] ) );
+	if ( ! ders )
+		goto err_alloc_ders;
+	reports = calloc ( count, sizeof ( reports[0] ) );
+	if ( ! reports )
+		goto err_alloc_reports;
+	for ( i = 0 ; i < count ; i++ ) {
+		ders[i].der = der;
+		ders[i].len = der_len;
+	}
+
+	/* Verify batch */
+	start = cxbench_now();
+	verified = cx_seedrep_verify_batch ( ders, count, NULL, reports,
+					     threads );
+	snprintf ( subname, sizeof ( subname ), "batch %u desc %u threads",
+		   num, threads );
+	cxbench_report ( name, subname, count, ( cxbench_now() - start ) );
+	if ( verified != count )
+		goto err_verify;
+
+	ok = 1;
+ err_verify:
+	for ( i = 0 ; i < count ; i++ )
+		cx_seedrep_free ( reports[i] );
+	free ( reports );
+ err_alloc_reports:
+	free ( ders );
+ err_alloc_ders:
+	OPENSSL_free ( der );
+ err_sign:
+	seedrepbench_free ( &report );
+ err_report:
+	return ok;
+}
+
+/**
+ * Run seed report benchmarks
+ *
+ * @v count		Number of signatures
+ * @ret ok		Success indicator
+ */
+int seedrepbench ( unsigned int count ) {
+	long online = sysconf ( _SC_NPROCESSORS_ONLN );
+	EVP_PKEY *keys[SEEDREPBENCH_KEYS];
+	unsigned int threads;
+	unsigned int num;
+	unsigned int i;
+	unsigned int j;
+	int ok = 0;
+
+	/* Construct preseed verification keys */
+	for ( i = 0 ; i < SEEDREPBENCH_KEYS ; i++ ) {
+		keys[i] = cx_preseed_key();
+		if ( ! keys[i] )
+			goto err_key;
+	}
+
+	/* Run benchmarks */
+	ok = 1;
+	for ( j = 0 ; j < ( sizeof ( seedrepbench_num ) /
+			    sizeof ( seedrepbench_num[0] ) ) ; j++ ) {
+		num = seedrepbench_num[j];
+		ok &= seedrepbench_sign ( "seedrep", num, count, keys, 0 );
+		ok &= seedrepbench_sign ( "seedrep", num, count, keys,
+					  CX_SEED_REPORT_SIGN_NO_VERIFY );
+		ok &= seedrepbench_verify ( "seedrep", num, count, keys );
+		ok &= seedrepbench_check ( "seedrep", num, count, keys );
+	}
+	for ( threads = 1 ; threads <= online ; threads *= 2 ) {
+		ok &= seedrepbench_parallel ( "seedrep", SEEDREPBENCH_PARALLEL,
+					      count, keys, threads );
+	}
+	for ( threads = 1 ; threads <= online ; threads *= 2 ) {
+		ok &= seedrepbench_batch ( "seedrep_batch", SEEDREPBENCH_BATCH,
+					   count, keys, threads );
+	}
+
+ err_key:
+	while ( i-- )
+		EVP_PKEY_free ( keys[i] );
+	return ok;
+}
@@ -24,14 +24,31 @@
  * and the licenses of the other code concerned.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <openssl/err.h>
 #include <cx/seedrep.h>
 #include "SeedReport.h"
 #include "cxtest.h"
 #include "seedreptest.h"
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+/* EVP_PKEY_cmp() is deprecated in OpenSSL 3 */
+#define EVP_PKEY_cmp EVP_PKEY_eq
+#else
+/* ERR_peek_last_error_data() is new in OpenSSL 3 */
+#define ERR_peek_last_error_data( data, flags ) \
+	ERR_peek_last_error_line_data ( NULL, NULL, data, flags )
+#endif
+
+/** Number of threads used for multi-threaded signing and verification */
+#define SEEDREPTEST_THREADS 4
+
+/** Number of seed reports used for batch verification */
+#define SEEDREPTEST_BATCH 12
+
 /** Seed report test descriptor parameter */
 #define seedreptestdesc( type, preseed, key ) \
 	type, preseed, sizeof ( preseed ), key
@@ -135,6 +152,74 @@ static int seedreptest_check ( const char *name, const char *subname,
 	return 1;
 }
 
+/**
+ * Check multi-threaded signing and verification
+ *
+ * @v name		Test name
+ * @v seedReport	Signed seed report
+ * @ret ok		Success indicator
+ *
+ * The seed report is re-signed using multiple threads, and must
+ * produce exactly the same DER encoding as was produced by signing
+ * with a single thread.
+ */
+static int seedreptest_parallel ( const char *name,
+				  CX_SEED_REPORT *seedReport ) {
+	unsigned char *serial;
+	unsigned char *parallel;
+	int serial_len;
+	int parallel_len;
+
+	/* Encode report signed using a single thread */
+	serial = NULL;
+	serial_len = i2d_CX_SEED_REPORT ( seedReport, &serial );
+	if ( serial_len < 0 ) {
+		fprintf ( stderr, "SEEDREPTEST %s parallel could not encode\n",
+			  name );
+		goto err_serial;
+	}
+
+	/* Re-sign report using multiple threads */
+	if ( ! CX_SEED_REPORT_sign_parallel ( seedReport, NULL, 0,
+					      SEEDREPTEST_THREADS ) ) {
+		fprintf ( stderr, "SEEDREPTEST %s parallel could not sign\n",
+			  name );
+		goto err_sign;
+	}
+
+	/* Check encoding is unchanged */
+	parallel = NULL;
+	parallel_len = i2d_CX_SEED_REPORT ( seedReport, &parallel );
+	if ( ( parallel_len != serial_len ) ||
+	     ( memcmp ( parallel, serial, serial_len ) != 0 ) ) {
+		fprintf ( stderr, "SEEDREPTEST %s parallel signature "
+			  "mismatch\n", name );
+		goto err_mismatch;
+	}
+
+	/* Verify report using multiple threads */
+	if ( ! CX_SEED_REPORT_verify_parallel ( seedReport,
+						SEEDREPTEST_THREADS ) ) {
+		fprintf ( stderr, "SEEDREPTEST %s parallel could not "
+			  "verify\n", name );
+		goto err_verify;
+	}
+
+	/* Free encodings */
+	OPENSSL_free ( parallel );
+	OPENSSL_free ( serial );
+
+	return 1;
+
+ err_verify:
+ err_mismatch:
+	OPENSSL_free ( parallel );
+ err_sign:
+	OPENSSL_free ( serial );
+ err_serial:
+	return 0;
+}
+
 /**
  * Run a seed report test
  *
@@ -185,6 +270,10 @@ static int seedreptest ( const char *name, const char *publisher,
 	if ( ! seedreptest_check ( name, "ASN.1", check_asn1, &report ) )
 		goto err_check_asn1;
 
+	/* Check multi-threaded signing and verification */
+	if ( ! seedreptest_parallel ( name, seedReport ) )
+		goto err_parallel_asn1;
+
 	/* Ensure verification fails if report is modified */
 	CX_SEED_REPORT_set1_challenge ( seedReport, "Someone else" );
 	fail = cx_seedrep_verify_asn1 ( seedReport );
@@ -195,8 +284,9 @@ static int seedreptest ( const char *name, const char *publisher,
 		goto err_fail_asn1;
 	}
 
-	/* Construct and sign report in DER format */
-	der = cx_seedrep_sign_der ( &report, NULL, &len );
+	/* Construct and sign report in DER format, without self-check */
+	der = cx_seedrep_sign_der_ex ( &report, NULL,
+				       CX_SEED_REPORT_SIGN_NO_VERIFY, &len );
 	if ( ! der ) {
 		fprintf ( stderr, "SEEDREPTEST %s DER could not sign\n",
 			  name );
@@ -262,6 +352,7 @@ static int seedreptest ( const char *name, const char *publisher,
 	OPENSSL_free ( der );
  err_sign_der:
  err_fail_asn1:
+ err_parallel_asn1:
  err_check_asn1:
 	cx_seedrep_free ( check_asn1 );
  err_verify_asn1:
@@ -270,6 +361,360 @@ static int seedreptest ( const char *name, const char *publisher,
 	return 0;
 }
 
+/**
+ * Run a batch seed report verification test
+ *
+ * @v name		Test name
+ * @v publisher		Publisher name
+ * @v challenge		Seed report challenge
+ * @v count		Number of seed descriptors
+ * @v ...		Seed descriptor values
+ * @ret ok		Success indicator
+ *
+ * The batch contains several copies of the signed seed report, of
+ * which every third copy is modified and must fail verification.
+ */
+static int seedreptest_batch ( const char *name, const char *publisher,
+			       const char *challenge, unsigned int count,
+			       ... ) {
+	struct cx_seed_report report;
+	struct cx_seed_descriptor desc[count];
+	struct cx_seed_report_der ders[SEEDREPTEST_BATCH];
+	struct cx_seed_report *reports[SEEDREPTEST_BATCH];
+	unsigned char *copies[SEEDREPTEST_BATCH];
+	unsigned int expected = 0;
+	unsigned int verified;
+	unsigned int i;
+	va_list args;
+	void *der;
+	size_t len;
+	int ok = 0;
+
+	/* Populate report */
+	va_start ( args, count );
+	seedreptest_populate ( &report, desc, publisher, challenge,
+			       count, args );
+	va_end ( args );
+
+	/* Construct and sign report in DER format */
+	der = cx_seedrep_sign_der ( &report, NULL, &len );
+	if ( ! der ) {
+		fprintf ( stderr, "SEEDREPTEST %s batch could not sign\n",
+			  name );
+		goto err_sign;
+	}
+
+	/* Construct batch, modifying every third copy */
+	for ( i = 0 ; i < SEEDREPTEST_BATCH ; i++ ) {
+		copies[i] = malloc ( len );
+		if ( ! copies[i] )
+			goto err_alloc;
+		memcpy ( copies[i], der, len );
+		if ( ( i % 3 ) == 2 ) {
+			copies[i][ len - 1 - i ] ^= 0x01;
+		} else {
+			expected++;
+		}
+		ders[i].der = copies[i];
+		ders[i].len = len;
+	}
+
+	/* Verify batch */
+	verified = cx_seedrep_verify_batch ( ders, SEEDREPTEST_BATCH, NULL,
+					     reports, SEEDREPTEST_THREADS );
+	if ( verified != expected ) {
+		fprintf ( stderr, "SEEDREPTEST %s batch verified %d of %d "
+			  "reports (expected %d)\n", name, verified,
+			  SEEDREPTEST_BATCH, expected );
+		goto err_verified;
+	}
+
+	/* Check each result */
+	for ( i = 0 ; i < SEEDREPTEST_BATCH ; i++ ) {
+		if ( ( i % 3 ) == 2 ) {
+			if ( reports[i] ) {
+				fprintf ( stderr, "SEEDREPTEST %s batch "
+					  "report %d verified after "
+					  "modification\n", name, i );
+				goto err_check;
+			}
+		} else {
+			if ( ! reports[i] ) {
+				fprintf ( stderr, "SEEDREPTEST %s batch "
+					  "report %d could not verify\n",
+					  name, i );
+				goto err_check;
+			}
+			if ( ! seedreptest_check ( name, "batch", reports[i],
+						   &report ) )
+				goto err_check;
+		}
+	}
+
+	ok = 1;
+ err_check:
+ err_verified:
+	for ( i = 0 ; i < SEEDREPTEST_BATCH ; i++ )
+		cx_seedrep_free ( reports[i] );
+ err_alloc:
+	while ( i-- )
+		free ( copies[i] );
+	OPENSSL_free ( der );
+ err_sign:
+	return ok;
+}
+
+/**
+ * Run a corrupted signature test
+ *
+ * @v name		Test name
+ * @v publisher		Publisher name
+ * @v challenge		Seed report challenge
+ * @v corrupt		Index of signature to corrupt
+ * @v count		Number of seed descriptors
+ * @v ...		Seed descriptor values
+ * @ret ok		Success indicator
+ *
+ * Verification using a single thread and using multiple threads must
+ * both fail, leaving exactly one error in the OpenSSL error queue,
+ * identical in both cases and identifying the corrupted signature.
+ * Each seed descriptor key must be a 2048-bit RSA key, so that each
+ * signature value is encoded as a 256-byte OCTET STRING.
+ */
+static int seedreptest_corrupt ( const char *name, const char *publisher,
+				 const char *challenge, unsigned int corrupt,
+				 unsigned int count, ... ) {
+	static const unsigned char value[] = { 0x04, 0x82, 0x01, 0x00 };
+	static const unsigned int threads[] = { 1, SEEDREPTEST_THREADS };
+	struct cx_seed_report report;
+	struct cx_seed_descriptor desc[count];
+	CX_SEED_REPORT *seedReport;
+	const unsigned char *tmp;
+	const char *data;
+	unsigned long error;
+	unsigned long first = 0;
+	char expected[24];
+	unsigned char *der;
+	unsigned int found;
+	unsigned int i;
+	va_list args;
+	size_t offset;
+	size_t len;
+	int flags;
+	int ok = 0;
+
+	/* Populate report */
+	va_start ( args, count );
+	seedreptest_populate ( &report, desc, publisher, challenge,
+			       count, args );
+	va_end ( args );
+
+	/* Construct and sign report in DER format */
+	der = cx_seedrep_sign_der ( &report, NULL, &len );
+	if ( ! der ) {
+		fprintf ( stderr, "SEEDREPTEST %s corrupt could not sign\n",
+			  name );
+		goto err_sign;
+	}
+
+	/* Corrupt the chosen signature value */
+	for ( found = 0, offset = 0 ;
+	      ( offset + sizeof ( value ) + 256 ) <= len ; offset++ ) {
+		if ( ( memcmp ( &der[offset], value,
+				sizeof ( value ) ) == 0 ) &&
+		     ( found++ == corrupt ) )
+			break;
+	}
+	if ( ( offset + sizeof ( value ) + 256 ) > len ) {
+		fprintf ( stderr, "SEEDREPTEST %s corrupt could not find "
+			  "signature %d\n", name, corrupt );
+		goto err_find;
+	}
+	der[ offset + sizeof ( value ) + 128 ] ^= 0x01;
+	snprintf ( expected, sizeof ( expected ), "descriptor %u", corrupt );
+
+	/* Verify using each number of threads */
+	for ( i = 0 ; i < ( sizeof ( threads ) / sizeof ( threads[0] ) ) ;
+	      i++ ) {
+
+		/* Parse report */
+		tmp = der;
+		seedReport = d2i_CX_SEED_REPORT ( NULL, &tmp, len );
+		if ( ! seedReport ) {
+			fprintf ( stderr, "SEEDREPTEST %s corrupt could not "
+				  "parse\n", name );
+			goto err_parse;
+		}
+
+		/* Check that verification fails */
+		ERR_clear_error();
+		if ( CX_SEED_REPORT_verify_parallel ( seedReport,
+						      threads[i] ) ) {
+			fprintf ( stderr, "SEEDREPTEST %s corrupt verified "
+				  "with %d threads\n", name, threads[i] );
+			goto err_verified;
+		}
+
+		/* Check reported error */
+		data = NULL;
+		flags = 0;
+		error = ERR_peek_last_error_data ( &data, &flags );
+		if ( ( ! error ) || ( ! ( flags & ERR_TXT_STRING ) ) ||
+		     ( strcmp ( data, expected ) != 0 ) ||
+		     ( i && ( error != first ) ) ) {
+			fprintf ( stderr, "SEEDREPTEST %s corrupt reported "
+				  "%#lx \"%s\" with %d threads\n", name,
+				  error, ( data ? data : "" ), threads[i] );
+			goto err_error;
+		}
+		first = error;
+		ERR_get_error();
+		if ( ERR_peek_error() ) {
+			fprintf ( stderr, "SEEDREPTEST %s corrupt reported "
+				  "multiple errors with %d threads\n", name,
+				  threads[i] );
+			goto err_error;
+		}
+
+		CX_SEED_REPORT_free ( seedReport );
+	}
+
+	ok = 1;
+	goto done;
+
+ err_error:
+ err_verified:
+	CX_SEED_REPORT_free ( seedReport );
+ err_parse:
+ done:
+ err_find:
+	ERR_clear_error();
+	OPENSSL_free ( der );
+ err_sign:
+	return ok;
+}
+
+/**
+ * Run a seed report pre-validation test
+ *
+ * @v name		Test name
+ * @v publisher		Publisher name
+ * @v challenge		Seed report challenge
+ * @v count		Number of seed descriptors
+ * @v ...		Seed descriptor values
+ * @ret ok		Success indicator
+ */
+static int seedreptest_prevalidate ( const char *name, const char *publisher,
+				     const char *challenge, unsigned int count,
+				     ... ) {
+	struct cx_seed_report report;
+	struct cx_seed_descriptor desc[count];
+	struct cx_seedrep_limits limits;
+	struct cx_seed_report *parsed;
+	unsigned char *copy;
+	va_list args;
+	void *der;
+	size_t len;
+	size_t i;
+	int ok = 0;
+
+	/* Populate report */
+	va_start ( args, count );
+	seedreptest_populate ( &report, desc, publisher, challenge,
+			       count, args );
+	va_end ( args );
+
+	/* Construct and sign report in DER format */
+	der = cx_seedrep_sign_der ( &report, NULL, &len );
+	if ( ! der ) {
+		fprintf ( stderr, "SEEDREPTEST %s prevalidate could not "
+			  "sign\n", name );
+		goto err_sign;
+	}
+	copy = malloc ( len + 1 );
+	if ( ! copy )
+		goto err_alloc;
+	memcpy ( copy, der, len );
+	copy[len] = 0;
+
+	/* Check that report passes with default and exact limits */
+	limits = cx_seedrep_default_limits;
+	limits.max_len = len;
+	limits.max_descriptors = count;
+	if ( ! ( cx_seedrep_check_der ( der, len, NULL ) &&
+		 cx_seedrep_check_der ( der, len, &limits ) ) ) {
+		fprintf ( stderr, "SEEDREPTEST %s prevalidate failed\n",
+			  name );
+		goto err_pass;
+	}
+
+	/* Check that truncated or extended report fails */
+	if ( cx_seedrep_check_der ( der, ( len - 1 ), NULL ) ||
+	     cx_seedrep_check_der ( copy, ( len + 1 ), NULL ) ) {
+		fprintf ( stderr, "SEEDREPTEST %s prevalidate accepted "
+			  "truncated or extended report\n", name );
+		goto err_length;
+	}
+
+	/* Check that report exceeding limits fails */
+	limits.max_len = ( len - 1 );
+	if ( cx_seedrep_check_der ( der, len, &limits ) ) {
+		fprintf ( stderr, "SEEDREPTEST %s prevalidate accepted "
+			  "oversized report\n", name );
+		goto err_max_len;
+	}
+	limits.max_len = len;
+	limits.max_descriptors = ( count - 1 );
+	if ( cx_seedrep_check_der ( der, len, &limits ) ) {
+		fprintf ( stderr, "SEEDREPTEST %s prevalidate accepted too "
+			  "many descriptors\n", name );
+		goto err_max_descriptors;
+	}
+
+	/* Check that verification applies limits */
+	parsed = cx_seedrep_verify_der_ex ( der, len, &limits );
+	if ( parsed ) {
+		fprintf ( stderr, "SEEDREPTEST %s prevalidate verified "
+			  "despite limits\n", name );
+		cx_seedrep_free ( parsed );
+		goto err_verify;
+	}
+
+	/* Check that an unknown generator type fails */
+	for ( i = 0 ; ( i + 5 ) <= len ; i++ ) {
+		if ( ( copy[i] == 0x02 ) && ( copy[ i + 1 ] == 0x01 ) &&
+		     ( copy[ i + 2 ] == desc[0].type ) &&
+		     ( copy[ i + 3 ] == 0x04 ) &&
+		     ( copy[ i + 4 ] == desc[0].len ) ) {
+			break;
+		}
+	}
+	if ( ( i + 5 ) > len ) {
+		fprintf ( stderr, "SEEDREPTEST %s prevalidate could not find "
+			  "generator type\n", name );
+		goto err_type;
+	}
+	copy[ i + 2 ] = 0x7f;
+	if ( cx_seedrep_check_der ( copy, len, NULL ) ) {
+		fprintf ( stderr, "SEEDREPTEST %s prevalidate accepted "
+			  "modified generator type\n", name );
+		goto err_type;
+	}
+
+	ok = 1;
+ err_type:
+ err_verify:
+ err_max_descriptors:
+ err_max_len:
+ err_length:
+ err_pass:
+	free ( copy );
+ err_alloc:
+	OPENSSL_free ( der );
+ err_sign:
+	return ok;
+}
+
 /**
  * Run seed report self-tests
  *
@@ -301,5 +746,40 @@ int seedreptests ( void ) {
 					      seedcalc_type2_test3_preseed,
 					      keypair_d ) );
 
+	/* Run batch verification tests */
+	ok &= seedreptest_batch ( "batch1", "NHS", "4528 6597 3365 2261", 2,
+			    seedreptestdesc ( CX_GEN_AES_128_CTR_2048,
+					      seedcalc_type1_test1_preseed,
+					      keypair_c ),
+			    seedreptestdesc ( CX_GEN_AES_256_CTR_2048,
+					      seedcalc_type2_test1_preseed,
+					      keypair_d ) );
+
+	/* Run corrupted signature tests */
+	ok &= seedreptest_corrupt ( "corrupt1", "NHS", "4528 6597 3365 2261",
+			    2, 4,
+			    seedreptestdesc ( CX_GEN_AES_128_CTR_2048,
+					      seedcalc_type1_test1_preseed,
+					      keypair_c ),
+			    seedreptestdesc ( CX_GEN_AES_256_CTR_2048,
+					      seedcalc_type2_test1_preseed,
+					      keypair_d ),
+			    seedreptestdesc ( CX_GEN_AES_128_CTR_2048,
+					      seedcalc_type1_test2_preseed,
+					      keypair_d ),
+			    seedreptestdesc ( CX_GEN_AES_256_CTR_2048,
+					      seedcalc_type2_test2_preseed,
+					      keypair_c ) );
+
+	/* Run pre-validation tests */
+	ok &= seedreptest_prevalidate ( "prevalidate1", "CDC",
+			    "these three words", 2,
+			    seedreptestdesc ( CX_GEN_AES_128_CTR_2048,
+					      seedcalc_type1_test2_preseed,
+					      keypair_c ),
+			    seedreptestdesc ( CX_GEN_AES_256_CTR_2048,
+					      seedcalc_type2_test1_preseed,
+					      keypair_d ) );
+
 	return ok;
 }
@@ -0,0 +1,888 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Sort-merge contact ID matching
+ *
+ ******************************************************************************
+ *
+ * The observation index constructed by cx_match_create() must hold
+ * every observed contact ID in memory.  For very large observation
+ * sets (such as those used for server-side replay and simulation),
+ * this alternative matching strategy requires only a bounded amount
+ * of memory.
+ *
+ * Observed contact IDs and generated contact IDs are each
+ * radix-partitioned by the most significant bits of the contact ID
+ * into per-partition record buffers.  Whenever the buffered records
+ * for either side reach half of the memory budget, all of that
+ * side's buffered records are appended to a spill file as one extent
+ * per non-empty partition.  Once all seed values have been expanded,
+ * each partition in turn is read back, the observed and generated
+ * records are sorted, and the two sorted sequences are merge-joined.
+ *
+ * Contact IDs are uniformly distributed (other than the fixed UUID
+ * version and variant bits, which are not among the partition index
+ * bits), and so partitions are of roughly equal size.  A single
+ * partition must fit in memory while it is being joined, which
+ * allows for working sets of several hundred times the memory
+ * budget.
+ *
+ * Spill files are unlinked as soon as they are created, and so are
+ * removed automatically even if the process terminates abnormally.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <cx/sortmatch.h>
+#include "expand.h"
+#include "debug.h"
+
+/** Number of partition index bits */
+#define CX_SORTMATCH_BITS 8
+
+/** Number of partitions */
+#define CX_SORTMATCH_PARTITIONS ( 1 << CX_SORTMATCH_BITS )
+
+/** Number of radix sort digit bits */
+#define CX_SORTMATCH_RADIX_BITS 8
+
+/** Number of radix sort digit values */
+#define CX_SORTMATCH_RADIX ( 1 << CX_SORTMATCH_RADIX_BITS )
+
+/** Default memory budget */
+#define CX_SORTMATCH_DEFAULT_MEMORY ( 256 * 1024 * 1024 )
+
+/** Default spill file directory */
+#define CX_SORTMATCH_DEFAULT_DIR "/tmp"
+
+/** Spill file name template */
+#define CX_SORTMATCH_TEMPLATE "/cxsortXXXXXX"
+
+/** Initial number of records allocated for each partition */
+#define CX_SORTMATCH_MIN_RECORDS 64
+
+/** A partitioned contact ID */
+struct cx_sortmatch_record {
+	/** Most significant 64 bits */
+	uint64_t hi;
+	/** Least significant 64 bits */
+	uint64_t lo;
+	/** Index of observed contact ID or of seed value */
+	uint32_t index;
+	/** Iteration at which the contact ID was generated */
+	uint32_t iteration;
+};
+
+/** A range of records within a spill file */
+struct cx_sortmatch_extent {
+	/** Offset within spill file */
+	off_t offset;
+	/** Number of records */
+	size_t count;
+};
+
+/** A partition */
+struct cx_sortmatch_partition {
+	/** Buffered records */
+	struct cx_sortmatch_record *records;
+	/** Number of buffered records */
+	size_t count;
+	/** Number of buffered records allocated */
+	size_t alloc;
+	/** Spilled extents */
+	struct cx_sortmatch_extent *extents;
+	/** Number of spilled extents */
+	unsigned int extent_count;
+	/** Total number of spilled records */
+	size_t spilled;
+};
+
+/** One side of a sort-merge join */
+struct cx_sortmatch_side {
+	/** Partitions */
+	struct cx_sortmatch_partition parts[CX_SORTMATCH_PARTITIONS];
+	/** Total number of buffered records */
+	size_t buffered;
+	/** Spill file descriptor, or negative if not yet opened */
+	int fd;
+	/** Length of spill file */
+	off_t len;
+};
+
+/** A sort-merge matcher */
+struct cx_sortmatch {
+	/** Spill file directory */
+	char *dir;
+	/** Maximum number of buffered records for each side */
+	size_t limit;
+	/** Number of observed contact IDs */
+	unsigned int count;
+	/** Observed contact IDs */
+	struct cx_sortmatch_side observed;
+	/** Generated contact IDs */
+	struct cx_sortmatch_side generated;
+	/** Total CPU time, including spill file I/O */
+	double cpu;
+	/** CPU time spent in spill file I/O */
+	double io_cpu;
+	/** Statistics */
+	struct cx_sortmatch_stats stats;
+};
+
+/**
+ * Read clock
+ *
+ * @v clock		Clock ID
+ * @ret now		Current time (in seconds)
+ */
+static double cx_sortmatch_clock ( clockid_t clock ) {
+	struct timespec ts;
+
+	clock_gettime ( clock, &ts );
+	return ( ts.tv_sec + ( ts.tv_nsec / 1e9 ) );
+}
+
+/**
+ * Initialise one side of a sort-merge join
+ *
+ * @v side		Side
+ */
+static void cx_sortmatch_init ( struct cx_sortmatch_side *side ) {
+
+	memset ( side, 0, sizeof ( *side ) );
+	side->fd = -1;
+}
+
+/**
+ * Discard all records from one side of a sort-merge join
+ *
+ * @v side		Side
+ *
+ * Buffers are freed, and any spill file is closed (and hence
+ * deleted, since it has already been unlinked).
+ */
+static void cx_sortmatch_reset ( struct cx_sortmatch_side *side ) {
+	struct cx_sortmatch_partition *part;
+	unsigned int i;
+
+	/* Free partitions */
+	for ( i = 0 ; i < CX_SORTMATCH_PARTITIONS ; i++ ) {
+		part = &side->parts[i];
+		free ( part->records );
+		free ( part->extents );
+	}
+
+	/* Close spill file */
+	if ( side->fd >= 0 )
+		close ( side->fd );
+
+	/* Reinitialise side */
+	cx_sortmatch_init ( side );
+}
+
+/**
+ * Transfer data to or from a spill file
+ *
+ * @v sort		Sort-merge matcher
+ * @v fd		Spill file descriptor
+ * @v data		Data buffer
+ * @v len		Length of data
+ * @v offset		Offset within spill file
+ * @v writing		Transfer direction is towards the spill file
+ * @ret ok		Success indicator
+ *
+ * The elapsed time and the CPU time spent within the transfer are
+ * both recorded, so that I/O time can be reported separately from
+ * CPU time.
+ */
+static int cx_sortmatch_transfer ( struct cx_sortmatch *sort, int fd,
+				   void *data, size_t len, off_t offset,
+				   int writing ) {
+	unsigned char *bytes = data;
+	double start = cx_sortmatch_clock ( CLOCK_MONOTONIC );
+	double cpu = cx_sortmatch_clock ( CLOCK_THREAD_CPUTIME_ID );
+	size_t remaining = len;
+	ssize_t done;
+	int ok = 0;
+
+	/* Transfer data, allowing for short transfers */
+	while ( remaining ) {
+		if ( writing ) {
+			done = pwrite ( fd, bytes, remaining, offset );
+		} else {
+			done = pread ( fd, bytes, remaining, offset );
+		}
+		if ( ( done < 0 ) && ( errno == EINTR ) )
+			continue;
+		if ( done <= 0 ) {
+			DBG ( "SORTMATCH %p could not %s %zd bytes at %lld: "
+			      "%s\n", sort, ( writing ? "write" : "read" ),
+			      remaining, ( ( long long ) offset ),
+			      ( done ? strerror ( errno ) : "end of file" ) );
+			goto err;
+		}
+		bytes += done;
+		remaining -= done;
+		offset += done;
+	}
+	ok = 1;
+
+ err:
+	/* Record statistics */
+	sort->io_cpu += ( cx_sortmatch_clock ( CLOCK_THREAD_CPUTIME_ID ) -
+			  cpu );
+	sort->stats.io += ( cx_sortmatch_clock ( CLOCK_MONOTONIC ) - start );
+	if ( writing ) {
+		sort->stats.written += ( len - remaining );
+	} else {
+		sort->stats.read += ( len - remaining );
+	}
+	return ok;
+}
+
+/**
+ * Spill buffered records to disk
+ *
+ * @v sort		Sort-merge matcher
+ * @v side		Side
+ * @ret ok		Success indicator
+ */
+static int cx_sortmatch_spill ( struct cx_sortmatch *sort,
+				struct cx_sortmatch_side *side ) {
+	struct cx_sortmatch_partition *part;
+	struct cx_sortmatch_extent *extents;
+	struct cx_sortmatch_extent *extent;
+	size_t len;
+	unsigned int i;
+	char *path;
+
+	/* Create spill file, if applicable */
+	if ( side->fd < 0 ) {
+		len = ( strlen ( sort->dir ) +
+			sizeof ( CX_SORTMATCH_TEMPLATE ) );
+		path = malloc ( len );
+		if ( ! path )
+			return 0;
+		snprintf ( path, len, "%s%s", sort->dir,
+			   CX_SORTMATCH_TEMPLATE );
+		side->fd = mkstemp ( path );
+		if ( side->fd < 0 ) {
+			DBG ( "SORTMATCH %p could not create spill file in "
+			      "%s: %s\n", sort, sort->dir,
+			      strerror ( errno ) );
+			free ( path );
+			return 0;
+		}
+		unlink ( path );
+		free ( path );
+	}
+
+	/* Append each non-empty partition as a new extent */
+	for ( i = 0 ; i < CX_SORTMATCH_PARTITIONS ; i++ ) {
+		part = &side->parts[i];
+		if ( ! part->count )
+			continue;
+		extents = realloc ( part->extents,
+				    ( ( part->extent_count + 1 ) *
+				      sizeof ( part->extents[0] ) ) );
+		if ( ! extents )
+			return 0;
+		part->extents = extents;
+		len = ( part->count * sizeof ( part->records[0] ) );
+		if ( ! cx_sortmatch_transfer ( sort, side->fd, part->records,
+					       len, side->len, 1 ) )
+			return 0;
+		extent = &part->extents[ part->extent_count++ ];
+		extent->offset = side->len;
+		extent->count = part->count;
+		side->len += len;
+		part->spilled += part->count;
+		part->count = 0;
+	}
+	side->buffered = 0;
+
+	return 1;
+}
+
+/**
+ * Add record to one side of a sort-merge join
+ *
+ * @v sort		Sort-merge matcher
+ * @v side		Side
+ * @v id		Contact ID
+ * @v index		Index of observed contact ID or of seed value
+ * @v iteration		Iteration at which the contact ID was generated
+ * @ret ok		Success indicator
+ */
+static int cx_sortmatch_add ( struct cx_sortmatch *sort,
+			      struct cx_sortmatch_side *side,
+			      const struct cx_contact_id *id,
+			      unsigned int index, unsigned int iteration ) {
+	struct cx_sortmatch_partition *part;
+	struct cx_sortmatch_record *records;
+	struct cx_sortmatch_record *record;
+	uint64_t hi = cx_expand_be64 ( &id->bytes[0] );
+	size_t grow;
+
+	/* Identify partition */
+	part = &side->parts[ hi >> ( 64 - CX_SORTMATCH_BITS ) ];
+
+	/* Grow partition buffer, if necessary */
+	if ( part->count == part->alloc ) {
+		grow = ( part->alloc ? ( part->alloc * 2 ) :
+			 CX_SORTMATCH_MIN_RECORDS );
+		records = realloc ( part->records,
+				    ( grow * sizeof ( part->records[0] ) ) );
+		if ( ! records )
+			return 0;
+		part->records = records;
+		part->alloc = grow;
+	}
+
+	/* Add record */
+	record = &part->records[ part->count++ ];
+	record->hi = hi;
+	record->lo = cx_expand_be64 ( &id->bytes[8] );
+	record->index = index;
+	record->iteration = iteration;
+
+	/* Spill buffered records, if memory budget is reached */
+	if ( ++side->buffered >= sort->limit )
+		return cx_sortmatch_spill ( sort, side );
+
+	return 1;
+}
+
+/**
+ * Partition generated contact IDs
+ *
+ * @v ctx		Sort-merge matcher
+ * @v ids		Generated contact IDs
+ * @v count		Number of generated contact IDs
+ * @v seed		Index of seed value
+ * @v iteration		Iteration at which first contact ID was generated
+ * @ret ok		Success indicator
+ */
+static int cx_sortmatch_partition ( void *ctx,
+				    const struct cx_contact_id *ids,
+				    unsigned int count, unsigned int seed,
+				    unsigned int iteration ) {
+	struct cx_sortmatch *sort = ctx;
+	unsigned int i;
+
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ! cx_sortmatch_add ( sort, &sort->generated, &ids[i],
+					  seed, ( iteration + i ) ) )
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Load all records within a partition
+ *
+ * @v sort		Sort-merge matcher
+ * @v side		Side
+ * @v index		Partition index
+ * @v count		Number of records to fill in
+ * @ret records		Records, or NULL on error
+ *
+ * The caller is responsible for freeing the returned records.
+ */
+static struct cx_sortmatch_record *
+cx_sortmatch_load ( struct cx_sortmatch *sort, struct cx_sortmatch_side *side,
+		    unsigned int index, size_t *count ) {
+	struct cx_sortmatch_partition *part = &side->parts[index];
+	struct cx_sortmatch_extent *extent;
+	struct cx_sortmatch_record *records;
+	struct cx_sortmatch_record *record;
+	unsigned int i;
+
+	/* Allocate records */
+	*count = ( part->spilled + part->count );
+	records = malloc ( ( *count ? *count : 1 ) * sizeof ( records[0] ) );
+	if ( ! records )
+		goto err_alloc;
+	record = records;
+
+	/* Read spilled extents */
+	for ( i = 0 ; i < part->extent_count ; i++ ) {
+		extent = &part->extents[i];
+		if ( ! cx_sortmatch_transfer ( sort, side->fd, record,
+					       ( extent->count *
+						 sizeof ( record[0] ) ),
+					       extent->offset, 0 ) )
+			goto err_read;
+		record += extent->count;
+	}
+
+	/* Copy buffered records */
+	memcpy ( record, part->records,
+		 ( part->count * sizeof ( record[0] ) ) );
+
+	return records;
+
+ err_read:
+	free ( records );
+ err_alloc:
+	return NULL;
+}
+
+/**
+ * Compare records
+ *
+ * @v first		First record
+ * @v second		Second record
+ * @ret diff		Difference
+ */
+static int cx_sortmatch_compare ( const void *first, const void *second ) {
+	const struct cx_sortmatch_record *a = first;
+	const struct cx_sortmatch_record *b = second;
+
+	if ( a->hi != b->hi )
+		return ( ( a->hi < b->hi ) ? -1 : 1 );
+	if ( a->lo != b->lo )
+		return ( ( a->lo < b->lo ) ? -1 : 1 );
+	if ( a->index != b->index )
+		return ( ( a->index < b->index ) ? -1 : 1 );
+	if ( a->iteration != b->iteration )
+		return ( ( a->iteration < b->iteration ) ? -1 : 1 );
+	return 0;
+}
+
+/**
+ * Sort records
+ *
+ * @v records		Records
+ * @v count		Number of records
+ * @ret ok		Success indicator
+ *
+ * Records within a partition share their most significant bits, and
+ * the remaining bits of the most significant 64 bits are very nearly
+ * unique.  Records are therefore sorted using a least significant
+ * digit radix sort on the most significant 64 bits (skipping any
+ * digit that is identical for all records), and only runs of records
+ * that remain tied are then sorted by comparison.
+ */
+static int cx_sortmatch_sort ( struct cx_sortmatch_record *records,
+			       size_t count ) {
+	struct cx_sortmatch_record *scratch;
+	struct cx_sortmatch_record *from;
+	struct cx_sortmatch_record *to;
+	struct cx_sortmatch_record *tmp;
+	size_t offsets[CX_SORTMATCH_RADIX];
+	size_t total;
+	size_t start;
+	size_t i;
+	unsigned int shift;
+	unsigned int digit;
+
+	/* Allocate scratch space */
+	scratch = malloc ( ( count ? count : 1 ) * sizeof ( scratch[0] ) );
+	if ( ! scratch )
+		return 0;
+
+	/* Sort by each digit below the partition index bits */
+	from = records;
+	to = scratch;
+	for ( shift = 0 ; shift < ( 64 - CX_SORTMATCH_BITS ) ;
+	      shift += CX_SORTMATCH_RADIX_BITS ) {
+
+		/* Count occurrences of each digit */
+		memset ( offsets, 0, sizeof ( offsets ) );
+		for ( i = 0 ; i < count ; i++ ) {
+			digit = ( ( from[i].hi >> shift ) &
+				  ( CX_SORTMATCH_RADIX - 1 ) );
+			offsets[digit]++;
+		}
+
+		/* Skip digits that are identical for all records */
+		digit = ( count ? ( ( from[0].hi >> shift ) &
+				    ( CX_SORTMATCH_RADIX - 1 ) ) : 0 );
+		if ( offsets[digit] == count )
+			continue;
+
+		/* Convert counts to offsets and scatter records */
+		for ( total = 0, digit = 0 ; digit < CX_SORTMATCH_RADIX ;
+		      digit++ ) {
+			i = offsets[digit];
+			offsets[digit] = total;
+			total += i;
+		}
+		for ( i = 0 ; i < count ; i++ ) {
+			digit = ( ( from[i].hi >> shift ) &
+				  ( CX_SORTMATCH_RADIX - 1 ) );
+			to[ offsets[digit]++ ] = from[i];
+		}
+		tmp = from;
+		from = to;
+		to = tmp;
+	}
+	if ( from != records )
+		memcpy ( records, from, ( count * sizeof ( records[0] ) ) );
+	free ( scratch );
+
+	/* Sort any runs with tied most significant 64 bits */
+	for ( start = 0, i = 1 ; i <= count ; i++ ) {
+		if ( ( i < count ) && ( records[i].hi == records[start].hi ) )
+			continue;
+		if ( ( i - start ) > 1 ) {
+			qsort ( &records[start], ( i - start ),
+				sizeof ( records[0] ), cx_sortmatch_compare );
+		}
+		start = i;
+	}
+
+	return 1;
+}
+
+/**
+ * Compare matches
+ *
+ * @v first		First match
+ * @v second		Second match
+ * @ret diff		Difference
+ */
+static int cx_sortmatch_compare_hit ( const void *first,
+				      const void *second ) {
+	const struct cx_match_hit *a = first;
+	const struct cx_match_hit *b = second;
+
+	if ( a->seed != b->seed )
+		return ( ( a->seed < b->seed ) ? -1 : 1 );
+	if ( a->iteration != b->iteration )
+		return ( ( a->iteration < b->iteration ) ? -1 : 1 );
+	if ( a->observation != b->observation )
+		return ( ( a->observation < b->observation ) ? -1 : 1 );
+	return 0;
+}
+
+/**
+ * Merge-join a partition
+ *
+ * @v sort		Sort-merge matcher
+ * @v index		Partition index
+ * @v result		Match result
+ * @v max		Number of matches allocated
+ * @ret ok		Success indicator
+ */
+static int cx_sortmatch_join ( struct cx_sortmatch *sort, unsigned int index,
+			       struct cx_match_result *result,
+			       unsigned int *max ) {
+	struct cx_sortmatch_record *observed;
+	struct cx_sortmatch_record *generated;
+	size_t observed_count;
+	size_t generated_count;
+	size_t observed_end;
+	size_t generated_end;
+	size_t i;
+	size_t j;
+	size_t k;
+	size_t l;
+
+	/* Skip partitions that cannot contain any matches */
+	if ( ! ( sort->observed.parts[index].spilled +
+		 sort->observed.parts[index].count ) )
+		return 1;
+	if ( ! ( sort->generated.parts[index].spilled +
+		 sort->generated.parts[index].count ) )
+		return 1;
+
+	/* Load and sort both sides */
+	observed = cx_sortmatch_load ( sort, &sort->observed, index,
+				       &observed_count );
+	if ( ! observed )
+		goto err_observed;
+	generated = cx_sortmatch_load ( sort, &sort->generated, index,
+					&generated_count );
+	if ( ! generated )
+		goto err_generated;
+	if ( ! cx_sortmatch_sort ( observed, observed_count ) )
+		goto err_sort;
+	if ( ! cx_sortmatch_sort ( generated, generated_count ) )
+		goto err_sort;
+
+	/* Merge-join sorted records */
+	for ( i = 0, j = 0 ; ( ( i < generated_count ) &&
+			       ( j < observed_count ) ) ; ) {
+
+		/* Advance whichever side has the lower contact ID */
+		if ( ( generated[i].hi < observed[j].hi ) ||
+		     ( ( generated[i].hi == observed[j].hi ) &&
+		       ( generated[i].lo < observed[j].lo ) ) ) {
+			i++;
+			continue;
+		}
+		if ( ( generated[i].hi != observed[j].hi ) ||
+		     ( generated[i].lo != observed[j].lo ) ) {
+			j++;
+			continue;
+		}
+
+		/* Find runs of equal contact IDs on each side */
+		for ( generated_end = ( i + 1 ) ;
+		      ( ( generated_end < generated_count ) &&
+			( generated[generated_end].hi == generated[i].hi ) &&
+			( generated[generated_end].lo == generated[i].lo ) ) ;
+		      generated_end++ ) {}
+		for ( observed_end = ( j + 1 ) ;
+		      ( ( observed_end < observed_count ) &&
+			( observed[observed_end].hi == observed[j].hi ) &&
+			( observed[observed_end].lo == observed[j].lo ) ) ;
+		      observed_end++ ) {}
+
+		/* Record each pairing within the runs */
+		for ( k = i ; k < generated_end ; k++ ) {
+			for ( l = j ; l < observed_end ; l++ ) {
+				if ( ! cx_expand_hit ( result, max,
+						       generated[k].index,
+						       generated[k].iteration,
+						       observed[l].index ) ) {
+					DBG ( "SORTMATCH %p could not record "
+					      "match\n", sort );
+					goto err_record;
+				}
+			}
+		}
+		i = generated_end;
+		j = observed_end;
+	}
+
+	/* Free records */
+	free ( generated );
+	free ( observed );
+
+	return 1;
+
+ err_record:
+ err_sort:
+	free ( generated );
+ err_generated:
+	free ( observed );
+ err_observed:
+	return 0;
+}
+
+/**
+ * Create sort-merge matcher
+ *
+ * @v dir		Spill file directory, or NULL to use the default
+ * @v memory		Memory budget (in bytes), or zero to use the default
+ * @ret sort		Sort-merge matcher, or NULL on error
+ *
+ * The memory budget bounds the space used for buffering records
+ * before they are spilled to disk.  Joining a partition additionally
+ * requires space for all of that partition's records (of which there
+ * are 256 in total).
+ */
+struct cx_sortmatch * cx_sortmatch_create ( const char *dir, size_t memory ) {
+	struct cx_sortmatch *sort;
+
+	/* Apply defaults */
+	if ( ! dir ) {
+		dir = getenv ( "TMPDIR" );
+		if ( ! dir )
+			dir = CX_SORTMATCH_DEFAULT_DIR;
+	}
+	if ( ! memory )
+		memory = CX_SORTMATCH_DEFAULT_MEMORY;
+
+	/* Allocate and initialise structure */
+	sort = malloc ( sizeof ( *sort ) );
+	if ( ! sort )
+		goto err_alloc;
+	memset ( sort, 0, sizeof ( *sort ) );
+	sort->dir = strdup ( dir );
+	if ( ! sort->dir )
+		goto err_dir;
+	sort->limit = ( memory /
+			( 2 * sizeof ( struct cx_sortmatch_record ) ) );
+	if ( ! sort->limit )
+		sort->limit = 1;
+	cx_sortmatch_init ( &sort->observed );
+	cx_sortmatch_init ( &sort->generated );
+
+	return sort;
+
+	free ( sort->dir );
+ err_dir:
+	free ( sort );
+ err_alloc:
+	return NULL;
+}
+
+/**
+ * Add observed contact IDs
+ *
+ * @v sort		Sort-merge matcher
+ * @v ids		Observed contact IDs
+ * @v count		Number of observed contact IDs
+ * @ret ok		Success indicator
+ *
+ * Observations may be added in any number of calls.  Observed
+ * contact IDs are numbered consecutively from zero across all calls.
+ */
+int cx_sortmatch_observe ( struct cx_sortmatch *sort,
+			   const struct cx_contact_id *ids,
+			   unsigned int count ) {
+	double start = cx_sortmatch_clock ( CLOCK_THREAD_CPUTIME_ID );
+	unsigned int i;
+	int ok = 0;
+
+	/* Check for overflow */
+	if ( ( sort->count + count ) < sort->count ) {
+		DBG ( "SORTMATCH %p too many observations\n", sort );
+		goto err_overflow;
+	}
+
+	/* Partition observed contact IDs */
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( ! cx_sortmatch_add ( sort, &sort->observed, &ids[i],
+					  sort->count, 0 ) )
+			goto err_add;
+		sort->count++;
+	}
+
+	ok = 1;
+ err_add:
+ err_overflow:
+	sort->cpu += ( cx_sortmatch_clock ( CLOCK_THREAD_CPUTIME_ID ) -
+		       start );
+	return ok;
+}
+
+/**
+ * Match seed values against observed contact IDs
+ *
+ * @v sort		Sort-merge matcher
+ * @v seeds		Seed values
+ * @v count		Number of seed values
+ * @ret result		Match result, or NULL on error
+ *
+ * Seed values are expanded over their iteration ranges (as for
+ * cx_match_seeds()), and every generated contact ID is
+ * radix-partitioned alongside the observed contact IDs.  The result
+ * is identical to that of cx_match_seeds(), and must eventually be
+ * freed using cx_match_result_free().
+ */
+struct cx_match_result *
+cx_sortmatch_seeds ( struct cx_sortmatch *sort,
+		     const struct cx_match_seed *seeds, unsigned int count ) {
+	double start = cx_sortmatch_clock ( CLOCK_THREAD_CPUTIME_ID );
+	struct cx_match_result *result;
+	struct cx_expand expand;
+	unsigned int hits = 0;
+	unsigned int i;
+
+	/* Allocate and initialise result */
+	result = malloc ( sizeof ( *result ) );
+	if ( ! result )
+		goto err_alloc;
+	result->hits = NULL;
+	result->count = 0;
+	memset ( &expand, 0, sizeof ( expand ) );
+
+	/* Expand and partition seed values */
+	if ( ! cx_expand_seeds ( &expand, seeds, 0, count,
+				 cx_sortmatch_partition, sort ) )
+		goto err_expand;
+
+	/* Merge-join each partition */
+	for ( i = 0 ; i < CX_SORTMATCH_PARTITIONS ; i++ ) {
+		if ( ! cx_sortmatch_join ( sort, i, result, &hits ) )
+			goto err_join;
+	}
+
+	/* Sort matches into the same order as cx_match_seeds() */
+	if ( result->count ) {
+		qsort ( result->hits, result->count,
+			sizeof ( result->hits[0] ), cx_sortmatch_compare_hit );
+	}
+
+	/* Discard generated contact IDs */
+	cx_sortmatch_reset ( &sort->generated );
+	cx_expand_free ( &expand );
+
+	sort->cpu += ( cx_sortmatch_clock ( CLOCK_THREAD_CPUTIME_ID ) -
+		       start );
+	return result;
+
+ err_join:
+ err_expand:
+	cx_sortmatch_reset ( &sort->generated );
+	cx_expand_free ( &expand );
+	cx_match_result_free ( result );
+ err_alloc:
+	sort->cpu += ( cx_sortmatch_clock ( CLOCK_THREAD_CPUTIME_ID ) -
+		       start );
+	return NULL;
+}
+
+/**
+ * Get sort-merge matching statistics
+ *
+ * @v sort		Sort-merge matcher
+ * @v stats		Statistics to fill in
+ *
+ * Statistics are cumulative over the lifetime of the sort-merge
+ * matcher.
+ */
+void cx_sortmatch_stats ( struct cx_sortmatch *sort,
+			  struct cx_sortmatch_stats *stats ) {
+
+	memcpy ( stats, &sort->stats, sizeof ( *stats ) );
+	stats->cpu = ( sort->cpu - sort->io_cpu );
+	if ( stats->cpu < 0 )
+		stats->cpu = 0;
+}
+
+/**
+ * Free sort-merge matcher
+ *
+ * @v sort		Sort-merge matcher
+ */
+void cx_sortmatch_free ( struct cx_sortmatch *sort ) {
+
+	/* Do nothing if freeing a NULL pointer */
+	if ( ! sort )
+		return;
+
+	/* Free observed and generated contact IDs */
+	cx_sortmatch_reset ( &sort->generated );
+	cx_sortmatch_reset ( &sort->observed );
+
+	/* Free structure */
+	free ( sort->dir );
+	free ( sort );
+}
@@ -0,0 +1,337 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * Sort-merge contact ID matching self-tests
+ *
+ ******************************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <cx/match.h>
+#include <cx/sortmatch.h>
+#include "cxtest.h"
+#include "sortmatchtest.h"
+
+/** Number of seed values */
+#define SORTMATCHTEST_SEEDS 12
+
+/** Number of observed contact IDs */
+#define SORTMATCHTEST_OBSERVATIONS 200
+
+/** A sort-merge matching self-test */
+struct sortmatchtest {
+	/** Test name */
+	const char *name;
+	/** Memory budget */
+	size_t memory;
+	/** Spill files are expected to be used */
+	int spill;
+	/** Iteration ranges are applied */
+	int window;
+};
+
+/** Sort-merge matching self-tests */
+static const struct sortmatchtest sortmatchtests_all[] = {
+	{ "default", 0, 0, 0 },
+	{ "spill", 65536, 1, 0 },
+	{ "tiny", 1, 1, 0 },
+	{ "window", 65536, 1, 1 },
+};
+
+/**
+ * Run a sort-merge matching self-test
+ *
+ * @v test		Sort-merge matching self-test
+ * @v match		Observation index
+ * @v seeds		Seed values
+ * @v observed		Observed contact IDs
+ * @ret ok		Success indicator
+ *
+ * The result is compared against the result from the observation
+ * index.  Observations are added in two separate calls.
+ */
+static int sortmatchtest ( const struct sortmatchtest *test,
+			   struct cx_match *match,
+			   struct cx_match_seed *seeds,
+			   const struct cx_contact_id *observed ) {
+	struct cx_sortmatch_stats stats;
+	struct cx_match_result *expected;
+	struct cx_match_result *result;
+	struct cx_sortmatch *sort;
+	unsigned int split = ( SORTMATCHTEST_OBSERVATIONS / 3 );
+	unsigned int i;
+
+	/* Apply iteration ranges, if applicable */
+	for ( i = 0 ; i < SORTMATCHTEST_SEEDS ; i++ ) {
+		seeds[i].first = ( test->window ? ( i * 150 ) : 0 );
+		seeds[i].last = ( test->window ? ( i * 170 ) : 0 );
+	}
+
+	/* Match using observation index */
+	expected = cx_match_seeds ( match, seeds, SORTMATCHTEST_SEEDS );
+	if ( ! expected ) {
+		fprintf ( stderr, "SORTMATCH %s fail: could not match using "
+			  "index\n", test->name );
+		goto err_expected;
+	}
+
+	/* Create sort-merge matcher */
+	sort = cx_sortmatch_create ( NULL, test->memory );
+	if ( ! sort ) {
+		fprintf ( stderr, "SORTMATCH %s fail: could not create\n",
+			  test->name );
+		goto err_create;
+	}
+
+	/* Add observations */
+	if ( ( ! cx_sortmatch_observe ( sort, observed, split ) ) ||
+	     ( ! cx_sortmatch_observe ( sort, &observed[split],
+					( SORTMATCHTEST_OBSERVATIONS -
+					  split ) ) ) ) {
+		fprintf ( stderr, "SORTMATCH %s fail: could not observe\n",
+			  test->name );
+		goto err_observe;
+	}
+
+	/* Match seed values twice, to check that the matcher is reusable */
+	for ( i = 0 ; i < 2 ; i++ ) {
+		result = cx_sortmatch_seeds ( sort, seeds,
+					      SORTMATCHTEST_SEEDS );
+		if ( ! result ) {
+			fprintf ( stderr, "SORTMATCH %s fail: could not "
+				  "match\n", test->name );
+			goto err_seeds;
+		}
+		if ( ( result->count != expected->count ) ||
+		     ( memcmp ( result->hits, expected->hits,
+				( expected->count *
+				  sizeof ( expected->hits[0] ) ) ) != 0 ) ) {
+			fprintf ( stderr, "SORTMATCH %s fail: mismatch (%d "
+				  "hits, expected %d)\n", test->name,
+				  result->count, expected->count );
+			cx_match_result_free ( result );
+			goto err_mismatch;
+		}
+		cx_match_result_free ( result );
+	}
+
+	/* Check statistics */
+	cx_sortmatch_stats ( sort, &stats );
+	if ( ( !! stats.written ) != test->spill ) {
+		fprintf ( stderr, "SORTMATCH %s fail: wrote %llu bytes\n",
+			  test->name, stats.written );
+		goto err_stats;
+	}
+	if ( ( stats.read > stats.written ) ||
+	     ( ( !! stats.read ) != test->spill ) ) {
+		fprintf ( stderr, "SORTMATCH %s fail: read %llu of %llu "
+			  "bytes\n", test->name, stats.read, stats.written );
+		goto err_stats;
+	}
+
+	/* Free matcher and result */
+	cx_sortmatch_free ( sort );
+	cx_match_result_free ( expected );
+
+	fprintf ( stderr, "SORTMATCH %s ok\n", test->name );
+	return 1;
+
+ err_stats:
+ err_mismatch:
+ err_seeds:
+ err_observe:
+	cx_sortmatch_free ( sort );
+ err_create:
+	cx_match_result_free ( expected );
+ err_expected:
+	return 0;
+}
+
+/**
+ * Run sort-merge matching self-test with no matches
+ *
+ * @v seeds		Seed values
+ * @ret ok		Success indicator
+ *
+ * The only observation is a contact ID that is never generated, so
+ * the result must be empty rather than an error.
+ */
+static int sortmatchtest_nomatch ( struct cx_match_seed *seeds ) {
+	struct cx_match_result *result;
+	struct cx_sortmatch *sort;
+	struct cx_contact_id unseen;
+
+	/* Create sort-merge matcher */
+	sort = cx_sortmatch_create ( NULL, 0 );
+	if ( ! sort ) {
+		fprintf ( stderr, "SORTMATCH nomatch fail: could not "
+			  "create\n" );
+		goto err_create;
+	}
+
+	/* Add an observation that is never generated */
+	memset ( &unseen, 0, sizeof ( unseen ) );
+	if ( ! cx_sortmatch_observe ( sort, &unseen, 1 ) ) {
+		fprintf ( stderr, "SORTMATCH nomatch fail: could not "
+			  "observe\n" );
+		goto err_observe;
+	}
+
+	/* Match seed values */
+	result = cx_sortmatch_seeds ( sort, seeds, SORTMATCHTEST_SEEDS );
+	if ( ! result ) {
+		fprintf ( stderr, "SORTMATCH nomatch fail: could not "
+			  "match\n" );
+		goto err_seeds;
+	}
+	if ( result->count ) {
+		fprintf ( stderr, "SORTMATCH nomatch fail: %d unexpected "
+			  "hits\n", result->count );
+		goto err_count;
+	}
+
+	cx_match_result_free ( result );
+	cx_sortmatch_free ( sort );
+
+	fprintf ( stderr, "SORTMATCH nomatch ok\n" );
+	return 1;
+
+ err_count:
+	cx_match_result_free ( result );
+ err_seeds:
+ err_observe:
+	cx_sortmatch_free ( sort );
+ err_create:
+	return 0;
+}
+
+/**
+ * Run invalid sort-merge matching self-test
+ *
+ * @v seeds		Seed values
+ * @v observed		Observed contact IDs
+ * @ret ok		Success indicator
+ */
+static int sortmatchtest_invalid ( struct cx_match_seed *seeds,
+				   const struct cx_contact_id *observed ) {
+	struct cx_match_result *result;
+	struct cx_sortmatch *sort;
+	size_t len;
+
+	/* Check that an unusable spill directory is reported */
+	sort = cx_sortmatch_create ( "/nonexistent", 1 );
+	if ( ! sort ) {
+		fprintf ( stderr, "SORTMATCH invalid fail: could not "
+			  "create\n" );
+		goto err_create_bad;
+	}
+	if ( cx_sortmatch_observe ( sort, observed,
+				    SORTMATCHTEST_OBSERVATIONS ) ) {
+		fprintf ( stderr, "SORTMATCH invalid fail: spilled to "
+			  "nonexistent directory\n" );
+		goto err_observe_bad;
+	}
+	cx_sortmatch_free ( sort );
+
+	/* Check that an invalid seed value is rejected */
+	sort = cx_sortmatch_create ( NULL, 0 );
+	if ( ! sort ) {
+		fprintf ( stderr, "SORTMATCH invalid fail: could not "
+			  "create\n" );
+		goto err_create;
+	}
+	len = seeds[1].len--;
+	result = cx_sortmatch_seeds ( sort, seeds, SORTMATCHTEST_SEEDS );
+	seeds[1].len = len;
+	if ( result ) {
+		fprintf ( stderr, "SORTMATCH invalid fail: accepted invalid "
+			  "seed\n" );
+		cx_match_result_free ( result );
+		goto err_accepted;
+	}
+	cx_sortmatch_free ( sort );
+
+	/* Check that freeing a NULL pointer is harmless */
+	cx_sortmatch_free ( NULL );
+
+	fprintf ( stderr, "SORTMATCH invalid ok\n" );
+	return 1;
+
+ err_accepted:
+ err_observe_bad:
+	cx_sortmatch_free ( sort );
+ err_create:
+ err_create_bad:
+	return 0;
+}
+
+/**
+ * Run sort-merge matching self-tests
+ *
+ * @ret ok		Success indicator
+ */
+int sortmatchtests ( void ) {
+	unsigned char raw[SORTMATCHTEST_SEEDS][CXTEST_MATCH_SEED_LEN];
+	struct cx_match_seed seeds[SORTMATCHTEST_SEEDS];
+	struct cx_contact_id observed[SORTMATCHTEST_OBSERVATIONS];
+	struct cx_match *match;
+	unsigned int i;
+	int ok = 1;
+
+	/* Construct seed values and observations */
+	cxtest_match_seeds ( seeds, raw, SORTMATCHTEST_SEEDS );
+	if ( ! cxtest_match_observe ( "SORTMATCH", seeds,
+				      SORTMATCHTEST_SEEDS, observed,
+				      SORTMATCHTEST_OBSERVATIONS ) )
+		return 0;
+
+	/* Include contact IDs never generated */
+	for ( i = 8 ; i < SORTMATCHTEST_OBSERVATIONS ; i += 9 )
+		observed[i].bytes[0] ^= 0x80;
+
+	/* Create observation index for comparison */
+	match = cx_match_create ( observed, SORTMATCHTEST_OBSERVATIONS );
+	if ( ! match ) {
+		fprintf ( stderr, "SORTMATCH fail: could not create index\n" );
+		return 0;
+	}
+
+	/* Run tests */
+	for ( i = 0 ; i < ( sizeof ( sortmatchtests_all ) /
+			    sizeof ( sortmatchtests_all[0] ) ) ; i++ ) {
+		ok &= sortmatchtest ( &sortmatchtests_all[i], match, seeds,
+				      observed );
+	}
+	ok &= sortmatchtest_nomatch ( seeds );
+	ok &= sortmatchtest_invalid ( seeds, observed );
+
+	cx_match_free ( match );
+	return ok;
+}
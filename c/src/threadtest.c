@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <cx/generator.h>
+#include "cxtest.h"
+#include "threadtest.h"
+
+/** Number of concurrent threads */
+#define THREADTEST_THREADS 8
+
+/** Number of seed values expanded by each thread */
+#define THREADTEST_SEEDS 5
+
+/** Number of times each thread repeats its expansions */
+#define THREADTEST_ROUNDS 4
+
+/** A concurrent expansion thread */
+struct threadtest {
+	/** Thread */
+	pthread_t thread;
+	/** Start gate */
+	pthread_rwlock_t *gate;
+	/** Thread index */
+	unsigned int index;
+	/** Generator type */
+	enum cx_generator_type type;
+	/** Base seed value */
+	const unsigned char *seed;
+	/** Length of seed value */
+	size_t len;
+	/** Expected maximum number of contact identifiers */
+	unsigned int max;
+	/** Contact identifiers from individual expansion */
+	struct cx_contact_id *single;
+	/** Contact identifiers from multiple seed expansion */
+	struct cx_contact_id *multi;
+	/** Success indicator */
+	int ok;
+};
+
+/**
+ * Construct distinct seed value
+ *
+ * @v base		Base seed value
+ * @v len		Length of seed value
+ * @v index		Thread index
+ * @v i			Seed index within thread
+ * @v seed		Seed value to fill in
+ */
+static void threadtest_seed ( const unsigned char *base, size_t len,
+			      unsigned int index, unsigned int i,
+			      unsigned char *seed ) {
+
+	memcpy ( seed, base, len );
+	seed[0] ^= i;
+	seed[1] ^= index;
+}
+
+/**
+ * Run expansions within a single thread
+ *
+ * @v arg		Concurrent expansion thread
+ * @ret ret		Return value (unused)
+ */
+static void * threadtest_run ( void *arg ) {
+	struct threadtest *test = arg;
+	unsigned char seeds[THREADTEST_SEEDS][test->len];
+	struct cx_contact_id *ids;
+	unsigned int round;
+	unsigned int i;
+
+	/* Construct seed values */
+	for ( i = 0 ; i < THREADTEST_SEEDS ; i++ ) {
+		threadtest_seed ( test->seed, test->len, test->index, i,
+				  seeds[i] );
+	}
+
+	/* Wait for all threads to be created, so that even first-use
+	 * initialisation takes place concurrently.
+	 */
+	pthread_rwlock_rdlock ( test->gate );
+	pthread_rwlock_unlock ( test->gate );
+
+	/* Repeatedly expand seed values */
+	for ( round = 0 ; round < THREADTEST_ROUNDS ; round++ ) {
+
+		/* Expand each seed value individually */
+		for ( i = 0 ; i < THREADTEST_SEEDS ; i++ ) {
+			ids = &test->single[ i * test->max ];
+			if ( ! cx_gen_expand ( test->type, seeds[i], test->len,
+					       ids ) ) {
+				fprintf ( stderr, "THREAD %d fail: could not "
+					  "expand seed %d\n", test->index, i );
+				return NULL;
+			}
+		}
+
+		/* Expand all seed values together */
+		ids = test->multi;
+		if ( ! cx_gen_expand_multi ( test->type, seeds, test->len,
+					     THREADTEST_SEEDS, ids ) ) {
+			fprintf ( stderr, "THREAD %d fail: could not expand "
+				  "multiple seeds\n", test->index );
+			return NULL;
+		}
+
+		/* Compare results */
+		if ( memcmp ( test->single, test->multi,
+			      ( THREADTEST_SEEDS * test->max *
+				sizeof ( test->single[0] ) ) ) != 0 ) {
+			fprintf ( stderr, "THREAD %d fail: multi mismatch\n",
+				  test->index );
+			return NULL;
+		}
+	}
+
+	test->ok = 1;
+	return NULL;
+}
+
+/**
+ * Run a concurrent expansion self-test
+ *
+ * @v name		Test name
+ * @v type		Generator type
+ * @v seed		Base seed value
+ * @v len		Length of seed value
+ * @ret ok		Success indicator
+ *
+ * Each thread expands its own set of seed values, both individually
+ * and in bulk, and the results are then checked against a
+ * single-threaded expansion of the same seed values.
+ */
+static int threadtest ( const char *name, enum cx_generator_type type,
+			const unsigned char *seed, size_t len ) {
+	struct threadtest tests[THREADTEST_THREADS];
+	struct threadtest *test;
+	struct cx_contact_id *ids;
+	pthread_rwlock_t gate = PTHREAD_RWLOCK_INITIALIZER;
+	unsigned char check[len];
+	unsigned int max = cx_gen_max_iterations ( type );
+	unsigned int count;
+	unsigned int i;
+	unsigned int j;
+	int ok = 0;
+
+	/* Allocate reference contact IDs */
+	ids = calloc ( max, sizeof ( *ids ) );
+	if ( ! ids ) {
+		fprintf ( stderr, "THREAD %s fail: out of memory\n", name );
+		goto err_alloc_ids;
+	}
+
+	/* Allocate per-thread contact IDs */
+	memset ( tests, 0, sizeof ( tests ) );
+	for ( i = 0 ; i < THREADTEST_THREADS ; i++ ) {
+		test = &tests[i];
+		test->gate = &gate;
+		test->index = i;
+		test->type = type;
+		test->seed = seed;
+		test->len = len;
+		test->max = max;
+		test->single = calloc ( ( THREADTEST_SEEDS * max ),
+					sizeof ( test->single[0] ) );
+		test->multi = calloc ( ( THREADTEST_SEEDS * max ),
+				       sizeof ( test->multi[0] ) );
+		if ( ! ( test->single && test->multi ) ) {
+			fprintf ( stderr, "THREAD %s fail: out of memory\n",
+				  name );
+			goto err_alloc;
+		}
+	}
+
+	/* Create threads, holding them at the start gate */
+	pthread_rwlock_wrlock ( &gate );
+	for ( count = 0 ; count < THREADTEST_THREADS ; count++ ) {
+		test = &tests[count];
+		if ( pthread_create ( &test->thread, NULL, threadtest_run,
+				      test ) != 0 ) {
+			fprintf ( stderr, "THREAD %s fail: could not create "
+				  "thread %d\n", name, count );
+			break;
+		}
+	}
+
+	/* Open start gate and wait for threads to complete */
+	pthread_rwlock_unlock ( &gate );
+	for ( i = 0 ; i < count ; i++ )
+		pthread_join ( tests[i].thread, NULL );
+	if ( count < THREADTEST_THREADS )
+		goto err_create;
+
+	/* Check results against single-threaded expansion */
+	for ( i = 0 ; i < THREADTEST_THREADS ; i++ ) {
+		test = &tests[i];
+		if ( ! test->ok ) {
+			fprintf ( stderr, "THREAD %s fail: thread %d failed\n",
+				  name, i );
+			goto err_thread;
+		}
+		for ( j = 0 ; j < THREADTEST_SEEDS ; j++ ) {
+			threadtest_seed ( seed, len, i, j, check );
+			if ( ! cx_gen_expand ( type, check, len, ids ) ) {
+				fprintf ( stderr, "THREAD %s fail: could not "
+					  "expand seed %d.%d\n", name, i, j );
+				goto err_expand;
+			}
+			if ( memcmp ( ids, &test->single[ j * max ],
+				      ( max * sizeof ( *ids ) ) ) != 0 ) {
+				fprintf ( stderr, "THREAD %s fail: seed %d.%d "
+					  "mismatch\n", name, i, j );
+				goto err_mismatch;
+			}
+		}
+	}
+
+	fprintf ( stderr, "THREAD %s ok\n", name );
+	ok = 1;
+
+ err_mismatch:
+ err_expand:
+ err_thread:
+ err_create:
+ err_alloc:
+	for ( i = 0 ; i < THREADTEST_THREADS ; i++ ) {
+		free ( tests[i].multi );
+		free ( tests[i].single );
+	}
+	free ( ids );
+ err_alloc_ids:
+	return ok;
+}
+
+/**
+ * Run a standard concurrent expansion self-test
+ *
+ * @v type		Generator type
+ * @v prefix		Self-test variable prefix
+ * @ret ok		Success indicator
+ */
+#define threadtest_std( type, prefix )					\
+	threadtest ( #prefix, type, prefix ## _seed,			\
+		     sizeof ( prefix ## _seed ) )
+
+/**
+ * Run concurrent expansion self-tests
+ *
+ * @ret ok		Success indicator
+ */
+int threadtests ( void ) {
+	int ok = 1;
+
+	/* Run tests */
+	ok &= threadtest_std ( CX_GEN_AES_128_CTR_2048, gen_type1_test1 );
+	ok &= threadtest_std ( CX_GEN_AES_256_CTR_2048, gen_type2_test1 );
+
+	return ok;
+}
@@ -0,0 +1,420 @@
+/*
+ * Copyright (C) 2020 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give you permission to combine this program with code
+ * included in the standard release of OpenSSL (or modified versions
+ * of such code, with unchanged license).  You may copy and distribute
+ * such a system following the terms of the GNU GPL for this program
+ * and the licenses of the other code concerned.
+ */
+
+/******************************************************************************
+ *
+ * VAES generator kernel
+ *
+ * This kernel performs CTR_DRBG generate operations for up to sixteen
+ * independent DRBG instances in lockstep using the AVX-512 vector AES
+ * instructions.  Each 512-bit register holds one block from each of
+ * four lanes, and each lane uses its own round keys within the
+ * corresponding 128-bit portion of the round key registers.
+ *
+ * The counter values are held as pairs of little-endian 64-bit
+ * integers and incremented using vector arithmetic, so that no
+ * per-lane scalar work is required within an iteration.
+ *
+ ******************************************************************************
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include "kernel.h"
+
+#if defined ( __x86_64__ )
+
+#include <immintrin.h>
+
+/** Number of lanes per vector */
+#define CX_VAES_VECTOR_LANES 4
+
+/** Number of vectors processed in lockstep */
+#define CX_VAES_VECTORS 4
+
+/** Number of lanes processed in lockstep */
+#define CX_VAES_WIDTH ( CX_VAES_VECTOR_LANES * CX_VAES_VECTORS )
+
+/** AES block size */
+#define CX_VAES_BLOCK_LEN 16
+
+/** Maximum number of AES rounds */
+#define CX_VAES_MAX_ROUNDS 14
+
+/** Maximum number of blocks per lane per iteration */
+#define CX_VAES_MAX_BLOCKS \
+	( ( CX_KERNEL_MAX_LEN + 32 /* key */ + 16 /* V */ ) / \
+	  CX_VAES_BLOCK_LEN )
+
+/** Function attributes for VAES code */
+#define CX_VAES_TARGET \
+	__attribute__ (( target ( "avx512f,avx512bw,vaes,aes" ) ))
+
+/** AES round constants */
+static const uint8_t cx_vaes_rcon[] = {
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36
+};
+
+/** VAES vector state */
+struct cx_vaes_vector {
+	/** Round keys */
+	__m512i rk[ CX_VAES_MAX_ROUNDS + 1 ];
+	/** Current key */
+	__m512i key[2];
+	/** Counter values (as little-endian 64-bit low/high pairs) */
+	__m512i ctr;
+};
+
+/**
+ * Check if VAES kernel is supported
+ *
+ * @ret supported	Kernel is supported
+ */
+static int cx_vaes_supported ( void ) {
+
+	return ( __builtin_cpu_supports ( "vaes" ) &&
+		 __builtin_cpu_supports ( "avx512f" ) &&
+		 __builtin_cpu_supports ( "avx512bw" ) );
+}
+
+/**
+ * Byte-swap mask for converting between big-endian blocks and integers
+ *
+ * @ret mask		Byte-swap mask
+ */
+static CX_VAES_TARGET inline __m512i cx_vaes_bswap ( void ) {
+
+	return _mm512_broadcast_i32x4 ( _mm_set_epi8 ( 0, 1, 2, 3, 4, 5, 6, 7,
+						       8, 9, 10, 11, 12, 13,
+						       14, 15 ) );
+}
+
+/**
+ * Calculate XOR of all preceding words within each key
+ *
+ * @v key		Keys
+ * @ret key		Keys with each word XORed with all preceding words
+ */
+static CX_VAES_TARGET inline __m512i cx_vaes_shift_xor ( __m512i key ) {
+
+	key = _mm512_xor_si512 ( key, _mm512_bslli_epi128 ( key, 4 ) );
+	key = _mm512_xor_si512 ( key, _mm512_bslli_epi128 ( key, 8 ) );
+	return key;
+}
+
+/**
+ * Calculate round key using RotWord(), SubWord(), and Rcon
+ *
+ * @v prev		Round key from one key length earlier
+ * @v last		Preceding round key
+ * @v rcon		Round constant
+ * @ret rk		Round key
+ */
+static CX_VAES_TARGET inline __m512i
+cx_vaes_rk_rot ( __m512i prev, __m512i last, __m512i rcon ) {
+	const __m512i rotword = _mm512_set1_epi32 ( 0x0c0f0e0d );
+	__m512i tmp;
+
+	tmp = _mm512_shuffle_epi8 ( last, rotword );
+	tmp = _mm512_aesenclast_epi128 ( tmp, rcon );
+	return _mm512_xor_si512 ( cx_vaes_shift_xor ( prev ), tmp );
+}
+
+/**
+ * Calculate round key using SubWord() only
+ *
+ * @v prev		Round key from one key length earlier
+ * @v last		Preceding round key
+ * @ret rk		Round key
+ */
+static CX_VAES_TARGET inline __m512i
+cx_vaes_rk_sub ( __m512i prev, __m512i last ) {
+	__m512i tmp;
+
+	tmp = _mm512_shuffle_epi32 ( last, _MM_PERM_DDDD );
+	tmp = _mm512_aesenclast_epi128 ( tmp,
+					_mm512_setzero_si512() );
+	return _mm512_xor_si512 ( cx_vaes_shift_xor ( prev ), tmp );
+}
+
+/**
+ * Expand keys
+ *
+ * @v vectors		Vectors
+ * @v count		Number of vectors
+ * @v key_len		AES key length
+ */
+static CX_VAES_TARGET CX_KERNEL_GENERIC void
+cx_vaes_expand ( struct cx_vaes_vector *vectors, unsigned int count,
+		 size_t key_len ) {
+	__m512i *rk;
+	__m512i rcon;
+	unsigned int i;
+	unsigned int v;
+
+	if ( key_len == 16 ) {
+
+		/* AES-128 key schedule */
+		for ( v = 0 ; v < count ; v++ )
+			vectors[v].rk[0] = vectors[v].key[0];
+		for ( i = 1 ; i <= 10 ; i++ ) {
+			rcon = _mm512_set1_epi32 ( cx_vaes_rcon[ i - 1 ] );
+			for ( v = 0 ; v < count ; v++ ) {
+				rk = vectors[v].rk;
+				rk[i] = cx_vaes_rk_rot ( rk[ i - 1 ],
+							 rk[ i - 1 ], rcon );
+			}
+		}
+
+	} else {
+
+		/* AES-256 key schedule */
+		for ( v = 0 ; v < count ; v++ ) {
+			vectors[v].rk[0] = vectors[v].key[0];
+			vectors[v].rk[1] = vectors[v].key[1];
+		}
+		for ( i = 2 ; i <= 14 ; i += 2 ) {
+			rcon = _mm512_set1_epi32 (
+				cx_vaes_rcon[ ( i / 2 ) - 1 ] );
+			for ( v = 0 ; v < count ; v++ ) {
+				rk = vectors[v].rk;
+				rk[i] = cx_vaes_rk_rot ( rk[ i - 2 ],
+							 rk[ i - 1 ], rcon );
+			}
+			if ( i == 14 )
+				break;
+			for ( v = 0 ; v < count ; v++ ) {
+				rk = vectors[v].rk;
+				rk[ i + 1 ] = cx_vaes_rk_sub ( rk[ i - 1 ],
+							       rk[i] );
+			}
+		}
+	}
+}
+
+/**
+ * Get lanes used within a vector
+ *
+ * @v lanes		Lanes
+ * @v count		Number of lanes
+ * @v v			Vector index
+ * @v used		Number of lanes used within this vector
+ * @ret group		First lane within this vector
+ */
+static inline struct cx_kernel_lane *
+cx_vaes_group ( struct cx_kernel_lane *lanes, unsigned int count,
+		unsigned int v, unsigned int *used ) {
+	unsigned int first = ( v * CX_VAES_VECTOR_LANES );
+
+	*used = ( count - first );
+	if ( *used > CX_VAES_VECTOR_LANES )
+		*used = CX_VAES_VECTOR_LANES;
+	return &lanes[first];
+}
+
+/**
+ * Generate random bytes
+ *
+ * @v lanes		Lanes
+ * @v count		Number of lanes (at most the kernel width)
+ * @v key_len		AES key length
+ * @v len		Length of output per iteration
+ * @v iterations	Number of iterations
+ */
+static CX_VAES_TARGET CX_KERNEL_GENERIC void
+cx_vaes_generate ( struct cx_kernel_lane *lanes, unsigned int count,
+		   size_t key_len, size_t len, unsigned int iterations ) {
+	const __m512i bswap = cx_vaes_bswap();
+	const __m512i one = _mm512_set_epi64 ( 0, 1, 0, 1, 0, 1, 0, 1 );
+	const __m512i carry_one = _mm512_set1_epi64 ( 1 );
+	const __m512i zero = _mm512_setzero_si512();
+	struct cx_vaes_vector state[CX_VAES_VECTORS];
+	__m512i blocks[CX_VAES_VECTORS][CX_VAES_MAX_BLOCKS];
+	union {
+		__m512i vector;
+		unsigned char bytes[CX_VAES_VECTOR_LANES][CX_VAES_BLOCK_LEN];
+	} buf;
+	struct cx_kernel_lane *group;
+	struct cx_vaes_vector *vec;
+	__m512i ctr;
+	__mmask8 carry;
+	unsigned int rounds = ( ( key_len == 16 ) ? 10 : 14 );
+	unsigned int key_blocks = ( key_len / CX_VAES_BLOCK_LEN );
+	unsigned int vectors;
+	unsigned int out_blocks;
+	unsigned int num_blocks;
+	unsigned int iteration;
+	unsigned int used;
+	unsigned int l;
+	unsigned int v;
+	unsigned int b;
+	unsigned int r;
+	size_t frag_len;
+	size_t offset;
+
+	/* Calculate number of vectors and blocks */
+	vectors = ( ( count + CX_VAES_VECTOR_LANES - 1 ) /
+		    CX_VAES_VECTOR_LANES );
+	out_blocks = ( ( len + CX_VAES_BLOCK_LEN - 1 ) / CX_VAES_BLOCK_LEN );
+	num_blocks = ( out_blocks + key_blocks + 1 );
+
+	/* Load initial state (leaving any unused lanes zeroed) */
+	for ( v = 0 ; v < vectors ; v++ ) {
+		group = cx_vaes_group ( lanes, count, v, &used );
+		for ( b = 0 ; b < key_blocks ; b++ ) {
+			offset = ( b * CX_VAES_BLOCK_LEN );
+			memset ( &buf, 0, sizeof ( buf ) );
+			for ( l = 0 ; l < used ; l++ ) {
+				memcpy ( buf.bytes[l],
+					 ( group[l].key + offset ),
+					 CX_VAES_BLOCK_LEN );
+			}
+			state[v].key[b] = buf.vector;
+		}
+		memset ( &buf, 0, sizeof ( buf ) );
+		for ( l = 0 ; l < used ; l++ )
+			memcpy ( buf.bytes[l], group[l].v, CX_VAES_BLOCK_LEN );
+		state[v].ctr = _mm512_shuffle_epi8 ( buf.vector, bswap );
+	}
+
+	/* Perform iterations */
+	for ( iteration = 0 ; iteration < iterations ; iteration++ ) {
+
+		/* Expand keys */
+		cx_vaes_expand ( state, vectors, key_len );
+
+		/* Construct counter blocks and apply initial round key */
+		for ( v = 0 ; v < vectors ; v++ ) {
+			vec = &state[v];
+			for ( b = 0 ; b < num_blocks ; b++ ) {
+				ctr = _mm512_add_epi64 ( vec->ctr, one );
+				carry = _mm512_cmpeq_epi64_mask ( ctr, zero );
+				carry = ( ( carry & 0x55 ) << 1 );
+				ctr = _mm512_mask_add_epi64 ( ctr, carry, ctr,
+							      carry_one );
+				vec->ctr = ctr;
+				ctr = _mm512_shuffle_epi8 ( ctr, bswap );
+				blocks[v][b] = _mm512_xor_si512 ( ctr,
+								  vec->rk[0] );
+			}
+		}
+
+		/* Apply AES rounds, interleaved across all vectors */
+		for ( r = 1 ; r < rounds ; r++ ) {
+			for ( v = 0 ; v < vectors ; v++ ) {
+				for ( b = 0 ; b < num_blocks ; b++ ) {
+					blocks[v][b] = _mm512_aesenc_epi128 (
+					    blocks[v][b], state[v].rk[r] );
+				}
+			}
+		}
+		for ( v = 0 ; v < vectors ; v++ ) {
+			for ( b = 0 ; b < num_blocks ; b++ ) {
+				blocks[v][b] = _mm512_aesenclast_epi128 (
+				    blocks[v][b], state[v].rk[rounds] );
+			}
+		}
+
+		/* Store output and update keys and counter values */
+		for ( v = 0 ; v < vectors ; v++ ) {
+			group = cx_vaes_group ( lanes, count, v, &used );
+			for ( b = 0 ; b < out_blocks ; b++ ) {
+				buf.vector = blocks[v][b];
+				offset = ( b * CX_VAES_BLOCK_LEN );
+				frag_len = ( len - offset );
+				if ( frag_len > CX_VAES_BLOCK_LEN )
+					frag_len = CX_VAES_BLOCK_LEN;
+				for ( l = 0 ; l < used ; l++ ) {
+					memcpy ( ( group[l].output + offset ),
+						 buf.bytes[l], frag_len );
+				}
+			}
+			for ( b = 0 ; b < key_blocks ; b++ )
+				state[v].key[b] = blocks[v][ out_blocks + b ];
+			state[v].ctr = _mm512_shuffle_epi8 (
+				blocks[v][ num_blocks - 1 ], bswap );
+		}
+		for ( l = 0 ; l < count ; l++ )
+			lanes[l].output += len;
+	}
+
+	/* Store final state */
+	for ( v = 0 ; v < vectors ; v++ ) {
+		group = cx_vaes_group ( lanes, count, v, &used );
+		for ( b = 0 ; b < key_blocks ; b++ ) {
+			offset = ( b * CX_VAES_BLOCK_LEN );
+			buf.vector = state[v].key[b];
+			for ( l = 0 ; l < used ; l++ ) {
+				memcpy ( ( group[l].key + offset ),
+					 buf.bytes[l], CX_VAES_BLOCK_LEN );
+			}
+		}
+		buf.vector = _mm512_shuffle_epi8 ( state[v].ctr, bswap );
+		for ( l = 0 ; l < used ; l++ )
+			memcpy ( group[l].v, buf.bytes[l], CX_VAES_BLOCK_LEN );
+	}
+
+	/* Zero internal state */
+	OPENSSL_cleanse ( state, sizeof ( state ) );
+	OPENSSL_cleanse ( blocks, sizeof ( blocks ) );
+	OPENSSL_cleanse ( &buf, sizeof ( buf ) );
+}
+
+/* Specialised variants for each AES key length */
+CX_KERNEL_VARIANT ( cx_vaes, CX_VAES_TARGET, 128 )
+CX_KERNEL_VARIANT ( cx_vaes, CX_VAES_TARGET, 256 )
+
+/** VAES generator kernel */
+const struct cx_kernel cx_kernel_vaes = {
+	.name = "vaes",
+	.width = CX_VAES_WIDTH,
+	.supported = cx_vaes_supported,
+	.aes128 = { .generate = cx_vaes_generate_128 },
+	.aes256 = { .generate = cx_vaes_generate_256 },
+	.single = &cx_kernel_aesni,
+};
+
+#else /* __x86_64__ */
+
+/**
+ * Check if VAES kernel is supported
+ *
+ * @ret supported	Kernel is supported
+ */
+static int cx_vaes_supported ( void ) {
+
+	return 0;
+}
+
+/** VAES generator kernel (unsupported on this architecture) */
+const struct cx_kernel cx_kernel_vaes = {
+	.name = "vaes",
+	.width = 1,
+	.supported = cx_vaes_supported,
+};
+
+#endif /* __x86_64__ */